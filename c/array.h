@@ -34,7 +34,7 @@ typedef struct {
     int all;
     long validity;
     long grace;
-    ARRAY* resource;
+    struct hashcash_matcher* matcher; /* resources to purge, or NULL */
 } db_arg;
 
 void array_alloc( ARRAY* array, int num );
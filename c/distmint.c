@@ -0,0 +1,571 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* Minting spread over several hosts.  A coordinator listens on a TCP
+ * port and hands out units to the workers that connect: a unit is one
+ * value of the 16 character random field, and the worker searches one
+ * pass of a counter of <chars> characters after it.  The coordinator
+ * sizes units to about 1/UNIT_SHARE of the tries the target is
+ * expected to take, so the work spreads over the workers and a lost
+ * unit costs little.  Unit fields are the coordinator's random 8
+ * characters for this mint then the unit number, so units never
+ * overlap.  The protocol is lines of text; the coordinator sends
+ *
+ *   unit <id> <bits> <compress> <chars> <field> <stamp up to the field>
+ *   stop			(give up the unit, it is found)
+ *   quit
+ *
+ * and the worker answers a unit with
+ *
+ *   progress <id> <tries> <bits>	(about once a second)
+ *   done <id> <tries> <best stamp found, or ->
+ *
+ * The coordinator checks every stamp returned with the reference SHA1
+ * and that it is from the unit given.  A unit whose worker goes away,
+ * or says nothing for COORD_TIMEOUT seconds, is given to the next
+ * worker to ask.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#if defined( unix ) || defined( __unix__ ) || defined( __APPLE__ )
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <netdb.h>
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #define DIST_MINT
+#endif
+#include "hashcash.h"
+#include "libfastmint.h"
+#include "random.h"
+
+#if !defined( MSG_NOSIGNAL )
+    #define MSG_NOSIGNAL 0
+#endif
+
+#define COORD_MAX_WORKERS 64
+#define COORD_MAX_LINE ( MAX_TOK + 64 )
+#define COORD_POLL_MS 100	/* how often the coordinator calls back */
+#define COORD_TIMEOUT 30	/* seconds a unit's worker may be silent */
+#define WORKER_PROGRESS 1	/* seconds between progress reports */
+#define WORKER_CONNECT_TRIES 10	/* one a second */
+#define UNIT_FIELD 16
+#define UNIT_BASE 8		/* random characters before the unit id */
+#define UNIT_SHARE_BITS 4	/* a unit is 1/16th of the expected tries */
+#define UNIT_MIN_CHARS 2	/* counter characters in a unit, 64^2 tries */
+#define UNIT_MAX_CHARS 5	/* a full pass, as hashcash_fastmint makes */
+
+typedef struct {
+    int fd;			/* -1 if not connected */
+    char in[ COORD_MAX_LINE+1 ];
+    long in_len;
+} dist_conn;
+
+typedef struct {
+    dist_conn conn;
+    long unit;			/* unit being searched, -1 if none */
+    double tries;		/* in it so far */
+    time_t heard;		/* last word from the worker */
+} coord_worker;
+
+struct hashcash_coord {
+    int sock;
+    long next_unit;
+    long* lost;			/* units to hand out again */
+    int num_lost, max_lost;
+    hashcash_ctx* ctx;
+    coord_worker worker[ COORD_MAX_WORKERS ];
+};
+
+#if defined( DIST_MINT )
+
+static int conn_send( dist_conn* c, const char* line )
+{
+    long len = strlen( line ), put = 0, n = 0;
+
+    for ( put = 0; c->fd >= 0 && put < len; put += n ) {
+	n = send( c->fd, line + put, len - put, MSG_NOSIGNAL );
+	if ( n < 0 && errno == EINTR ) { n = 0; continue; }
+	if ( n <= 0 ) { return 0; }
+    }
+    return c->fd >= 0;
+}
+
+/* read what there is; returns 0 on EOF or error */
+
+static int conn_fill( dist_conn* c )
+{
+    long got = 0;
+
+    if ( c->in_len >= COORD_MAX_LINE ) { return 0; } /* line too long */
+    got = recv( c->fd, c->in + c->in_len, COORD_MAX_LINE - c->in_len, 0 );
+    if ( got < 0 && ( errno == EINTR || errno == EAGAIN ) ) { return 1; }
+    if ( got <= 0 ) { return 0; }
+    c->in_len += got;
+    return 1;
+}
+
+/* take the next complete line into line, 0 if there isn't one */
+
+static int conn_line( dist_conn* c, char line[ COORD_MAX_LINE+1 ] )
+{
+    char* eol = memchr( c->in, '\n', c->in_len );
+    long len = 0;
+
+    if ( eol == NULL ) { return 0; }
+    len = eol - c->in;
+    memcpy( line, c->in, len );
+    line[ len ] = '\0';
+    if ( len > 0 && line[ len-1 ] == '\r' ) { line[ len-1 ] = '\0'; }
+    memmove( c->in, eol + 1, c->in_len - len - 1 );
+    c->in_len -= len + 1;
+    return 1;
+}
+
+/* counter characters for units of a bits target, 6 bits each */
+
+static int unit_chars( unsigned bits )
+{
+    int chars = ( (int)bits - UNIT_SHARE_BITS ) / 6;
+
+    if ( chars < UNIT_MIN_CHARS ) { return UNIT_MIN_CHARS; }
+    if ( chars > UNIT_MAX_CHARS ) { return UNIT_MAX_CHARS; }
+    return chars;
+}
+
+static void unit_field( const char* base, long unit,
+			char field[ UNIT_FIELD+1 ] )
+{
+    int i = 0;
+
+    memcpy( field, base, UNIT_BASE );
+    for ( i = UNIT_FIELD - 1; i >= UNIT_BASE; i--, unit >>= 6 ) {
+	field[i] = encodeAlphabets[ EncodeBase64 ][ unit & 0x3f ];
+    }
+    field[ UNIT_FIELD ] = '\0';
+}
+
+#endif
+
+hashcash_coord* hashcash_coord_open( int port, int* err )
+{
+#if defined( DIST_MINT )
+    struct addrinfo hints, *ai = NULL;
+    hashcash_coord* coord = NULL;
+    char service[ 16 ];
+    int i = 0, on = 1, sock = -1;
+
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    sprintf( service, "%d", port );
+    if ( getaddrinfo( NULL, service, &hints, &ai ) != 0 ) {
+	*err = EINVAL;
+	return NULL;
+    }
+    sock = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
+    if ( sock < 0 ) { *err = errno; freeaddrinfo( ai ); return NULL; }
+    setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+    if ( bind( sock, ai->ai_addr, ai->ai_addrlen ) != 0 ||
+	 listen( sock, 16 ) != 0 ) {
+	*err = errno;
+	close( sock );
+	freeaddrinfo( ai );
+	return NULL;
+    }
+    freeaddrinfo( ai );
+
+    coord = calloc( 1, sizeof( hashcash_coord ) );
+    if ( coord ) { coord->ctx = hashcash_ctx_new(); }
+    if ( coord == NULL || coord->ctx == NULL ) {
+	free( coord );
+	close( sock );
+	*err = ENOMEM;
+	return NULL;
+    }
+    coord->sock = sock;
+    for ( i = 0; i < COORD_MAX_WORKERS; i++ ) {
+	coord->worker[i].conn.fd = -1;
+	coord->worker[i].unit = -1;
+    }
+    *err = 0;
+    return coord;
+#else
+    port = port;
+    *err = ENOSYS;
+    return NULL;
+#endif
+}
+
+#if defined( DIST_MINT )
+
+static void coord_lose( hashcash_coord* coord, coord_worker* w )
+{
+    long* more = NULL;
+
+    if ( w->unit >= 0 ) {
+	if ( coord->num_lost == coord->max_lost ) {
+	    more = realloc( coord->lost, ( coord->max_lost * 2 + 16 ) *
+			    sizeof( long ) );
+	    if ( more ) {
+		coord->lost = more;
+		coord->max_lost = coord->max_lost * 2 + 16;
+	    }
+	}
+	/* if out of memory the unit is skipped; it's only one of many */
+	if ( coord->num_lost < coord->max_lost ) {
+	    coord->lost[ coord->num_lost++ ] = w->unit;
+	}
+    }
+    close( w->conn.fd );
+    w->conn.fd = -1;
+    w->conn.in_len = 0;
+    w->unit = -1;
+    w->tries = 0;
+}
+
+static void coord_issue( hashcash_coord* coord, coord_worker* w,
+			 const char* base, unsigned bits, int compress,
+			 const char* token )
+{
+    char field[ UNIT_FIELD+1 ];
+    char* line = malloc( strlen( token ) + 128 );
+
+    if ( line == NULL ) { coord_lose( coord, w ); return; }
+    w->unit = coord->num_lost > 0 ? coord->lost[ --coord->num_lost ] :
+	coord->next_unit++;
+    w->tries = 0;
+    w->heard = time( 0 );
+    unit_field( base, w->unit, field );
+    sprintf( line, "unit %ld %u %d %d %s %s\n", w->unit, bits, compress,
+	     unit_chars( bits ), field, token );
+    if ( !conn_send( &w->conn, line ) ) { coord_lose( coord, w ); }
+    free( line );
+}
+
+/* the stamp found in a unit, if it is from the unit and as good as
+ * it says */
+
+static int coord_verify( const char* stamp, const char* token,
+			 const char* base, long unit )
+{
+    char field[ UNIT_FIELD+1 ];
+    int len = strlen( token );
+
+    unit_field( base, unit, field );
+    if ( strncmp( stamp, token, len ) != 0 ||
+	 strncmp( stamp + len, field, UNIT_FIELD ) != 0 ||
+	 stamp[ len + UNIT_FIELD ] != ':' ) {
+	return -1;
+    }
+    return hashcash_count( stamp );
+}
+
+#endif
+
+int hashcash_coord_mint( hashcash_coord* coord, time_t now_time,
+			 int time_width, const char* resource,
+			 unsigned bits, long anon_period, char** stamp,
+			 long* anon_random, double* tries_taken, char* ext,
+			 int compress, hashcash_callback cb, void* user_arg )
+{
+#if defined( DIST_MINT )
+    struct pollfd pfd[ COORD_MAX_WORKERS+1 ];
+    int slot[ COORD_MAX_WORKERS+1 ];
+    char line[ COORD_MAX_LINE+1 ], base[ UNIT_BASE+1 ];
+    char* token = NULL, *found = NULL, *p = NULL;
+    coord_worker* w = NULL;
+    double done_tries = 0, total = 0, expected = 0, tries = 0;
+    time_t now = 0;
+    long unit = 0;
+    unsigned char c = 0;
+    int ret = 0, i = 0, n = 0, fd = 0, got = 0, count = 0, best = 0;
+    int stopped = 0;
+
+    ret = hashcash_mint_token( coord->ctx, now_time, time_width, resource,
+			       bits, anon_period, anon_random, ext, &token );
+    if ( ret != HASHCASH_OK ) { return ret; }
+    for ( i = 0; i < UNIT_BASE; i++ ) {
+	if ( !random_state_getbytes( &coord->ctx->rng, &c, 1 ) ) {
+	    free( token );
+	    return HASHCASH_RNG_FAILED;
+	}
+	base[i] = encodeAlphabets[ EncodeBase64 ][ c & 0x3f ];
+    }
+    base[ UNIT_BASE ] = '\0';
+    coord->num_lost = 0;
+    expected = hashcash_expected_tries( bits );
+
+    for ( i = 0; i < COORD_MAX_WORKERS; i++ ) {
+	if ( coord->worker[i].conn.fd >= 0 ) {
+	    coord_issue( coord, &coord->worker[i], base, bits, compress,
+			 token );
+	}
+    }
+
+    while ( found == NULL && !stopped ) {
+	pfd[0].fd = coord->sock;
+	pfd[0].events = POLLIN;
+	for ( n = 1, i = 0; i < COORD_MAX_WORKERS; i++ ) {
+	    if ( coord->worker[i].conn.fd < 0 ) { continue; }
+	    pfd[n].fd = coord->worker[i].conn.fd;
+	    pfd[n].events = POLLIN;
+	    slot[n++] = i;
+	}
+	got = poll( pfd, n, COORD_POLL_MS );
+	if ( got < 0 && errno != EINTR ) { ret = HASHCASH_INTERNAL_ERROR; break; }
+	now = time( 0 );
+
+	if ( got > 0 && ( pfd[0].revents & POLLIN ) ) {
+	    fd = accept( coord->sock, NULL, NULL );
+	    for ( i = 0; i < COORD_MAX_WORKERS &&
+		      coord->worker[i].conn.fd >= 0; i++ ) {}
+	    if ( fd >= 0 && i == COORD_MAX_WORKERS ) { close( fd ); }
+	    else if ( fd >= 0 ) {
+		fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+		coord->worker[i].conn.fd = fd;
+		coord->worker[i].conn.in_len = 0;
+		coord_issue( coord, &coord->worker[i], base, bits, compress,
+			     token );
+	    }
+	}
+
+	for ( i = 1; got > 0 && i < n && found == NULL; i++ ) {
+	    if ( !( pfd[i].revents & ( POLLIN | POLLHUP | POLLERR ) ) ) {
+		continue;
+	    }
+	    w = &coord->worker[ slot[i] ];
+	    if ( !conn_fill( &w->conn ) ) { coord_lose( coord, w ); continue; }
+	    while ( w->conn.fd >= 0 && found == NULL &&
+		    conn_line( &w->conn, line ) ) {
+		if ( sscanf( line, "progress %ld %lf", &unit, &tries ) == 2 ) {
+		    if ( unit == w->unit ) { w->tries = tries; w->heard = now; }
+		    continue;
+		}
+		if ( sscanf( line, "done %ld %lf", &unit, &tries ) != 2 ) {
+		    coord_lose( coord, w );	/* not speaking our protocol */
+		    break;
+		}
+		if ( unit != w->unit ) { continue; } /* stale, from a stop */
+		p = strchr( line + 5, ' ' );
+		p = p ? strchr( p + 1, ' ' ) : NULL;
+		count = p == NULL ? -1 : strcmp( p + 1, "-" ) == 0 ? 0 :
+		    coord_verify( p + 1, token, base, unit );
+		if ( count < 0 ) { coord_lose( coord, w ); break; }
+		p++;
+		done_tries += tries;
+		w->unit = -1;
+		w->tries = 0;
+		if ( count > best ) { best = count; }
+		if ( count >= (int)bits ) {
+		    found = strdup( p );
+		    if ( found == NULL ) { ret = HASHCASH_OUT_OF_MEMORY; }
+		    break;
+		}
+		coord_issue( coord, w, base, bits, compress, token );
+	    }
+	    if ( ret == HASHCASH_OUT_OF_MEMORY ) { stopped = 1; break; }
+	}
+
+	for ( total = done_tries, i = 0; i < COORD_MAX_WORKERS; i++ ) {
+	    w = &coord->worker[i];
+	    if ( w->conn.fd >= 0 && w->unit >= 0 &&
+		 now - w->heard > COORD_TIMEOUT ) {
+		coord_lose( coord, w );
+	    }
+	    total += w->tries;
+	}
+	if ( found == NULL && cb != NULL &&
+	     !cb( (int)( total / expected * 100 + 0.5 ), best, bits,
+		  total, expected, user_arg ) ) {
+	    ret = HASHCASH_USER_ABORT;
+	    stopped = 1;
+	}
+    }
+
+    /* call off the search */
+    for ( i = 0; i < COORD_MAX_WORKERS; i++ ) {
+	w = &coord->worker[i];
+	if ( w->conn.fd >= 0 && w->unit >= 0 ) {
+	    if ( !conn_send( &w->conn, "stop\n" ) ) { coord_lose( coord, w ); }
+	    w->unit = -1;
+	}
+	total += w->tries;
+	w->tries = 0;
+    }
+    free( token );
+    if ( tries_taken ) { *tries_taken = total; }
+    if ( found == NULL ) { return ret; }
+    if ( cb != NULL ) { cb( 100, bits, bits, total, expected, user_arg ); }
+    *stamp = found;
+    return HASHCASH_OK;
+#else
+    coord = coord; now_time = now_time; time_width = time_width;
+    resource = resource; bits = bits; anon_period = anon_period;
+    stamp = stamp; anon_random = anon_random; tries_taken = tries_taken;
+    ext = ext; compress = compress; cb = cb; user_arg = user_arg;
+    return HASHCASH_INTERNAL_ERROR;
+#endif
+}
+
+void hashcash_coord_close( hashcash_coord* coord )
+{
+#if defined( DIST_MINT )
+    int i = 0;
+
+    if ( coord == NULL ) { return; }
+    for ( i = 0; i < COORD_MAX_WORKERS; i++ ) {
+	if ( coord->worker[i].conn.fd >= 0 ) {
+	    conn_send( &coord->worker[i].conn, "quit\n" );
+	    close( coord->worker[i].conn.fd );
+	}
+    }
+    close( coord->sock );
+    hashcash_ctx_free( coord->ctx );
+    free( coord->lost );
+    free( coord );
+#else
+    coord = coord;
+#endif
+}
+
+#if defined( DIST_MINT )
+
+typedef struct {
+    dist_conn* conn;
+    long unit;
+    time_t sent;		/* last progress report */
+    int quit;			/* told to quit, or the coordinator went */
+    hashcash_callback cb;
+    void* user_arg;
+} worker_state;
+
+/* report progress, and give up the unit if told to */
+
+static int worker_cb( int percent, int largest, int target,
+		      double count, double expected, void* user )
+{
+    worker_state* ws = (worker_state*)user;
+    struct pollfd pfd;
+    char line[ 64 ];
+    time_t now = time( 0 );
+
+    if ( ws->cb && !ws->cb( percent, largest, target, count, expected,
+			    ws->user_arg ) ) {
+	ws->quit = 1;
+	return 0;
+    }
+    if ( largest >= target ) { return 1; } /* found, finish */
+    if ( now - ws->sent >= WORKER_PROGRESS ) {
+	sprintf( line, "progress %ld %.0f %d\n", ws->unit, count, largest );
+	if ( !conn_send( ws->conn, line ) ) { ws->quit = 1; return 0; }
+	ws->sent = now;
+    }
+    pfd.fd = ws->conn->fd;
+    pfd.events = POLLIN;
+    if ( poll( &pfd, 1, 0 ) > 0 ) {
+	if ( !conn_fill( ws->conn ) ) { ws->quit = 1; return 0; }
+	/* any word from the coordinator mid unit is to stop */
+	if ( memchr( ws->conn->in, '\n', ws->conn->in_len ) ) { return 0; }
+    }
+    return 1;
+}
+
+static int worker_connect( const char* host, int port )
+{
+    struct addrinfo hints, *ai = NULL, *a = NULL;
+    char service[ 16 ];
+    int sock = -1, tries = 0;
+
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    sprintf( service, "%d", port );
+    if ( getaddrinfo( host, service, &hints, &ai ) != 0 ) { return -1; }
+    /* the coordinator may not be listening yet */
+    for ( tries = 0; sock < 0 && tries < WORKER_CONNECT_TRIES; tries++ ) {
+	if ( tries > 0 ) { sleep( 1 ); }
+	for ( a = ai; a && sock < 0; a = a->ai_next ) {
+	    sock = socket( a->ai_family, a->ai_socktype, a->ai_protocol );
+	    if ( sock >= 0 && connect( sock, a->ai_addr, a->ai_addrlen ) ) {
+		close( sock );
+		sock = -1;
+	    }
+	}
+    }
+    freeaddrinfo( ai );
+    return sock;
+}
+
+#endif
+
+int hashcash_ctx_mint_worker( hashcash_ctx* ctx, const char* host,
+			      int port, hashcash_callback cb,
+			      void* user_arg )
+{
+#if defined( DIST_MINT )
+    dist_conn conn;
+    worker_state ws;
+    char line[ COORD_MAX_LINE+1 ], field[ UNIT_FIELD+1 ];
+    char* reply = NULL, *result = NULL, *token = NULL;
+    double taken = 0;
+    unsigned bits = 0;
+    int compress = 0, chars = 0, n = 0;
+
+    conn.fd = worker_connect( host, port );
+    conn.in_len = 0;
+    if ( conn.fd < 0 ) { return HASHCASH_INTERNAL_ERROR; }
+    memset( &ws, 0, sizeof( ws ) );
+    ws.conn = &conn;
+    ws.cb = cb;
+    ws.user_arg = user_arg;
+
+    while ( !ws.quit ) {
+	if ( !conn_line( &conn, line ) ) {
+	    if ( !conn_fill( &conn ) ) { break; }
+	    continue;
+	}
+	if ( strcmp( line, "quit" ) == 0 ) { break; }
+	if ( sscanf( line, "unit %ld %u %d %d %16s %n", &ws.unit, &bits,
+		     &compress, &chars, field, &n ) != 5 || n == 0 ||
+	     strlen( field ) != UNIT_FIELD ) {
+	    continue;		/* stop, or something we don't know */
+	}
+	token = line + n;
+	ws.sent = time( 0 );
+	ctx->unit = field;
+	ctx->unit_chars = chars;
+	result = NULL;
+	taken = hashcash_fastmint( ctx, bits, token, compress, &result,
+				   worker_cb, &ws );
+	ctx->unit = NULL;
+	ctx->unit_chars = 0;
+	if ( taken < 0 ) { continue; } /* stopped */
+	reply = malloc( ( result ? strlen( result ) : 1 ) + 64 );
+	if ( reply == NULL ) { free( result ); break; }
+	sprintf( reply, "done %ld %.0f %s\n", ws.unit, taken,
+		 result ? result : "-" );
+	free( result );
+	n = conn_send( &conn, reply );
+	free( reply );
+	if ( !n ) { break; }
+    }
+    close( conn.fd );
+    return HASHCASH_OK;
+#else
+    ctx = ctx; host = host; port = port; cb = cb; user_arg = user_arg;
+    return HASHCASH_INTERNAL_ERROR;
+#endif
+}
+
+int hashcash_mint_worker( const char* host, int port, hashcash_callback cb,
+			  void* user_arg )
+{
+    return hashcash_ctx_mint_worker( &hashcash_global_ctx, host, port, cb,
+				     user_arg );
+}
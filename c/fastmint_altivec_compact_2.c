@@ -689,7 +689,7 @@ unsigned long minter_altivec_compact_2( int bits, int* best,
     }
 	
     /* The Tight Loop - everything in here should be extra efficient */
-    for ( iters=0; iters < maxIter-8; iters += 8 ) {
+    for ( iters=0; iters <= maxIter-8; iters += 8 ) {
 	/* Encode iteration count into tail */
 	/* Iteration count is always 8-aligned, so only least-significant character needs multiple lookup */
 	/* Further, we assume we're always big-endian */
@@ -961,7 +961,7 @@ unsigned long minter_altivec_compact_2( int bits, int* best,
 	MINTER_CALLBACK();
     }
 	
-    return iters+8;
+    return iters;
 
     /* For other platforms */
 #else  /* defined( COMPACT ) */
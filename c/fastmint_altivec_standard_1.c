@@ -134,7 +134,7 @@ unsigned long minter_altivec_standard_1(int bits, int* best, unsigned char *bloc
 	}
 	
 	/* The Tight Loop - everything in here should be extra efficient */
-	for(iters=0; iters < maxIter-4; iters += 4) {
+	for(iters=0; iters <= maxIter-4; iters += 4) {
 		/* Encode iteration count into tail */
 		/* Iteration count is always 4-aligned, so only least-significant character needs multiple lookup */
 		/* Further, we assume we're always big-endian */
@@ -379,7 +379,7 @@ unsigned long minter_altivec_standard_1(int bits, int* best, unsigned char *bloc
 		MINTER_CALLBACK();
 	}
 	
-	return iters+4;
+	return iters;
 
 	/* For other platforms */
 #else	/* defined( COMPACT ) */
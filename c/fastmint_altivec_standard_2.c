@@ -373,7 +373,7 @@ unsigned long minter_altivec_standard_2(int bits, int* best, unsigned char *bloc
 	}
 	
 	/* The Tight Loop - everything in here should be extra efficient */
-	for(iters=0; iters < maxIter-8; iters += 8) {
+	for(iters=0; iters <= maxIter-8; iters += 8) {
 		/* Encode iteration count into tail */
 		/* Iteration count is always 8-aligned, so only least-significant character needs multiple lookup */
 		/* Further, we assume we're always big-endian */
@@ -669,7 +669,7 @@ unsigned long minter_altivec_standard_2(int bits, int* best, unsigned char *bloc
 		MINTER_CALLBACK();
 	}
 	
-	return iters+8;
+	return iters;
 
 	/* For other platforms */
 #else	/* defined( COMPACT ) */
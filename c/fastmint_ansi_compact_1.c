@@ -258,7 +258,7 @@ unsigned long minter_ansi_compact_1(int bits, int* best, unsigned char *block, c
 		MINTER_CALLBACK();
 	}
 	
-	return iters+1;
+	return iters;
 #else
 	return 0;
 #endif
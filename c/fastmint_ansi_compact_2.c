@@ -156,17 +156,27 @@ unsigned long minter_ansi_compact_2(int bits, int* best, unsigned char *block, c
 		wordUpdate[t] = 1;
 	
 	/* The Tight Loop - everything in here should be extra efficient */
-	for(iters=0; iters < maxIter-2; iters += 2) {
+	for(iters=0; iters <= maxIter-2; iters += 2) {
 
 		/* Encode iteration count into tail */
 		X1[(tailIndex - 1) ^ addressMask] = p[((iters+0)      ) & 0x3f];
 		X2[(tailIndex - 1) ^ addressMask] = p[((iters+1)      ) & 0x3f];
 		if(!(iters & 0x3f)) {
-			X1[(tailIndex - 2) ^ addressMask] = X2[(tailIndex - 2) ^ addressMask] = p[((iters) >>  6) & 0x3f];
-			X1[(tailIndex - 3) ^ addressMask] = X2[(tailIndex - 3) ^ addressMask] = p[((iters) >> 12) & 0x3f];
-			X1[(tailIndex - 4) ^ addressMask] = X2[(tailIndex - 4) ^ addressMask] = p[((iters) >> 18) & 0x3f];
-			X1[(tailIndex - 5) ^ addressMask] = X2[(tailIndex - 5) ^ addressMask] = p[((iters) >> 24) & 0x3f];
-			X1[(tailIndex - 6) ^ addressMask] = X2[(tailIndex - 6) ^ addressMask] = p[((iters) >> 30) & 0x3f];
+			if ( iters >> 6 ) {
+				X1[(tailIndex - 2) ^ addressMask] = X2[(tailIndex - 2) ^ addressMask] = p[((iters) >>  6) & 0x3f];
+			}
+			if ( iters >> 12 ) {
+				X1[(tailIndex - 3) ^ addressMask] = X2[(tailIndex - 3) ^ addressMask] = p[((iters) >> 12) & 0x3f];
+			}
+			if ( iters >> 18 ) {
+				X1[(tailIndex - 4) ^ addressMask] = X2[(tailIndex - 4) ^ addressMask] = p[((iters) >> 18) & 0x3f];
+			}
+			if ( iters >> 24 ) {
+				X1[(tailIndex - 5) ^ addressMask] = X2[(tailIndex - 5) ^ addressMask] = p[((iters) >> 24) & 0x3f];
+			}
+			if ( iters >> 30 ) {
+				X1[(tailIndex - 6) ^ addressMask] = X2[(tailIndex - 6) ^ addressMask] = p[((iters) >> 30) & 0x3f];
+			}
 		}
 
 		/* Bypass shortcuts below on certain iterations */
@@ -352,7 +362,7 @@ unsigned long minter_ansi_compact_2(int bits, int* best, unsigned char *block, c
 		MINTER_CALLBACK();
 	}
 	
-	return iters+2;
+	return iters;
 #else
 	return 0;
 #endif
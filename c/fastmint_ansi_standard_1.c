@@ -291,7 +291,7 @@ unsigned long minter_ansi_standard_1(int bits, int* best, unsigned char *block,
 		MINTER_CALLBACK();
 	}
 	
-	return iters+1;
+	return iters;
 #else
 	return 0;
 #endif
@@ -136,7 +136,7 @@ unsigned long minter_ansi_standard_2(int bits, int* best, unsigned char *block,
 		pH[t] = H[t] = IV[t];
 	
 	/* The Tight Loop - everything in here should be extra efficient */
-	for(iters=0; iters < maxIter-2; iters += 2) {
+	for(iters=0; iters <= maxIter-2; iters += 2) {
 
 		/* Encode iteration count into tail */
 		X1[(tailIndex - 1) ^ addressMask] = p[((iters+0)      ) & 0x3f];
@@ -388,7 +388,7 @@ unsigned long minter_ansi_standard_2(int bits, int* best, unsigned char *block,
 		MINTER_CALLBACK();
 	}
 	
-	return iters+2;
+	return iters;
 #else
 	return 0;
 #endif
@@ -249,7 +249,7 @@ unsigned long minter_ansi_ultracompact_1(int bits, int* best, unsigned char *blo
 		MINTER_CALLBACK();
 	}
 	
-	return iters+1;
+	return iters;
 #else
 	return 0;
 #endif
@@ -195,5 +195,5 @@ unsigned long minter_library( int bits, int* best, unsigned char *block,
 	MINTER_CALLBACK();
     }
     
-    return iters+1;
+    return iters;
 }
@@ -239,7 +239,7 @@ unsigned long minter_mmx_compact_1(int bits, int* best, unsigned char *block, co
 	}
 	
   /* The Tight Loop - everything in here should be extra efficient */
-  for(iters=0; iters < maxIter-2; iters += 2) {
+  for(iters=0; iters <= maxIter-2; iters += 2) {
     /* Encode iteration count into tail */
     /* Iteration count is always 2-aligned, so only least-significant character needs multiple lookup */
     /* Further, we assume we're always little-endian */
@@ -478,7 +478,7 @@ unsigned long minter_mmx_compact_1(int bits, int* best, unsigned char *block, co
   /* Shut down use of MMX */
   __builtin_ia32_emms();
 
-  return iters+2;
+  return iters;
 
   /* For other platforms */
 #else
@@ -346,7 +346,7 @@ unsigned long minter_mmx_standard_1(int bits, int* best, unsigned char *block, c
   }
 	
   /* The Tight Loop - everything in here should be extra efficient */
-  for(iters=0; iters < maxIter-2; iters += 2) {
+  for(iters=0; iters <= maxIter-2; iters += 2) {
 
     /* Encode iteration count into tail */
     /* Iteration count is always 2-aligned, so only least-significant character needs multiple lookup */
@@ -633,7 +633,7 @@ unsigned long minter_mmx_standard_1(int bits, int* best, unsigned char *block, c
   /* Shut down use of MMX */
   __builtin_ia32_emms();
 
-  return iters+2;
+  return iters;
 
   /* For other platforms */
 #else
@@ -0,0 +1,248 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* Minting with a pool of child processes, for where threads are not
+ * an option.  The search is split into lanes, one per child, each
+ * minting with its own first random character so no stamp is tried
+ * twice.  The children report their tries and any stamp found through
+ * a shared page, and a byte each on a pipe as they finish.  The
+ * parent takes the first stamp found and sets stop, which the others
+ * see at their next progress callback (every 100ms or so) and give
+ * up, having recorded exactly how many tries they made.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#if defined( unix ) || defined( __unix__ ) || defined( __APPLE__ )
+    #include <unistd.h>
+    #include <poll.h>
+    #include <sys/types.h>
+    #include <sys/mman.h>
+    #include <sys/wait.h>
+    #define FORK_MINT
+#endif
+#include "hashcash.h"
+#include "libfastmint.h"
+#include "random.h"
+#include "sha1.h"
+
+#if !defined( MAP_ANONYMOUS ) && defined( MAP_ANON )
+    #define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define FORK_POLL_MS 100	/* how often the parent calls back */
+
+typedef struct {
+    volatile double tries;
+    volatile int best;		/* most bits found so far */
+    volatile int status;	/* HASHCASH_* when finished */
+} fork_slot;
+
+typedef struct {
+    volatile int stop;		/* set by the parent when done */
+    fork_slot slot[ HASHCASH_MAX_FORK ];
+} fork_page;
+
+typedef struct {
+    fork_page* page;
+    fork_slot* slot;
+} fork_child;
+
+#if defined( FORK_MINT )
+
+static int fork_child_cb( int percent, int largest, int target,
+			  double count, double expected, void* user )
+{
+    fork_child* child = (fork_child*)user;
+
+    percent = percent; expected = expected;
+    child->slot->tries = count;
+    child->slot->best = largest;
+    /* once found, finish even if another lane has won */
+    return largest >= target || !child->page->stop;
+}
+
+static void fork_child_mint( hashcash_ctx* ctx, fork_page* page,
+			     char* stamp_buf, int stamp_max, int lane,
+			     int lanes, int fd, time_t now_time,
+			     int time_width, const char* resource,
+			     unsigned bits, char* ext, int compress )
+{
+    fork_child child;
+    char* stamp = NULL;
+    double tries = 0;
+    unsigned char c = lane;
+    int ret = 0;
+
+    child.page = page;
+    child.slot = &page->slot[ lane ];
+
+    /* don't share the parent's buffered random stream */
+    random_state_final( &ctx->rng );
+    ctx->lane = lane;
+    ctx->lanes = lanes;
+
+    ret = hashcash_ctx_mint( ctx, now_time, time_width, resource, bits, 0,
+			     &stamp, NULL, &tries, ext, compress,
+			     fork_child_cb, &child );
+    if ( ret == HASHCASH_OK ) {
+	if ( stamp && (int)strlen( stamp ) < stamp_max ) {
+	    strcpy( stamp_buf, stamp );
+	    child.slot->tries = tries;
+	    child.slot->best = bits;
+	} else {
+	    ret = HASHCASH_INTERNAL_ERROR;
+	}
+    }
+    child.slot->status = ret;
+    while ( write( fd, &c, 1 ) < 0 && errno == EINTR ) { }
+    _exit( 0 );
+}
+
+#endif
+
+int hashcash_ctx_fork_mint( hashcash_ctx* ctx, int procs, time_t now_time,
+			    int time_width, const char* resource,
+			    unsigned bits, long anon_period, char** stamp,
+			    long* anon_random, double* tries_taken,
+			    char* ext, int compress, hashcash_callback cb,
+			    void* user_arg )
+{
+#if defined( FORK_MINT )
+    pid_t pids[ HASHCASH_MAX_FORK ];
+    fork_page* page = NULL;
+    char* stamps = NULL;
+    struct pollfd pfd;
+    unsigned char lanes[ HASHCASH_MAX_FORK ];
+    long rnd = 0, stamp_max = 0, map_len = 0;
+    double total = 0, expected = 0;
+    int fds[2], started = 0, finished = 0, winner = -1, best = 0;
+    int i = 0, n = 0, ret = HASHCASH_INTERNAL_ERROR;
+
+    if ( procs <= 1 || resource == NULL ) {
+	return hashcash_ctx_mint( ctx, now_time, time_width, resource, bits,
+				  anon_period, stamp, anon_random,
+				  tries_taken, ext, compress, cb, user_arg );
+    }
+    if ( procs > HASHCASH_MAX_FORK ) { procs = HASHCASH_MAX_FORK; }
+
+    /* pick the time once, so all lanes mint the same stamp but for
+       the random field */
+    if ( anon_random == NULL ) { anon_random = &rnd; }
+    *anon_random = 0;
+    if ( anon_period != 0 &&
+	 !random_state_rectangular( &ctx->rng, anon_period, anon_random ) ) {
+	return HASHCASH_RNG_FAILED;
+    }
+
+    stamp_max = MAX_TOK + ( ext ? strlen( ext ) : 0 ) +
+	2 * SHA1_INPUT_BYTES + 1;
+    map_len = sizeof( fork_page ) + procs * stamp_max;
+    page = mmap( NULL, map_len, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if ( page == MAP_FAILED ) { return HASHCASH_OUT_OF_MEMORY; }
+    stamps = (char*)( page + 1 );
+    if ( pipe( fds ) != 0 ) {
+	munmap( page, map_len );
+	return HASHCASH_INTERNAL_ERROR;
+    }
+
+    hashcash_select_minter();	/* detect CPU features once, here */
+    for ( started = 0; started < procs; started++ ) {
+	pids[ started ] = fork();
+	if ( pids[ started ] < 0 ) { break; }
+	if ( pids[ started ] == 0 ) {
+	    close( fds[0] );
+	    fork_child_mint( ctx, page, stamps + started * stamp_max,
+			     stamp_max, started, procs, fds[1],
+			     now_time + *anon_random, time_width, resource,
+			     bits, ext, compress );
+	}
+    }
+    close( fds[1] );
+
+    if ( started == 0 ) {
+	close( fds[0] );
+	munmap( page, map_len );
+	return hashcash_ctx_mint( ctx, now_time + *anon_random, time_width,
+				  resource, bits, 0, stamp, NULL,
+				  tries_taken, ext, compress, cb, user_arg );
+    }
+    /* with fewer than asked for, the lanes of the missing ones are
+       just never searched */
+
+    expected = hashcash_expected_tries( bits );
+    pfd.fd = fds[0];
+    pfd.events = POLLIN;
+    while ( finished < started && winner < 0 && !page->stop ) {
+	pfd.revents = 0;
+	n = poll( &pfd, 1, FORK_POLL_MS );
+	if ( n < 0 && errno != EINTR ) { break; }
+	if ( n > 0 ) {
+	    n = read( fds[0], lanes, sizeof( lanes ) );
+	    if ( n == 0 ) { break; } /* all gone, some without a word */
+	    for ( i = 0; i < n; i++ ) {
+		finished++;
+		if ( page->slot[ lanes[i] ].status == HASHCASH_OK ) {
+		    if ( winner < 0 ) { winner = lanes[i]; }
+		} else if ( page->slot[ lanes[i] ].status !=
+			    HASHCASH_USER_ABORT ) {
+		    ret = page->slot[ lanes[i] ].status;
+		}
+	    }
+	    continue;
+	}
+	if ( cb != NULL ) {
+	    for ( total = 0, best = 0, i = 0; i < started; i++ ) {
+		total += page->slot[i].tries;
+		if ( page->slot[i].best > best ) { best = page->slot[i].best; }
+	    }
+	    if ( !cb( (int)( total / expected * 100 + 0.5 ), best, bits,
+		      total, expected, user_arg ) ) {
+		ret = HASHCASH_USER_ABORT;
+		page->stop = 1;
+	    }
+	}
+    }
+
+    /* call off the rest, and wait for them to record their tries */
+    page->stop = 1;
+    for ( i = 0; i < started; i++ ) {
+	while ( waitpid( pids[i], NULL, 0 ) < 0 && errno == EINTR ) { }
+    }
+    close( fds[0] );
+
+    for ( total = 0, i = 0; i < started; i++ ) {
+	total += page->slot[i].tries;
+    }
+    if ( tries_taken ) { *tries_taken = total; }
+    if ( winner >= 0 ) {
+	*stamp = strdup( stamps + winner * stamp_max );
+	ret = *stamp ? HASHCASH_OK : HASHCASH_OUT_OF_MEMORY;
+	if ( cb != NULL && ret == HASHCASH_OK ) {
+	    cb( 100, bits, bits, total, expected, user_arg );
+	}
+    }
+    munmap( page, map_len );
+    return ret;
+#else
+    procs = procs;
+    return hashcash_ctx_mint( ctx, now_time, time_width, resource, bits,
+			      anon_period, stamp, anon_random, tries_taken,
+			      ext, compress, cb, user_arg );
+#endif
+}
+
+int hashcash_fork_mint( int procs, time_t now_time, int time_width,
+			const char* resource, unsigned bits,
+			long anon_period, char** stamp, long* anon_random,
+			double* tries_taken, char* ext, int compress,
+			hashcash_callback cb, void* user_arg )
+{
+    return hashcash_ctx_fork_mint( &hashcash_global_ctx, procs, now_time,
+				   time_width, resource, bits, anon_period,
+				   stamp, anon_random, tries_taken, ext,
+				   compress, cb, user_arg );
+}
@@ -26,8 +26,18 @@
 #include <errno.h>
 #include <assert.h>
 #include <math.h>
+#if defined( HAVE_PTHREADS )
+    #include <pthread.h>
+#endif
+#if defined( unix ) || defined( __unix__ ) || defined( __APPLE__ )
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #define HCDAEMON_CLIENT
+#endif
 
 #include "sdb.h"
+#include "shmcache.h"
+#include "hdrscan.h"
 #include "utct.h"
 #include "random.h"
 #include "hashcash.h"
@@ -35,6 +45,7 @@
 #include "sstring.h"
 #include "getopt.h"
 #include "array.h"
+#include "hashcashd.h"
 
 #if defined( OPENSSL )
 #include <openssl/sha.h>
@@ -65,6 +76,7 @@ void die_msg( const char* );
 void usage( const char* );
 int parse_period( const char* aperiod, long* resp );
 double report_speed( int bits, double* time_est, int display );
+void report_placements( const char* place );
 
 #if defined( WIN32 )
 #define LINEFEED "\r\n"
@@ -77,18 +89,107 @@ double report_speed( int bits, double* time_est, int display );
 void mystolower( char* str );
 #define stolower mystolower
 
+int db_purge( DB* db, ARRAY* purge_resource, int purge_all, 
+	      long purge_period, time_t now_time, long validity_period,
+	      long grace_period, int verbose_flag, int* err );
+int db_purge_step( DB* db, ARRAY* purge_resource, int purge_all, 
+		   long purge_period, time_t now_time, long validity_period,
+		   long grace_period, int verbose_flag, long max_records,
+		   long max_millis, int* err );
 void db_open( DB* db, const char* db_filename );
+void db_die( int err );
 void db_purge_arr( DB* db, ARRAY* purge_resource, int purge_all, 
 		   long purge_period, time_t now_time, long validity_period,
 		   long grace_period );
 int db_in( DB* db, char* token, char *period );
 void db_add( DB* db, char* token, char *token_utime );
 void db_close( DB* db ) ;
+int cache_open( HCCACHE* cache, const char* db_filename );
+time_t cache_expiry( time_t token_time, const char* period, 
+		     long grace_period );
+hashcash_matcher* resource_matcher( ARRAY* resource );
+int online_cpus( void );
+
+/* stamps read ahead from stdin to be hashed and matched together */
+
+#define CHECK_AHEAD 64
+
+typedef struct {
+    char* tok[ CHECK_AHEAD ];
+    hashcash_stamp stamp[ CHECK_AHEAD ];
+    int match[ CHECK_AHEAD ];	/* hashcash_matcher_match result */
+    char* hits;			/* CHECK_AHEAD rows, one byte per resource */
+    int num;
+    int pos;
+} STAMP_BATCH;
+
+/* check pipeline: with -T n, n threads take turns to read a batch of
+ * stamps and prepare and match their batches in parallel; the checker
+ * takes batches in input order, so database lookups and output are as
+ * without -T.  At most CHECK_SLOTS batches per thread are in flight.
+ * Without -T the checker reads and prepares each batch itself.
+ */
+
+#define CHECK_SLOTS 2
+#define MAX_CHECK_THREADS 256
+
+#define SLOT_FREE 0
+#define SLOT_BUSY 1
+#define SLOT_READY 2
+
+typedef struct {
+    hashcash_hdrscan scan;
+    hashcash_matcher* matcher;	/* built first, so shared read only */
+    int nres;
+    STAMP_BATCH* slot;
+    int* state;
+    int slots;
+    long next_read;		/* batch numbers, batch k is in slot k % slots */
+    long next_check;
+    int eof;
+    int threads;
+#if defined( HAVE_PTHREADS )
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+} CHECK_PIPE;
+
+int read_stamps( STAMP_BATCH* batch, hashcash_hdrscan* scan );
+void prepare_stamps( STAMP_BATCH* batch, hashcash_matcher* matcher, 
+		     int nres );
+void check_pipe_start( CHECK_PIPE* pipe, int threads, 
+		       hashcash_matcher* matcher, int nres );
+STAMP_BATCH* check_pipe_next( CHECK_PIPE* pipe );
+
+/* client of a resident hashcashd, see hashcashd.h */
+
+typedef struct {
+    FILE* in;			/* NULL if not connected */
+    FILE* out;
+    char db[ PATH_MAX+1 ];	/* the database it uses */
+} HCDAEMON;
+
+int daemon_open( HCDAEMON* d, const char* path, const char* db_filename,
+		 int need_db );
+void daemon_close( HCDAEMON* d );
+char* daemon_reply( HCDAEMON* d, char* reply );
+void daemon_resources( HCDAEMON* d, ARRAY* resource, int bits_flag );
+long daemon_check( HCDAEMON* d, const char* token, int mode, 
+		   const char* period );
+int daemon_mint( HCDAEMON* d, ELEMENT* ent, char** stamp );
 
 #define hc_est_time(b) ( hashcash_expected_tries(b) / \
-        (double)hashcash_per_sec() )
+        (double)hashcash_effective_per_sec() )
 int quiet_flag;
 int verbose_flag;
+int sync_mode = SDB_SYNC_NONE;
+long sync_interval = 0;
+long purge_records = 0;
+long purge_millis = 0;
+int db_shards = 0;
+int cache_flag = 0;
+long cache_slots = 0;
+int check_threads = -1;		/* -T, -1 to check without threads */
 int out_is_tty;
 int in_is_tty;
 
@@ -122,12 +223,14 @@ int main( int argc, char* argv[] )
     char header2[ MAX_HDR+1 ] = { 0 };
     char* header_wrapped = NULL;
     int hdr_len, hdr2_len, token_found = 0, token2_found = 0, hdrs_found = 0;
-    char token[ MAX_TOK+1 ] = { 0 }, token_resource[ MAX_RES+1 ] = { 0 };
+    char token_buf[ MAX_TOK+1 ] = { 0 }, *token = token_buf;
+    char token_resource[ MAX_RES+1 ] = { 0 };
     char *new_token = NULL ;
     char line_arr[ MAX_LINE+1 ] = { 0 }, *line = line_arr;
     int line_max = MAX_LINE, line_alloc = 0;
     char ahead[ MAX_LINE+1 ] = { 0 } , *ext = NULL, *junk = NULL;
     ARRAY purge_resource, resource, tokens, args;
+    HCCACHE cache = { NULL, 0, 0, 0 };
 
     clock_t start = 0, end = 0, tmp = 0;
 
@@ -142,6 +245,15 @@ int main( int argc, char* argv[] )
     time_t token_time = 0, expiry_time = 0;
     int time_width_flag = 0;	/* -z option, default 6 YYMMDD */
     int compress = 0;		/* fast by default */
+    int mint_threads = 0;	/* -A, mint with this many threads */
+    int threads_flag = 0;
+    char* place = NULL;		/* -B, CPUs to run them on */
+    int duty = 0;		/* -L, percent of the CPU to mint with */
+    int fork_procs = 0;		/* -F, mint in this many processes */
+    int coord_port = 0;		/* -G, hand out the minting on port */
+    char* worker_host = NULL;	/* -J, mint for the coordinator there */
+    int worker_port = 0;
+    hashcash_coord* coord = NULL;
     int inferred_time_width = 0, time_width = 6; /* default YYMMDD */
     int core = 0, res = 0, core_flag = 0;
 
@@ -150,6 +262,18 @@ int main( int argc, char* argv[] )
     int in_headers = 0, skip = 0, over = 0, precision = 0;
     char *re_err = NULL;
     ELEMENT* ent = NULL;
+    hashcash_stamp prepared;
+    hashcash_matcher* matcher = NULL;
+    char* hits = NULL;
+    int matched = 0, have_prepared = 0;
+    static CHECK_PIPE check_pipe;
+    STAMP_BATCH* stamps = NULL;
+    char* stamp_hits = NULL;
+    int stamp_match = 0, piping = 0;
+    hashcash_hdrscan scan;
+    int scanning = 0;
+    HCDAEMON hcd = { NULL, NULL, { 0 } };
+    char* hcd_path = NULL;
     DB db;
     hashcash_callback callback = NULL;
 
@@ -172,13 +296,22 @@ int main( int argc, char* argv[] )
     array_alloc( &args, 32 );
 
     while ( (opt=getopt(argc, argv, 
-		"-a:b:cde:f:g:hij:klmnop:qr:st:uvwx:yz:CEMO:PSVXZ:")) >0 ) {
+		"-a:A:b:B:cde:f:g:hij:klL:mnop:qr:st:uvwx:yz:CD:EF:G:H:I:J:MN:O:PST:VXZ:")) >0 ) {
 	switch ( opt ) {
 	case 'a': anon_flag = 1; 
 	    if ( !parse_period( optarg, &anon_period ) ) {
 		usage( "error: -a invalid period arg" );
 	    }
 	    break;
+	case 'A': 
+	    threads_flag = 1;
+	    mint_threads = strtol( optarg, &junk, 10 );
+	    if ( *junk != '\0' || mint_threads < 0 || 
+		 mint_threads > HASHCASH_MAX_THREADS ) {
+		usage( "error: -A invalid number of threads" );
+	    }
+	    break;
+	case 'B': place = strdup( optarg ); break;
 	case 'b':
 	    if ( bits_flag ) { multiple_bits = 1; }
 	    bits_flag = 1;
@@ -202,6 +335,46 @@ int main( int argc, char* argv[] )
 	case 'C': case_flag = 1; break;
 	case 'c': check_flag = 1; break;
 	case 'd': db_flag = 1; break;
+	case 'D':
+	    if ( strcmp( optarg, "none" ) == 0 ) { 
+		sync_mode = SDB_SYNC_NONE; 
+	    } else if ( strcmp( optarg, "batch" ) == 0 ) { 
+		sync_mode = SDB_SYNC_BATCH; 
+	    } else if ( parse_period( optarg, &sync_interval ) &&
+			sync_interval >= 0 ) {
+		sync_mode = SDB_SYNC_INTERVAL;
+	    } else {
+		usage( "error: -D invalid durability mode" );
+	    }
+	    break;
+	case 'H':
+	    cache_flag = 1;
+	    cache_slots = strtol( optarg, &junk, 10 );
+	    if ( *junk != '\0' || cache_slots < 0 ) {
+		usage( "error: -H invalid cache size" );
+	    }
+	    break;
+	case 'T':
+	    check_threads = strtol( optarg, &junk, 10 );
+	    if ( *junk != '\0' || check_threads < 0 || 
+		 check_threads > MAX_CHECK_THREADS ) {
+		usage( "error: -T invalid number of threads" );
+	    }
+	    if ( check_threads == 0 ) { check_threads = online_cpus(); }
+	    break;
+	case 'N':
+	    db_shards = strtol( optarg, &junk, 10 );
+	    if ( *junk != '\0' || db_shards < 0 || db_shards > MAX_SHARDS ) {
+		usage( "error: -N invalid number of shards" );
+	    }
+	    break;
+	case 'I':
+	    purge_records = strtol( optarg, &junk, 10 );
+	    if ( *junk == ':' ) { purge_millis = strtol( junk+1, &junk, 10 ); }
+	    if ( *junk != '\0' || purge_records < 0 || purge_millis < 0 ) {
+		usage( "error: -I invalid purge step, expect records[:ms]" );
+	    }
+	    break;
 	case 'e': 
 	    if ( validity_flag ) { multiple_validity = 1; }
 	    validity_flag = 1; 
@@ -211,7 +384,30 @@ int main( int argc, char* argv[] )
 	    }
 	    break;
 	case 'E': str_type = TYPE_REGEXP; break;
+	case 'F': 
+	    fork_procs = strtol( optarg, &junk, 10 );
+	    if ( *junk != '\0' || fork_procs < 1 || 
+		 fork_procs > HASHCASH_MAX_FORK ) {
+		usage( "error: -F invalid number of processes" );
+	    }
+	    break;
 	case 'f': db_filename = strdup( optarg ); break;
+	case 'G': 
+	    coord_port = strtol( optarg, &junk, 10 );
+	    if ( *junk != '\0' || coord_port < 1 || coord_port > 65535 ) {
+		usage( "error: -G invalid port" );
+	    }
+	    break;
+	case 'J': 
+	    worker_host = strdup( optarg );
+	    junk = strrchr( worker_host, ':' );
+	    if ( junk == NULL ) { usage( "error: -J expect host:port" ); }
+	    *junk++ = '\0';
+	    worker_port = strtol( junk, &junk, 10 );
+	    if ( *junk != '\0' || worker_port < 1 || worker_port > 65535 ) {
+		usage( "error: -J invalid port" );
+	    }
+	    break;
 	case 'g': 
 	    if ( grace_flag ) { multiple_grace = 1; }
 	    grace_flag = 1;
@@ -231,6 +427,12 @@ int main( int argc, char* argv[] )
 	    break;
 	case 'k': purge_all = 1; break;
 	case 'l': left_flag = 1; break;
+	case 'L': 
+	    duty = strtol( optarg, &junk, 10 );
+	    if ( *junk != '\0' || duty < 1 || duty > 100 ) {
+		usage( "error: -L invalid percent" );
+	    }
+	    break;
 	case 'n': name_flag = 1; break;
 	case 'o': over_flag = 1; break;
 	case 'O': 
@@ -374,6 +576,22 @@ int main( int argc, char* argv[] )
 	usage( "can only specify one of -m, -c" );
     }
 
+    if ( worker_host ) {	/* mint for a coordinator until it's done */
+	if ( mint_flag + check_flag + purge_flag > 0 ) {
+	    usage( "can not use -m, -c or -p with -J" );
+	}
+	if ( place && hashcash_use_cpus( place ) < 0 ) {
+	    usage( "error: -B invalid placement" );
+	}
+	if ( threads_flag ) { hashcash_use_threads( mint_threads ); }
+	if ( duty ) { hashcash_use_duty( duty ); }
+	if ( hashcash_mint_worker( worker_host, worker_port, callback, 
+				   NULL ) != HASHCASH_OK ) {
+	    die_msg( "error: can not connect to coordinator" );
+	}
+	exit( EXIT_SUCCESS );
+    }
+
     if ( mint_flag && ( name_flag || width_flag || left_flag ) ) {
 	usage( "can not use -n, -w or -l with -m" );
     }
@@ -386,7 +604,33 @@ int main( int argc, char* argv[] )
     if ( quiet_flag ) {	verbose_flag = 0; } /* quiet overrides verbose */
     if ( speed_flag && check_flag ) { speed_flag = 0; }	/* ignore speed */
 
-    if ( purge_flag ) {
+    /* hand checks, mints and plain purges to a resident hashcashd; it
+     * answers for now, and says only whether a check passed
+     */
+    hcd_path = getenv( HASHCASHD_ENV );
+    if ( hcd_path && hcd_path[0] && now_time == real_time && !verbose_flag &&
+	 !speed_flag && !name_flag && !width_flag && !left_flag &&
+	 ( mint_flag || ( check_flag && quiet_flag ) || 
+	   ( purge_flag && !db_flag && !bits_flag && !res_flag ) ) &&
+	 ( !check_flag || quiet_flag ) &&
+	 ( !mint_flag || ( !anon_flag && !ext && !callback && !compress &&
+			  !core_flag && !coord_port ) ) &&
+	 ( !purge_flag || ( array_num( &purge_resource ) == 0 && !purge_all &&
+			    purge_records == 0 && purge_millis == 0 ) ) ) {
+	daemon_open( &hcd, hcd_path, db_filename, 
+		     ( check_flag && db_flag ) || purge_flag );
+    }
+    /* what isn't handed over would wait forever on the db's lock */
+    if ( hcd_path && hcd_path[0] ) { hashcash_db_nowait( 1 ); }
+
+    if ( purge_flag && hcd.in ) {
+	fprintf( hcd.out, "purge %ld %ld %ld\n", purge_period, 
+		 validity_flag ? purge_validity_period : 0, grace_period );
+	if ( strcmp( daemon_reply( &hcd, line ), "ok" ) != 0 ) {
+	    die( atoi( line + strlen( "fail " ) ) );
+	}
+	if ( mint_flag + check_flag == 0 ) { exit( EXIT_SUCCESS ); }
+    } else if ( purge_flag ) {
 	db_open( &db, db_filename );
 	db_opened = 1;
 
@@ -394,6 +638,13 @@ int main( int argc, char* argv[] )
 		  now_time, validity_flag ? purge_validity_period : 0,
 		  grace_period );
 
+	/* stamps purged early are no longer spent as far as the db knows */
+	if ( cache_flag && ( purge_all || array_num( &purge_resource ) > 0 ||
+			     validity_flag ) && 
+	     cache_open( &cache, db_filename ) ) {
+	    hashcash_cache_clear( &cache );
+	}
+
 	if ( mint_flag + check_flag + name_flag + left_flag + 
 	     width_flag + bits_flag + res_flag + speed_flag == 0 ) { 
 	    db_close( &db );	/* just -p we're done */
@@ -403,6 +654,12 @@ int main( int argc, char* argv[] )
 
     if ( mint_flag || speed_flag ) { /* mint stamp */
 
+	if ( place && hashcash_use_cpus( place ) < 0 ) {
+	    usage( "error: -B invalid placement" );
+	}
+	if ( threads_flag ) { hashcash_use_threads( mint_threads ); }
+	if ( duty ) { hashcash_use_duty( duty ); }
+
 	if ( mint_flag ) {
 
 	    /* no resources given, read them from stdin */
@@ -432,6 +689,7 @@ int main( int argc, char* argv[] )
 	    } else {
 		hashcash_benchtest( 3, -1 );
 	    }
+	    if ( threads_flag || place ) { report_placements( place ); }
 	    exit( EXIT_SUCCESS ); /* don't actually calculate it */
 	}
 
@@ -453,7 +711,12 @@ int main( int argc, char* argv[] )
                 PPRINTF( stdout, "%ld\n", hashcash_per_sec() );
 	    }
 	    QPRINTF( stderr, "compression: %d\n", compress );
+	    if ( threads_flag || place || duty ) {
+		QPRINTF( stderr, "effective speed: %ld preimage tests per "
+			 "second\n", hashcash_effective_per_sec() );
+	    }
 	    if ( speed_flag && !bits_flag && !mint_flag ) {
+		if ( threads_flag || place ) { report_placements( place ); }
 		exit( EXIT_SUCCESS ); /* don't actually calculate it */
 	    }
 	}
@@ -465,6 +728,11 @@ int main( int argc, char* argv[] )
 	    exit( EXIT_SUCCESS ); /* don't actually calculate it */
 	}
 
+	if ( coord_port && mint_flag ) {
+	    coord = hashcash_coord_open( coord_port, &err );
+	    if ( coord == NULL ) { die( err ); }
+	}
+
 	for ( i = 0; i < array_num( &args ); i++ ) {
 
 	    start = clock();
@@ -485,10 +753,21 @@ int main( int argc, char* argv[] )
 	    }
 	    sprintf( progress_format, PROGRESS_FMT, precision );
 
-	    err = hashcash_mint( now_time, ent->width, ent->str, ent->bits, 
-				 ent->anon, &new_token, &anon_random, 
-				 &tries_taken, ext, compress, 
-				 callback, NULL );
+	    if ( coord ) {
+		err = hashcash_coord_mint( coord, now_time, ent->width, 
+					   ent->str, ent->bits, ent->anon, 
+					   &new_token, &anon_random, 
+					   &tries_taken, ext, compress, 
+					   callback, NULL );
+	    } else if ( hcd.in ) {
+		err = daemon_mint( &hcd, ent, &new_token );
+	    } else {
+		err = hashcash_fork_mint( fork_procs, now_time, ent->width, 
+					  ent->str, ent->bits, ent->anon, 
+					  &new_token, &anon_random, 
+					  &tries_taken, ext, compress, 
+					  callback, NULL );
+	    }
 	    end = clock();
 
 	    switch ( err ) {
@@ -527,6 +806,10 @@ int main( int argc, char* argv[] )
 	    if ( end < start ) { tmp = end; end = start; start = tmp; }
 	    taken = (end-start)/(double)CLOCKS_PER_SEC;
 	    VPRINTF( stderr, "time: %.0f seconds\n", taken );
+	    if ( threads_flag || place || duty ) {
+		VPRINTF( stderr, "effective speed: %ld preimage tests per "
+			 "second\n", hashcash_effective_per_sec() );
+	    }
 	    
 	    if ( hdr_flag ) {
 		header_wrapped = hashcash_make_header( new_token, HDR_LINE_LEN,
@@ -546,6 +829,7 @@ int main( int argc, char* argv[] )
 	    }
 	    free( new_token );
 	}
+	hashcash_coord_close( coord );
 	exit( EXIT_SUCCESS );
 
     } else if ( check_flag || name_flag || width_flag || 
@@ -569,6 +853,16 @@ int main( int argc, char* argv[] )
 			grace_period, anon_period, time_width, bits, 0 );
 	}
 
+	if ( hcd.in ) { daemon_resources( &hcd, &resource, bits_flag ); }
+
+	/* with several resources find all a stamp matches in one go */
+
+	if ( !hcd.in && ( array_num( &resource ) > 1 || check_threads > 0 ) ) {
+	    matcher = resource_matcher( &resource );
+	    hits = malloc( array_num( &resource ) );
+	    if ( hits == NULL ) { die( ENOMEM ); }
+	}
+
 	hdrs_found = 0;
 	tty_info = 0;
 	in_headers = 0;
@@ -577,13 +871,53 @@ int main( int argc, char* argv[] )
 	for ( t = 0, token_found = 0, boundary = 0; !boundary; ) {
 	    /* read tokens from cmd line args 1st */
 	    if ( t < array_num( &tokens ) ) {
+		token = token_buf;
 		sstrncpy( token, tokens.elt[t].str, MAX_TOK );
 		t++;
 		token_found = 1;
 	    }
 	    /* if no hdr flag, and were cmd line tokens, we're done */
 	    else if ( !hdr_flag && array_num( &tokens ) > 0 ) { break; }
-	    else {
+	    else if ( !hdr_flag && !in_is_tty ) {
+		/* stamps one per line: read ahead to hash them together */
+		in_headers = 1;
+		if ( !piping ) {
+		    check_pipe_start( &check_pipe, check_threads, matcher,
+				      array_num( &resource ) );
+		    piping = 1;
+		}
+		if ( ( stamps == NULL || stamps->pos == stamps->num ) &&
+		     ( stamps = check_pipe_next( &check_pipe ) ) == NULL ) {
+		    break;
+		}
+		token = stamps->tok[ stamps->pos ];
+		prepared = stamps->stamp[ stamps->pos ];
+		stamp_match = stamps->match[ stamps->pos ];
+		stamp_hits = stamps->hits + 
+		    stamps->pos * array_num( &resource );
+		stamps->pos++;
+		have_prepared = 1;
+		token_found = 1;
+	    } else if ( hdr_flag && !in_is_tty ) {
+		/* a message on stdin: scan its headers in big reads and
+		 * check stamps where they lie in the buffer 
+		 */
+		in_headers = 1;
+		if ( !scanning ) {
+		    if ( !hashcash_hdrscan_open( &scan, fileno( stdin ),
+						 ignore_boundary_flag ) ) {
+			die( errno );
+		    }
+		    hashcash_hdrscan_name( &scan, header );
+		    if ( header2[0] ) { hashcash_hdrscan_name( &scan, header2 ); }
+		    scanning = 1;
+		}
+		token = hashcash_hdrscan_next( &scan, NULL );
+		if ( token == NULL ) { token = token_buf; break; }
+		hdrs_found = 1;
+		token_found = 1;
+	    } else {
+		token = token_buf;
 		if ( !in_headers ) { in_headers = 1; }
 		if ( in_is_tty && !tty_info ) {
 		    if ( hdr_flag ) {
@@ -630,6 +964,36 @@ int main( int argc, char* argv[] )
 		skip = 0;
 		over = 0;
 		accept = 0;
+
+		if ( hcd.in ) {
+		    checked = db_flag ? yes_flag || ( res_flag && bits_flag ) :
+			yes_flag;
+		    sprintf( period, "%ld", validity_period );
+		    have_prepared = 0;
+		    valid_for = daemon_check( &hcd, token, !db_flag ? 'n' :
+					      checked ? 'a' : 'd', period );
+		    if ( valid_for < 0 ) { continue; } /* to next token */
+		    goto leave;
+		}
+
+		/* parse, hash, decode time and match once for all
+		 * resources; stamps from stdin come done already 
+		 */
+		if ( !have_prepared ) { 
+		    hashcash_stamp_prepare( &prepared, token ); 
+		    stamp_hits = hits;
+		    stamp_match = matcher && prepared.status == HASHCASH_OK ?
+			hashcash_matcher_match( matcher, prepared.res, 
+						prepared.lower_res, hits, 
+						&re_err ) : -1;
+		}
+		have_prepared = 0;
+		token_time = prepared.time;
+
+		/* on a regexp error check one at a time to report it */
+		matched = matcher && prepared.status == HASHCASH_OK &&
+		    stamp_match >= 0;
+
 		for ( i = 0; i < array_num( &resource ) && !skip; i++ ) {
 		    ent = &resource.elt[i];
 
@@ -647,13 +1011,15 @@ int main( int argc, char* argv[] )
 		    over = 0;
 
 		    if ( !ent->case_flag ) { stolower( ent->str ); }
-		    valid_for = hashcash_check( token, ent->case_flag, 
-						ent->str, 
-						&(ent->regexp), &re_err,
-						ent->type, now_time, 
-						ent->validity, ent->grace, 
-						bits_flag ? ent->bits : 0,
-						&token_time );
+		    if ( matched && !stamp_hits[i] ) {
+			valid_for = HASHCASH_WRONG_RESOURCE;
+		    } else {
+			valid_for = hashcash_stamp_check_resource( 
+			    &prepared, ent->case_flag, 
+			    matched ? NULL : ent->str, &(ent->regexp), 
+			    &re_err, ent->type, now_time, ent->validity, 
+			    ent->grace, bits_flag ? ent->bits : 0 );
+		    }
 
 		    if ( valid_for < 0 ) {
 			switch ( valid_for ) {
@@ -760,11 +1126,31 @@ int main( int argc, char* argv[] )
 
 		if ( valid_for >= 0 || accept ) {
 		    if ( db_flag ) {
+			if ( cache_flag && cache.map == NULL ) {
+			    cache_flag = cache_open( &cache, db_filename );
+			}
+			if ( cache_flag && 
+			     hashcash_cache_in( &cache, token, now_time ) ) {
+			    QPRINTF( stderr, "skipped: spent stamp\n" );
+			    valid_for = HASHCASH_SPENT;
+			    continue; /* to next token */
+			}
 			if ( !db_opened ) {
 			    db_open( &db, db_filename );
 			    db_opened = 1;
+			    /* it may only now exist */
+			    if ( cache_flag && 
+				 !hashcash_cache_rebind( &cache, 
+							 db_filename ) ) {
+				cache_flag = 0;
+			    }
 			}
 			if ( db_in( &db, token, token_utime ) ) {
+			    if ( cache_flag ) {
+				hashcash_cache_add( &cache, token, 
+				    cache_expiry( token_time, token_utime,
+						  grace_period ), now_time );
+			    }
 			    QPRINTF( stderr, "skipped: spent stamp\n" );
 			    valid_for = HASHCASH_SPENT;
 			    continue; /* to next token */
@@ -858,6 +1244,11 @@ int main( int argc, char* argv[] )
 			if ( checked ) {
 			    sprintf( period, "%ld", validity_period );
 			    db_add( &db, token, period );
+			    if ( cache_flag ) {
+				hashcash_cache_add( &cache, token, 
+				    cache_expiry( token_time, period, 
+						  grace_period ), now_time );
+			    }
 			}
 		    } else {
 			checked = yes_flag;
@@ -999,6 +1390,11 @@ void usage( const char* msg )
     fprintf( stderr, "\t-v\t\tprint verbose informational output\n" );
     fprintf( stderr, "\t-h\t\tprint this usage info\n" );
     fprintf( stderr, "\t-f dbfile\tuse filename dbfile for database\n" );
+    fprintf( stderr, "\t-D mode\t\tdatabase sync: none, batch or a period\n" );
+    fprintf( stderr, "\t-H n\t\tshared memory cache of n spent stamps (0 = default)\n" );
+    fprintf( stderr, "\t-N n\t\tcreate database split over n shard files\n" );
+    fprintf( stderr, "\t-I n[:ms]\tpurge incrementally, n records or ms per run\n" );
+    fprintf( stderr, "\t-T n\t\tcheck stamps from stdin with n threads (0 = a cpu each)\n" );
     fprintf( stderr, "\t-j resource\twith -p delete just stamps matching the given resource\n" );
     fprintf( stderr, "\t-k\t\twith -p delete all not just expired\n" );
     fprintf( stderr, "\t-x ext\t\tput in extension field\n" );
@@ -1013,6 +1409,12 @@ void usage( const char* msg )
     fprintf( stderr, "\t-P\t\tshow progress while searching\n");
     fprintf( stderr, "\t-O core\t\tuse specified minting core\n");
     fprintf( stderr, "\t-Z n\t\t0 = fast (default), 1 = medium, 2 = small/slow\n");
+    fprintf( stderr, "\t-A n\t\tmint with n threads (0 = one per core)\n");
+    fprintf( stderr, "\t-B cpus\t\trun them on cores, all, smt or CPUs as 0-3,8\n");
+    fprintf( stderr, "\t-L percent\tmint in the background with percent of the CPU\n");
+    fprintf( stderr, "\t-F n\t\tmint with n processes\n");
+    fprintf( stderr, "\t-G port\t\tmint with workers connecting to port\n");
+    fprintf( stderr, "\t-J host:port\tbe a worker for the -G coordinator there\n");
     fprintf( stderr, "examples:\n" );
     fprintf( stderr, "\thashcash -mb20 foo                               # mint 20 bit preimage\n" );
     fprintf( stderr, "\thashcash -cdb20 -r foo 1:20:040806:foo::831d0c6f22eb81ff:15eae4 # check preimage\n" );
@@ -1026,8 +1428,15 @@ void db_purge_arr( DB* db, ARRAY* purge_resource, int purge_all,
 	       long purge_period, time_t now_time, long validity_period,
 	       long grace_period ) {
     int res, err = HASHCASH_FAIL;
-    res = db_purge( db, purge_resource, purge_all, purge_period, now_time, 
-		    validity_period, grace_period, verbose_flag, &err );
+    if ( purge_records > 0 || purge_millis > 0 ) {
+	res = db_purge_step( db, purge_resource, purge_all, purge_period, 
+			     now_time, validity_period, grace_period, 
+			     verbose_flag, purge_records, purge_millis, &err );
+    } else {
+	res = db_purge( db, purge_resource, purge_all, purge_period, 
+			now_time, validity_period, grace_period, 
+			verbose_flag, &err );
+    }
     switch ( res ) {
     case HASHCASH_INVALID_TIME:
 	die_msg( "error: invalid time argument" ); break;
@@ -1039,7 +1448,15 @@ void db_purge_arr( DB* db, ARRAY* purge_resource, int purge_all,
 
 void db_open( DB* db, const char* db_filename ) {
     int err;
-    if (!hashcash_db_open( db, db_filename, &err )) { die(err); }
+    if (!hashcash_db_open_sharded( db, db_filename, db_shards, &err )) { 
+	if ( err == EINPUT ) {
+	    die_msg( "error: database exists with a different -N" );
+	}
+	db_die(err); 
+    }
+    if (!hashcash_db_durability( db, sync_mode, sync_interval, &err )) {
+	die(err); 
+    }
 }
 
 int db_in( DB* db, char* token, char *period ) {
@@ -1047,15 +1464,25 @@ int db_in( DB* db, char* token, char *period ) {
     int res;
 
     res = hashcash_db_in( db, token, period, &err );
-    if ( err ) { die( err ); }
+    if ( err ) { db_die( err ); }
     return res;
 }
 
 void db_add( DB* db, char* token, char *period ) {
     int err = 0;
     if ( !hashcash_db_add( db, token, period, &err ) ) {
-	die( err );
+	db_die( err );
+    }
+}
+
+/* a db locked while a hashcashd is configured is most likely its */
+
+void db_die( int err ) {
+    if ( err == EWOULDBLOCK ) {
+	die_msg( "error: database owned by hashcashd, which only answers "
+		 "quiet checks (-q), mints and plain purges" );
     }
+    die( err );
 }
 
 void db_close( DB* db ) {
@@ -1065,6 +1492,321 @@ void db_close( DB* db ) {
     }
 }
 
+/* the cache is optional, if it can't be had carry on with the db */
+
+int cache_open( HCCACHE* cache, const char* db_filename ) {
+    int err = 0;
+    if ( !hashcash_cache_open( cache, db_filename, cache_slots, &err ) ) {
+	VPRINTF( stderr, "warning: no shared memory cache: %s\n", 
+		 strerror( err ) );
+	return 0;
+    }
+    return 1;
+}
+
+/* when the db will purge a stamp stored with the given period */
+
+time_t cache_expiry( time_t token_time, const char* period, 
+		     long grace_period ) {
+    long validity = atol( period );
+    if ( validity == 0 ) { return HCCACHE_FOREVER; }
+    return token_time + validity + grace_period;
+}
+
+/* matcher for all the resources, NULL to check them one at a time */
+
+hashcash_matcher* resource_matcher( ARRAY* resource ) {
+    hashcash_matcher* matcher = hashcash_matcher_new();
+    ELEMENT* ent = NULL;
+    int i = 0;
+
+    for ( i = 0; matcher && i < array_num( resource ); i++ ) {
+	ent = &resource->elt[i];
+	if ( ent->str == NULL || 
+	     !hashcash_matcher_add( matcher, ent->type, ent->case_flag, 
+				    ent->str ) ) {
+	    hashcash_matcher_free( matcher );
+	    matcher = NULL;
+	}
+    }
+    return matcher;
+}
+
+/* read up to CHECK_AHEAD stamps, one per line */
+
+int read_stamps( STAMP_BATCH* batch, hashcash_hdrscan* scan ) {
+    char* line = NULL, *tok = NULL;
+    int len = 0;
+
+    for ( batch->num = 0; batch->num < CHECK_AHEAD; batch->num++ ) {
+	line = hashcash_hdrscan_next( scan, NULL );
+	if ( line == NULL ) { break; }
+	len = strlen( line );
+	tok = realloc( batch->tok[ batch->num ], len+1 );
+	if ( tok == NULL ) { die( ENOMEM ); }
+	memcpy( tok, line, len+1 );
+	batch->tok[ batch->num ] = tok;
+    }
+    batch->pos = 0;
+    return batch->num > 0;
+}
+
+/* parse, hash and match a batch */
+
+void prepare_stamps( STAMP_BATCH* batch, hashcash_matcher* matcher, 
+		     int nres ) {
+    char* re_err = NULL;
+    int i = 0;
+
+    hashcash_stamp_prepare_batch( batch->stamp, 
+				  (const char* const*)batch->tok, 
+				  batch->num );
+    for ( i = 0; i < batch->num; i++ ) {
+	batch->match[i] = -1;
+	if ( matcher && batch->stamp[i].status == HASHCASH_OK ) {
+	    batch->match[i] = 
+		hashcash_matcher_match( matcher, batch->stamp[i].res,
+					batch->stamp[i].lower_res, 
+					batch->hits + i * nres, &re_err );
+	}
+    }
+}
+
+#if defined( HAVE_PTHREADS )
+
+static void* check_pipe_worker( void* argp ) {
+    CHECK_PIPE* pipe = (CHECK_PIPE*)argp;
+    STAMP_BATCH* batch = NULL;
+    long k = 0;
+
+    pthread_mutex_lock( &pipe->lock );
+    while ( !pipe->eof ) {
+	k = pipe->next_read % pipe->slots;
+	if ( pipe->state[k] != SLOT_FREE ) {
+	    pthread_cond_wait( &pipe->cond, &pipe->lock );
+	    continue;
+	}
+	pipe->next_read++;
+	pipe->state[k] = SLOT_BUSY;
+	batch = &pipe->slot[k];
+	if ( !read_stamps( batch, &pipe->scan ) ) { pipe->eof = 1; }
+	pthread_mutex_unlock( &pipe->lock );
+
+	prepare_stamps( batch, pipe->matcher, pipe->nres );
+
+	pthread_mutex_lock( &pipe->lock );
+	pipe->state[k] = SLOT_READY;
+	pthread_cond_broadcast( &pipe->cond );
+    }
+    pthread_mutex_unlock( &pipe->lock );
+    return NULL;
+}
+
+#endif
+
+void check_pipe_start( CHECK_PIPE* pipe, int threads, 
+		       hashcash_matcher* matcher, int nres ) {
+    char* re_err = NULL;
+    int i = 0;
+#if defined( HAVE_PTHREADS )
+    pthread_t thread;
+#endif
+
+    memset( pipe, 0, sizeof( CHECK_PIPE ) );
+    if ( !hashcash_hdrscan_open( &pipe->scan, fileno( stdin ), 1 ) ) {
+	die( errno );
+    }
+    pipe->matcher = matcher;
+    pipe->nres = nres;
+#if !defined( HAVE_PTHREADS )
+    threads = 0;
+#endif
+    if ( threads < 0 ) { threads = 0; }
+    pipe->slots = threads ? threads * CHECK_SLOTS : 1;
+    pipe->slot = calloc( pipe->slots, sizeof( STAMP_BATCH ) );
+    pipe->state = calloc( pipe->slots, sizeof( int ) );
+    if ( pipe->slot == NULL || pipe->state == NULL ) { die( ENOMEM ); }
+    for ( i = 0; i < pipe->slots; i++ ) {
+	pipe->slot[i].hits = malloc( CHECK_AHEAD * nres + 1 );
+	if ( pipe->slot[i].hits == NULL ) { die( ENOMEM ); }
+    }
+
+    /* build the matcher (compiling its regexps) before sharing it */
+    if ( matcher ) {
+	hashcash_matcher_match( matcher, "", "", pipe->slot[0].hits, 
+				&re_err );
+    }
+
+#if defined( HAVE_PTHREADS )
+    pthread_mutex_init( &pipe->lock, NULL );
+    pthread_cond_init( &pipe->cond, NULL );
+    for ( i = 0; i < threads; i++ ) {
+	if ( pthread_create( &thread, NULL, check_pipe_worker, pipe ) != 0 ) {
+	    break;
+	}
+	pthread_detach( thread );
+	pipe->threads++;
+    }
+#endif
+}
+
+STAMP_BATCH* check_pipe_next( CHECK_PIPE* pipe ) {
+    STAMP_BATCH* batch = NULL;
+    long k = 0;
+
+    if ( pipe->threads == 0 ) {
+	batch = &pipe->slot[0];
+	if ( !read_stamps( batch, &pipe->scan ) ) { return NULL; }
+	prepare_stamps( batch, pipe->matcher, pipe->nres );
+	return batch;
+    }
+#if defined( HAVE_PTHREADS )
+    pthread_mutex_lock( &pipe->lock );
+    if ( pipe->next_check > 0 ) { /* done with the last batch */
+	pipe->state[ ( pipe->next_check - 1 ) % pipe->slots ] = SLOT_FREE;
+	pthread_cond_broadcast( &pipe->cond );
+    }
+    k = pipe->next_check % pipe->slots;
+    while ( pipe->state[k] != SLOT_READY ) {
+	pthread_cond_wait( &pipe->cond, &pipe->lock );
+    }
+    pipe->next_check++;
+    batch = &pipe->slot[k];
+    pthread_mutex_unlock( &pipe->lock );
+#endif
+    return batch->num > 0 ? batch : NULL;
+}
+
+int online_cpus( void ) {
+#if defined( _SC_NPROCESSORS_ONLN )
+    long n = sysconf( _SC_NPROCESSORS_ONLN );
+    if ( n > MAX_CHECK_THREADS ) { return MAX_CHECK_THREADS; }
+    if ( n > 0 ) { return (int)n; }
+#endif
+    return 1;
+}
+
+/* connect to the hashcashd listening at path, unless need_db and it
+ * uses a database other than db_filename; 0 to go without
+ */
+
+int daemon_open( HCDAEMON* d, const char* path, const char* db_filename,
+		 int need_db ) {
+#if defined( HCDAEMON_CLIENT )
+    char line[ PATH_MAX+64 ] = { 0 }, db[ PATH_MAX+1 ] = { 0 };
+    struct sockaddr_un addr;
+    char* version = NULL;
+    int fd = -1;
+
+    d->in = d->out = NULL;
+    if ( strlen( path ) >= sizeof( addr.sun_path ) ) { return 0; }
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    strcpy( addr.sun_path, path );
+    fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( fd < 0 ) { return 0; }
+    if ( connect( fd, (struct sockaddr*)&addr, sizeof( addr ) ) != 0 ||
+	 ( d->in = fdopen( fd, "r" ) ) == NULL ) {
+	close( fd );
+	return 0;
+    }
+    d->out = fdopen( dup( fd ), "w" );
+    if ( d->out == NULL || fgets( line, sizeof( line ), d->in ) == NULL ||
+	 strncmp( line, HASHCASHD_GREETING " ", 
+		  strlen( HASHCASHD_GREETING " " ) ) != 0 ) {
+	daemon_close( d );
+	return 0;
+    }
+    chomplf( line );
+    version = line + strlen( HASHCASHD_GREETING " " );
+    sstrncpy( d->db, strchr( version, ' ' ) ? strchr( version, ' ' ) + 1 :
+	      "", PATH_MAX );
+    if ( need_db && ( realpath( db_filename, db ) == NULL || 
+		      strcmp( db, d->db ) != 0 ) ) {
+	daemon_close( d );
+	return 0;
+    }
+    return 1;
+#else
+    d->in = d->out = NULL;
+    return 0;
+#endif
+}
+
+void daemon_close( HCDAEMON* d ) {
+    if ( d->in ) { fclose( d->in ); }
+    if ( d->out ) { fclose( d->out ); }
+    d->in = d->out = NULL;
+}
+
+/* next reply, to requests sent to d->out since the last; reply has
+ * room for MAX_LINE
+ */
+
+char* daemon_reply( HCDAEMON* d, char* reply ) {
+    if ( fflush( d->out ) == EOF || 
+	 fgets( reply, MAX_LINE, d->in ) == NULL ) {
+	die_msg( "error: lost connection to hashcashd" );
+    }
+    chomplf( reply );
+    return reply;
+}
+
+/* send the resources, then read the replies */
+
+void daemon_resources( HCDAEMON* d, ARRAY* resource, int bits_flag ) {
+    char reply[ MAX_LINE+1 ];
+    ELEMENT* ent = NULL;
+    int i = 0;
+
+    fprintf( d->out, "reset\n" );
+    for ( i = 0; i < array_num( resource ); i++ ) {
+	ent = &resource->elt[i];
+	fprintf( d->out, "res %d %d %d %d %ld %ld %s\n", ent->type, 
+		 ent->case_flag, ent->over, bits_flag ? ent->bits : 0, 
+		 ent->validity, ent->grace, ent->str ? ent->str : "" );
+    }
+    for ( i = 0; i <= array_num( resource ); i++ ) {
+	if ( strcmp( daemon_reply( d, reply ), "ok" ) != 0 ) {
+	    die( atoi( reply + strlen( "fail " ) ) );
+	}
+    }
+}
+
+/* valid_for as the checks in main would find it, and spent checked
+ * (mode d) and recorded (mode a) as -d would
+ */
+
+long daemon_check( HCDAEMON* d, const char* token, int mode, 
+		   const char* period ) {
+    char reply[ MAX_LINE+1 ];
+    char* msg = NULL;
+    long valid_for = 0;
+
+    fprintf( d->out, "check %c %s %s\n", mode, period, token );
+    daemon_reply( d, reply );
+    if ( strncmp( reply, "ok ", 3 ) == 0 ) { return atol( reply + 3 ); }
+    if ( strcmp( reply, "spent" ) == 0 ) { return HASHCASH_SPENT; }
+    valid_for = strtol( reply + strlen( "fail " ), &msg, 10 );
+    if ( valid_for == HASHCASH_REGEXP_ERROR ) {
+	fprintf( stderr, "regexp error: " );
+	die_msg( msg[0] ? msg + 1 : msg );
+    }
+    return valid_for < 0 ? valid_for : HASHCASH_INVALID;
+}
+
+int daemon_mint( HCDAEMON* d, ELEMENT* ent, char** stamp ) {
+    char reply[ MAX_LINE+1 ];
+
+    fprintf( d->out, "mint %d %d %s\n", ent->bits, ent->width, ent->str );
+    daemon_reply( d, reply );
+    if ( strncmp( reply, "ok ", 3 ) != 0 ) {
+	return atoi( reply + strlen( "fail " ) );
+    }
+    *stamp = strdup( reply + 3 );
+    return *stamp ? HASHCASH_OK : HASHCASH_INTERNAL_ERROR;
+}
+
 void die( int err ) 
 {
     const char* str = "";
@@ -1115,6 +1857,25 @@ void trimspace( char* token ) {
     }
 }
 
+/* speed minting with threads on each placement, and place if given */
+
+void report_placements( const char* place )
+{
+    const char* places[ 3 ] = { "cores", "all", NULL };
+    unsigned long rate = 0;
+    int i = 0, threads = 0;
+
+    if ( place && strcmp( place, "cores" ) && strcmp( place, "all" ) ) {
+	places[2] = place;
+    }
+    for ( i = 0; i < 3 && places[i]; i++ ) {
+	rate = hashcash_place_per_sec( places[i], &threads );
+	if ( threads == 0 ) { continue; }
+	QPRINTF( stderr, "placement %s: %d threads, "
+		 "%ld preimage tests per second\n", places[i], threads, rate );
+    }
+}
+
 double report_speed( int bits, double* time_est, int display ) 
 {
     double te = 0;
@@ -145,6 +145,58 @@ int hashcash_mint( time_t now_time, int time_width, const char* resource,
 		   long* anon_random, double* tries_taken, char* ext,
 		   int compress, hashcash_callback cb, void* user_arg );
 
+/* hashcash_fork_mint: as hashcash_mint, but searching with procs
+ * child processes (at most HASHCASH_MAX_FORK), for where threads
+ * can't be used.  Each child searches its own part of the stamp space;
+ * the first stamp found is returned, the other children stopped, and
+ * tries_taken is the total tries of all of them.  cb is called in the
+ * calling process, with the combined progress.  Where there is no
+ * fork, or procs is 1 or less, it is hashcash_mint.
+ */
+
+#define HASHCASH_MAX_FORK 64
+
+HCEXPORT
+int hashcash_fork_mint( int procs, time_t now_time, int time_width, 
+			const char* resource, unsigned bits, 
+			long anon_period, char** stamp, long* anon_random, 
+			double* tries_taken, char* ext, int compress, 
+			hashcash_callback cb, void* user_arg );
+
+/* distributed minting: hashcash_coord_open listens on a TCP port for
+ * workers, and hashcash_coord_mint mints as hashcash_mint but by
+ * handing out disjoint units of the search to the workers connected,
+ * checking the stamps they return.  Workers stay connected between
+ * mints, and units of workers lost are handed out again.  tries_taken
+ * is the workers' tries.  hashcash_coord_open returns NULL with an
+ * errno value in err on failure.
+ *
+ * hashcash_mint_worker connects to a coordinator on host:port (trying
+ * for 10 seconds) and mints what it is given until told to quit, or
+ * the coordinator goes, returning HASHCASH_OK, or
+ * HASHCASH_INTERNAL_ERROR if it couldn't connect.  cb is called as
+ * for hashcash_mint, for each unit.
+ */
+
+typedef struct hashcash_coord hashcash_coord;
+
+HCEXPORT
+hashcash_coord* hashcash_coord_open( int port, int* err );
+
+HCEXPORT
+int hashcash_coord_mint( hashcash_coord* coord, time_t now_time, 
+			 int time_width, const char* resource, 
+			 unsigned bits, long anon_period, char** stamp, 
+			 long* anon_random, double* tries_taken, char* ext, 
+			 int compress, hashcash_callback cb, void* user_arg );
+
+HCEXPORT
+void hashcash_coord_close( hashcash_coord* coord );
+
+HCEXPORT
+int hashcash_mint_worker( const char* host, int port, hashcash_callback cb,
+			  void* user_arg );
+
 /* simpler API for minting  */
 
 HCEXPORT
@@ -211,6 +263,33 @@ int hashcash_parse( const char* stamp, int* vers, int* bits, char* utct,
 		    int utct_max, char* stamp_resource, int res_max, 
 		    char** ext, int ext_max );
 
+/* parse stamp in place: the fields are given as offsets and lengths
+ * into stamp, nothing is copied or allocated.  The stamp is read once,
+ * finding the colons and checking the rand and counter alphabet with a
+ * table lookup per character; if digest is not NULL the same pass
+ * hashes the stamp into it for counting its bits.
+ *
+ * returns 1 if stamp parses as hashcash_parse would, 0 otherwise.
+ * Fields a version does not have are left { 0, 0 } (in version 0:
+ * claim, ext and cnt), bits is -1 in version 0.
+ */
+
+typedef struct {
+    int off;
+    int len;
+} hashcash_field;
+
+typedef struct {
+    int vers;			/* stamp version */
+    int bits;			/* claimed bits (atoi of claim) */
+    int len;			/* length of the whole stamp */
+    hashcash_field ver, claim, utct, res, ext, rnd, cnt;
+} hashcash_view;
+
+HCEXPORT
+int hashcash_parse_view( const char* stamp, hashcash_view* view,
+			 unsigned char digest[20] );
+
 /* return how many seconds the stamp remains valid for
  * return value HASHCASH_VALID_FOREVER (value 0) means forever
  * return value < 0 is error code
@@ -273,12 +352,72 @@ int hashcash_check( const char* stamp, int case_flag, const char* resource,
 		    long validity_period, long grace_period, 
 		    int required_bits, time_t* stamp_time );
 
+/* prepared stamp: parse, convert time and count bits once, then check
+ * the same stamp against any number of resources cheaply
+ *
+ * hashcash_stamp_prepare returns HASHCASH_OK, HASHCASH_INVALID or
+ * HASHCASH_UNSUPPORTED_VERSION (also left in status);
+ * hashcash_stamp_check_resource returns the same as hashcash_check,
+ * which is built on these two.
+ */
+
+typedef struct {
+    int status;			/* result of hashcash_stamp_prepare */
+    int vers;
+    int claimed_bits;
+    int bits;			/* value: count, or claimed if version 1 */
+    time_t time;		/* time stamp was created (UTC) */
+    char res[ MAX_RES+1 ];	/* resource as in the stamp */
+    char lower_res[ MAX_RES+1 ]; /* and lower cased */
+} hashcash_stamp;
+
+HCEXPORT
+int hashcash_stamp_prepare( hashcash_stamp* prepared, const char* stamp );
+
+HCEXPORT
+int hashcash_stamp_check_resource( const hashcash_stamp* prepared, 
+				   int case_flag, const char* resource, 
+				   void **compile, char** re_err, int type, 
+				   time_t now_time, long validity_period, 
+				   long grace_period, int required_bits );
+
+/* batches of stamps are hashed several at a time with SIMD SHA1
+ *
+ * hashcash_stamp_prepare_batch prepares prepared[i] from stamps[i] for
+ * i < n, returning how many are well formed.
+ *
+ * hashcash_check_batch sets results[i] (and stamp_times[i] if not
+ * NULL) to what hashcash_check would return for stamps[i], and returns
+ * how many are valid (results[i] >= 0).
+ */
+
+HCEXPORT
+int hashcash_stamp_prepare_batch( hashcash_stamp prepared[], 
+				  const char* const stamps[], int n );
+
+HCEXPORT
+int hashcash_check_batch( int n, const char* const stamps[], 
+			  int case_flag, const char* resource, 
+			  void **compile, char** re_err, int type, 
+			  time_t now_time, long validity_period, 
+			  long grace_period, int required_bits, 
+			  int results[], time_t stamp_times[] );
+
 /* return how many tries per second the machine can do */
 
 HCEXPORT
 unsigned long hashcash_per_sec( void );
 
-/* estimate how many seconds it would take to mint a stamp of given size */
+/* return how many tries per second minting gets: measured by the last
+ * mint with threads or in the background, else the speed above for
+ * each thread with a CPU, for the percent of the time minting
+ */
+
+HCEXPORT
+unsigned long hashcash_effective_per_sec( void );
+
+/* estimate how many seconds it would take to mint a stamp of given
+ * size, at the effective speed */
 
 HCEXPORT
 double hashcash_estimate_time( int b );
@@ -309,7 +448,7 @@ double hashcash_expected_tries( int b );
  *
  * res             -- resource we're comparing against
  *
- * compile         -- cache for regexp compilation result
+ * compile         -- cache for regexp or wildcard compilation result
  *                    (hashcash_free it when you've finished)
  * 
  * err             -- NULL on success, regexp error string if regexp fails
@@ -319,6 +458,46 @@ HCEXPORT
 int hashcash_resource_match( int type, const char* stamp_res, const char* res, 
 			     void** compile, char** err );
 
+/* compiled set of resources to match stamps against
+ *
+ * For long accept lists: exact strings are hashed, *@domain style
+ * wildcards are kept in a trie of domain labels, and regexps are
+ * screened by one combined regexp, so one call finds every matching
+ * pattern without comparing against each in turn.
+ *
+ * hashcash_matcher_add    -- add a pattern, types as for
+ *                            hashcash_resource_match; case insensitive
+ *                            patterns are matched against lower_res.
+ *                            Patterns are numbered from 0 in the order
+ *                            added
+ *
+ * hashcash_matcher_match  -- if hits is not NULL set hits[i] to 1 for
+ *                            each pattern i that matches, 0 otherwise,
+ *                            and return how many matched; if hits is
+ *                            NULL stop at the first match.  Returns -1
+ *                            with *re_err set on a regexp error
+ */
+
+typedef struct hashcash_matcher hashcash_matcher;
+
+HCEXPORT
+hashcash_matcher* hashcash_matcher_new( void );
+
+HCEXPORT
+int hashcash_matcher_add( hashcash_matcher* matcher, int type, 
+			  int case_flag, const char* pattern );
+
+HCEXPORT
+int hashcash_matcher_match( hashcash_matcher* matcher, const char* res, 
+			    const char* lower_res, char* hits, 
+			    char** re_err );
+
+HCEXPORT
+int hashcash_matcher_num( const hashcash_matcher* matcher );
+
+HCEXPORT
+void hashcash_matcher_free( hashcash_matcher* matcher );
+
 /* free memory which may beallocated by:
  *
  *                hashcash_check
@@ -347,6 +526,9 @@ void hashcash_free( void* ptr);
  * utct        -- utct string to convert
  *
  * utc         -- if true use UTC, else express in local time zone
+ *
+ * the UTC conversion is plain arithmetic (no mktime or TZ), so it is
+ * safe to call from several threads; local time still uses mktime
  */
 
 HCEXPORT
@@ -391,11 +573,166 @@ int hashcash_core(void);
 HCEXPORT
 int hashcash_use_core(int);
 
+/* mint with this many threads (at most HASHCASH_MAX_THREADS), or
+ * with 0 one per core; returns the number that will be used, which is
+ * 1 where there are no threads.  The threads take small parts of the
+ * search as they are free, so slower cores hold none of them up.
+ */
+
+#define HASHCASH_MAX_THREADS 64
+
+HCEXPORT
+int hashcash_use_threads(int);
+
+/* place minting threads, pinning each to a CPU: "cores" on the
+ * first CPU of each physical core (what threads use unless placed,
+ * going on to the SMT siblings only if there are more threads than
+ * cores; fewer threads than cores are not pinned), "all" on every
+ * CPU, "smt" on the cores and also the siblings if that measures at
+ * least HASHCASH_SMT_GAIN percent faster, or a list of CPUs as
+ * 0-3,8.  Sets the number of threads to the number of CPUs, use
+ * hashcash_use_threads after to change it.  Returns the number of
+ * CPUs, 0 where threads can't be pinned, -1 if place is invalid.
+ *
+ * hashcash_place_per_sec measures the speed of minting placed so,
+ * with the number of threads it takes in threads.
+ */
+
+#define HASHCASH_SMT_GAIN 15
+
+HCEXPORT
+int hashcash_use_cpus( const char* place );
+
+HCEXPORT
+unsigned long hashcash_place_per_sec( const char* place, int* threads );
+
+/* mint in the background: for percent (1-100) of the time, resting
+ * between short runs, less if others want the CPU, and where possible
+ * with threads only run when the CPU is otherwise idle (on Linux,
+ * SCHED_IDLE or failing that nice 19).  The threads are started for
+ * each mint, so the caller's own thread is left as it was.  100 mints
+ * flat out.  Returns percent, 100 where there are no threads to do it
+ * with, -1 if invalid.
+ */
+
+HCEXPORT
+int hashcash_use_duty( int percent );
+
 /* give name of specified core */
 
 HCEXPORT
 const char* hashcash_core_name(int);
 
+/* hashcash_ctx: library state -- the minting core chosen, its measured
+ * speed, the random number generator and the buffer regexp errors are
+ * returned in.  The functions above share one global context, so they
+ * must not be called from several threads at once; the hashcash_ctx_
+ * variants below take the context to use instead, and calls on
+ * different contexts can run concurrently.  A context is used by one
+ * thread at a time.  Stamp parsing and the other functions without
+ * state are safe from any thread.
+ *
+ * hashcash_ctx_new returns NULL if out of memory.  A new context uses
+ * the machine default core; its random number generator is opened on
+ * first use.  re_err strings returned from a context's calls live in
+ * the context.
+ */
+
+typedef struct hashcash_ctx hashcash_ctx;
+
+HCEXPORT
+hashcash_ctx* hashcash_ctx_new( void );
+
+HCEXPORT
+void hashcash_ctx_free( hashcash_ctx* ctx );
+
+HCEXPORT
+int hashcash_ctx_mint( hashcash_ctx* ctx, time_t now_time, int time_width, 
+		       const char* resource, unsigned bits, long anon_period, 
+		       char** stamp, long* anon_random, double* tries_taken, 
+		       char* ext, int compress, hashcash_callback cb, 
+		       void* user_arg );
+
+HCEXPORT
+int hashcash_ctx_fork_mint( hashcash_ctx* ctx, int procs, time_t now_time, 
+			    int time_width, const char* resource, 
+			    unsigned bits, long anon_period, char** stamp, 
+			    long* anon_random, double* tries_taken, 
+			    char* ext, int compress, hashcash_callback cb, 
+			    void* user_arg );
+
+HCEXPORT
+int hashcash_ctx_mint_worker( hashcash_ctx* ctx, const char* host, 
+			      int port, hashcash_callback cb, 
+			      void* user_arg );
+
+HCEXPORT
+char* hashcash_ctx_simple_mint( hashcash_ctx* ctx, const char* resource, 
+				unsigned bits, long anon_period, char* ext, 
+				int compress );
+
+HCEXPORT
+int hashcash_ctx_check( hashcash_ctx* ctx, const char* stamp, int case_flag, 
+			const char* resource, void **compile, char** re_err, 
+			int type, time_t now_time, long validity_period, 
+			long grace_period, int required_bits, 
+			time_t* stamp_time );
+
+HCEXPORT
+int hashcash_ctx_stamp_check_resource( hashcash_ctx* ctx, 
+				       const hashcash_stamp* prepared, 
+				       int case_flag, const char* resource, 
+				       void **compile, char** re_err, 
+				       int type, time_t now_time, 
+				       long validity_period, 
+				       long grace_period, int required_bits );
+
+HCEXPORT
+int hashcash_ctx_check_batch( hashcash_ctx* ctx, int n, 
+			      const char* const stamps[], int case_flag, 
+			      const char* resource, void **compile, 
+			      char** re_err, int type, time_t now_time, 
+			      long validity_period, long grace_period, 
+			      int required_bits, int results[], 
+			      time_t stamp_times[] );
+
+HCEXPORT
+int hashcash_ctx_resource_match( hashcash_ctx* ctx, int type, 
+				 const char* stamp_res, const char* res, 
+				 void** compile, char** err );
+
+HCEXPORT
+unsigned long hashcash_ctx_per_sec( hashcash_ctx* ctx );
+
+HCEXPORT
+unsigned long hashcash_ctx_effective_per_sec( hashcash_ctx* ctx );
+
+HCEXPORT
+double hashcash_ctx_estimate_time( hashcash_ctx* ctx, int b );
+
+HCEXPORT
+unsigned long hashcash_ctx_benchtest( hashcash_ctx* ctx, int verbose, 
+				      int core );
+
+HCEXPORT
+int hashcash_ctx_core( hashcash_ctx* ctx );
+
+HCEXPORT
+int hashcash_ctx_use_core( hashcash_ctx* ctx, int core );
+
+HCEXPORT
+int hashcash_ctx_use_threads( hashcash_ctx* ctx, int threads );
+
+HCEXPORT
+int hashcash_ctx_use_cpus( hashcash_ctx* ctx, const char* place );
+
+HCEXPORT
+unsigned long hashcash_ctx_place_per_sec( hashcash_ctx* ctx, 
+					  const char* place, int* threads );
+
+HCEXPORT
+int hashcash_ctx_use_duty( hashcash_ctx* ctx, int percent );
+
 
 #if defined( __cplusplus )
 }
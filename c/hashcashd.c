@@ -0,0 +1,1159 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/*  hashcashd: resident hashcash checker and minter, see hashcashd.h
+ *
+ *  one process, one thread: requests from all clients, and the mail
+ *  filter sessions of MTAs, are answered in turn from a poll loop, so
+ *  the database needs no further locking.  Mints, which don't touch
+ *  the database and may take long, are done each in a child process,
+ *  whose reply is taken from a pipe in the same loop.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "sdb.h"
+#include "hashcash.h"
+#include "sstring.h"
+#include "getopt.h"
+#include "array.h"
+#include "hashcashd.h"
+
+#if defined( OPENSSL )
+#include <openssl/sha.h>
+#define SHA1_ctx SHA_CTX
+#define SHA1_Final( x, digest ) SHA1_Final( digest, x )
+#define SHA1_DIGEST_BYTES SHA_DIGEST_LENGTH
+#else
+#include "sha1.h"
+#endif
+
+#define EXIT_ERROR 3
+#define MAX_PERIOD 11		/* max time_t = 10 plus 's' */
+
+#define MAX_CLIENTS 64
+#define MAX_POLICIES 16		/* compiled resource lists kept */
+#define READ_SIZE 65536
+
+/* milter: the sendmail/postfix mail filter protocol, packets of a 4
+ * byte length (network order, counting the command byte), a command
+ * and its data.  Only the recipients and the headers are asked for.
+ */
+
+#define MILTER_VERSION 6
+#define MILTER_MAX_PACKET ( 1024*1024 )
+#define MILTER_MAX_RCPT 100
+#define MILTER_MAX_STAMPS 16
+#define MILTER_HEADER "X-Hashcash-Check"
+
+#define SMFIF_ADDHDRS 0x01	/* actions: may add headers */
+
+#define SMFIP_NOCONNECT 0x01	/* protocol: steps not to send */
+#define SMFIP_NOHELO 0x02
+#define SMFIP_NOMAIL 0x04
+#define SMFIP_NOBODY 0x10
+#define SMFIP_NOUNKNOWN 0x100
+#define SMFIP_NODATA 0x200
+#define MILTER_SKIP ( SMFIP_NOCONNECT | SMFIP_NOHELO | SMFIP_NOMAIL | \
+		      SMFIP_NOBODY | SMFIP_NOUNKNOWN | SMFIP_NODATA )
+
+/* a message in a milter session */
+
+typedef struct {
+    char* rcpt[ MILTER_MAX_RCPT ]; /* envelope recipients, lower case */
+    int rcpts;
+    char* stamp[ MILTER_MAX_STAMPS ];
+    int stamps;
+    int addhdrs;		/* the MTA lets us add headers */
+} MILTER;
+
+/* digests of the stamps in the db, open addressed, all 0 is empty */
+
+typedef struct {
+    unsigned char* slot;
+    long slots;
+    long used;
+} SPENT;
+
+/* a client's resources, compiled once for all clients sending the
+ * same res lines
+ */
+
+typedef struct {
+    char* key;			/* the res lines, NULL if unused */
+    ARRAY resource;
+    hashcash_matcher* matcher;	/* NULL for one resource */
+    char* hits;
+    long used;			/* last use, to pick one to replace */
+} POLICY;
+
+typedef struct {
+    int fd;			/* -1 if free */
+    char* in;
+    long in_len, in_alloc;
+    char* out;
+    long out_len, out_alloc;
+    char* key;			/* res lines so far */
+    long key_len;
+    MILTER* milter;		/* NULL if not a milter session */
+    int closing;		/* close when out is written */
+    pid_t mint_pid;		/* child minting for it, 0 if none */
+    int mint_fd;		/* the child's reply comes on this */
+} CLIENT;
+
+void usage( const char* msg );
+void die( int err );
+void die_msg( const char* str );
+int parse_period( const char* aperiod, long* resp );
+
+/* in sdb.c */
+
+int db_purge( DB* db, ARRAY* purge_resource, int purge_all,
+	      long purge_period, time_t now_time, long validity_period,
+	      long grace_period, int verbose_flag, int* err );
+
+static DB db;
+static SPENT spent;
+static POLICY policy[ MAX_POLICIES ];
+static CLIENT client[ MAX_CLIENTS ];
+static long policy_uses = 0;
+static const unsigned char no_digest[ SHA1_DIGEST_BYTES ];
+int quiet_flag = 0;
+static volatile sig_atomic_t stopping = 0;
+
+/* milter policy, see usage */
+
+static int milter_bits = 20;
+static long milter_validity = 28*TIME_DAY;
+static long milter_grace = 2*TIME_DAY;
+static int milter_reject = 0;
+
+static void on_signal( int sig )
+{
+    stopping = sig;
+}
+
+/* spent index */
+
+static void stamp_digest( const char* stamp, int len,
+			  unsigned char md[ SHA1_DIGEST_BYTES ] )
+{
+    SHA1_ctx ctx;
+
+    SHA1_Init( &ctx );
+    SHA1_Update( &ctx, stamp, len );
+    SHA1_Final( &ctx, md );
+}
+
+/* the slot is picked with the tail of the digest, the head is the
+ * zero bits the stamp was minted for
+ */
+
+static long spent_find( SPENT* s, const unsigned char* md )
+{
+    unsigned long h = 0;
+    unsigned char* e = NULL;
+    int i = 0;
+
+    for ( i = SHA1_DIGEST_BYTES - 8; i < SHA1_DIGEST_BYTES; i++ ) {
+	h = ( h << 8 ) | md[i];
+    }
+    for ( h %= s->slots; ; h = ( h + 1 ) % s->slots ) {
+	e = s->slot + h * SHA1_DIGEST_BYTES;
+	if ( memcmp( e, md, SHA1_DIGEST_BYTES ) == 0 ||
+	     memcmp( e, no_digest, SHA1_DIGEST_BYTES ) == 0 ) {
+	    return h;
+	}
+    }
+}
+
+static int spent_in( SPENT* s, const unsigned char* md )
+{
+    return memcmp( s->slot + spent_find( s, md ) * SHA1_DIGEST_BYTES,
+		   md, SHA1_DIGEST_BYTES ) == 0;
+}
+
+static int spent_init( SPENT* s, long slots )
+{
+    s->slot = calloc( slots, SHA1_DIGEST_BYTES );
+    if ( s->slot == NULL ) { return 0; }
+    s->slots = slots;
+    s->used = 0;
+    return 1;
+}
+
+static int spent_add( SPENT* s, const unsigned char* md )
+{
+    SPENT bigger;
+    unsigned char* e = NULL;
+    long i = 0;
+
+    if ( ( s->used + 1 ) * 2 > s->slots ) { /* keep at most half full */
+	if ( !spent_init( &bigger, s->slots * 2 ) ) { return 0; }
+	for ( i = 0; i < s->slots; i++ ) {
+	    e = s->slot + i * SHA1_DIGEST_BYTES;
+	    if ( memcmp( e, no_digest, SHA1_DIGEST_BYTES ) != 0 ) {
+		spent_add( &bigger, e );
+	    }
+	}
+	free( s->slot );
+	*s = bigger;
+    }
+    e = s->slot + spent_find( s, md ) * SHA1_DIGEST_BYTES;
+    if ( memcmp( e, md, SHA1_DIGEST_BYTES ) != 0 ) {
+	memcpy( e, md, SHA1_DIGEST_BYTES );
+	s->used++;
+    }
+    return 1;
+}
+
+static int spent_vcb_add( const char* key, int klen, const char* val,
+			  int vlen, void* arg, int* err )
+{
+    unsigned char md[ SHA1_DIGEST_BYTES ];
+
+    if ( ( klen == strlen( PURGED_KEY ) &&
+	   strncmp( key, PURGED_KEY, klen ) == 0 ) ||
+	 ( klen == strlen( SHARDS_KEY ) &&
+	   strncmp( key, SHARDS_KEY, klen ) == 0 ) ) {
+	return 0;
+    }
+    stamp_digest( key, klen, md );
+    if ( !spent_add( (SPENT*)arg, md ) ) { *err = ENOMEM; return 1; }
+    return 0;
+}
+
+static void spent_load( void )
+{
+    int err = 0;
+
+    free( spent.slot );
+    if ( !spent_init( &spent, 1024 ) ) { die( ENOMEM ); }
+    hashcash_db_iterate( &db, spent_vcb_add, &spent, &err );
+    if ( err ) { die( err ); }
+}
+
+/* stamps added reach the file by the end of each round of requests,
+ * as they would when a hashcash process exits
+ */
+
+static void db_flush( void )
+{
+    int i = 0;
+
+    if ( db.file ) { fflush( db.file ); }
+    for ( i = 0; i < db.shards; i++ ) {
+	if ( db.shard[i].file ) { fflush( db.shard[i].file ); }
+    }
+}
+
+/* compiled resource lists */
+
+static void policy_free( POLICY* p )
+{
+    int i = 0;
+
+    for ( i = 0; i < array_num( &p->resource ); i++ ) {
+	free( p->resource.elt[i].str );
+	hashcash_free( p->resource.elt[i].regexp );
+    }
+    free( p->resource.elt );
+    if ( p->matcher ) { hashcash_matcher_free( p->matcher ); }
+    free( p->hits );
+    free( p->key );
+    memset( p, 0, sizeof( POLICY ) );
+}
+
+static int policy_compile( POLICY* p, const char* key )
+{
+    const char* line = key, *eol = NULL;
+    char res[ MAX_RES+1 ];
+    int type, case_flag, over, bits, n = 0, i = 0, len = 0;
+    long validity, grace;
+    ELEMENT* ent = NULL;
+
+    p->key = strdup( key );
+    if ( p->key == NULL ) { return 0; }
+    array_alloc( &p->resource, 4 );
+    for ( ; *line; line = *eol ? eol + 1 : eol ) {
+	eol = strchr( line, '\n' );
+	if ( eol == NULL ) { eol = line + strlen( line ); }
+	res[0] = '\0';
+	/* %n before any space, which would eat the newline of an empty
+	   resource */
+	if ( sscanf( line, "%d %d %d %d %ld %ld%n", &type, &case_flag,
+		     &over, &bits, &validity, &grace, &n ) < 6 ||
+	     line + n > eol ) {
+	    return 0;
+	}
+	if ( line[n] == ' ' ) { n++; }
+	len = eol - ( line + n );
+	if ( len > 0 ) {
+	    sstrncpy( res, line + n, len < MAX_RES ? len : MAX_RES );
+	}
+	array_push( &p->resource, res[0] ? res : NULL, type, case_flag,
+		    validity, grace, 0, 0, bits, over );
+    }
+    if ( array_num( &p->resource ) == 0 ) {
+	array_push( &p->resource, NULL, TYPE_WILD, 0, 0, 0, 0, 0, 0, 0 );
+    }
+    for ( i = 0; i < array_num( &p->resource ); i++ ) {
+	ent = &p->resource.elt[i];
+	if ( ent->str && !ent->case_flag ) { stolower( ent->str ); }
+    }
+
+    /* with several resources find all a stamp matches in one go */
+    if ( array_num( &p->resource ) > 1 ) {
+	p->matcher = hashcash_matcher_new();
+	for ( i = 0; p->matcher && i < array_num( &p->resource ); i++ ) {
+	    ent = &p->resource.elt[i];
+	    if ( ent->str == NULL ||
+		 !hashcash_matcher_add( p->matcher, ent->type,
+					ent->case_flag, ent->str ) ) {
+		hashcash_matcher_free( p->matcher );
+		p->matcher = NULL;
+	    }
+	}
+	p->hits = malloc( array_num( &p->resource ) );
+	if ( p->hits == NULL ) { return 0; }
+    }
+    return 1;
+}
+
+static POLICY* policy_get( const char* key )
+{
+    POLICY* p = &policy[0];
+    int i = 0;
+
+    for ( i = 0; i < MAX_POLICIES; i++ ) {
+	if ( policy[i].key && strcmp( policy[i].key, key ) == 0 ) {
+	    policy[i].used = ++policy_uses;
+	    return &policy[i];
+	}
+	if ( policy[i].used < p->used ) { p = &policy[i]; }
+    }
+    policy_free( p );
+    if ( !policy_compile( p, key ) ) { policy_free( p ); return NULL; }
+    p->used = ++policy_uses;
+    return p;
+}
+
+/* what hashcash -c would decide for stamp against resources p */
+
+static long policy_check( POLICY* p, const char* stamp, time_t now_time,
+			  char** re_err )
+{
+    hashcash_stamp prepared;
+    ELEMENT* ent = NULL;
+    long valid_for = HASHCASH_INVALID;
+    int i = 0, over = 0, matched = 0;
+
+    if ( hashcash_stamp_prepare( &prepared, stamp ) != HASHCASH_OK ) {
+	return prepared.status;
+    }
+    matched = p->matcher &&
+	hashcash_matcher_match( p->matcher, prepared.res,
+				prepared.lower_res, p->hits, re_err ) >= 0;
+
+    for ( i = 0; i < array_num( &p->resource ); i++ ) {
+	ent = &p->resource.elt[i];
+	if ( over && ent->over ) { continue; }
+	over = 0;
+	if ( matched && !p->hits[i] ) {
+	    valid_for = HASHCASH_WRONG_RESOURCE;
+	} else {
+	    valid_for = hashcash_stamp_check_resource(
+		&prepared, ent->case_flag, matched ? NULL : ent->str,
+		&ent->regexp, re_err, ent->type, now_time, ent->validity,
+		ent->grace, ent->bits );
+	}
+	switch ( valid_for ) {
+	case HASHCASH_INSUFFICIENT_BITS:
+	case HASHCASH_VALID_IN_FUTURE:
+	case HASHCASH_EXPIRED:
+	    over = 1;
+	    break;
+	case HASHCASH_WRONG_RESOURCE:
+	    break;
+	default:
+	    return valid_for;	/* valid, or no use trying others */
+	}
+    }
+    return valid_for;
+}
+
+/* requests */
+
+static void reply_data( CLIENT* c, const char* data, long len )
+{
+    char* more = NULL;
+    long need = c->out_len + len;
+
+    if ( need > c->out_alloc ) {
+	more = realloc( c->out, need );
+	if ( more == NULL ) { c->closing = 1; return; }
+	c->out = more;
+	c->out_alloc = need;
+    }
+    memcpy( c->out + c->out_len, data, len );
+    c->out_len += len;
+}
+
+static void reply( CLIENT* c, const char* line )
+{
+    reply_data( c, line, strlen( line ) );
+    reply_data( c, "\n", 1 );
+}
+
+static void reply_code( CLIENT* c, const char* what, long code )
+{
+    char line[ 64 ];
+
+    sprintf( line, "%s %ld", what, code );
+    reply( c, line );
+}
+
+static void do_res( CLIENT* c, const char* args )
+{
+    long len = strlen( args );
+    char* more = realloc( c->key, c->key_len + len + 2 );
+
+    if ( more == NULL ) { reply_code( c, "fail", ENOMEM ); return; }
+    c->key = more;
+    memcpy( c->key + c->key_len, args, len );
+    c->key_len += len;
+    c->key[ c->key_len++ ] = '\n';
+    c->key[ c->key_len ] = '\0';
+    reply( c, "ok" );
+}
+
+static void do_check( CLIENT* c, char* args )
+{
+    unsigned char md[ SHA1_DIGEST_BYTES ];
+    char mode = 'n', period[ MAX_UTC+1 ] = {0};
+    char line[ MAX_RES+32 ];
+    char* stamp = NULL, *re_err = NULL;
+    POLICY* p = NULL;
+    long valid_for = 0;
+    int n = 0, err = 0;
+
+    if ( sscanf( args, "%c %13s %n", &mode, period, &n ) < 2 ) {
+	reply_code( c, "fail", HASHCASH_INVALID ); return;
+    }
+    stamp = args + n;
+    p = policy_get( c->key ? c->key : "" );
+    if ( p == NULL ) { reply_code( c, "fail", HASHCASH_OUT_OF_MEMORY ); return; }
+    valid_for = policy_check( p, stamp, time( 0 ), &re_err );
+    if ( valid_for == HASHCASH_REGEXP_ERROR ) {
+	sprintf( line, "fail %ld ", valid_for );
+	sstrncpy( line + strlen( line ), re_err ? re_err : "", MAX_RES );
+	reply( c, line );
+	return;
+    }
+    if ( valid_for < 0 ) { reply_code( c, "fail", valid_for ); return; }
+    if ( mode != 'n' ) {
+	stamp_digest( stamp, strlen( stamp ), md );
+	if ( spent_in( &spent, md ) ) { reply( c, "spent" ); return; }
+	if ( mode == 'a' ) {
+	    if ( !hashcash_db_add( &db, stamp, period, &err ) ) { die( err ); }
+	    if ( !spent_add( &spent, md ) ) { die( ENOMEM ); }
+	}
+    }
+    reply_code( c, "ok", valid_for );
+}
+
+/* the child writes its reply line to fd in one go and exits; the
+ * client's later requests wait for it, so replies stay in order
+ */
+
+static void do_mint( CLIENT* c, char* args )
+{
+    char* stamp = NULL, *line = NULL;
+    double tries = 0;
+    int bits = 0, width = 0, n = 0, ret = 0, fds[2];
+
+    if ( sscanf( args, "%d %d %n", &bits, &width, &n ) < 2 ) {
+	reply_code( c, "fail", HASHCASH_INVALID ); return;
+    }
+    if ( pipe( fds ) != 0 ) { reply_code( c, "fail", errno ); return; }
+    db_flush();			/* nothing buffered for the child to copy */
+    c->mint_pid = fork();
+    if ( c->mint_pid < 0 ) {
+	c->mint_pid = 0;
+	close( fds[0] ); close( fds[1] );
+	reply_code( c, "fail", errno );
+	return;
+    }
+    if ( c->mint_pid == 0 ) {
+	close( fds[0] );
+	signal( SIGINT, SIG_DFL ); signal( SIGTERM, SIG_DFL );
+	signal( SIGHUP, SIG_DFL );
+	ret = hashcash_mint( time( 0 ), width, args + n, bits, 0, &stamp,
+			     NULL, &tries, NULL, 0, NULL, NULL );
+	line = malloc( ret == HASHCASH_OK ? strlen( stamp ) + 5 : 64 );
+	if ( line == NULL ) { _exit( EXIT_ERROR ); }
+	if ( ret == HASHCASH_OK ) { sprintf( line, "ok %s\n", stamp ); }
+	else { sprintf( line, "fail %d\n", ret ); }
+	while ( write( fds[1], line, strlen( line ) ) < 0 && 
+		errno == EINTR ) { }
+	_exit( 0 );
+    }
+    close( fds[1] );
+    c->mint_fd = fds[0];
+}
+
+/* take the reply of the child minting for c */
+
+static void mint_done( CLIENT* c )
+{
+    char line[ MAX_TOK+64 ];
+    long got = 0;
+
+    do {
+	got = read( c->mint_fd, line, sizeof( line ) );
+    } while ( got < 0 && errno == EINTR );
+    if ( got > 0 ) { reply_data( c, line, got ); }
+    else { reply_code( c, "fail", HASHCASH_INTERNAL_ERROR ); }
+    close( c->mint_fd );
+    while ( waitpid( c->mint_pid, NULL, 0 ) < 0 && errno == EINTR ) { }
+    c->mint_pid = 0;
+}
+
+static void mint_kill( CLIENT* c )
+{
+    if ( c->mint_pid == 0 ) { return; }
+    kill( c->mint_pid, SIGKILL );
+    close( c->mint_fd );
+    while ( waitpid( c->mint_pid, NULL, 0 ) < 0 && errno == EINTR ) { }
+    c->mint_pid = 0;
+}
+
+static void do_purge( CLIENT* c, char* args )
+{
+    ARRAY none;
+    long period = 0, validity = 0, grace = 0;
+    int err = 0, ret = 0;
+
+    if ( sscanf( args, "%ld %ld %ld", &period, &validity, &grace ) < 3 ) {
+	reply_code( c, "fail", EINPUT ); return;
+    }
+    array_alloc( &none, 1 );
+    ret = db_purge( &db, &none, 0, period, time( 0 ), validity, grace, 0,
+		    &err );
+    free( none.elt );
+    if ( ret != HASHCASH_OK ) {
+	reply_code( c, "fail", err ? err : ret ); return;
+    }
+    spent_load();		/* forget the stamps purged */
+    reply( c, "ok" );
+}
+
+static void do_request( CLIENT* c, char* line )
+{
+    char* args = strchr( line, ' ' );
+
+    if ( args ) { *args++ = '\0'; } else { args = line + strlen( line ); }
+    if ( strcmp( line, "check" ) == 0 ) { do_check( c, args ); }
+    else if ( strcmp( line, "res" ) == 0 ) { do_res( c, args ); }
+    else if ( strcmp( line, "reset" ) == 0 ) {
+	free( c->key );
+	c->key = NULL; c->key_len = 0;
+	reply( c, "ok" );
+    }
+    else if ( strcmp( line, "mint" ) == 0 ) { do_mint( c, args ); }
+    else if ( strcmp( line, "purge" ) == 0 ) { do_purge( c, args ); }
+    else if ( strcmp( line, "quit" ) == 0 ) { c->closing = 1; }
+    else { reply_code( c, "fail", EINPUT ); }
+}
+
+/* milter sessions */
+
+static void milter_reset( MILTER* m )
+{
+    int i = 0;
+
+    for ( i = 0; i < m->rcpts; i++ ) { free( m->rcpt[i] ); }
+    for ( i = 0; i < m->stamps; i++ ) { free( m->stamp[i] ); }
+    m->rcpts = m->stamps = 0;
+}
+
+static void milter_reply( CLIENT* c, int cmd, const char* data, long len )
+{
+    unsigned char head[5];
+    unsigned long n = len + 1;
+
+    head[0] = ( n >> 24 ) & 0xff; head[1] = ( n >> 16 ) & 0xff;
+    head[2] = ( n >> 8 ) & 0xff; head[3] = n & 0xff;
+    head[4] = cmd;
+    reply_data( c, (char*)head, 5 );
+    if ( len > 0 ) { reply_data( c, data, len ); }
+}
+
+static unsigned long milter_uint( const char* p )
+{
+    const unsigned char* u = (const unsigned char*)p;
+
+    return ( (unsigned long)u[0] << 24 ) | ( (unsigned long)u[1] << 16 ) |
+	( (unsigned long)u[2] << 8 ) | u[3];
+}
+
+/* take what we do from what the MTA offers */
+
+static void milter_optneg( CLIENT* c, const char* data, long len )
+{
+    char opt[12];
+    unsigned long version = 0, actions = 0, protocol = 0;
+    int i = 0;
+
+    if ( len < 12 ) { c->closing = 1; return; }
+    version = milter_uint( data );
+    actions = milter_uint( data + 4 ) & SMFIF_ADDHDRS;
+    c->milter->addhdrs = actions != 0;
+    protocol = milter_uint( data + 8 ) & MILTER_SKIP;
+    if ( version < 2 ) { c->closing = 1; return; }
+    if ( version > MILTER_VERSION ) { version = MILTER_VERSION; }
+    for ( i = 0; i < 4; i++ ) {
+	opt[i] = ( version >> ( 24 - 8*i ) ) & 0xff;
+	opt[4+i] = ( actions >> ( 24 - 8*i ) ) & 0xff;
+	opt[8+i] = ( protocol >> ( 24 - 8*i ) ) & 0xff;
+    }
+    milter_reply( c, 'O', opt, 12 );
+}
+
+static void milter_rcpt( MILTER* m, const char* addr, long len )
+{
+    char* rcpt = NULL;
+    long n = strlen( addr );
+
+    if ( n >= len ) { return; }
+    if ( addr[0] == '<' ) { addr++; n--; }
+    if ( n > 0 && addr[ n-1 ] == '>' ) { n--; }
+    if ( m->rcpts == MILTER_MAX_RCPT || n == 0 || n > MAX_RES ) { return; }
+    rcpt = malloc( n + 1 );
+    if ( rcpt == NULL ) { return; }
+    sstrncpy( rcpt, addr, n );
+    stolower( rcpt );
+    m->rcpt[ m->rcpts++ ] = rcpt;
+}
+
+/* a stamp header's value, unfolded as -X would read it */
+
+static void milter_header( MILTER* m, const char* data, long len )
+{
+    const char* name = data, *value = NULL;
+    char* stamp = NULL, *p = NULL;
+
+    if ( (long)strlen( name ) + 1 >= len ) { return; }
+    if ( strcasecmp( name, "X-Hashcash" ) != 0 && 
+	 strcasecmp( name, "Hashcash" ) != 0 ) {
+	return;
+    }
+    if ( m->stamps == MILTER_MAX_STAMPS ) { return; }
+    value = name + strlen( name ) + 1;
+    stamp = malloc( MAX_TOK + 1 );
+    if ( stamp == NULL ) { return; }
+    while ( isspace( (unsigned char)*value ) ) { value++; }
+    for ( p = stamp; *value && p < stamp + MAX_TOK; value++ ) {
+	if ( *value == '\r' ) { continue; }
+	if ( *value == '\n' ) {
+	    if ( value[1] == ' ' || value[1] == '\t' ) { value++; }
+	    continue;
+	}
+	*p++ = *value;
+    }
+    while ( p > stamp && isspace( (unsigned char)p[-1] ) ) { p--; }
+    *p = '\0';
+    m->stamp[ m->stamps++ ] = stamp;
+}
+
+/* each recipient wants a stamp for it, valid and not spent; the
+ * stamps that pay are recorded as spent, once the message is taken
+ */
+
+static void milter_eom( CLIENT* c, MILTER* m )
+{
+    unsigned char md[ MILTER_MAX_STAMPS ][ SHA1_DIGEST_BYTES ];
+    char result[ 64 ], period[ MAX_UTC+1 ];
+    char* spend[ MILTER_MAX_STAMPS ], *periods[ MILTER_MAX_STAMPS ];
+    hashcash_stamp prepared;
+    int paid[ MILTER_MAX_RCPT ], pays[ MILTER_MAX_STAMPS ];
+    int i = 0, j = 0, r = 0, ok = 0, err = 0, n = 0, spends = 0;
+    char* re_err = NULL;
+    const char* what = NULL;
+    time_t now_time = time( 0 );
+
+    sprintf( period, "%ld", milter_validity );
+    for ( r = 0; r < m->rcpts; r++ ) { paid[r] = 0; }
+    for ( i = 0; i < m->stamps; i++ ) {
+	pays[i] = 0;
+	if ( hashcash_stamp_prepare( &prepared, m->stamp[i] ) != 
+	     HASHCASH_OK ) {
+	    continue;
+	}
+	stamp_digest( m->stamp[i], strlen( m->stamp[i] ), md[i] );
+	if ( spent_in( &spent, md[i] ) ) { continue; }
+	for ( j = 0; j < i; j++ ) {	/* the same stamp twice */
+	    if ( pays[j] && memcmp( md[j], md[i], SHA1_DIGEST_BYTES ) == 0 ) {
+		break;
+	    }
+	}
+	if ( j < i ) { continue; }
+	for ( r = 0; r < m->rcpts; r++ ) {
+	    if ( paid[r] || hashcash_stamp_check_resource( 
+		     &prepared, 0, m->rcpt[r], NULL, &re_err, TYPE_STR, 
+		     now_time, milter_validity, milter_grace, 
+		     milter_bits ) < 0 ) {
+		continue;
+	    }
+	    paid[r] = 1;
+	    pays[i] = 1;
+	    ok++;
+	    break;
+	}
+    }
+
+    /* rejected, the sender may send it again paid for in full */
+    if ( milter_reject && ok < m->rcpts ) {
+	milter_reply( c, 'y', "550 5.7.1 hashcash stamp required", 
+		      strlen( "550 5.7.1 hashcash stamp required" ) + 1 );
+	milter_reset( m );
+	return;
+    }
+    /* a message to a list spends a stamp a recipient: one commit */
+    for ( i = 0; i < m->stamps; i++ ) {
+	if ( !pays[i] ) { continue; }
+	spend[ spends ] = m->stamp[i];
+	periods[ spends++ ] = period;
+	if ( !spent_add( &spent, md[i] ) ) { die( ENOMEM ); }
+    }
+    if ( !hashcash_db_add_batch( &db, spend, periods, spends, NULL, &err ) ) {
+	die( err );
+    }
+    what = m->stamps == 0 ? "none" : ok == 0 ? "fail" :
+	ok < m->rcpts ? "partial" : "pass";
+    if ( m->addhdrs ) {
+	/* name\0value\0 */
+	n = sprintf( result, "%s", MILTER_HEADER ) + 1;
+	n += sprintf( result + n, "%s %d/%d", what, ok, m->rcpts ) + 1;
+	milter_reply( c, 'h', result, n );
+    }
+    milter_reply( c, 'c', NULL, 0 );
+    milter_reset( m );
+}
+
+static void milter_packet( CLIENT* c, int cmd, const char* data, long len )
+{
+    MILTER* m = c->milter;
+
+    switch ( cmd ) {
+    case 'O': milter_optneg( c, data, len ); break;
+    case 'D': break;		/* macros, no reply */
+    case 'R':
+	milter_rcpt( m, data, len );
+	milter_reply( c, 'c', NULL, 0 );
+	break;
+    case 'L':
+	milter_header( m, data, len );
+	milter_reply( c, 'c', NULL, 0 );
+	break;
+    case 'E': milter_eom( c, m ); break;
+    case 'A': milter_reset( m ); break; /* abort message, no reply */
+    case 'K': milter_reset( m ); break; /* new connection, no reply */
+    case 'Q': c->closing = 1; break;
+    default:			/* connect, helo, mail, eoh, body, ... */
+	milter_reply( c, 'c', NULL, 0 );
+	break;
+    }
+}
+
+/* answer the complete packets read */
+
+static void milter_read( CLIENT* c )
+{
+    unsigned long len = 0;
+    long pos = 0;
+    char save = 0;
+
+    while ( !c->closing && c->in_len - pos >= 5 ) {
+	len = milter_uint( c->in + pos );
+	if ( len == 0 || len > MILTER_MAX_PACKET ) { c->closing = 1; break; }
+	if ( c->in_len - pos < 4 + (long)len ) { break; }
+	/* \0 terminate the data for the string commands; there is
+	 * room past the end of input, see client_read
+	 */
+	save = c->in[ pos + 4 + len ];
+	c->in[ pos + 4 + len ] = '\0';
+	milter_packet( c, c->in[ pos + 4 ], c->in + pos + 5, len - 1 );
+	c->in[ pos + 4 + len ] = save;
+	pos += 4 + len;
+    }
+    memmove( c->in, c->in + pos, c->in_len - pos );
+    c->in_len -= pos;
+}
+
+/* clients */
+
+static void client_close( CLIENT* c )
+{
+    mint_kill( c );
+    close( c->fd );
+    free( c->in );
+    free( c->out );
+    free( c->key );
+    if ( c->milter ) { milter_reset( c->milter ); free( c->milter ); }
+    memset( c, 0, sizeof( CLIENT ) );
+    c->fd = -1;
+}
+
+static void client_accept( int sock, int milter )
+{
+    char path[ PATH_MAX+1 ] = {0};
+    char line[ PATH_MAX+64 ];
+    CLIENT* c = NULL;
+    int fd = 0, i = 0;
+
+    fd = accept( sock, NULL, NULL );
+    if ( fd < 0 ) { return; }
+    for ( i = 0; i < MAX_CLIENTS && client[i].fd >= 0; i++ ) {}
+    if ( i == MAX_CLIENTS ) { close( fd ); return; }
+    fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+    c = &client[i];
+    c->fd = fd;
+    if ( milter ) {
+	c->milter = calloc( 1, sizeof( MILTER ) );
+	if ( c->milter == NULL ) { client_close( c ); }
+	return;
+    }
+    if ( realpath( db.filename, path ) == NULL ) {
+	sstrncpy( path, db.filename, PATH_MAX );
+    }
+    sprintf( line, "%s %s %s", HASHCASHD_GREETING, HASHCASH_VERSION_STRING,
+	     path );
+    reply( c, line );
+}
+
+/* answer the complete lines read, up to a mint */
+
+static void client_lines( CLIENT* c )
+{
+    char* line = NULL, *eol = NULL;
+    long done = 0;
+
+    for ( line = c->in; !c->closing && !c->mint_pid &&
+	      ( eol = (char*)smemchr( line, c->in + c->in_len, '\n' ) );
+	  line = eol + 1 ) {
+	*eol = '\0';
+	if ( eol > line && eol[-1] == '\r' ) { eol[-1] = '\0'; }
+	do_request( c, line );
+    }
+    done = line - c->in;
+    memmove( c->in, line, c->in_len - done );
+    c->in_len -= done;
+    if ( c->in_len > HASHCASHD_MAX_LINE && !c->mint_pid ) { c->closing = 1; }
+}
+
+/* answer the complete lines (or milter packets) read */
+
+static void client_read( CLIENT* c )
+{
+    char* more = NULL;
+    long got = 0;
+
+    if ( c->in_alloc - c->in_len < READ_SIZE + 1 ) {
+	more = realloc( c->in, c->in_len + READ_SIZE + 1 );
+	if ( more == NULL ) { client_close( c ); return; }
+	c->in = more;
+	c->in_alloc = c->in_len + READ_SIZE + 1;
+    }
+    got = read( c->fd, c->in + c->in_len, READ_SIZE );
+    if ( got < 0 && ( errno == EINTR || errno == EAGAIN ) ) { return; }
+    if ( got <= 0 ) { client_close( c ); return; }
+    c->in_len += got;
+    if ( c->milter ) { 
+	milter_read( c ); 
+	if ( c->in_len > MILTER_MAX_PACKET + 4 ) { c->closing = 1; }
+	return; 
+    }
+    client_lines( c );
+}
+
+static void client_write( CLIENT* c )
+{
+    long put = 0;
+
+    if ( c->out_len > 0 ) {
+	put = write( c->fd, c->out, c->out_len );
+	if ( put < 0 && ( errno == EINTR || errno == EAGAIN ) ) { return; }
+	if ( put < 0 ) { client_close( c ); return; }
+	memmove( c->out, c->out + put, c->out_len - put );
+	c->out_len -= put;
+    }
+    if ( c->out_len == 0 && c->closing ) { client_close( c ); }
+}
+
+static int listen_on( const char* path )
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int sock = 0;
+
+    if ( strlen( path ) >= sizeof( addr.sun_path ) ) {
+	die_msg( "error: socket path too long" );
+    }
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    strcpy( addr.sun_path, path );
+
+    sock = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( sock < 0 ) { die( errno ); }
+
+    /* a socket left by a daemon that has gone can be replaced */
+    if ( lstat( path, &st ) == 0 && S_ISSOCK( st.st_mode ) ) {
+	if ( connect( sock, (struct sockaddr*)&addr, sizeof( addr ) ) == 0 ) {
+	    die_msg( "error: a hashcashd is already listening there" );
+	}
+	unlink( path );
+    }
+    if ( bind( sock, (struct sockaddr*)&addr, sizeof( addr ) ) != 0 ||
+	 listen( sock, 16 ) != 0 ) {
+	die( errno );
+    }
+    return sock;
+}
+
+int main( int argc, char* argv[] )
+{
+    struct pollfd fds[ 2*MAX_CLIENTS+2 ];
+    const char* db_filename = "hashcash.sdb";
+    const char* path = getenv( HASHCASHD_ENV ), *milter_path = NULL;
+    long sync_interval = 0;
+    int sync_mode = SDB_SYNC_NONE, shards = 0;
+    int opt = 0, err = 0, sock = -1, milter_sock = -1, i = 0, n = 0;
+    char* junk = NULL;
+
+    opterr = 0;
+    while ( (opt=getopt( argc, argv, "b:D:e:f:g:hm:N:qRs:" )) > 0 ) {
+	switch ( opt ) {
+	case 'b':
+	    milter_bits = strtol( optarg, &junk, 10 );
+	    if ( *junk != '\0' || milter_bits < 0 || 
+		 milter_bits > SHA1_DIGEST_BYTES*8 ) {
+		usage( "error: -b invalid number of bits" );
+	    }
+	    break;
+	case 'D':
+	    if ( strcmp( optarg, "none" ) == 0 ) {
+		sync_mode = SDB_SYNC_NONE;
+	    } else if ( strcmp( optarg, "batch" ) == 0 ) {
+		sync_mode = SDB_SYNC_BATCH;
+	    } else if ( parse_period( optarg, &sync_interval ) &&
+			sync_interval >= 0 ) {
+		sync_mode = SDB_SYNC_INTERVAL;
+	    } else {
+		usage( "error: -D invalid durability mode" );
+	    }
+	    break;
+	case 'e':
+	    if ( !parse_period( optarg, &milter_validity ) ||
+		 milter_validity < 0 ) {
+		usage( "error: -e invalid validity period" );
+	    }
+	    break;
+	case 'f': db_filename = optarg; break;
+	case 'g':
+	    if ( !parse_period( optarg, &milter_grace ) ||
+		 milter_grace < 0 ) {
+		usage( "error: -g invalid grace period" );
+	    }
+	    break;
+	case 'h': usage( "" ); break;
+	case 'm': milter_path = optarg; break;
+	case 'N':
+	    shards = strtol( optarg, &junk, 10 );
+	    if ( *junk != '\0' || shards < 0 || shards > MAX_SHARDS ) {
+		usage( "error: -N invalid number of shards" );
+	    }
+	    break;
+	case 'q': quiet_flag = 1; break;
+	case 'R': milter_reject = 1; break;
+	case 's': path = optarg; break;
+	default: usage( "error with argument processing" ); break;
+	}
+    }
+    if ( path != NULL && path[0] == '\0' ) { path = NULL; }
+    if ( path == NULL && milter_path == NULL ) {
+	usage( "error: no socket, use -s or -m or set " HASHCASHD_ENV );
+    }
+
+    if ( !hashcash_db_open_sharded( &db, db_filename, shards, &err ) ) {
+	if ( err == EINPUT ) {
+	    die_msg( "error: database exists with a different -N" );
+	}
+	die( err );
+    }
+    if ( !hashcash_db_durability( &db, sync_mode, sync_interval, &err ) ) {
+	die( err );
+    }
+    spent_load();
+    for ( i = 0; i < MAX_CLIENTS; i++ ) { client[i].fd = -1; }
+
+    if ( path ) { sock = listen_on( path ); }
+    if ( milter_path ) { milter_sock = listen_on( milter_path ); }
+    signal( SIGPIPE, SIG_IGN );
+    signal( SIGINT, on_signal );
+    signal( SIGTERM, on_signal );
+    signal( SIGHUP, on_signal );
+
+    while ( !stopping ) {
+	fds[0].fd = sock;	/* ignored by poll if -1 */
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	for ( i = 0; i < MAX_CLIENTS; i++ ) {
+	    fds[i+1].fd = client[i].fd;
+	    /* a client's requests after a mint wait for it */
+	    fds[i+1].events = client[i].closing || client[i].mint_pid ?
+		0 : POLLIN;
+	    if ( client[i].out_len > 0 || client[i].closing ) {
+		fds[i+1].events |= POLLOUT;
+	    }
+	    fds[i+1].revents = 0;
+	    fds[MAX_CLIENTS+2+i].fd = client[i].fd >= 0 && 
+		client[i].mint_pid ? client[i].mint_fd : -1;
+	    fds[MAX_CLIENTS+2+i].events = POLLIN;
+	    fds[MAX_CLIENTS+2+i].revents = 0;
+	}
+	fds[MAX_CLIENTS+1].fd = milter_sock;
+	fds[MAX_CLIENTS+1].events = POLLIN;
+	fds[MAX_CLIENTS+1].revents = 0;
+	n = poll( fds, 2*MAX_CLIENTS+2, -1 );
+	if ( n < 0 ) {
+	    if ( errno == EINTR ) { continue; }
+	    die( errno );
+	}
+	for ( i = 0; i < MAX_CLIENTS; i++ ) {
+	    if ( client[i].fd >= 0 && fds[i+1].fd == client[i].fd &&
+		 ( fds[i+1].revents & ( POLLIN | POLLHUP | POLLERR ) ) ) {
+		client_read( &client[i] );
+	    }
+	    if ( client[i].fd >= 0 && client[i].mint_pid &&
+		 fds[MAX_CLIENTS+2+i].fd == client[i].mint_fd &&
+		 ( fds[MAX_CLIENTS+2+i].revents & 
+		   ( POLLIN | POLLHUP | POLLERR ) ) ) {
+		mint_done( &client[i] );
+		client_lines( &client[i] );
+	    }
+	}
+	db_flush();		/* before replying */
+	for ( i = 0; i < MAX_CLIENTS; i++ ) {
+	    if ( client[i].fd >= 0 ) { client_write( &client[i] ); }
+	}
+	if ( fds[0].revents & POLLIN ) { client_accept( sock, 0 ); }
+	if ( fds[MAX_CLIENTS+1].revents & POLLIN ) {
+	    client_accept( milter_sock, 1 );
+	}
+    }
+
+    for ( i = 0; i < MAX_CLIENTS; i++ ) { mint_kill( &client[i] ); }
+    if ( path ) { close( sock ); unlink( path ); }
+    if ( milter_path ) { close( milter_sock ); unlink( milter_path ); }
+    if ( !hashcash_db_close( &db, &err ) ) { die( err ); }
+    exit( EXIT_SUCCESS );
+    return 0;
+}
+
+void usage( const char* msg )
+{
+    if ( msg && msg[0] ) { fputs( msg, stderr ); fputc( '\n', stderr ); }
+    fprintf( stderr, "Usage: hashcashd [-q] [-s socket] [-m socket [-b bits] [-e period] [-g period] [-R]]\n\t\t [-f dbname] [-N n] [-D mode]\n" );
+    fprintf( stderr, "\t-s socket\tlisten on socket (default $" HASHCASHD_ENV ")\n" );
+    fprintf( stderr, "\t-m socket\tlisten for MTA mail filter (milter) connections\n" );
+    fprintf( stderr, "\t-b bits\t\tmilter: bits a stamp must have (default 20)\n" );
+    fprintf( stderr, "\t-e period\tmilter: stamps valid for period (default 28d)\n" );
+    fprintf( stderr, "\t-g period\tmilter: grace period for clock skew (default 2d)\n" );
+    fprintf( stderr, "\t-R\t\tmilter: reject mail not paid for every recipient\n" );
+    fprintf( stderr, "\t-f dbname\tuse database dbname (default hashcash.sdb)\n" );
+    fprintf( stderr, "\t-N n\t\tcreate the database split over n shards\n" );
+    fprintf( stderr, "\t-D mode\t\tdatabase durability: none, batch or period\n" );
+    fprintf( stderr, "\t-q\t\tquiet\n" );
+    exit( EXIT_ERROR );
+}
+
+void die( int err )
+{
+    const char* str = "";
+
+    switch ( err ) {
+    case EOK:
+	exit( EXIT_SUCCESS );
+	break;
+    case EINPUT:
+	str = "invalid inputs";
+	break;
+    default:
+	str = strerror( err );
+	break;
+    }
+    QPRINTF( stderr, "hashcashd: error: %s\n", str );
+    exit( EXIT_ERROR );
+}
+
+void die_msg( const char* str )
+{
+    QPRINTF( stderr, "hashcashd: %s\n", str );
+    exit( EXIT_ERROR );
+}
+
+int parse_period( const char* aperiod, long* resp )
+{
+    int period_len;
+    char last_char;
+    long res = 1;
+    char period_array[MAX_PERIOD+1];
+    char* period = period_array;
+
+    if ( period == NULL ) { return 0; }
+    period_len = strlen( aperiod );
+    if ( period_len == 0 ) { return 0; }
+    last_char = aperiod[period_len-1];
+    if ( ! isdigit( last_char ) && ! strchr( "YyMdhmsw", last_char ) ) {
+	return 0;
+    }
+
+    sstrncpy( period, aperiod, MAX_PERIOD );
+
+    if ( ! isdigit( last_char ) ) { period[--period_len] = '\0'; }
+    if ( period[0] == '+' || period[0] == '-' ) {
+	if ( period[0] == '-' ) { res = -1; }
+	period++; period_len--;
+    }
+    if ( period_len > 0 ) { res *= atoi( period ); }
+    switch ( last_char )
+    {
+    case 's': break;
+    case 'm': res *= TIME_MINUTE; break;
+    case 'h': res *= TIME_HOUR; break;
+    case 'd': res *= TIME_DAY; break;
+    case 'w': res *= TIME_DAY*7; break;
+    case 'M': res *= TIME_MONTH; break;
+    case 'y': case 'Y': res *= TIME_YEAR; break;
+    case '0': case '1': case '2': case '3': case '4': 
+    case '5': case '6': case '7': case '8': case '9': break;
+    default: return 0;
+    }
+    *resp = res;
+    return 1;
+}
@@ -0,0 +1,51 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+#if !defined( _hashcashd_h )
+#define _hashcashd_h
+
+/* hashcashd: resident stamp checker and minter
+ *
+ * hashcashd listens on a UNIX domain socket and keeps between
+ * requests what each hashcash process would otherwise set up again:
+ * the open spent stamp database with an in memory index of the stamps
+ * in it, compiled resource matchers and the tuned minting core.  It
+ * holds the database lock while it runs, so the database should only
+ * be used through it.  With HASHCASH_SOCKET set, hashcash hands checks
+ * (-c with -q), mints and plain purges to the daemon, and does them
+ * itself if it can't connect.
+ *
+ * The protocol is lines of text, one reply line per request line,
+ * replies in request order, so a client can send several requests
+ * before reading the replies.  On connecting the daemon sends
+ *
+ *   hashcashd <version> <database path>
+ *
+ * then requests are:
+ *
+ *   res <type> <case> <over> <bits> <validity> <grace> [resource]
+ *	add a resource to check against, fields as for -r with its
+ *	preceding options (type is TYPE_*, bits 0 for don't check);
+ *	no resource means don't check the resource.  Reply: ok
+ *   reset
+ *	forget the resources.  Reply: ok
+ *   check <db> <period> <stamp>
+ *	check the stamp against the resources; db is n (no database),
+ *	d (fail if spent) or a (and add it with period if not).
+ *	Reply: ok <valid_for>, spent, or fail <code> [regexp error]
+ *   mint <bits> <width> <resource>
+ *	Reply: ok <stamp> or fail <code>
+ *   purge <period> <validity> <grace>
+ *	as -p period (-e validity if not 0).  Reply: ok or fail <code>
+ *   quit
+ *
+ * codes are the HASHCASH_* values, or errno values for purge.
+ *
+ * A second socket (-m) speaks the sendmail milter protocol instead,
+ * for checking mail as the MTA receives it; see hashcashd.pod.
+ */
+
+#define HASHCASHD_ENV "HASHCASH_SOCKET"
+#define HASHCASHD_GREETING "hashcashd"
+#define HASHCASHD_MAX_LINE ( MAX_TOK + MAX_RES + 64 )
+
+#endif
@@ -0,0 +1,222 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#if defined( unix ) || defined( WIN32 )
+    #include <unistd.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined( WIN32 )
+    #include <io.h>
+#endif
+#include "hashcash.h"
+#include "sstring.h"
+
+#define BUILD_DLL
+#include "hdrscan.h"
+
+#if defined( unix ) || defined( __unix__ ) || defined( __APPLE__ )
+    #include <sys/mman.h>
+    #define HDRSCAN_MMAP
+#endif
+
+static void scan_init( hashcash_hdrscan* s, int fd, int ignore_boundary )
+{
+    memset( s, 0, sizeof( hashcash_hdrscan ) );
+    s->fd = fd;
+    s->ignore_boundary = ignore_boundary;
+}
+
+/* a file ending in \n is mapped copy on write so headers can be
+ * unfolded in it; otherwise the \0 after the last line would be past
+ * the end of the file
+ */
+
+static int scan_map( hashcash_hdrscan* s )
+{
+#if defined( HDRSCAN_MMAP )
+    struct stat st;
+    char* map = NULL;
+
+    if ( fstat( s->fd, &st ) != 0 || !S_ISREG( st.st_mode ) ||
+	 st.st_size == 0 || lseek( s->fd, 0, SEEK_CUR ) != 0 ) {
+	return 0;
+    }
+    map = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		s->fd, 0 );
+    if ( map == MAP_FAILED ) { return 0; }
+    if ( map[ st.st_size - 1 ] != '\n' ) {
+	munmap( map, st.st_size );
+	return 0;
+    }
+    s->buf = map;
+    s->len = st.st_size;
+    s->mapped = 1;
+    s->eof = 1;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int hashcash_hdrscan_open( hashcash_hdrscan* scan, int fd,
+			   int ignore_boundary )
+{
+    scan_init( scan, fd, ignore_boundary );
+    if ( scan_map( scan ) ) { return 1; }
+    scan->alloc = HDRSCAN_READ + 1;
+    scan->buf = malloc( scan->alloc );
+    if ( scan->buf == NULL ) { errno = ENOMEM; return 0; }
+    return 1;
+}
+
+void hashcash_hdrscan_buffer( hashcash_hdrscan* scan, char* buf, long len,
+			      int ignore_boundary )
+{
+    scan_init( scan, -1, ignore_boundary );
+    scan->buf = buf;
+    scan->len = len;
+    scan->eof = 1;
+}
+
+int hashcash_hdrscan_name( hashcash_hdrscan* scan, const char* name )
+{
+    if ( scan->names == HDRSCAN_NAMES ) { return 0; }
+    scan->name[ scan->names ] = name;
+    scan->name_len[ scan->names ] = strlen( name );
+    scan->names++;
+    return 1;
+}
+
+/* append one read to the buffer, 0 at end of input */
+
+static int scan_read( hashcash_hdrscan* s )
+{
+    char* more = NULL;
+    long got = 0;
+
+    if ( s->eof ) { return 0; }
+    if ( s->alloc - s->len < HDRSCAN_READ + 1 ) {
+	more = realloc( s->buf, s->len + HDRSCAN_READ + 1 );
+	if ( more == NULL ) { s->eof = 1; return 0; }
+	s->buf = more;
+	s->alloc = s->len + HDRSCAN_READ + 1;
+    }
+    do {
+	got = read( s->fd, s->buf + s->len, HDRSCAN_READ );
+    } while ( got < 0 && errno == EINTR );
+    if ( got <= 0 ) { s->eof = 1; return 0; }
+    s->len += got;
+    return 1;
+}
+
+/* offset of the \n ending the line at from, reading until the byte
+ * after it is in too (to see if the next line continues this one);
+ * s->len if the input ends without one
+ */
+
+static long scan_eol( hashcash_hdrscan* s, long from )
+{
+    const char* nl = NULL;
+
+    for ( ;; ) {
+	nl = smemchr( s->buf + from, s->buf + s->len, '\n' );
+	if ( nl != NULL ) {
+	    from = nl - s->buf;
+	    if ( from + 1 < s->len || s->eof ) { return from; }
+	} else {
+	    from = s->len;
+	}
+	if ( !scan_read( s ) && nl == NULL ) { return s->len; }
+    }
+}
+
+/* length of the line [from,eol) less a \r before the \n */
+
+static long scan_chomp( const hashcash_hdrscan* s, long from, long eol )
+{
+    return ( eol > from && s->buf[ eol-1 ] == '\r' ) ? eol - 1 : eol;
+}
+
+static int scan_match( const hashcash_hdrscan* s, const char* line,
+		       long len )
+{
+    int k = 0;
+
+    if ( s->names == 0 ) { return 0; } /* every line, name_len[0] is 0 */
+    for ( k = 0; k < s->names; k++ ) {
+	if ( len >= s->name_len[k] &&
+	     tolower( (unsigned char)line[0] ) ==
+	     tolower( (unsigned char)s->name[k][0] ) &&
+	     strncasecmp( line, s->name[k], s->name_len[k] ) == 0 ) {
+	    return k;
+	}
+    }
+    return -1;
+}
+
+char* hashcash_hdrscan_next( hashcash_hdrscan* s, int* which )
+{
+    long line = 0, eol = 0, end = 0, next = 0, cont = 0;
+    char* val = NULL, *last = NULL;
+    int k = 0;
+
+    for ( ;; ) {
+	if ( s->boundary && !s->ignore_boundary ) { return NULL; }
+
+	/* lines before pos are done with: once a read's worth have
+	 * gone drop them, so the buffer only grows for long headers
+	 */
+	if ( s->alloc && s->pos > 0 && 
+	     ( s->pos == s->len || s->pos >= HDRSCAN_READ ) ) {
+	    memmove( s->buf, s->buf + s->pos, s->len - s->pos );
+	    s->len -= s->pos;
+	    s->pos = 0;
+	}
+	if ( s->pos >= s->len && !scan_read( s ) ) { return NULL; }
+
+	line = s->pos;
+	eol = scan_eol( s, line );
+	end = scan_chomp( s, line, eol );
+	s->pos = eol < s->len ? eol + 1 : s->len;
+	if ( end == line ) { s->boundary = 1; continue; }
+
+	k = scan_match( s, s->buf + line, end - line );
+	if ( k < 0 ) { continue; }
+
+	/* unfold: move each continuation, less its first space or
+	 * tab, up to the end of the line so far
+	 */
+	while ( s->pos < s->len &&
+		( s->buf[ s->pos ] == ' ' || s->buf[ s->pos ] == '\t' ) ) {
+	    cont = s->pos + 1;
+	    eol = scan_eol( s, cont );
+	    next = scan_chomp( s, cont, eol );
+	    memmove( s->buf + end, s->buf + cont, next - cont );
+	    end += next - cont;
+	    s->pos = eol < s->len ? eol + 1 : s->len;
+	}
+
+	val = s->buf + line + s->name_len[k];
+	last = s->buf + end;
+	if ( last - val > MAX_TOK ) { last = val + MAX_TOK; }
+	while ( val < last && isspace( (unsigned char)*val ) ) { val++; }
+	while ( last > val && isspace( (unsigned char)last[-1] ) ) { last--; }
+	*last = '\0';
+	if ( which ) { *which = k; }
+	return val;
+    }
+}
+
+void hashcash_hdrscan_close( hashcash_hdrscan* scan )
+{
+#if defined( HDRSCAN_MMAP )
+    if ( scan->mapped ) { munmap( scan->buf, scan->len ); }
+#endif
+    if ( scan->alloc ) { free( scan->buf ); }
+    scan->buf = NULL;
+    scan->len = scan->alloc = scan->pos = 0;
+}
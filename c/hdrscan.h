@@ -0,0 +1,92 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+#if !defined( _hdrscan_h )
+#define _hdrscan_h
+
+#if defined( __cplusplus )
+extern "C" {
+#endif
+
+#if !defined(HCEXPORT)
+    #if !defined(WIN32) || defined(MONOLITHIC)
+        #define HCEXPORT
+    #elif defined(BUILD_DLL)
+        #define HCEXPORT __declspec(dllexport)
+    #else /* USE_DLL */
+        #define HCEXPORT extern __declspec(dllimport)
+    #endif
+#endif
+
+/* mail header scanner
+ *
+ * Finds stamps in the headers of a mail message.  Input is read in
+ * large blocks, or mapped if it is a regular file, line ends are found
+ * with smemchr (16 bytes a compare with SSE2), and only lines starting
+ * with one of the header names are looked at further.  A matching
+ * header is unfolded in place (continuation lines joined as the -X
+ * line reader did) and its value, trimmed of white space, handed back
+ * as a \0 terminated view into the buffer.  Reading stops at the blank
+ * line ending the headers, so the body is never read, unless
+ * ignore_boundary is set.
+ *
+ * With no names every non blank line is handed back, unfolded and
+ * trimmed the same way: stamps one per line.
+ *
+ * A view stays valid until the next call to hashcash_hdrscan_next.
+ */
+
+#define HDRSCAN_NAMES 4
+#define HDRSCAN_READ 65536	/* bytes per read */
+
+typedef struct {
+    int fd;			/* -1 if scanning a buffer */
+    char* buf;
+    long len;			/* bytes of input in buf */
+    long alloc;			/* size of buf, 0 if not ours to free */
+    long pos;			/* start of the next line */
+    int mapped;
+    int eof;
+    int boundary;		/* blank line after headers reached */
+    int ignore_boundary;
+    int names;
+    const char* name[ HDRSCAN_NAMES ];
+    int name_len[ HDRSCAN_NAMES ];
+} hashcash_hdrscan;
+
+/* scan the message read from fd; returns 1, or 0 and errno on failure
+ */
+
+HCEXPORT
+int hashcash_hdrscan_open( hashcash_hdrscan* scan, int fd,
+			   int ignore_boundary );
+
+/* scan a message already in memory; buf is modified by unfolding and
+ * must have room for a \0 after len bytes
+ */
+
+HCEXPORT
+void hashcash_hdrscan_buffer( hashcash_hdrscan* scan, char* buf, long len,
+			      int ignore_boundary );
+
+/* look for headers starting name (eg "X-Hashcash:"), matched case
+ * insensitively; returns 0 if there are already HDRSCAN_NAMES
+ */
+
+HCEXPORT
+int hashcash_hdrscan_name( hashcash_hdrscan* scan, const char* name );
+
+/* value of the next matching header, NULL when there are no more;
+ * which (if not NULL) is set to the index of the name matched
+ */
+
+HCEXPORT
+char* hashcash_hdrscan_next( hashcash_hdrscan* scan, int* which );
+
+HCEXPORT
+void hashcash_hdrscan_close( hashcash_hdrscan* scan );
+
+#if defined( __cplusplus )
+}
+#endif
+
+#endif
@@ -18,6 +18,12 @@
 #include <string.h>
 #include <signal.h>
 #include <setjmp.h>
+#if defined( HAVE_PTHREADS )
+#include <pthread.h>
+#endif
+#if defined( unix ) || defined( __unix__ ) || defined( __APPLE__ )
+#include <unistd.h>
+#endif
 #include "random.h"
 #include "sha1.h"
 
@@ -25,11 +31,50 @@
 #include "libfastmint.h"
 
 
-/* Index into array of available minters */
-static int fastest_minter = -1;
-static unsigned int num_minters = 0;
-#define MAX_MINTERS 20
-static HC_Minter minters[MAX_MINTERS];
+/* The available minters, indexed by core number.  Never changed, so
+ * shared by all contexts.
+ */
+static const HC_Minter minters[] = {
+#if defined( OPENSSL )
+    { "SHA1 library (openSSL)", EncodeBase64, 
+      minter_library, minter_library_test },
+#else
+    { "SHA1 library (hashcash)", EncodeBase64, 
+      minter_library, minter_library_test },
+#endif
+    { "ANSI Compact 1-pipe", EncodeBase64, 
+      minter_ansi_compact_1, minter_ansi_compact_1_test },
+    { "ANSI Standard 1-pipe", EncodeBase64, 
+      minter_ansi_standard_1, minter_ansi_standard_1_test },
+    { "ANSI Ultra-Compact 1-pipe", EncodeBase64, 
+      minter_ansi_ultracompact_1, minter_ansi_ultracompact_1_test },
+    { "ANSI Compact 2-pipe", EncodeBase64, 
+      minter_ansi_compact_2, minter_ansi_compact_2_test },
+    { "ANSI Standard 2-pipe", EncodeBase64, 
+      minter_ansi_standard_2, minter_ansi_standard_2_test },
+    { "PowerPC Altivec Standard 1x4-pipe", EncodeBase64, 
+      minter_altivec_standard_1, minter_altivec_standard_1_test },
+    { "PowerPC Altivec Compact 2x4-pipe", EncodeBase64, 
+      minter_altivec_compact_2, minter_altivec_compact_2_test },
+    { "PowerPC Altivec Standard 2x4-pipe", EncodeBase64, 
+      minter_altivec_standard_2, minter_altivec_standard_2_test },
+    { "AMD64/x86 MMX Compact 1x2-pipe", EncodeBase64, 
+      minter_mmx_compact_1, minter_mmx_compact_1_test },
+    { "AMD64/x86 MMX Standard 1x2-pipe", EncodeBase64, 
+      minter_mmx_standard_1, minter_mmx_standard_1_test }
+};
+
+#define num_minters ( (int)( sizeof( minters ) / sizeof( *minters ) ) )
+
+/* Index of the machine default minter, set once by
+ * hashcash_select_minter */
+static int default_minter = -1;
+#if defined( HAVE_PTHREADS )
+static pthread_once_t default_minter_once = PTHREAD_ONCE_INIT;
+#endif
+
+/* The context used by the API calls that don't take one */
+hashcash_ctx hashcash_global_ctx = { -1, 0, RANDOM_STATE_INIT, "", 0, 0 };
 
 const char *encodeAlphabets[] = {
     "0123456789ABCDEF",
@@ -143,96 +188,21 @@ static void hashcash_detect_features( void ) {
 
 /* Statically guesstimate the fastest hashcash minting routine.  Takes
  * into account only the gross hardware architecture and features
- * available.  Updates fastest_minter.  Also initialises and populates
- * the available minter array if necessary.
+ * available.  Sets default_minter.
  */
 
-static const EncodeAlphabet encodings[] = {
-    EncodeBase64,
-    EncodeBase64,
-    EncodeBase64,
-    EncodeBase64,
-    EncodeBase64,
-    EncodeBase64,
-    EncodeBase64,
-    EncodeBase64,
-    EncodeBase64,
-    EncodeBase64,
-    EncodeBase64 
-};
-
-void hashcash_select_minter() {
-    static const HC_Mint_Routine funcs[] = {
-	minter_library,
-	minter_ansi_compact_1,
-	minter_ansi_standard_1,
-	minter_ansi_ultracompact_1,
-	minter_ansi_compact_2,
-	minter_ansi_standard_2,
-	minter_altivec_standard_1,
-	minter_altivec_compact_2,
-	minter_altivec_standard_2,
-	minter_mmx_compact_1,
-	minter_mmx_standard_1,
-	NULL };
-    static const HC_Mint_Capable_Routine tests[] = {
-	minter_library_test,
-	minter_ansi_compact_1_test,
-	minter_ansi_standard_1_test,
-	minter_ansi_ultracompact_1_test,
-	minter_ansi_compact_2_test,
-	minter_ansi_standard_2_test,
-	minter_altivec_standard_1_test,
-	minter_altivec_compact_2_test,
-	minter_altivec_standard_2_test,
-	minter_mmx_compact_1_test,
-	minter_mmx_standard_1_test,
-	NULL };
-    static const char *names[] = {
-#if defined( OPENSSL )
-	"SHA1 library (openSSL)",
-#else
-	"SHA1 library (hashcash)",
-#endif
-	"ANSI Compact 1-pipe",
-	"ANSI Standard 1-pipe",
-	"ANSI Ultra-Compact 1-pipe",
-	"ANSI Compact 2-pipe",
-	"ANSI Standard 2-pipe",
-	"PowerPC Altivec Standard 1x4-pipe",
-	"PowerPC Altivec Compact 2x4-pipe",
-	"PowerPC Altivec Standard 2x4-pipe",
-	"AMD64/x86 MMX Compact 1x2-pipe",
-	"AMD64/x86 MMX Standard 1x2-pipe",
-	NULL };
-    int i = 0 ;
-	
-    /* Populate array */
-    if( !num_minters ) {
-	num_minters = (sizeof(funcs) / sizeof(*funcs)) - 1;
-	if ( num_minters > MAX_MINTERS ) {
-	    fprintf(stderr, 
-		    "INTERNAL ERROR: " 
-		    "increase size of MAX_MINTERS\n");
-	    exit(3); /* EXIT_ERROR */
-	}
-	for( i=0; i < num_minters; i++ ) {
-	    minters[i].name = names[i];
-	    minters[i].func = funcs[i];
-	    minters[i].test = tests[i];
-	    minters[i].encoding = encodings[i];
-	}
-    }
+static void choose_default_minter( void ) {
+    int i = 0, best = 0;
 	
     /* If nothing else works, just use the compact_1 minter on x86
        and standard_1 elsewhere */
 
 #ifdef __i386__
-    fastest_minter = 1;
+    best = 1;
 #elif defined(__M68000__)
-    fastest_minter = 3;
+    best = 3;
 #else
-    fastest_minter = 2;
+    best = 2;
 #endif
     
     /* Detect actual CPU capabilities */
@@ -242,39 +212,80 @@ void hashcash_select_minter() {
        highest-numbered one that does */
     
     for ( i=6; i < num_minters; i++ ) {
-	if ( minters[i].test() ) { fastest_minter = i; }
+	if ( minters[i].test() ) { best = i; }
+    }
+    default_minter = best;
+}
+
+/* Choose the machine default minter, the first time only: feature
+ * detection traps SIGILL, so must not run in two threads at once.
+ */
+
+void hashcash_select_minter() {
+#if defined( HAVE_PTHREADS )
+    pthread_once( &default_minter_once, choose_default_minter );
+#else
+    if ( default_minter < 0 ) { choose_default_minter(); }
+#endif
+}
+
+int hashcash_ctx_minter( hashcash_ctx* ctx ) {
+    hashcash_select_minter();
+    return ctx->core < 0 ? default_minter : ctx->core;
+}
+
+/* seconds of CPU the calling thread has used, for the benchmarks:
+ * clock() is the whole process's CPU, which counts the other threads
+ * while they mint.  Where there's no thread clock a monotonic one is
+ * used, and failing that clock().
+ */
+
+#define BENCH_MIN_SECS 0.01	/* shortest run per_sec_calc times */
+
+static double bench_clock( void ) {
+#if defined( CLOCK_THREAD_CPUTIME_ID ) || defined( CLOCK_MONOTONIC )
+    struct timespec ts;
+#endif
+
+#if defined( CLOCK_THREAD_CPUTIME_ID )
+    if ( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) == 0 ) {
+	return ts.tv_sec + ts.tv_nsec / 1e9;
     }
+#endif
+#if defined( CLOCK_MONOTONIC )
+    if ( clock_gettime( CLOCK_MONOTONIC, &ts ) == 0 ) {
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+#endif
+    return clock() / (double) CLOCKS_PER_SEC;
 }
 
 /* Do a quick, silent benchmark of the selected backend.  Assumes it
  * works. */
-unsigned long hashcash_per_sec_calc( void ) {
+static unsigned long hashcash_per_sec_calc( int core ) {
     static const unsigned int test_bits = 64;
     static const char *test_string = 
 	"1:32:040404:foo@fnord.gov::0123456789abcdef:00000000";
     static const int test_tail = 52;
     unsigned long rate = 0, iter_count = 256;
-    volatile clock_t begin = 0 , end = 0 , tmp = 0 , res = 0 , taken = 0 ;
-    double elapsed = 0 , multiple = 0 ;
+    volatile double begin = 0, end = 0, res = 0;
+    double elapsed = 0;
     unsigned char block[SHA1_INPUT_BYTES] = {0};
     int gotbits = 0;
     HC_Mint_Routine best_minter_fp;
     
-    /* Ensure a valid minter backend is selected */
-    if ( !num_minters ) { hashcash_select_minter(); }
-    best_minter_fp = minters[fastest_minter].func;
+    best_minter_fp = minters[core].func;
     
     /* Determine clock resolution */
-    end = clock();
-    while ( (begin = clock()) == end ) {}
-    while ( (end = clock()) == begin ) {}
-    if ( end < begin ) { tmp = begin; begin = end; end = tmp; }
+    end = bench_clock();
+    while ( (begin = bench_clock()) == end ) {}
+    while ( (end = bench_clock()) == begin ) {}
     res = end - begin;
     
     /* where there is poor resolution use this */
     /* less accurate but faster -- otherwise takes 0.5secs */
     
-    if ( res > 1000 ) {
+    if ( res > 0.001 ) {
 	/* Run minter, with clock running */
 	begin = end;
 	do {
@@ -295,14 +306,10 @@ unsigned long hashcash_per_sec_calc( void ) {
 		return 1;
 	    }
 	    rate += iter_count;
-	    end = clock();
-	    if ( end < begin ) { taken = begin-end; }
-	    else { taken = end-begin; }
-	} while ( taken < 8*res );
-	multiple = CLOCKS_PER_SEC / (double)(8*res);
-	rate *= multiple;
+	    elapsed = bench_clock() - begin;
+	} while ( elapsed < 8*res );
 	
-	return rate;
+	return rate / elapsed;
     }
 
     /* Run increasing lengths of minting until we have sufficient
@@ -315,8 +322,8 @@ unsigned long hashcash_per_sec_calc( void ) {
 	PUT_WORD(block+60, test_tail << 3);
 	
 	/* Run minter, with clock running */
-	end = clock();
-	while ( (begin = clock()) == end ) {}
+	end = bench_clock();
+	while ( (begin = bench_clock()) == end ) {}
 	best_minter_fp(test_bits,&gotbits,block,SHA1_IV,test_tail,
 		       iter_count, NULL, NULL, 0, 0);
 	if ( gotbits >= test_bits) {
@@ -325,11 +332,11 @@ unsigned long hashcash_per_sec_calc( void ) {
 	    fprintf(stderr, "Error in hashcash_quickbench(): found preimage while trying to benchmark!\n");
 	    return 1;
 	}
-	end = clock();
-	if ( end < begin ) { tmp = begin; begin = end; end = tmp; }
-	elapsed = (end-begin) / (double) CLOCKS_PER_SEC;
+	end = bench_clock();
+	elapsed = end - begin;
 	
-	if(end-begin > (res * 16)) { break; }
+	/* a fine clock would otherwise stop at a few microseconds */
+	if ( elapsed > res * 16 && elapsed > BENCH_MIN_SECS ) { break; }
 	
 	iter_count <<= 1;
     }
@@ -338,27 +345,28 @@ unsigned long hashcash_per_sec_calc( void ) {
     return rate;
 }
 
-/* version of hashcash_per_sec_calc which caches result, so only doing
- * the work once.  Note: hashcash_use_core will dirty the cache to
- * trigger a recalc
+/* version of hashcash_per_sec_calc which caches result in the
+ * context, so only doing the work once.  Note: hashcash_use_core will
+ * dirty the cache to trigger a recalc
  */
 
-static int cached_per_sec = 0;
+unsigned long hashcash_ctx_per_sec( hashcash_ctx* ctx ) {
+    if ( !ctx->per_sec ) {
+	ctx->per_sec = hashcash_per_sec_calc( hashcash_ctx_minter( ctx ) );
+    }
+    return ctx->per_sec;
+}
 
 unsigned long hashcash_per_sec( void ) {
-    static unsigned long cache = 0;
-    if ( !cached_per_sec ) {
-	cache = hashcash_per_sec_calc();
-	cached_per_sec = 1;
-    }
-    return cache;
+    return hashcash_ctx_per_sec( &hashcash_global_ctx );
 }
 
 /* Test and benchmark available hashcash minting backends.  Returns
- * the speed of the fastest valid routine, and updates fastest_minter
- * as appropriate.
+ * the speed of the fastest valid routine, and makes it the context's
+ * core.
  */
-unsigned long hashcash_benchtest( int verbose, int core ) {
+unsigned long hashcash_ctx_benchtest( hashcash_ctx* ctx, int verbose, 
+				      int core ) {
     unsigned long i, a, b;
     int best_minter = -1, got_bits = 0;
     static const unsigned int test_bits = 22;
@@ -368,14 +376,14 @@ unsigned long hashcash_benchtest( int verbose, int core ) {
     static const int bit_stats[] = { 8, 10, 16, 20, 22, 
 				     24, 26, 28, 30, 0 };
     unsigned char block[SHA1_INPUT_BYTES+1] = {0};
-    volatile clock_t begin = 0, end = 0, tmp = 0;
+    volatile double begin = 0, end = 0;
     double elapsed = 0, rate = 0, peak_rate = 0;
     SHA1_ctx crypter;
     unsigned char hash[SHA1_DIGEST_BYTES] = {0};
     const char *p = NULL , *q = NULL ;
     int start = 0, stop = 0;
     
-    /* If minter list isn't valid, make it so */
+    /* Detect CPU features if not yet done */
     hashcash_select_minter();
     
     /* print header */
@@ -410,13 +418,12 @@ unsigned long hashcash_benchtest( int verbose, int core ) {
 	PUT_WORD(block+60, test_tail << 3);
 	
 	/* Run minter, with clock running */
-	end = clock();
-	while ( (begin = clock()) == end ) {}
+	end = bench_clock();
+	while ( (begin = bench_clock()) == end ) {}
 	minters[i].func(test_bits, &got_bits, block, SHA1_IV, 
 			test_tail, 1 << 30, NULL, NULL, 0, 0);
-	end = clock();
-	if ( end < begin ) { tmp = begin; begin = end; end = tmp; }
-	elapsed = (end-begin) / (double) CLOCKS_PER_SEC;
+	end = bench_clock();
+	elapsed = end - begin;
 	
 	/* Different minter iteration patterns will find
 	 * different solutions */
@@ -476,7 +483,7 @@ unsigned long hashcash_benchtest( int verbose, int core ) {
 	if ( verbose ) {
 	    printf("%9lu %s %c\n", (unsigned long) rate, 
 		   minters[i].name, 
-		   (i == fastest_minter) ? '*' : ' ');
+		   (i == default_minter) ? '*' : ' ');
 	}
 
 	if ( rate > peak_rate ) {
@@ -493,7 +500,8 @@ unsigned long hashcash_benchtest( int verbose, int core ) {
 	}
     }
 	
-    fastest_minter = best_minter;
+    ctx->core = best_minter;
+    ctx->per_sec = 0;
 	
     if ( verbose && best_minter >= 0 ) {
 	printf("Best minter: %s (%lu hashes/sec)\n", 
@@ -522,15 +530,374 @@ unsigned long hashcash_benchtest( int verbose, int core ) {
     return (unsigned long) peak_rate;
 }
 
+unsigned long hashcash_benchtest( int verbose, int core ) {
+    return hashcash_ctx_benchtest( &hashcash_global_ctx, verbose, core );
+}
+
+/* Minting with threads: the counter of a pass is cut into calls of
+ * the minter over its low MINT_CALL_CHARS characters, the characters
+ * above numbering the call.  Threads take runs of calls from a shared
+ * cursor with compare-and-swap, so a thread that finishes early just
+ * takes more and none waits on a slower one.  Each sizes its runs to
+ * take about MINT_RUN_MS at the rate it last ran at, but to no more
+ * than its share of half of what is left, so the last calls are spread
+ * over all threads.  Every call is made exactly once (until a stamp is
+ * found), and the tries counted are those the minter made.
+ *
+ * Minting in the background (ctx->duty) goes the same way, even with
+ * one thread, but all the threads minting are started for it and the
+ * caller only waits and calls back: they run at idle priority, which
+ * they couldn't leave, with runs that much shorter, and rest after
+ * each so as to mint for duty percent of the time.  A run that got
+ * less of the CPU than it had (by the thread's CPU time) means others
+ * want it, and the thread backs off by as much again.
+ */
+
+#define MINT_CALL_CHARS 2
+#define MINT_RUN_MS 50
+#define MINT_NAP_MS 10		/* longest rest without checking stop */
+
+#if defined( HAVE_PTHREADS )
+
+typedef struct {
+    HC_Mint_Routine minter;
+    const char* digits;		/* the minter's alphabet */
+    int bit_rate;
+    const unsigned char* block;	/* the block to search */
+    const uInt32* IV;
+    int tail, width, bits, threads;
+    int duty;			/* percent of the time to mint, 0 for all */
+    long run_us;		/* how long runs should take */
+    unsigned long calls;	/* to cover the counter */
+    unsigned long next;		/* first call not yet taken */
+    volatile int stop;
+    pthread_mutex_t lock;	/* guards the rest */
+    int best;
+    unsigned char best_block[SHA1_INPUT_BYTES];
+    double tries;
+    int running;		/* threads started and not yet done */
+} mint_share;
+
+typedef struct {
+    mint_share* share;
+    hashcash_callback cb;	/* only for the calling thread */
+    void* user_args;
+    double counter, expected;
+    int cpu;			/* to pin to, -1 for none */
+    int background;		/* run at idle priority */
+    int aborted;
+} mint_thread;
+
+static long thread_cpu_us( void )
+{
+#if defined( CLOCK_THREAD_CPUTIME_ID )
+    struct timespec ts;
+
+    if ( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) == 0 ) {
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+    }
+#endif
+    return -1;
+}
+
+static void nap_us( long us )
+{
+#if defined( WIN32 )
+    Sleep( us / 1000 );
+#else
+    struct timespec ts;
+
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = ( us % 1000000 ) * 1000;
+    nanosleep( &ts, NULL );
+#endif
+}
+
+static long elapsed_us( TIMETYPE* from, TIMETYPE* to )
+{
+#if defined( WIN32 )
+    return (long)( *to - *from ) * 1000;
+#else
+    return ( to->tv_sec - from->tv_sec ) * 1000000L + 
+	( to->tv_usec - from->tv_usec );
+#endif
+}
+
+static unsigned long calls_to_take( mint_share* share, unsigned long next,
+				    unsigned long want )
+{
+    unsigned long n = 0;
+
+    if ( next >= share->calls ) { return 0; }
+    n = ( share->calls - next ) / ( 2 * share->threads );
+    if ( n > want ) { n = want; }
+    return n < 1 ? 1 : n;
+}
+
+/* take up to want calls, returns how many were taken, 0 when none left */
+
+static unsigned long take_calls( mint_share* share, unsigned long want,
+				 unsigned long* first )
+{
+    unsigned long next = 0, seen = 0, n = 0;
+
+#if defined( __GNUC__ )
+    next = __sync_fetch_and_add( &share->next, 0 );
+    while ( ( n = calls_to_take( share, next, want ) ) > 0 ) {
+	seen = __sync_val_compare_and_swap( &share->next, next, next + n );
+	if ( seen == next ) { break; }
+	next = seen;
+    }
+#else
+    pthread_mutex_lock( &share->lock );
+    next = share->next;
+    n = calls_to_take( share, next, want );
+    share->next = next + n;
+    pthread_mutex_unlock( &share->lock );
+#endif
+    *first = next;
+    return n;
+}
+
+/* after a run of us, cpu_us of it on the CPU, rest to keep to duty */
+
+static void duty_rest( mint_share* share, long us, long cpu_us )
+{
+    double got = 1;		/* of the CPU, in the run */
+    long rest = 0;
+
+    if ( cpu_us >= 0 && cpu_us < us ) { got = (double)cpu_us / us; }
+    if ( got < 0.05 ) { got = 0.05; }
+    rest = (long)( us * 100.0 / ( share->duty * got ) ) - us;
+    for ( ; rest > 0 && !share->stop; rest -= MINT_NAP_MS * 1000 ) {
+	nap_us( rest < MINT_NAP_MS * 1000 ? rest : MINT_NAP_MS * 1000 );
+    }
+}
+
+static void* mint_calls( void* arg )
+{
+    mint_thread* self = (mint_thread*)arg;
+    mint_share* share = self->share;
+    unsigned char block[SHA1_INPUT_BYTES];
+    unsigned long first = 0, n = 0, call = 0, want = 1, done = 0, k = 0;
+    unsigned long per_call = 1UL << ( MINT_CALL_CHARS * share->bit_rate );
+    unsigned long mask = ( 1UL << share->bit_rate ) - 1;
+    double tries = 0;
+    long us = 0, cpu_us = 0;
+    int best = 0, got = 0, percent = 0;
+    TIMETYPE start, now, prev;
+
+    if ( self->cpu >= 0 ) { hashcash_pin_thread( self->cpu, NULL ); }
+    if ( self->background ) { hashcash_background_thread(); }
+    memcpy( block, share->block, SHA1_INPUT_BYTES );
+    timer( &prev );
+    while ( !share->stop && ( n = take_calls( share, want, &first ) ) ) {
+	timer( &start );
+	cpu_us = thread_cpu_us();
+	pthread_mutex_lock( &share->lock );
+	best = share->best;
+	pthread_mutex_unlock( &share->lock );
+	for ( tries = 0, call = first; 
+	      call < first + n && !share->stop; call++ ) {
+	    for ( k = 0; k < MINT_CALL_CHARS; k++ ) {
+		block[ share->tail - 1 - k ] = share->digits[0];
+	    }
+	    for ( ; (int)k < share->width; k++ ) {
+		block[ share->tail - 1 - k ] = share->digits[ 
+		    ( call >> ( ( k - MINT_CALL_CHARS ) * share->bit_rate ) ) 
+		    & mask ];
+	    }
+	    got = best;
+	    done = share->minter( share->bits, &got, block, share->IV, 
+				  share->tail, per_call, NULL, NULL, 0, 0 );
+	    tries += done;
+	    if ( got > best ) {
+		best = got;
+		pthread_mutex_lock( &share->lock );
+		if ( got > share->best ) {
+		    share->best = got;
+		    memcpy( share->best_block, block, SHA1_INPUT_BYTES );
+		}
+		if ( got >= share->bits ) { share->stop = 1; }
+		pthread_mutex_unlock( &share->lock );
+	    }
+	}
+	pthread_mutex_lock( &share->lock );
+	share->tries += tries;
+	tries = share->tries;
+	best = share->best;
+	pthread_mutex_unlock( &share->lock );
+
+	/* size the next run from the rate of this one */
+	timer( &now );
+	us = elapsed_us( &start, &now );
+	want = us > 0 ? (unsigned long)
+	    ( (double)share->run_us * ( call - first ) / us ) : n * 2;
+	if ( want < 1 ) { want = 1; }
+	if ( share->duty ) {
+	    duty_rest( share, us, cpu_us < 0 ? -1 : thread_cpu_us() - cpu_us );
+	}
+
+	if ( self->cb && elapsed_us( &prev, &now ) > 100 * 1000 ) {
+	    prev = now;
+	    percent = (int)( ( self->counter + tries ) / 
+			     self->expected * 100 + 0.5 );
+	    if ( !self->cb( percent, best, share->bits, self->counter + tries, 
+			    self->expected, self->user_args ) ) {
+		self->aborted = 1;
+		share->stop = 1;
+	    }
+	}
+    }
+    pthread_mutex_lock( &share->lock );
+    share->running--;
+    pthread_mutex_unlock( &share->lock );
+    return NULL;
+}
+
+/* call back as mint_calls would while the threads started mint */
+
+static void mint_watch( mint_thread* self )
+{
+    mint_share* share = self->share;
+    double tries = 0;
+    int best = 0, running = 0, percent = 0;
+    TIMETYPE now, prev;
+
+    timer( &prev );
+    for ( ;; ) {
+	nap_us( MINT_NAP_MS * 1000 );
+	pthread_mutex_lock( &share->lock );
+	running = share->running;
+	tries = share->tries;
+	best = share->best;
+	pthread_mutex_unlock( &share->lock );
+	if ( running == 0 ) { break; }
+	timer( &now );
+	if ( self->cb && !share->stop && 
+	     elapsed_us( &prev, &now ) > 100 * 1000 ) {
+	    prev = now;
+	    percent = (int)( ( self->counter + tries ) / 
+			     self->expected * 100 + 0.5 );
+	    if ( !self->cb( percent, best, share->bits, self->counter + tries, 
+			    self->expected, self->user_args ) ) {
+		self->aborted = 1;
+		share->stop = 1;
+	    }
+	}
+    }
+}
+
+/* as a minter over the whole counter of width chars, with threads */
+
+static unsigned long mint_threaded( hashcash_ctx* ctx, 
+				    HC_Mint_Routine minter,
+				    const char* digits, int bit_rate,
+				    int bits, int* best, 
+				    unsigned char* block, const uInt32 IV[5], 
+				    int tail, int width, hashcash_callback cb,
+				    void* user_args, double counter, 
+				    double expected )
+{
+    pthread_t thread[ HASHCASH_MAX_THREADS ];
+    mint_thread self[ HASHCASH_MAX_THREADS ], caller;
+    mint_share share;
+    void* saved = NULL;
+    int i = 0, started = 1, threads = ctx->threads > 1 ? ctx->threads : 1;
+    int first = ctx->duty ? 0 : 1;	/* the first thread started */
+    long us = 0;
+    TIMETYPE begin, end;
+
+    share.minter = minter;
+    share.digits = digits;
+    share.bit_rate = bit_rate;
+    share.block = block;
+    share.IV = IV;
+    share.tail = tail;
+    share.width = width;
+    share.bits = bits;
+    share.threads = threads;
+    share.duty = ctx->duty;
+    share.run_us = MINT_RUN_MS * 10L * ( ctx->duty ? ctx->duty : 100 );
+    share.calls = 1UL << ( ( width - MINT_CALL_CHARS ) * bit_rate );
+    share.next = 0;
+    share.stop = 0;
+    pthread_mutex_init( &share.lock, NULL );
+    share.best = *best;
+    share.tries = 0;
+    share.running = 0;
+
+    for ( i = 0; i < threads; i++ ) {
+	self[i].share = &share;
+	self[i].cb = NULL;
+	self[i].user_args = user_args;
+	self[i].counter = counter;
+	self[i].expected = expected;
+	self[i].cpu = ctx->ncpus > 0 ? ctx->cpus[ i % ctx->ncpus ] : -1;
+	self[i].background = ctx->duty != 0;
+	self[i].aborted = 0;
+    }
+    caller = self[0];
+    caller.cb = cb;
+    caller.background = 0;
+    timer( &begin );
+    for ( started = first; started < threads; started++ ) {
+	pthread_mutex_lock( &share.lock );
+	share.running++;
+	pthread_mutex_unlock( &share.lock );
+	if ( pthread_create( &thread[ started ], NULL, mint_calls, 
+			     &self[ started ] ) != 0 ) {
+	    pthread_mutex_lock( &share.lock );
+	    share.running--;
+	    pthread_mutex_unlock( &share.lock );
+	    break;
+	}
+    }
+    if ( first == 0 && started > 0 ) {
+	mint_watch( &caller );
+    } else {
+	/* the calling thread mints too, but goes back where it was 
+	   after; it is never put in the background */
+	if ( caller.cpu >= 0 ) { hashcash_pin_thread( caller.cpu, &saved ); }
+	caller.cpu = -1;
+	mint_calls( &caller );
+	hashcash_unpin_thread( saved );
+    }
+    for ( i = first; i < started; i++ ) { pthread_join( thread[i], NULL ); }
+    pthread_mutex_destroy( &share.lock );
+
+    /* the speed reached, rests and all */
+    timer( &end );
+    us = elapsed_us( &begin, &end );
+    if ( us > 100 * 1000 ) {
+	ctx->eff_per_sec = (unsigned long)( share.tries * 1000000 / us );
+    }
+
+    if ( caller.aborted ) { *best = -1; return 0; }
+    if ( share.best > *best ) {
+	*best = share.best;
+	memcpy( block, share.best_block, SHA1_INPUT_BYTES );
+    }
+    return (unsigned long)share.tries;
+}
+
+#endif
+
 /* Attempt to mint a hashcash token with a given bit-value.
  * Will append a random string to token that produces the required
  * preimage, then return a pointer to the resultant string in result.
  * Caller must free() result buffer after use.
  * Returns the number of bits actually minted (may be more or less
  * than requested).
+ *
+ * If ctx->unit is set it is used as the random string, and only one
+ * pass is made over the counter, of at most ctx->unit_chars characters
+ * if that is set: result is then the best stamp found, which may have
+ * fewer bits than asked for.
  */
 
-double hashcash_fastmint( const int bits, const char *token, int compress,
+double hashcash_fastmint( hashcash_ctx* ctx, const int bits, 
+			  const char *token, int compress,
 			  char **result, hashcash_callback cb, 
 			  void* user_args )
 {
@@ -544,18 +911,15 @@ double hashcash_fastmint( const int bits, const char *token, int compress,
     HC_Mint_Routine best_minter;
     double counter = 0, expected = 0;
     int gotBits = 0, bit_rate = 6, chars = 0, blocks = 1, oldblocks = 0;
-    int prevBits = 0;
+    int prevBits = 0, core = 0;
     int* best = &gotBits; /* NB this is needed for CALLBACK macros */
     /* this is to allow this fn to call the same callback macro */
     MINTER_CALLBACK_VARS;
     
-    /* Make sure list of minters is valid */
-    if ( fastest_minter < 0 ) { hashcash_select_minter(); }
-
     /* only the library minter can cope with split blocks */
-    if ( compress > 1 ) { fastest_minter = 0; }
+    core = compress > 1 ? 0 : hashcash_ctx_minter( ctx );
     
-    best_minter = minters[fastest_minter].func;
+    best_minter = minters[core].func;
     
     expected = hashcash_expected_tries( bits );
     
@@ -570,9 +934,18 @@ again:
     /* Add 96 bits of random data */
     t = tail + 16;
     for( ; tail < t; tail++) {
-	random_getbytes(&c, 1);
+	if ( ctx->unit ) {
+	    buffer[tail] = ctx->unit[16-(t-tail)];
+	    continue;
+	}
+	random_state_getbytes(&ctx->rng, &c, 1);
 	buffer[tail] = encodeAlphabets[EncodeBase64][c & 0x3f];
     }
+    /* a split search gives each lane its own first random character,
+       so no two lanes try the same stamps */
+    if ( ctx->lanes > 1 ) {
+	buffer[tail-16] = encodeAlphabets[EncodeBase64][ctx->lane & 0x3f];
+    }
 #if defined( DEBUG )
     fprintf( stderr, "tail = \"%s\"\n", buffer+tail-16 );
 #endif
@@ -581,12 +954,15 @@ again:
     buffer[tail++] = ':';
     save_tail = tail;
     
-    bit_rate = EncodeBitRate[encodings[fastest_minter]];
+    bit_rate = EncodeBitRate[minters[core].encoding];
 #if defined( DEBUG )
     chars = 18/bit_rate;
 #else
     chars = 31/bit_rate;
 #endif
+    if ( ctx->unit && ctx->unit_chars > 0 && ctx->unit_chars < chars ) {
+	chars = ctx->unit_chars;
+    }
     for ( i = compress ? 1 : chars; 
 	  i <= chars && (first || gotBits < bits); i++ ) {
 	first = 0;
@@ -646,6 +1022,15 @@ again:
 	tail -= t;
 	
 	/* Run the minter over the last block */
+#if defined( HAVE_PTHREADS )
+	if ( ( ctx->threads > 1 || ctx->duty ) && blocks == 1 && 
+	     i > MINT_CALL_CHARS ) {
+	    loop=mint_threaded(ctx, best_minter, 
+			       encodeAlphabets[minters[core].encoding], 
+			       bit_rate, bits, &gotBits, block, IV, tail, i,
+			       cb, user_args, counter, expected);
+	} else
+#endif
 	loop=best_minter(bits, &gotBits, block, IV, tail,
 			 0x1U << (i*bit_rate), cb,
 			 user_args,counter,expected);
@@ -685,13 +1070,18 @@ again:
     /* The minter appears to be broken! */
     if ( b < gotBits ) {
 	fprintf(stderr, "ERROR: requested %d bits, reported %d bits, got %d bits using %s minter: \"%s\"\n",
-		bits, gotBits, b, minters[fastest_minter].name, last );
+		bits, gotBits, b, minters[core].name, last );
 	exit(3);
     }
     
     /* The minter might not be able to detect unusually large
      * (32+) bit counts, so we're allowed to give it another try.
      */
+    if ( b < bits && ctx->unit ) {
+	free(buffer);
+	*result = (char*)last;
+	return counter;
+    }
     if ( b < bits ) {
 	/*		fprintf( stderr, "buffer = %s\n", buffer );
 			fprintf( stderr, "wrapped\n" ); */
@@ -704,25 +1094,264 @@ again:
     return counter;
 }
 
+int hashcash_ctx_core( hashcash_ctx* ctx ) {
+    return hashcash_ctx_minter( ctx );
+}
+
 int hashcash_core( void ) {
-    if (!num_minters) { hashcash_select_minter(); }
-    return fastest_minter;
+    return hashcash_ctx_core( &hashcash_global_ctx );
 }
 
-int hashcash_use_core( int core ) {
-    if (!num_minters) { hashcash_select_minter(); }
+int hashcash_ctx_use_core( hashcash_ctx* ctx, int core ) {
+    hashcash_select_minter();
     if ( core < 0 || core >= num_minters ) { return -1; }
     if ( !minters[core].test() ) { return 0; }
-    fastest_minter = core;
+    ctx->core = core;
     /* force recalc */
-    cached_per_sec = 0;
+    ctx->per_sec = 0;
+    ctx->eff_per_sec = 0;
     return 1;
 }
 
+int hashcash_use_core( int core ) {
+    return hashcash_ctx_use_core( &hashcash_global_ctx, core );
+}
+
 const char* hashcash_core_name( int core ) {
-    if (!num_minters) { hashcash_select_minter(); }
     if ( core < 0 || core >= num_minters ) {
 	return "undefined core";
     }
     return minters[core].name;
 }
+
+#if defined( HAVE_PTHREADS )
+
+/* Measuring a placement: a thread on each CPU runs the minter for
+ * PLACE_BENCH_MS, on a stamp it won't find.
+ */
+
+#define PLACE_BENCH_MS 250
+
+typedef struct {
+    HC_Mint_Routine minter;
+    int cpu;
+    double rate;
+} place_bench;
+
+static void* place_bench_calls( void* arg )
+{
+    static const char *test_string = 
+	"1:32:040404:foo@fnord.gov::0123456789abcdef:00000000";
+    static const int test_tail = 52;
+    place_bench* bench = (place_bench*)arg;
+    unsigned char block[SHA1_INPUT_BYTES] = {0};
+    double tries = 0;
+    long us = 0;
+    int got = 0;
+    TIMETYPE start, now;
+
+    hashcash_pin_thread( bench->cpu, NULL );
+    strncpy((char*)block, test_string, SHA1_INPUT_BYTES);
+    block[test_tail] = 0x80;
+    memset(block+test_tail+1, 0, 59-test_tail);
+    PUT_WORD(block+60, test_tail << 3);
+
+    timer( &start );
+    do {
+	got = 0;
+	tries += bench->minter( 64, &got, block, SHA1_IV, test_tail, 
+				1UL << 16, NULL, NULL, 0, 0 );
+	timer( &now );
+	us = elapsed_us( &start, &now );
+    } while ( us < PLACE_BENCH_MS * 1000L );
+    bench->rate = tries * 1000000 / us;
+    return NULL;
+}
+
+static double place_rate( hashcash_ctx* ctx, const int cpus[], int n )
+{
+    pthread_t thread[ HASHCASH_MAX_THREADS ];
+    place_bench bench[ HASHCASH_MAX_THREADS ];
+    double rate = 0;
+    int i = 0, started = 0;
+
+    for ( i = 0; i < n; i++ ) {
+	bench[i].minter = minters[ hashcash_ctx_minter( ctx ) ].func;
+	bench[i].cpu = cpus[i];
+	bench[i].rate = 0;
+    }
+    for ( started = 0; started < n; started++ ) {
+	if ( pthread_create( &thread[ started ], NULL, place_bench_calls, 
+			     &bench[ started ] ) != 0 ) {
+	    break;
+	}
+    }
+    for ( i = 0; i < started; i++ ) {
+	pthread_join( thread[i], NULL );
+	rate += bench[i].rate;
+    }
+    return rate;
+}
+
+#endif
+
+/* the CPUs of a placement, see hashcash_ctx_use_cpus */
+
+static int place_cpus( hashcash_ctx* ctx, const char* place, int cpus[] )
+{
+    int all[ HASHCASH_MAX_THREADS ];
+    int cores = 0, n = 0;
+
+#if defined( HAVE_PTHREADS )
+
+    if ( strcmp( place, "cores" ) == 0 ) {
+	return hashcash_cpu_topology( cpus, HASHCASH_MAX_THREADS, 0 );
+    }
+    if ( strcmp( place, "all" ) == 0 ) {
+	return hashcash_cpu_topology( cpus, HASHCASH_MAX_THREADS, 1 );
+    }
+    if ( strcmp( place, "smt" ) == 0 ) {
+	cores = hashcash_cpu_topology( cpus, HASHCASH_MAX_THREADS, 0 );
+	n = hashcash_cpu_topology( all, HASHCASH_MAX_THREADS, 1 );
+	if ( n > cores && place_rate( ctx, all, n ) * 100 >= 
+	     place_rate( ctx, cpus, cores ) * ( 100 + HASHCASH_SMT_GAIN ) ) {
+	    memcpy( cpus, all, n * sizeof( int ) );
+	    return n;
+	}
+	return cores;
+    }
+    n = hashcash_cpu_list( place, cpus, HASHCASH_MAX_THREADS );
+    return n == 0 ? -1 : n;
+#else
+    ctx = ctx; cpus = cpus; cores = cores; n = n;
+    if ( strcmp( place, "cores" ) == 0 || strcmp( place, "all" ) == 0 ||
+	 strcmp( place, "smt" ) == 0 ) {
+	return 0;
+    }
+    return hashcash_cpu_list( place, all, HASHCASH_MAX_THREADS ) > 0 ? 
+	0 : -1;
+#endif
+}
+
+int hashcash_ctx_use_threads( hashcash_ctx* ctx, int threads ) {
+#if defined( HAVE_PTHREADS )
+    long n = 1;
+    int cores = 0;
+
+    /* unless placed, one per core, then on their siblings if more; but
+       fewer threads than cores are left to the scheduler, or every
+       process minting would pile onto the first cores */
+    if ( !ctx->placed ) {
+	cores = place_cpus( ctx, "cores", ctx->cpus );
+	ctx->ncpus = cores;
+	if ( threads > cores ) {
+	    ctx->ncpus = place_cpus( ctx, "all", ctx->cpus );
+	}
+    }
+    if ( threads <= 0 ) {
+	n = ctx->ncpus;
+#if defined( _SC_NPROCESSORS_ONLN )
+	if ( n < 1 ) { n = sysconf( _SC_NPROCESSORS_ONLN ); }
+#endif
+	threads = n < 1 ? 1 : n;
+    }
+    if ( threads > HASHCASH_MAX_THREADS ) { threads = HASHCASH_MAX_THREADS; }
+    if ( !ctx->placed && threads < cores ) { ctx->ncpus = 0; }
+    ctx->threads = threads;
+    ctx->eff_per_sec = 0;
+#else
+    threads = threads;
+    ctx->threads = 1;
+#endif
+    return ctx->threads;
+}
+
+int hashcash_use_threads( int threads ) {
+    return hashcash_ctx_use_threads( &hashcash_global_ctx, threads );
+}
+
+int hashcash_ctx_use_cpus( hashcash_ctx* ctx, const char* place ) {
+    int cpus[ HASHCASH_MAX_THREADS ];
+    int n = place_cpus( ctx, place, cpus );
+
+    if ( n < 0 ) { return -1; }
+    memcpy( ctx->cpus, cpus, n * sizeof( int ) );
+    ctx->ncpus = n;
+    ctx->placed = 1;
+    if ( n > 0 ) { hashcash_ctx_use_threads( ctx, n ); }
+    return n;
+}
+
+int hashcash_use_cpus( const char* place ) {
+    return hashcash_ctx_use_cpus( &hashcash_global_ctx, place );
+}
+
+unsigned long hashcash_ctx_place_per_sec( hashcash_ctx* ctx, 
+					  const char* place, int* threads ) {
+    int cpus[ HASHCASH_MAX_THREADS ];
+    int n = place_cpus( ctx, place, cpus );
+
+    if ( threads ) { *threads = n < 0 ? 0 : n; }
+#if defined( HAVE_PTHREADS )
+    if ( n > 0 ) { return (unsigned long)place_rate( ctx, cpus, n ); }
+#endif
+    return 0;
+}
+
+unsigned long hashcash_place_per_sec( const char* place, int* threads ) {
+    return hashcash_ctx_place_per_sec( &hashcash_global_ctx, place, 
+				       threads );
+}
+
+int hashcash_ctx_use_duty( hashcash_ctx* ctx, int percent ) {
+    if ( percent < 1 || percent > 100 ) { return -1; }
+#if defined( HAVE_PTHREADS )
+    ctx->duty = percent < 100 ? percent : 0;
+#endif
+    ctx->eff_per_sec = 0;
+    return ctx->duty ? ctx->duty : 100;
+}
+
+int hashcash_use_duty( int percent ) {
+    return hashcash_ctx_use_duty( &hashcash_global_ctx, percent );
+}
+
+/* the speed the last threaded or background mint reached, or until
+ * there is one the speed of the core times the threads that have a
+ * CPU, for the time minting
+ */
+
+unsigned long hashcash_ctx_effective_per_sec( hashcash_ctx* ctx ) {
+    double rate = 0;
+    long cpus = 1;
+    int threads = ctx->threads > 1 ? ctx->threads : 1;
+
+    if ( ctx->eff_per_sec ) { return ctx->eff_per_sec; }
+#if defined( _SC_NPROCESSORS_ONLN )
+    cpus = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+    if ( ctx->ncpus > 0 && ctx->ncpus < cpus ) { cpus = ctx->ncpus; }
+    if ( threads > cpus && cpus > 0 ) { threads = cpus; }
+    rate = (double)hashcash_ctx_per_sec( ctx ) * threads;
+    if ( ctx->duty ) { rate = rate * ctx->duty / 100; }
+    return (unsigned long)rate;
+}
+
+unsigned long hashcash_effective_per_sec( void ) {
+    return hashcash_ctx_effective_per_sec( &hashcash_global_ctx );
+}
+
+hashcash_ctx* hashcash_ctx_new( void ) {
+    hashcash_ctx* ctx = calloc( 1, sizeof( hashcash_ctx ) );
+    
+    if ( ctx == NULL ) { return NULL; }
+    ctx->core = -1;
+    ctx->rng.urandom = NULL;
+    return ctx;
+}
+
+void hashcash_ctx_free( hashcash_ctx* ctx ) {
+    if ( ctx == NULL ) { return; }
+    random_state_final( &ctx->rng );
+    free( ctx );
+}
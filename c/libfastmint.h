@@ -8,6 +8,7 @@
 #include <sys/time.h>
 #endif
 #include "hashcash.h"
+#include "random.h"
 
 #if defined(WIN32)
 #define MILLISEC 1
@@ -95,6 +96,47 @@ extern const int EncodeBitRate[];
 
 extern void hashcash_select_minter();
 
+/* library state, see hashcash_ctx in hashcash.h; the API calls without
+ * a ctx use hashcash_global_ctx
+ */
+
+#define MAX_RE_ERR 256
+
+struct hashcash_ctx {
+	int core;		/* minting core, -1 for the machine default */
+	unsigned long per_sec;	/* its measured speed, 0 if not measured */
+	random_state rng;
+	char re_err[MAX_RE_ERR+1];
+	int lane, lanes;	/* search only lane of lanes, if lanes > 1 */
+	const char* unit;	/* random field to search one pass of */
+	int unit_chars;		/* counter characters in the pass, 0 for all */
+	int threads;		/* to mint with, if more than 1 */
+	int cpus[HASHCASH_MAX_THREADS];	/* to pin them to, in turn */
+	int ncpus, placed;	/* placed if cpus were given */
+	int duty;		/* CPU percent to mint in, 0 for all */
+	unsigned long eff_per_sec; /* speed minting reached, 0 if none */
+};
+
+extern hashcash_ctx hashcash_global_ctx;
+
+/* the core ctx mints with, choosing the default if it has none */
+extern int hashcash_ctx_minter(hashcash_ctx* ctx);
+
+/* the stamp hashcash_ctx_mint would mint, up to the random field */
+extern int hashcash_mint_token(hashcash_ctx* ctx, time_t now_time, int time_width, const char* resource, unsigned bits, long anon_period, long* anon_random, char* ext, char** token);
+
+/* where minting threads run, see placement.c; CPUs are numbered
+ * below HASHCASH_MAX_CPU */
+#define HASHCASH_MAX_CPU 1024
+extern int hashcash_cpu_list(const char* list, int cpus[], int max);
+extern int hashcash_cpu_topology(int cpus[], int max, int smt);
+extern int hashcash_pin_thread(int cpu, void** saved);
+extern void hashcash_unpin_thread(void* saved);
+extern int hashcash_background_thread(void);
+
+/* match as hashcash_resource_match, regexp errors written to re_buf */
+extern int hashcash_resource_match_buf(int type, const char* stamp_res, const char* res, void** compile, char** err, char re_buf[MAX_RE_ERR+1]);
+
 /* Portably write a word into a byte array */
 #define PUT_WORD(_dst, _src) { \
 		*((unsigned char*)(_dst)+0) = ((_src) >> 24) & 0xFF; \
@@ -116,13 +158,13 @@ extern void hashcash_select_minter();
  * result buffer after use.
  * Returns the number of bits actually minted (may be more or less than requested).
  */
-extern double hashcash_fastmint(const int bits, const char *token, int small, char **result, hashcash_callback cb, void* user_arg);
+extern double hashcash_fastmint(hashcash_ctx* ctx, const int bits, const char *token, int small, char **result, hashcash_callback cb, void* user_arg);
 
 /* Perform a quick benchmark of the selected minting backend.  Returns speed. */
 extern unsigned long hashcash_per_sec(void);
 
 /* Test and benchmark available hashcash minting backends.  Returns the speed
- * of the fastest valid routine, and updates fastest_minter as appropriate.
+ * of the fastest valid routine, and makes it the context's core.
  * Uses one or more known solutions to gauge both speed and accuracy.
  * Optionally displays status and benchmark results on console.
  */
@@ -39,129 +39,256 @@ time_t round_off( time_t now_time, int digits );
 #define GFORMAT "%08x"
 #endif
 
-long per_sec = 0;		/* cache calculation */
+/* compiled wildcard pattern
+ *
+ * A pattern is split into the user part and, after the '@', one glob
+ * per domain label.  Each glob is the segments between its '*'s; with
+ * a '*' the first segment must be a prefix, the last a suffix, and the
+ * ones between are found leftmost first, which can't miss a match as
+ * '*' is the only wildcard.  Segments are searched with KMP, so
+ * matching is linear in the lengths of resource and pattern, and
+ * after compiling needs no allocation or copying.
+ */
 
-char *strrstr(char *s1,char *s2) 
+typedef struct {
+    const char* str;		/* not NUL terminated */
+    int len;
+    const int* fail;		/* KMP failure function, len entries */
+} wild_seg;
+
+typedef struct {
+    int star;			/* glob had a '*' */
+    int nseg;
+    const wild_seg* seg;
+} wild_glob;
+
+typedef struct {
+    int at;			/* pattern has an '@' */
+    int dom;			/* and something after it */
+    int nglob;			/* user part then each domain label */
+    const wild_glob* glob;
+} wild_pat;
+
+static int count_char( const char* s, int len, int c )
 {
-    char *sc2 = NULL , *psc1 = NULL , *ps1 = NULL ;
- 
-    if ( *s2 == '\0' ) { return s1; }
-    ps1 = s1 + strlen(s1);
-
-    while( ps1 != s1 ) {
-	--ps1;
-	for ( psc1 = ps1, sc2 = s2; ; ) {
-	    if (*(psc1++) != *(sc2++)) { break; }
-	    else if ( *sc2 == '\0' ) { return ps1; }
-	}
+    int n = 0;
+    for ( ; len > 0; len--, s++ ) { if ( *s == c ) { n++; } }
+    return n;
+}
+
+static void kmp_fail( const char* s, int len, int* fail )
+{
+    int i = 0, k = 0;
+
+    if ( len > 0 ) { fail[0] = 0; }
+    for ( i = 1; i < len; i++ ) {
+	while ( k > 0 && s[i] != s[k] ) { k = fail[k-1]; }
+	if ( s[i] == s[k] ) { k++; }
+	fail[i] = k;
     }
-    return NULL;
 }
 
-int wild_match( char* pat, char* str )
+/* offset of the first seg in str[0..len), or -1 */
+
+static int kmp_find( const char* str, int len, const wild_seg* seg )
 {
-    int num = 1, last = 0, first = 1;
-    char* term = NULL , *ptr = pat, *pos = str;
+    int i = 0, k = 0;
 
-    do {
-	term = ptr; ptr = strchr( ptr, '*' );
-	if ( ptr ) { *ptr = '\0'; ptr++; } 
-	else { last = 1; }
-	
-	if ( *term != '\0' ) {
-	    if ( first ) {	/* begin */
-		if ( strncmp( pos, term, strlen( term ) ) != 0 ) {
-		    return 0;
-		}
-		pos += strlen( term );
-	    } else if ( !first ) { /* middle */
-		if ( last ) {
-		    pos = strrstr( pos, term );
-		} else {
-		    pos = strstr( pos, term );
-		}
-		if ( pos == 0 ) { return 0; }
-		pos += strlen( term );
-	    }
-	    if ( last && *pos != '\0' ) {
-		return 0; 
-	    }
-	}
+    for ( i = 0; i < len; i++ ) {
+	while ( k > 0 && str[i] != seg->str[k] ) { k = seg->fail[k-1]; }
+	if ( str[i] == seg->str[k] ) { k++; }
+	if ( k == seg->len ) { return i - k + 1; }
+    }
+    return -1;
+}
 
-	num++; first = 0;
-    } while ( term && !last );
-    
-    return 1;
+static void glob_compile( wild_glob* glob, const char* s, int len, 
+			  wild_seg** seg, int** fail )
+{
+    const char* end = s + len, *star = NULL;
+
+    glob->star = memchr( s, '*', len ) != NULL;
+    glob->nseg = 0;
+    glob->seg = *seg;
+    do {
+	star = memchr( s, '*', end - s );
+	(*seg)->str = s;
+	(*seg)->len = ( star ? star : end ) - s;
+	(*seg)->fail = *fail;
+	kmp_fail( s, (*seg)->len, *fail );
+	*fail += (*seg)->len;
+	(*seg)++;
+	glob->nseg++;
+	s = star + 1;
+    } while ( star );
 }
 
-int email_match( const char* email, const char* pattern )
+static int glob_match( const wild_glob* glob, const char* str, int len )
 {
-    int len = 0 , ret = 0;
-    char *pat_user = NULL, *pat_dom = NULL;
-    char *em_user = NULL, *em_dom = NULL;
-    char *pat_sub = NULL , *em_sub = NULL , *pat_next = NULL , *em_next = NULL , *state = NULL ;
-    
-    sstrtok( pattern, "@", &pat_user, 0, &len, &state );
-    sstrtok( NULL, "@", &pat_dom, 0, &len, &state );
+    const wild_seg* first = &glob->seg[0], *last = NULL;
+    int pos = 0, i = 0, off = 0;
+
+    if ( !glob->star ) {	/* "" matches anything, as always has */
+	return first->len == 0 || 
+	    ( len == first->len && memcmp( str, first->str, len ) == 0 );
+    }
+    if ( len < first->len || memcmp( str, first->str, first->len ) != 0 ) {
+	return 0;
+    }
+    pos = first->len;
+    for ( i = 1; i < glob->nseg - 1; i++ ) {
+	if ( glob->seg[i].len == 0 ) { continue; }
+	off = kmp_find( str + pos, len - pos, &glob->seg[i] );
+	if ( off < 0 ) { return 0; }
+	pos += off + glob->seg[i].len;
+    }
+    last = &glob->seg[ glob->nseg - 1 ];
+    return len - pos >= last->len && 
+	memcmp( str + len - last->len, last->str, last->len ) == 0;
+}
 
-    sstrtok( email, "@", &em_user, 0, &len, &state );
-    sstrtok( NULL, "@", &em_dom, 0, &len, &state );
+/* compile pattern into a single block, free with free() */
 
-    /* if @ in pattern, must have @ sign in email too */
-    if ( pat_dom && em_dom == NULL ) { goto done; } 
+static wild_pat* wild_compile( const char* pattern )
+{
+    int plen = strlen( pattern ), user_len = plen, dom_len = 0, nglob = 1;
+    const char* at = strchr( pattern, '@' ), *dom = NULL, *dot = NULL;
+    const char* s = NULL, *end = NULL;
+    wild_pat* pat = NULL;
+    wild_glob* glob = NULL;
+    wild_seg* seg = NULL;
+    int* fail = NULL;
+    char* copy = NULL;
+    int nseg = 0, i = 0;
+
+    if ( at ) {
+	user_len = at - pattern;
+	dom = at + 1;
+	end = strchr( dom, '@' );
+	dom_len = end ? end - dom : plen - user_len - 1;
+	if ( *dom != '\0' ) { nglob += count_char( dom, dom_len, '.' ) + 1; }
+    }
+    nseg = nglob + count_char( pattern, user_len, '*' ) + 
+	count_char( dom, dom_len, '*' );
+
+    pat = malloc( sizeof( wild_pat ) + nglob * sizeof( wild_glob ) + 
+		  nseg * sizeof( wild_seg ) + plen * sizeof( int ) + 
+		  plen + 1 );
+    if ( pat == NULL ) { return NULL; }
+    glob = (wild_glob*)( pat + 1 );
+    seg = (wild_seg*)( glob + nglob );
+    fail = (int*)( seg + nseg );
+    copy = (char*)( fail + plen );
+    memcpy( copy, pattern, plen + 1 );
+
+    pat->at = at != NULL;
+    pat->dom = nglob > 1;
+    pat->nglob = nglob;
+    pat->glob = glob;
+    glob_compile( &glob[0], copy, user_len, &seg, &fail );
+    if ( pat->dom ) {
+	s = copy + ( dom - pattern );
+	end = s + dom_len;
+	for ( i = 1; i < nglob; i++, s = dot + 1 ) {
+	    dot = memchr( s, '.', end - s );
+	    if ( dot == NULL ) { dot = end; }
+	    glob_compile( &glob[i], s, dot - s, &seg, &fail );
+	}
+    }
+    return pat;
+}
 
-    if ( !wild_match( pat_user, em_user ) ) { goto done; }
+/* user up to the first '@', domain (if not empty) up to the next; a
+ * pattern's user part must match, and its domain labels match the
+ * resource's one for one.  A pattern with no '@' is matched against
+ * the whole resource.
+ */
 
-    if ( !pat_dom && !em_dom ) { ret = 1; goto done; } /* no @ in either, ok */
+static int wild_pat_match( const wild_pat* pat, const char* email )
+{
+    const char* at = strchr( email, '@' ), *dom = NULL, *end = NULL;
+    const char* label = NULL, *dot = NULL;
+    int i = 0;
+
+    if ( at && at[1] != '\0' ) { 
+	dom = at + 1; 
+	end = strchr( dom, '@' );
+	if ( end == NULL ) { end = dom + strlen( dom ); }
+    }
 
-    pat_next = pat_dom; em_next = em_dom;
-    do {
-	pat_sub = pat_next; em_sub = em_next;
-	pat_next = strchr( pat_next, '.' ); 
-	if ( pat_next ) { *pat_next = '\0'; pat_next++; }
-	em_next = strchr( em_next, '.' ); 
-	if ( em_next ) { *em_next = '\0'; em_next++; }
+    /* if @ in pattern, must have @ sign in email too */
+    if ( pat->dom && dom == NULL ) { return 0; }
+    if ( !pat->at ) { return glob_match( &pat->glob[0], email, 
+					 at && !dom ? at - email : 
+					 (int)strlen( email ) ); }
+    if ( !glob_match( &pat->glob[0], email, 
+		      at ? at - email : (int)strlen( email ) ) ) {
+	return 0;
+    }
+    if ( !pat->dom ) { return dom == NULL; }
+
+    /* same number of labels, each matching */
+    for ( i = 1, label = dom; i < pat->nglob; i++, label = dot + 1 ) {
+	dot = memchr( label, '.', end - label );
+	if ( ( dot == NULL ) != ( i == pat->nglob - 1 ) ) { return 0; }
+	if ( dot == NULL ) { dot = end; }
+	if ( !glob_match( &pat->glob[i], label, dot - label ) ) { return 0; }
+    }
+    return 1;
+}
 
-	if ( !wild_match( pat_sub, em_sub ) ) { goto done; }
-	
-    } while ( pat_next && em_next );
+/* compile is a cache for the compiled pattern as for regexps, NULL
+ * to compile for this call only
+ */
 
-    /* different numbers of subdomains, fail */
-    if ( ( pat_next == NULL && em_next != NULL ) ||
-	 ( pat_next != NULL && em_next == NULL ) ) { goto done; }
-    
-    ret = 1;
- done:
-    if ( pat_user ) { free( pat_user ); }
-    if ( pat_dom ) { free( pat_dom ); }
-    if ( em_user ) { free( em_user ); }
-    if ( em_dom ) { free( em_dom ); }
+int email_match( const char* email, const char* pattern, void** compile )
+{
+    wild_pat* pat = compile ? (wild_pat*)*compile : NULL;
+    int ret = 0;
+
+    if ( pat == NULL ) {
+	pat = wild_compile( pattern );
+	if ( pat == NULL ) { return 0; }
+	if ( compile ) { *compile = pat; }
+    }
+    ret = wild_pat_match( pat, email );
+    if ( compile == NULL ) { free( pat ); }
     return ret;
 }
 
 const char* hashcash_version( void ) { return HASHCASH_VERSION_STRING; }
 
-char* hashcash_simple_mint( const char* resource, unsigned bits, 
-			    long anon_period, char* ext, int compress ) {
+char* hashcash_ctx_simple_mint( hashcash_ctx* ctx, const char* resource, 
+				unsigned bits, long anon_period, char* ext, 
+				int compress ) {
     time_t now_time = time( 0 );
     char* stamp = NULL;
-    int ret = hashcash_mint( now_time, 6, resource, bits, anon_period,
-			     &stamp, NULL, NULL, ext, compress, NULL, NULL );
+    int ret = hashcash_ctx_mint( ctx, now_time, 6, resource, bits, 
+				 anon_period, &stamp, NULL, NULL, ext, 
+				 compress, NULL, NULL );
     if ( ret != HASHCASH_OK ) {
 	return NULL;
     }
     return stamp;
 }
 
-int hashcash_mint( time_t now_time, int time_width, const char* resource, 
-		   unsigned bits, long anon_period, char** new_token, 
-		   long* anon_random, double* tries_taken, char* ext,
-		   int compress, hashcash_callback cb, void* user_arg )
+char* hashcash_simple_mint( const char* resource, unsigned bits, 
+			    long anon_period, char* ext, int compress ) {
+    return hashcash_ctx_simple_mint( &hashcash_global_ctx, resource, bits,
+				     anon_period, ext, compress );
+}
+
+/* the stamp up to its random field, as hashcash_ctx_mint would mint it;
+ * the caller frees token
+ */
+
+int hashcash_mint_token( hashcash_ctx* ctx, time_t now_time, int time_width, 
+			 const char* resource, unsigned bits, 
+			 long anon_period, long* anon_random, char* ext, 
+			 char** token )
 {
     long rnd = 0 ;
     char now_utime[ MAX_UTC+1 ] = {0}; /* current time */
-    char* token = 0;
-    double taken;
 
     if ( resource == NULL ) {
 	return HASHCASH_INTERNAL_ERROR;
@@ -182,7 +309,8 @@ int hashcash_mint( time_t now_time, int time_width, const char* resource,
     }
 
     if ( anon_period != 0 ) {
-	if ( !random_rectangular( (long)anon_period, anon_random ) ) {
+	if ( !random_state_rectangular( &ctx->rng, (long)anon_period, 
+					anon_random ) ) {
 	    return HASHCASH_RNG_FAILED;
 	}
     }
@@ -197,12 +325,29 @@ int hashcash_mint( time_t now_time, int time_width, const char* resource,
     hashcash_to_utctimestr( now_utime, time_width, now_time );
 
     if ( !ext ) { ext = ""; }
-    token = malloc( MAX_TOK+strlen(ext)+1 );
-    if ( token == NULL ) { return HASHCASH_OUT_OF_MEMORY; }
-    sprintf( token, "%d:%d:%s:%s:%s:", 
+    *token = malloc( MAX_TOK+strlen(ext)+1 );
+    if ( *token == NULL ) { return HASHCASH_OUT_OF_MEMORY; }
+    sprintf( *token, "%d:%d:%s:%s:%s:", 
 	     HASHCASH_FORMAT_VERSION, bits, now_utime, resource, ext );
+    return HASHCASH_OK;
+}
+
+int hashcash_ctx_mint( hashcash_ctx* ctx, time_t now_time, int time_width, 
+		       const char* resource, unsigned bits, long anon_period, 
+		       char** new_token, long* anon_random, 
+		       double* tries_taken, char* ext, int compress, 
+		       hashcash_callback cb, void* user_arg )
+{
+    char* token = 0;
+    double taken;
+    int ret = hashcash_mint_token( ctx, now_time, time_width, resource, 
+				   bits, anon_period, anon_random, ext, 
+				   &token );
+
+    if ( ret != HASHCASH_OK ) { return ret; }
 
-    taken = hashcash_fastmint( bits,token,compress,new_token,cb,user_arg );
+    taken = hashcash_fastmint( ctx, bits, token, compress, new_token, 
+			       cb, user_arg );
     if ( taken < 0 ) {
 	free( token );
 	return HASHCASH_USER_ABORT;
@@ -214,6 +359,17 @@ int hashcash_mint( time_t now_time, int time_width, const char* resource,
     return HASHCASH_OK;
 }
 
+int hashcash_mint( time_t now_time, int time_width, const char* resource, 
+		   unsigned bits, long anon_period, char** new_token, 
+		   long* anon_random, double* tries_taken, char* ext,
+		   int compress, hashcash_callback cb, void* user_arg )
+{
+    return hashcash_ctx_mint( &hashcash_global_ctx, now_time, time_width,
+			      resource, bits, anon_period, new_token, 
+			      anon_random, tries_taken, ext, compress, 
+			      cb, user_arg );
+}
+
 #define X_HASHCASH "X-Hashcash"
 #define CONT '\t'
 #define LF "\r\n"
@@ -266,12 +422,19 @@ char* hashcash_make_header( const char* stamp, int line_len,
 time_t round_off( time_t now_time, int digits )
 {
     struct tm* now = NULL ;
+#if defined( unix ) || defined( __unix__ ) || defined( __APPLE__ )
+    struct tm now_tm;
+#endif
 
     if ( digits != 2 && digits != 4 && 
 	 digits != 6 && digits != 8 && digits != 10 ) {
 	return now_time;
     }
+#if defined( unix ) || defined( __unix__ ) || defined( __APPLE__ )
+    now = gmtime_r( &now_time, &now_tm );	/* re-entrant, for contexts */
+#else
     now = gmtime( &now_time );	/* still in UTC */
+#endif
 
     switch ( digits ) {
     case 10: now->tm_mon = 0;
@@ -307,17 +470,100 @@ int hashcash_validity_to_width( long validity_period )
 #define VALID_STR_CHARS "/+0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"\
 			"abcdefghijklmnopqrstuvwxyz="
 
-int hashcash_parse( const char* token, int* vers, int* bits, char* utct,
-		    int utct_max, char* token_resource, int res_max, 
-		    char** ext, int ext_max ) 
+/* character classes for hashcash_parse_view: rnd and cnt may only use
+ * VALID_STR_CHARS, : separates fields, \0 ends the stamp
+ */
+
+#define VIEW_BAD 0
+#define VIEW_STR 1
+#define VIEW_COLON 2
+#define VIEW_END 3
+
+static const unsigned char view_class[ 256 ] = {
+    3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 0, 0, 1, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+#define VIEW_FIELDS 7
+
+/* atoi of at most max chars of the field, as atoi of sstrtok's copy */
+
+static int view_atoi( const char* stamp, const hashcash_field* f, int max )
+{
+    char num[ 3+1 ] = {0};
+
+    sstrncpy( num, stamp + f->off, f->len < max ? f->len : max );
+    return atoi( num );
+}
+
+/* field k as sstrtok would find it: present if the text after the kth
+ * colon is not empty
+ */
+
+static int view_field( hashcash_field* f, int k, const int colon[], 
+		       int ncolon, int len )
 {
-    char ver_arr[MAX_VER+1] = {0};
-    char bits_arr[3+1] = {0};
-    char *bits_str = bits_arr, *ver = ver_arr;
-    char *rnd = NULL, *cnt = NULL;
-    char *state = NULL ;
-    int ver_len = 0, utct_len = 0, res_len = 0, bit_len = 0;
-    int rnd_len = 0, cnt_len = 0 ;
+    f->off = k ? colon[k-1] + 1 : 0;
+    f->len = ( ncolon > k ? colon[k] : len ) - f->off;
+    return k ? ncolon >= k && f->off < len : len > 0;
+}
+
+int hashcash_parse_view( const char* stamp, hashcash_view* view,
+			 unsigned char digest[ SHA1_DIGEST_BYTES ] )
+{
+    const unsigned char* s = (const unsigned char*)stamp;
+    hashcash_field f[ VIEW_FIELDS ];
+    hashcash_field zero = { 0, 0 };
+    SHA1_ctx ctx;
+    int colon[ VIEW_FIELDS ];
+    int ncolon = 0, rnd_field = -1, cnt_field = -1, bad = 0;
+    int i = 0, start = 0, end = 0, k = 0, nfields = 0;
+
+    view->vers = 0; view->bits = -1; view->len = 0;
+    view->ver = view->claim = view->utct = view->res = zero;
+    view->ext = view->rnd = view->cnt = zero;
+
+    /* one block at a time: classify it, then hash it while in cache */
+
+    if ( digest ) { SHA1_Init( &ctx ); }
+    for ( start = 0; ; start = i ) {
+	for ( end = start + SHA1_INPUT_BYTES; i < end; i++ ) {
+	    switch ( view_class[ s[i] ] ) {
+	    case VIEW_STR: continue;
+	    case VIEW_END: goto block_done;
+	    case VIEW_COLON:
+		if ( ncolon < VIEW_FIELDS ) { colon[ ncolon ] = i; }
+		if ( ncolon++ == 0 ) {
+		    view_field( &f[0], 0, colon, ncolon, i );
+		    view->vers = view_atoi( stamp, &f[0], MAX_VER );
+		    if ( view->vers == 0 ) { rnd_field = 3; }
+		    if ( view->vers == 1 ) { rnd_field = 5; cnt_field = 6; }
+		}
+		break;
+	    default:
+		if ( ncolon == rnd_field || ncolon == cnt_field ) { bad = 1; }
+	    }
+	}
+    block_done:
+	if ( digest ) { SHA1_Update( &ctx, s + start, i - start ); }
+	if ( i < end ) { break; }
+    }
+    if ( digest ) { SHA1_Final( &ctx, digest ); }
+    view->len = i;
 
     /* parse out the resource name component 
      * v1 format:   ver:bits:utctime:resource:ext:rand:counter
@@ -329,47 +575,66 @@ int hashcash_parse( const char* token, int* vers, int* bits, char* utct,
      * :s some encoding such as URL encoding must be used
      */
 
+    if ( !view_field( &f[0], 0, colon, ncolon, i ) ) { return 0; }
+    view->ver = f[0];
+    view->vers = view_atoi( stamp, &f[0], MAX_VER );
+    if ( view->vers == 0 ) { nfields = 4; }
+    else if ( view->vers == 1 ) { nfields = VIEW_FIELDS; }
+    else { return 0; }
+    for ( k = 1; k < nfields; k++ ) {
+	if ( !view_field( &f[k], k, colon, ncolon, i ) ) { return 0; }
+    }
+    if ( view->vers == 0 ) {
+	view->utct = f[1]; view->res = f[2]; view->rnd = f[3];
+    } else {
+	view->claim = f[1]; view->utct = f[2]; view->res = f[3];
+	view->ext = f[4]; view->rnd = f[5]; view->cnt = f[6];
+	view->bits = view_atoi( stamp, &f[1], 3 );
+	if ( view->bits < 0 ) { return 0; }
+    }
+    return !bad;
+}
+
+/* copy a field truncated to max (0 for no limit) */
+
+static void view_copy( char* dst, int max, const char* stamp, 
+		       const hashcash_field* f )
+{
+    sstrncpy( dst, stamp + f->off, max > 0 && max < f->len ? max : f->len );
+}
+
+int hashcash_parse( const char* token, int* vers, int* bits, char* utct,
+		    int utct_max, char* token_resource, int res_max, 
+		    char** ext, int ext_max ) 
+{
+    hashcash_view view;
+
     if ( ext != NULL ) { *ext = NULL; }
-    if ( !sstrtok( token, ":", &ver, MAX_VER, &ver_len, &state ) ) {
-	return 0;
+    if ( !hashcash_parse_view( token, &view, NULL ) ) { 
+	*vers = view.vers; 
+	return 0; 
     }
-    *vers = atoi( ver ); if ( *vers < 0 ) { return 0; }
-    if ( *vers == 0 ) {
-	*bits = -1;
-	if ( !sstrtok( NULL, ":", &utct, utct_max, &utct_len, &state ) ||
-	     !sstrtok( NULL, ":", &token_resource, res_max,&res_len,&state ) ||
-	     !sstrtok( NULL, ":", &rnd, 0, &rnd_len, &state ) ) {
-	    return 0;
-	}
-    } else if ( *vers == 1 ) {
-	if ( !sstrtok( NULL, ":", &bits_str, 3, &bit_len, &state ) ||
-	     !sstrtok( NULL, ":", &utct, utct_max, &utct_len, &state ) ||
-	     !sstrtok( NULL, ":", &token_resource, res_max,&res_len,&state ) ||
-	     !sstrtok( NULL, ":", ext, 0, &ext_max, &state ) ||
-	     !sstrtok( NULL, ":", &rnd, 0, &rnd_len, &state ) ||
-	     !sstrtok( NULL, ":", &cnt, 0, &cnt_len, &state ) ) {
-	    return 0; 
-	}
-	*bits = atoi( bits_str ); if ( *bits < 0 ) { return 0; }
-	if ( strspn( cnt, VALID_STR_CHARS ) != cnt_len ) { return 0; }
+    *vers = view.vers;
+    *bits = view.bits;
+    view_copy( utct, utct_max, token, &view.utct );
+    view_copy( token_resource, res_max, token, &view.res );
+    if ( ext != NULL && view.vers == 1 ) {
+	*ext = malloc( view.ext.len + 1 );
+	if ( *ext == NULL ) { return 0; }
+	view_copy( *ext, 0, token, &view.ext );
     }
-    if ( rnd == NULL || strspn( rnd, VALID_STR_CHARS ) != rnd_len ) { return 0; }
     return 1;
 }
 
-unsigned hashcash_count( const char* token )
+/* 0 if token is not a version hashcash_count can value */
+
+static int count_version_ok( const char* token )
 {
-    SHA1_ctx ctx;
-    byte target_digest[ SHA1_DIGEST_BYTES ] = {0};
-    byte token_digest[ SHA1_DIGEST_BYTES ] = {0};
     char ver[MAX_VER+1] = {0};
     int vers = 0 ;
     char* first_colon = NULL; 
     char* second_colon = NULL; 
     int ver_len = 0 ;
-    int i = 0 ;
-    int last = 0 ;
-    int preimage_bits = 0 ;
 
     first_colon = strchr( token, ':' );
     if ( first_colon == NULL ) { return 0; } /* should really fail */
@@ -381,13 +646,18 @@ unsigned hashcash_count( const char* token )
     if ( vers > 1 ) { return 0; } /* unsupported version number */
     second_colon = strchr( first_colon+1, ':' );
     if ( second_colon == NULL ) { return 0; } /* should really fail */
+    return 1;
+}
 
-    memset( target_digest, 0, SHA1_DIGEST_BYTES );
+/* leading zero bits of digest */
+
+static unsigned count_digest( const byte token_digest[ SHA1_DIGEST_BYTES ] )
+{
+    byte target_digest[ SHA1_DIGEST_BYTES ] = {0};
+    int i = 0 ;
+    int last = 0 ;
+    int preimage_bits = 0 ;
 
-    SHA1_Init( &ctx );
-    SHA1_Update( &ctx, token, strlen( token ) );
-    SHA1_Final( &ctx, token_digest );
-   
     for ( i = 0; 
 	  i < SHA1_DIGEST_BYTES && token_digest[ i ] == target_digest[ i ]; 
 	  i++ ) { 
@@ -398,7 +668,7 @@ unsigned hashcash_count( const char* token )
 
 #define bit( n, c ) (((c) >> (7 - (n))) & 1)
 
-    for ( i = 0; i < 8; i++ ) 
+    for ( i = 0; i < 8 && last < SHA1_DIGEST_BYTES; i++ ) 
     {
 	if ( bit( i, token_digest[ last ] ) == 
 	     bit( i, target_digest[ last ] ) ) { 
@@ -410,6 +680,19 @@ unsigned hashcash_count( const char* token )
     return preimage_bits;
 }
 
+unsigned hashcash_count( const char* token )
+{
+    SHA1_ctx ctx;
+    byte token_digest[ SHA1_DIGEST_BYTES ] = {0};
+
+    if ( !count_version_ok( token ) ) { return 0; }
+
+    SHA1_Init( &ctx );
+    SHA1_Update( &ctx, token, strlen( token ) );
+    SHA1_Final( &ctx, token_digest );
+    return count_digest( token_digest );
+}
+
 long hashcash_valid_for( time_t token_time, long validity_period,
 			 long grace_period, time_t now_time )
 {
@@ -435,10 +718,10 @@ long hashcash_valid_for( time_t token_time, long validity_period,
 #define REGEXP_UNSUP "{}"
 #define REGEXP_SAME "\\.?[]*+^$"
 
-#define MAX_RE_ERR 256
+/* regexp errors are written to re_err */
 
 int regexp_match( const char* str, const char* regexp, 
-		  void** compile, char** err ) 
+		  void** compile, char** err, char re_err[MAX_RE_ERR+1] ) 
 {
 #if defined( REGEXP_BSD )
 	char* q = NULL ;
@@ -481,7 +764,6 @@ int regexp_match( const char* str, const char* regexp,
 	int re_code = 0 ;
 	char* bound_regexp = NULL ;
 	int re_len = 0 , bre_len = 0 ;
-	static char re_err[ MAX_RE_ERR+1 ] = {0};
 	re_err[0] = '\0';
 	*err = NULL;
 	
@@ -522,18 +804,21 @@ int regexp_match( const char* str, const char* regexp,
 #endif
 }
 
-int hashcash_resource_match( int type, const char* token_res, const char* res,
-			     void** compile, char** err ) 
+int hashcash_resource_match_buf( int type, const char* token_res, 
+				 const char* res, void** compile, char** err,
+				 char re_buf[MAX_RE_ERR+1] ) 
 {
     switch ( type ) {
     case TYPE_STR: 
 	if ( strcmp( token_res, res ) != 0 ) { return 0; }
 	break;
     case TYPE_WILD:
-	if ( !email_match( token_res, res  ) ) { return 0; }
+	if ( !email_match( token_res, res, compile ) ) { return 0; }
 	break;
     case TYPE_REGEXP:
-	if ( !regexp_match( token_res, res, compile, err ) ) { return 0; }
+	if ( !regexp_match( token_res, res, compile, err, re_buf ) ) { 
+	    return 0; 
+	}
 	break;
     default:
 	return 0;
@@ -541,59 +826,224 @@ int hashcash_resource_match( int type, const char* token_res, const char* res,
     return 1;
 }
 
-int hashcash_check( const char* token, int case_flag, const char* resource,
-		    void **compile, char** re_err, int type, time_t now_time, 
-		    long validity_period, long grace_period, 
-		    int required_bits, time_t* token_time ) {
-    time_t token_t = 0 ;
+int hashcash_ctx_resource_match( hashcash_ctx* ctx, int type, 
+				 const char* token_res, const char* res,
+				 void** compile, char** err ) 
+{
+    return hashcash_resource_match_buf( type, token_res, res, compile, err,
+					ctx->re_err );
+}
+
+int hashcash_resource_match( int type, const char* token_res, const char* res,
+			     void** compile, char** err ) 
+{
+    return hashcash_ctx_resource_match( &hashcash_global_ctx, type, 
+					token_res, res, compile, err );
+}
+
+/* all of hashcash_stamp_prepare but valuing the stamp; if digest is not
+ * NULL the stamp is hashed into it in the same pass
+ */
+
+static int stamp_parse( hashcash_stamp* prepared, const char* token,
+			hashcash_view* view, byte* digest ) {
     char token_utime[ MAX_UTC+1 ] = {0};
-    char token_res[ MAX_RES+1 ] = {0};
-    int bits = 0, claimed_bits = 0, vers = 0;
-    
-    if ( token_time == NULL ) { token_time = &token_t; }
+    hashcash_stamp* p = prepared;
+
+    p->status = HASHCASH_INVALID;
+    p->vers = 0; p->claimed_bits = 0; p->bits = 0; p->time = 0;
+    p->res[0] = '\0'; p->lower_res[0] = '\0';
 
-    if ( !hashcash_parse( token, &vers, &claimed_bits, token_utime, 
-			  MAX_UTC, token_res, MAX_RES, NULL, 0 ) ) {
-	return HASHCASH_INVALID;
+    if ( !hashcash_parse_view( token, view, digest ) ) {
+	return p->status = HASHCASH_INVALID;
     }
+    p->vers = view->vers;
+    p->claimed_bits = view->bits;
 
-    if ( vers < 0 || vers > 1 ) {
-	return HASHCASH_UNSUPPORTED_VERSION;
+    view_copy( token_utime, MAX_UTC, token, &view->utct );
+    p->time = hashcash_from_utctimestr( token_utime, 1 );
+    if ( p->time == -1 ) {
+	return p->status = HASHCASH_INVALID;
     }
 
-    *token_time = hashcash_from_utctimestr( token_utime, 1 );
-    if ( *token_time == -1 ) {
-	return HASHCASH_INVALID;
+    view_copy( p->res, MAX_RES, token, &view->res );
+    strcpy( p->lower_res, p->res );
+    stolower( p->lower_res );
+    return p->status = HASHCASH_OK;
+}
+
+/* a parsed stamp with a longer version than hashcash_count accepts is
+ * worth 0 bits
+ */
+
+#define VIEW_COUNTS( view ) ( (view).ver.len <= MAX_VER )
+
+static void stamp_value( hashcash_stamp* p, unsigned count ) {
+    p->bits = count;
+    if ( p->vers == 1 ) {
+	p->bits = ( p->bits < p->claimed_bits ) ? 0 : p->claimed_bits;
     }
+}
+
+int hashcash_stamp_prepare( hashcash_stamp* prepared, const char* token ) {
+    hashcash_view view;
+    byte digest[ SHA1_DIGEST_BYTES ];
 
-    if ( !case_flag ) {
-	stolower( token_res );
+    if ( stamp_parse( prepared, token, &view, digest ) == HASHCASH_OK ) {
+	stamp_value( prepared, VIEW_COUNTS( view ) ? 
+		     count_digest( digest ) : 0 );
     }
+    return prepared->status;
+}
+
+/* parse all then hash the valid ones together */
+
+#define PREPARE_BATCH 256
+
+int hashcash_stamp_prepare_batch( hashcash_stamp prepared[], 
+				  const char* const stamps[], int n ) {
+    const void* msgs[ PREPARE_BATCH ];
+    size_t lens[ PREPARE_BATCH ];
+    byte digests[ PREPARE_BATCH ][ SHA1_DIGEST_BYTES ];
+    int which[ PREPARE_BATCH ];
+    hashcash_view view;
+    int i = 0, j = 0, k = 0, ok = 0;
+
+    for ( i = 0; i < n; i += PREPARE_BATCH ) {
+	for ( k = 0, j = i; j < n && j < i + PREPARE_BATCH; j++ ) {
+	    if ( stamp_parse( &prepared[j], stamps[j], &view, NULL ) 
+		 != HASHCASH_OK ) {
+		continue;
+	    }
+	    ok++;
+	    if ( !VIEW_COUNTS( view ) ) { 
+		stamp_value( &prepared[j], 0 ); continue; 
+	    }
+	    msgs[k] = stamps[j];
+	    lens[k] = view.len;
+	    which[k++] = j;
+	}
+	SHA1_Multi( k, msgs, lens, digests );
+	for ( j = 0; j < k; j++ ) {
+	    stamp_value( &prepared[ which[j] ], count_digest( digests[j] ) );
+	}
+    }
+    return ok;
+}
+
+int hashcash_ctx_stamp_check_resource( hashcash_ctx* ctx, 
+				       const hashcash_stamp* prepared, 
+				       int case_flag, const char* resource, 
+				       void **compile, char** re_err, 
+				       int type, time_t now_time, 
+				       long validity_period, 
+				       long grace_period, int required_bits ) {
+    if ( prepared->status != HASHCASH_OK ) { return prepared->status; }
 
     if ( resource && 
-	 !hashcash_resource_match( type, token_res, 
-				   resource, compile, re_err ) ) {
+	 !hashcash_ctx_resource_match( ctx, type, case_flag ? prepared->res :
+				       prepared->lower_res, 
+				       resource, compile, re_err ) ) {
        if ( re_err && *re_err != NULL ) {
 	    return HASHCASH_REGEXP_ERROR;
 	} else {
 	    return HASHCASH_WRONG_RESOURCE;
 	}
     }
-    bits = hashcash_count( token );
-    if ( vers == 1 ) {
-	bits = ( bits < claimed_bits ) ? 0 : claimed_bits;
-    }
 
-    if ( bits < required_bits ) {
+    if ( prepared->bits < required_bits ) {
 	return HASHCASH_INSUFFICIENT_BITS;
     }
-    return hashcash_valid_for( *token_time, validity_period, 
+    return hashcash_valid_for( prepared->time, validity_period, 
 			       grace_period, now_time );
 }
 
+int hashcash_stamp_check_resource( const hashcash_stamp* prepared, 
+				   int case_flag, const char* resource, 
+				   void **compile, char** re_err, int type, 
+				   time_t now_time, long validity_period, 
+				   long grace_period, int required_bits ) {
+    return hashcash_ctx_stamp_check_resource( &hashcash_global_ctx, prepared,
+					      case_flag, resource, compile, 
+					      re_err, type, now_time, 
+					      validity_period, grace_period,
+					      required_bits );
+}
+
+int hashcash_ctx_check( hashcash_ctx* ctx, const char* token, int case_flag, 
+			const char* resource, void **compile, char** re_err, 
+			int type, time_t now_time, long validity_period, 
+			long grace_period, int required_bits, 
+			time_t* token_time ) {
+    hashcash_stamp prepared;
+
+    hashcash_stamp_prepare( &prepared, token );
+    if ( token_time ) { *token_time = prepared.time; }
+    return hashcash_ctx_stamp_check_resource( ctx, &prepared, case_flag, 
+					      resource, compile, re_err, 
+					      type, now_time, validity_period,
+					      grace_period, required_bits );
+}
+
+int hashcash_check( const char* token, int case_flag, const char* resource,
+		    void **compile, char** re_err, int type, time_t now_time, 
+		    long validity_period, long grace_period, 
+		    int required_bits, time_t* token_time ) {
+    return hashcash_ctx_check( &hashcash_global_ctx, token, case_flag, 
+			       resource, compile, re_err, type, now_time, 
+			       validity_period, grace_period, required_bits,
+			       token_time );
+}
+
+#define CHECK_BATCH 32
+
+int hashcash_ctx_check_batch( hashcash_ctx* ctx, int n, 
+			      const char* const stamps[], int case_flag, 
+			      const char* resource, void **compile, 
+			      char** re_err, int type, time_t now_time, 
+			      long validity_period, long grace_period, 
+			      int required_bits, int results[], 
+			      time_t stamp_times[] ) {
+    hashcash_stamp prepared[ CHECK_BATCH ];
+    int i = 0, j = 0, m = 0, valid = 0;
+
+    for ( i = 0; i < n; i += m ) {
+	m = n - i < CHECK_BATCH ? n - i : CHECK_BATCH;
+	hashcash_stamp_prepare_batch( prepared, stamps + i, m );
+	for ( j = 0; j < m; j++ ) {
+	    if ( stamp_times ) { stamp_times[ i+j ] = prepared[j].time; }
+	    results[ i+j ] = hashcash_ctx_stamp_check_resource( 
+		ctx, &prepared[j], case_flag, resource, compile, re_err, 
+		type, now_time, validity_period, grace_period, 
+		required_bits );
+	    if ( results[ i+j ] >= 0 ) { valid++; }
+	}
+    }
+    return valid;
+}
+
+int hashcash_check_batch( int n, const char* const stamps[], 
+			  int case_flag, const char* resource, 
+			  void **compile, char** re_err, int type, 
+			  time_t now_time, long validity_period, 
+			  long grace_period, int required_bits, 
+			  int results[], time_t stamp_times[] ) {
+    return hashcash_ctx_check_batch( &hashcash_global_ctx, n, stamps, 
+				     case_flag, resource, compile, re_err, 
+				     type, now_time, validity_period, 
+				     grace_period, required_bits, results, 
+				     stamp_times );
+}
+
+double hashcash_ctx_estimate_time( hashcash_ctx* ctx, int b )
+{
+    return hashcash_expected_tries( b ) / 
+	(double)hashcash_ctx_effective_per_sec( ctx );
+}
+
 double hashcash_estimate_time( int b )
 {
-    return hashcash_expected_tries( b ) / (double)hashcash_per_sec();
+    return hashcash_ctx_estimate_time( &hashcash_global_ctx, b );
 }
 
 double hashcash_expected_tries( int b )
@@ -16,6 +16,9 @@
     #include <stdio.h>
 #endif
 #include <string.h>
+#if defined( __SSSE3__ )
+    #include <tmmintrin.h>
+#endif
 #include "sha1.h"
 
 static int swap_endian32( void*, size_t );
@@ -152,33 +155,12 @@ void SHA1_Init_With_IV( SHA1_ctx* ctx,
     make_local_endian32( ctx->H, SHA1_DIGEST_WORDS );
 }
 
-void SHA1_Transform(  word32 H[ SHA1_DIGEST_WORDS ], 
-		      const byte M[ SHA1_INPUT_BYTES ] )
-{
-#ifdef	COMPACT
-    int t = 0 ;
-#endif
-    word32 A = H[ 0 ];
-    word32 B = H[ 1 ];
-    word32 C = H[ 2 ];
-    word32 D = H[ 3 ];
-    word32 E = H[ 4 ];
 #if !defined( COMPACT )
-    word32 W[ 16 ] = {0};
+#define W_WORDS 16
 #else
-    word32 W[ 80 ] = {0};
+#define W_WORDS 80
 #endif
 
-    memcpy( W, M, SHA1_INPUT_BYTES );
-
-/* Use method B from FIPS-180 (see fip-180.txt) where the use of
-   temporary array W of 80 word32s is avoided by working in a circular
-   buffer of size 16 word32s.
-
-   (Chromatix:  this is unreasonably slow on x86 due to register
-    pressure - going back to method A)
-*/
-
 /********************* define some macros *********************/
 
 /* Wc = access W as 16 word circular buffer */
@@ -237,6 +219,28 @@ void SHA1_Transform(  word32 H[ SHA1_DIGEST_WORDS ],
     ROUND5( t + 10, Func, K );\
     ROUND5( t + 15, Func, K )
 
+/* the 80 rounds on a block already in W as host order words (W is
+   used as scratch) */
+
+static void SHA1_Rounds( word32 H[ SHA1_DIGEST_WORDS ], word32 W[ W_WORDS ] )
+{
+#if defined( COMPACT ) || defined( VERBOSE )
+    int t = 0 ;
+#endif
+    word32 A = H[ 0 ];
+    word32 B = H[ 1 ];
+    word32 C = H[ 2 ];
+    word32 D = H[ 3 ];
+    word32 E = H[ 4 ];
+
+/* Use method B from FIPS-180 (see fip-180.txt) where the use of
+   temporary array W of 80 word32s is avoided by working in a circular
+   buffer of size 16 word32s.
+
+   (Chromatix:  this is unreasonably slow on x86 due to register
+    pressure - going back to method A)
+*/
+
 /********************* use the macros *********************/
 
 #if defined( VERBOSE ) && !defined( COMPACT )
@@ -277,6 +281,53 @@ void SHA1_Transform(  word32 H[ SHA1_DIGEST_WORDS ],
     H[ 4 ] += E;
 }
 
+void SHA1_Transform(  word32 H[ SHA1_DIGEST_WORDS ], 
+		      const byte M[ SHA1_INPUT_BYTES ] )
+{
+    word32 W[ W_WORDS ];
+
+    memcpy( W, M, SHA1_INPUT_BYTES );
+    SHA1_Rounds( H, W );
+}
+
+/* Bulk input: whole blocks are hashed where they lie in the caller's
+   buffer, aligned or not, the big endian words loaded straight into
+   W rather than copied to ctx->M, swapped there and copied again.
+   The shifts below compile to a load and a bswap (or movbe); with
+   SSSE3 a pshufb swaps four words at a time.
+*/
+
+#define LOAD_BE32( p ) \
+    ( (word32)(p)[ 0 ] << 24 | (word32)(p)[ 1 ] << 16 | \
+      (word32)(p)[ 2 ] << 8 | (word32)(p)[ 3 ] )
+
+static void SHA1_Transform_Blocks( word32 H[ SHA1_DIGEST_WORDS ], 
+				   const byte* data, size_t blocks )
+{
+    word32 W[ W_WORDS ];
+#if defined( __SSSE3__ )
+    const __m128i swap = _mm_set_epi8( 12, 13, 14, 15, 8, 9, 10, 11, 
+				       4, 5, 6, 7, 0, 1, 2, 3 );
+#endif
+    int t = 0 ;
+
+    for ( ; blocks > 0; blocks--, data += SHA1_INPUT_BYTES ) {
+#if defined( __SSSE3__ )
+	for ( t = 0; t < SHA1_INPUT_WORDS; t += 4 ) {
+	    _mm_storeu_si128( (__m128i*)( W + t ), 
+	        _mm_shuffle_epi8( 
+		    _mm_loadu_si128( (const __m128i*)( data + 4*t ) ), 
+		    swap ) );
+	}
+#else
+	for ( t = 0; t < SHA1_INPUT_WORDS; t++ ) {
+	    W[ t ] = LOAD_BE32( data + 4*t );
+	}
+#endif
+	SHA1_Rounds( H, W );
+    }
+}
+
 void SHA1_Update( SHA1_ctx* ctx, const void* pdata, size_t data_len )
 {
     const byte* data = (const byte*)pdata;
@@ -299,23 +350,26 @@ void SHA1_Update( SHA1_ctx* ctx, const void* pdata, size_t data_len )
     if ( ctx->lbits < low_bits ) { ctx->hbits++; }
 #endif
 
-/* deal with first block */
+/* top up a partly filled first block */
 
-    use = (unsigned)min( (size_t)(SHA1_INPUT_BYTES - mlen), data_len );
-    memcpy( ctx->M + mlen, data, use );
-    mlen += use;
-    data_len -= use;
-    data += use;
+    if ( mlen > 0 ) {
+	use = (unsigned)min( (size_t)(SHA1_INPUT_BYTES - mlen), data_len );
+	memcpy( ctx->M + mlen, data, use );
+	mlen += use;
+	data_len -= use;
+	data += use;
 
-    while ( mlen == SHA1_INPUT_BYTES ) {
+	if ( mlen < SHA1_INPUT_BYTES ) { return; }
 	make_big_endian32( (word32*)ctx->M, SHA1_INPUT_WORDS );
 	SHA1_Transform( ctx->H, ctx->M );
-	use = (unsigned)min( SHA1_INPUT_BYTES, data_len );
-	memcpy( ctx->M, data, use );
-	mlen = use;
-	data_len -= use;
-        data += use;
     }
+
+/* whole blocks straight from the input, then buffer the rest */
+
+    SHA1_Transform_Blocks( ctx->H, data, data_len / SHA1_INPUT_BYTES );
+    data += data_len - data_len % SHA1_INPUT_BYTES;
+    data_len %= SHA1_INPUT_BYTES;
+    memcpy( ctx->M, data, data_len );
 }
 
 void SHA1_Final( SHA1_ctx* ctx, byte digest[ SHA1_DIGEST_BYTES ] )
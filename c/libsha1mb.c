@@ -0,0 +1,354 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/*
+ * Multi-buffer SHA1: hashes several independent messages at once, one
+ * per lane of a SIMD register.  Word t of each lane's block is held in
+ * one vector so every SHA1 operation is done for all lanes by one
+ * instruction: 16 lanes with AVX-512, 8 with AVX2, 4 with SSE2 (or
+ * GCC generic vectors on other CPUs).  A lane takes the next message
+ * when its message is done, so messages of mixed lengths keep every
+ * lane busy; the last one left is finished on its own.  Messages can
+ * start from a midstate, a context that has already hashed a prefix.
+ *
+ * Written with GCC vector extensions; other compilers get the scalar
+ * SHA1 one message at a time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "sha1.h"
+
+#if defined( __GNUC__ ) && \
+    ( __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 ) )
+    #define MB_VECTOR
+    #if defined( __x86_64__ ) || defined( __i386__ )
+        #define MB_X86
+    #endif
+#endif
+
+#define MB_H0 0x67452301
+#define MB_H1 0xEFCDAB89
+#define MB_H2 0x98BADCFE
+#define MB_H3 0x10325476
+#define MB_H4 0xC3D2E1F0
+
+#if defined( MB_VECTOR )
+
+/* as in libsha1.c, but on vectors of words */
+
+#define MB_F1( B, C, D ) ( (D) ^ ( (B) & ( (C) ^ (D) ) ) )
+#define MB_F2( B, C, D ) ( (B) ^ (C) ^ (D) )
+#define MB_F3( B, C, D ) ( ( (B) & ( (C) | (D) ) ) | ( (C) & (D) ) )
+#define MB_S( n, X ) ( ( (X) << (n) ) | ( (X) >> ( 32 - (n) ) ) )
+
+#define MB_K1 ((word32)0x5A827999)
+#define MB_K2 ((word32)0x6ED9EBA1)
+#define MB_K3 ((word32)0x8F1BBCDC)
+#define MB_K4 ((word32)0xCA62C1D6)
+
+#define MB_EXPAND( t )							\
+    W[ (t) & 15 ] = MB_S( 1, W[ ((t)-3) & 15 ] ^ W[ ((t)-8) & 15 ] ^	\
+			  W[ ((t)-14) & 15 ] ^ W[ (t) & 15 ] )
+
+#define MB_ROUND( F, K, t )						\
+    T = MB_S( 5, A ) + F( B, C, D ) + E + W[ (t) & 15 ] + (K);		\
+    E = D; D = C; C = MB_S( 30, B ); B = A; A = T
+
+/* one block for every lane: state is 5 words, block 16 words, each
+ * word a vector's worth of lanes
+ */
+
+#define MB_XFORM( name, vec )						\
+static void name( word32* state, const word32* block )			\
+{									\
+    vec W[ 16 ], H[ 5 ], A, B, C, D, E, T;				\
+    int t;								\
+									\
+    memcpy( W, block, sizeof( W ) );					\
+    memcpy( H, state, sizeof( H ) );					\
+    A = H[0]; B = H[1]; C = H[2]; D = H[3]; E = H[4];			\
+    for ( t = 0; t < 16; t++ ) { MB_ROUND( MB_F1, MB_K1, t ); }	\
+    for ( ; t < 20; t++ ) { MB_EXPAND( t ); MB_ROUND( MB_F1, MB_K1, t ); } \
+    for ( ; t < 40; t++ ) { MB_EXPAND( t ); MB_ROUND( MB_F2, MB_K2, t ); } \
+    for ( ; t < 60; t++ ) { MB_EXPAND( t ); MB_ROUND( MB_F3, MB_K3, t ); } \
+    for ( ; t < 80; t++ ) { MB_EXPAND( t ); MB_ROUND( MB_F2, MB_K4, t ); } \
+    H[0] += A; H[1] += B; H[2] += C; H[3] += D; H[4] += E;		\
+    memcpy( state, H, sizeof( H ) );					\
+}
+
+typedef word32 mb_v4 __attribute__(( vector_size( 16 ) ));
+MB_XFORM( mb_xform_4, mb_v4 )
+
+#if defined( MB_X86 )
+typedef word32 mb_v8 __attribute__(( vector_size( 32 ) ));
+typedef word32 mb_v16 __attribute__(( vector_size( 64 ) ));
+__attribute__(( target( "avx2" ) )) MB_XFORM( mb_xform_8, mb_v8 )
+__attribute__(( target( "avx512f" ) )) MB_XFORM( mb_xform_16, mb_v16 )
+#endif
+
+#endif
+
+static int mb_lanes = 0;	/* widest the CPU can do, 0 if not probed */
+
+int SHA1_Multi_Lanes( void )
+{
+    int lanes = 1;
+
+    if ( mb_lanes ) { return mb_lanes; }
+#if defined( MB_X86 )
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx512f" ) ) { lanes = 16; }
+    else if ( __builtin_cpu_supports( "avx2" ) ) { lanes = 8; }
+    else if ( __builtin_cpu_supports( "sse2" ) ) { lanes = 4; }
+#elif defined( MB_VECTOR )
+    lanes = 4;
+#endif
+    mb_lanes = lanes;		/* same answer if threads race */
+    return lanes;
+}
+
+static size_t mb_blocks( size_t len )
+{
+    return ( len + 8 ) / SHA1_INPUT_BYTES + 1;
+}
+
+#if defined( MB_VECTOR )
+
+/* a message still to hash: head (bytes buffered in a context) then
+ * msg, after a midstate iv; bits counts the whole message
+ */
+
+typedef struct {
+    word32 iv[ 5 ];
+    const byte* head;
+    size_t head_len;
+    const byte* msg;
+    size_t len;
+    unsigned long long bits;
+    size_t blocks;
+    int i;			/* index into msgs */
+} mb_msg;
+
+/* block b of the message padded as SHA1_Final would, as big endian
+ * words at out[0], out[lanes] .. out[15*lanes]
+ */
+
+static void mb_load( const mb_msg* m, size_t b, int lanes, word32* out )
+{
+    byte pad[ SHA1_INPUT_BYTES ];
+    size_t off = b * SHA1_INPUT_BYTES, total = m->head_len + m->len;
+    size_t from = 0, to = 0;
+    const byte* p = NULL;
+    int w = 0, i = 0;
+
+    if ( off >= m->head_len && off - m->head_len + SHA1_INPUT_BYTES <= 
+	 m->len ) {
+	p = m->msg + ( off - m->head_len ); /* straight from the input */
+    } else {
+	memset( pad, 0, SHA1_INPUT_BYTES );
+	if ( off < m->head_len ) {
+	    to = m->head_len - off;
+	    if ( to > SHA1_INPUT_BYTES ) { to = SHA1_INPUT_BYTES; }
+	    memcpy( pad, m->head + off, to );
+	}
+	from = off < m->head_len ? m->head_len - off : 0;
+	if ( off + from < total ) {
+	    to = total - off;
+	    if ( to > SHA1_INPUT_BYTES ) { to = SHA1_INPUT_BYTES; }
+	    memcpy( pad + from, m->msg + ( off + from - m->head_len ), 
+		    to - from );
+	}
+	if ( off <= total && total < off + SHA1_INPUT_BYTES ) { 
+	    pad[ total - off ] = 0x80; 
+	}
+	if ( b == m->blocks - 1 ) {
+	    for ( i = 0; i < 8; i++ ) {
+		pad[ SHA1_INPUT_BYTES-1-i ] = (byte)( m->bits >> ( 8*i ) );
+	    }
+	}
+	p = pad;
+    }
+    for ( w = 0; w < SHA1_INPUT_WORDS; w++, p += 4 ) {
+	out[ w * lanes ] = ( (word32)p[0] << 24 ) | ( (word32)p[1] << 16 ) |
+	    ( (word32)p[2] << 8 ) | p[3];
+    }
+}
+
+static void mb_digest( const word32* state, int lanes, 
+		       byte digest[ SHA1_DIGEST_BYTES ] )
+{
+    int j = 0;
+
+    for ( j = 0; j < 5; j++ ) {
+	word32 h = state[ j * lanes ];
+	digest[ 4*j ] = (byte)( h >> 24 );
+	digest[ 4*j+1 ] = (byte)( h >> 16 );
+	digest[ 4*j+2 ] = (byte)( h >> 8 );
+	digest[ 4*j+3 ] = (byte)h;
+    }
+}
+
+/* the last message running finishes a lane at a time (the same
+ * rounds, compiled for one word)
+ */
+
+MB_XFORM( mb_xform_1, word32 )
+
+static void mb_tail( const word32* state, int lanes, const mb_msg* m, 
+		     size_t b, byte digest[ SHA1_DIGEST_BYTES ] )
+{
+    word32 one[ 5 ], block[ SHA1_INPUT_WORDS ];
+    int j = 0;
+
+    for ( j = 0; j < 5; j++ ) { one[j] = state[ j * lanes ]; }
+    for ( ; b < m->blocks; b++ ) {
+	mb_load( m, b, 1, block );
+	mb_xform_1( one, block );
+    }
+    mb_digest( one, 1, digest );
+}
+
+/* hash the n messages in lanes; each lane takes the next message as
+ * soon as its last one is done, so lanes are kept busy however the
+ * lengths are mixed.  Longest first, so the lanes drain together.
+ */
+
+static void mb_run( int lanes, int n, const mb_msg* idx,
+		    byte digests[][ SHA1_DIGEST_BYTES ] )
+{
+    word32 state[ 5 * SHA1_MAX_LANES ];
+    word32 block[ SHA1_INPUT_WORDS * SHA1_MAX_LANES ];
+    const mb_msg* lane[ SHA1_MAX_LANES ];
+    size_t b[ SHA1_MAX_LANES ];
+    int l = 0, j = 0, next = 0, busy = 0;
+
+    for ( l = 0; l < lanes; l++ ) { lane[l] = NULL; }
+    for ( ;; ) {
+	for ( l = 0; l < lanes; l++ ) {
+	    if ( lane[l] == NULL && next < n ) {
+		lane[l] = &idx[ next++ ];
+		b[l] = 0;
+		for ( j = 0; j < 5; j++ ) { 
+		    state[ j * lanes + l ] = lane[l]->iv[j]; 
+		}
+	    }
+	}
+	for ( busy = 0, l = 0; l < lanes; l++ ) { busy += lane[l] != NULL; }
+	if ( busy <= 1 ) { break; }
+	for ( l = 0; l < lanes; l++ ) {
+	    if ( lane[l] ) { 
+		mb_load( lane[l], b[l], lanes, block + l ); 
+	    } else {
+		for ( j = 0; j < SHA1_INPUT_WORDS; j++ ) {
+		    block[ j * lanes + l ] = 0;
+		}
+	    }
+	}
+	switch ( lanes ) {
+#if defined( MB_X86 )
+	case 16: mb_xform_16( state, block ); break;
+	case 8: mb_xform_8( state, block ); break;
+#endif
+	default: mb_xform_4( state, block ); break;
+	}
+	for ( l = 0; l < lanes; l++ ) {
+	    if ( lane[l] && ++b[l] == lane[l]->blocks ) {
+		mb_digest( state + l, lanes, digests[ lane[l]->i ] );
+		lane[l] = NULL;
+	    }
+	}
+    }
+    for ( l = 0; l < lanes; l++ ) {
+	if ( lane[l] ) { 
+	    mb_tail( state + l, lanes, lane[l], b[l], 
+		     digests[ lane[l]->i ] ); 
+	}
+    }
+}
+
+static int mb_cmp( const void* ap, const void* bp )
+{
+    const mb_msg* a = (const mb_msg*)ap, *b = (const mb_msg*)bp;
+    return a->blocks > b->blocks ? -1 : a->blocks < b->blocks ? 1 : 
+	a->i - b->i;
+}
+
+/* what is left to hash of msg after the midstate in ctx */
+
+static void mb_job( mb_msg* m, const SHA1_ctx* ctx, const void* msg, 
+		    size_t len )
+{
+    static const word32 iv[ 5 ] = { MB_H0, MB_H1, MB_H2, MB_H3, MB_H4 };
+    unsigned long long done = 0;
+
+    memcpy( m->iv, iv, sizeof( iv ) );
+    m->head = NULL;
+    m->head_len = 0;
+#if !defined( OPENSSL )
+    if ( ctx ) {
+	memcpy( m->iv, ctx->H, sizeof( m->iv ) );
+#if defined( word64 )
+	done = ctx->bits;
+#else
+	done = (unsigned long long)ctx->hbits << 32 | ctx->lbits;
+#endif
+	m->head = ctx->M;
+	m->head_len = ( done >> 3 ) % SHA1_INPUT_BYTES;
+    }
+#endif
+    m->msg = (const byte*)msg;
+    m->len = len;
+    m->bits = done + ( (unsigned long long)len << 3 );
+    m->blocks = mb_blocks( m->head_len + len );
+}
+
+#endif
+
+static void mb_scalar( const SHA1_ctx* mid, const void* msg, size_t len,
+		       byte digest[ SHA1_DIGEST_BYTES ] )
+{
+    SHA1_ctx ctx;
+
+    if ( mid ) { ctx = *mid; } else { SHA1_Init( &ctx ); }
+    SHA1_Update( &ctx, msg, len );
+    SHA1_Final( &ctx, digest );
+}
+
+void SHA1_Multi_Final( const SHA1_ctx* const ctx[], const void* const msgs[],
+		       const size_t lens[], int n, 
+		       byte digests[][ SHA1_DIGEST_BYTES ] )
+{
+#if defined( MB_VECTOR )
+    mb_msg* idx = NULL;
+    int i = 0, lanes = 0, max_lanes = SHA1_Multi_Lanes();
+
+#if defined( OPENSSL )
+    if ( ctx ) { max_lanes = 1; } /* can't see into its contexts */
+#endif
+    if ( max_lanes >= 4 && n > 1 ) { 
+	idx = malloc( n * sizeof( mb_msg ) ); 
+    }
+    if ( idx != NULL ) {
+	for ( i = 0; i < n; i++ ) { 
+	    mb_job( &idx[i], ctx ? ctx[i] : NULL, msgs[i], lens[i] );
+	    idx[i].i = i; 
+	}
+	qsort( idx, n, sizeof( mb_msg ), mb_cmp );
+
+	/* the narrowest lanes that take them all */
+	for ( lanes = 4; lanes < n && lanes < max_lanes; lanes *= 2 ) {}
+	mb_run( lanes, n, idx, digests );
+	free( idx );
+	return;
+    }
+#endif
+    for ( i = 0; i < n; i++ ) {
+	mb_scalar( ctx ? ctx[i] : NULL, msgs[i], lens[i], digests[i] );
+    }
+}
+
+void SHA1_Multi( int n, const void* const msgs[], const size_t lens[],
+		 byte digests[][ SHA1_DIGEST_BYTES ] )
+{
+    SHA1_Multi_Final( NULL, msgs, lens, n, digests );
+}
@@ -4,20 +4,28 @@
 
 #if defined( _WIN32 )
 
+void lock_nowait( int on ) { }
 int lock_write( FILE* f ) { return 1; }
 int lock_read( FILE* f ) { return 1; }
 int lock_unlock( FILE* f ) { return 1; }
 
 #else
 
+static int nowait = 0;		/* fail with EWOULDBLOCK, don't wait */
+
+void lock_nowait( int on )
+{
+  nowait = on ? LOCK_NB : 0;
+}
+
 int lock_write( FILE* f )
 {
-  return flock( fileno(f), LOCK_EX ) == 0;
+  return flock( fileno(f), LOCK_EX | nowait ) == 0;
 }
 
 int lock_read( FILE* f )
 {
-  return flock( fileno(f), LOCK_SH ) == 0;
+  return flock( fileno(f), LOCK_SH | nowait ) == 0;
 }
 
 int lock_unlock( FILE* f )
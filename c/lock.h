@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <sys/file.h>
 
+void lock_nowait( int on );
 int lock_write( FILE* f );
 int lock_read( FILE* f );
 int lock_unlock( FILE* f );
@@ -0,0 +1,177 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* miltertest: play an MTA to a mail filter, for testing hashcashd -m
+ *
+ *   miltertest [-n] socket rcpt ... < message
+ *
+ * negotiates (with -n not letting the filter add headers), sends the recipients and the headers of the message and
+ * prints the filter's actions for the end of the message: added
+ * headers as "header: name: value", then continue, reject <text>,
+ * tempfail, accept or discard.  Exits 0 unless the filter can't be
+ * talked to.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_PACKET 65536
+#define MAX_HEADER 8192
+
+static int sock = -1;
+
+static void fail( const char* msg )
+{
+    fprintf( stderr, "miltertest: %s\n", msg );
+    exit( 2 );
+}
+
+static void put_uint( char* p, unsigned long n )
+{
+    p[0] = ( n >> 24 ) & 0xff; p[1] = ( n >> 16 ) & 0xff;
+    p[2] = ( n >> 8 ) & 0xff; p[3] = n & 0xff;
+}
+
+static void send_packet( int cmd, const char* data, long len )
+{
+    char head[5];
+
+    put_uint( head, len + 1 );
+    head[4] = cmd;
+    if ( write( sock, head, 5 ) != 5 ||
+	 ( len > 0 && write( sock, data, len ) != len ) ) {
+	fail( "write failed" );
+    }
+}
+
+static void read_all( char* buf, long len )
+{
+    long got = 0, n = 0;
+
+    for ( got = 0; got < len; got += n ) {
+	n = read( sock, buf + got, len - got );
+	if ( n <= 0 ) { fail( "filter closed the connection" ); }
+    }
+}
+
+/* returns the command, data \0 terminated in buf */
+
+static int read_packet( char* buf, long* len )
+{
+    unsigned char head[5];
+
+    read_all( (char*)head, 5 );
+    *len = ( (long)head[0] << 24 | (long)head[1] << 16 |
+	     (long)head[2] << 8 | head[3] ) - 1;
+    if ( *len < 0 || *len >= MAX_PACKET ) { fail( "bad packet" ); }
+    read_all( buf, *len );
+    buf[ *len ] = '\0';
+    return head[4];
+}
+
+static void expect_continue( void )
+{
+    char buf[ MAX_PACKET ];
+    long len = 0;
+
+    if ( read_packet( buf, &len ) != 'c' ) { fail( "expected continue" ); }
+}
+
+static void send_header( char* header )
+{
+    char* colon = strchr( header, ':' ), *value = NULL;
+    long len = 0;
+
+    if ( colon == NULL ) { return; }
+    *colon = '\0';
+    for ( value = colon + 1; *value == ' ' || *value == '\t'; value++ ) { }
+    len = ( colon - header ) + 1 + strlen( value ) + 1;
+    send_packet( 'L', header, len );
+    expect_continue();
+}
+
+int main( int argc, char* argv[] )
+{
+    struct sockaddr_un addr;
+    char buf[ MAX_PACKET ], header[ MAX_HEADER ], line[ MAX_HEADER ];
+    char opt[12];
+    long len = 0, hlen = 0, n = 0;
+    int i = 0, cmd = 0, done = 0, actions = 0x1ff;
+
+    if ( argc > 1 && strcmp( argv[1], "-n" ) == 0 ) {
+	actions &= ~0x01;	/* SMFIF_ADDHDRS */
+	argv++; argc--;
+    }
+    if ( argc < 2 ) { 
+	fail( "usage: miltertest [-n] socket rcpt ... < message" ); 
+    }
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, argv[1], sizeof( addr.sun_path ) - 1 );
+    sock = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( sock < 0 ||
+	 connect( sock, (struct sockaddr*)&addr, sizeof( addr ) ) != 0 ) {
+	fail( "can't connect" );
+    }
+
+    /* offer everything, send whatever we are not told to skip */
+    put_uint( opt, 6 );
+    put_uint( opt + 4, actions );
+    put_uint( opt + 8, 0 );
+    send_packet( 'O', opt, 12 );
+    if ( read_packet( buf, &len ) != 'O' || len < 12 ) {
+	fail( "bad option negotiation" );
+    }
+
+    for ( i = 2; i < argc; i++ ) {
+	n = sprintf( buf, "<%.*s>", MAX_HEADER, argv[i] );
+	send_packet( 'R', buf, n + 1 );
+	expect_continue();
+    }
+
+    /* headers, continuation lines joined with \r\n as an MTA does */
+    hlen = 0;
+    while ( fgets( line, sizeof( line ), stdin ) ) {
+	n = strlen( line );
+	while ( n > 0 && ( line[n-1] == '\n' || line[n-1] == '\r' ) ) {
+	    line[--n] = '\0';
+	}
+	if ( ( line[0] == ' ' || line[0] == '\t' ) && hlen > 0 ) {
+	    if ( hlen + 2 + n < MAX_HEADER ) {
+		memcpy( header + hlen, "\r\n", 2 );
+		memcpy( header + hlen + 2, line, n + 1 );
+		hlen += 2 + n;
+	    }
+	    continue;
+	}
+	if ( hlen > 0 ) { send_header( header ); hlen = 0; }
+	if ( n == 0 ) { break; }
+	memcpy( header, line, n + 1 );
+	hlen = n;
+    }
+    if ( hlen > 0 ) { send_header( header ); }
+
+    send_packet( 'E', NULL, 0 );
+    while ( !done ) {
+	cmd = read_packet( buf, &len );
+	switch ( cmd ) {
+	case 'h':
+	    printf( "header: %s: %s\n", buf, buf + strlen( buf ) + 1 );
+	    break;
+	case 'c': printf( "continue\n" ); done = 1; break;
+	case 'y': printf( "reject %s\n", buf ); done = 1; break;
+	case 'r': printf( "reject\n" ); done = 1; break;
+	case 't': printf( "tempfail\n" ); done = 1; break;
+	case 'a': printf( "accept\n" ); done = 1; break;
+	case 'd': printf( "discard\n" ); done = 1; break;
+	default: break;
+	}
+    }
+    send_packet( 'Q', NULL, 0 );
+    close( sock );
+    return 0;
+}
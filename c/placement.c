@@ -0,0 +1,186 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* Where minting threads run.  The minters are register bound, so two
+ * threads on SMT siblings of one core mostly share its ALUs, and a
+ * thread that migrates (worse, between sockets) loses its caches.  So
+ * the CPUs threads are pinned to are by default the first of each
+ * physical core, from the topology Linux gives in sysfs, taking cores
+ * from each socket in turn; the SMT siblings come after all the cores.
+ * Elsewhere threads are not pinned.
+ *
+ * Minting in the background, threads run under SCHED_IDLE, so only
+ * when nothing else wants the CPU, or failing that at nice 19.  Only
+ * threads started to mint are put there: without privilege a thread
+ * can't come back.
+ */
+
+#if defined( __linux__ ) && !defined( _GNU_SOURCE )
+    #define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#if defined( __linux__ )
+    #include <sched.h>
+    #include <sys/time.h>
+    #include <sys/resource.h>
+    #define CPU_PLACE
+#endif
+#include "hashcash.h"
+#include "libfastmint.h"
+
+#define SYSFS_CPU "/sys/devices/system/cpu/cpu%d/topology/%s"
+
+/* parse a CPU list as 0-3,8 into cpus, returns how many, -1 if it
+ * isn't one
+ */
+
+int hashcash_cpu_list( const char* list, int cpus[], int max )
+{
+    const char* p = list;
+    char* end = NULL;
+    long from = 0, to = 0;
+    int n = 0;
+
+    while ( *p ) {
+	if ( !isdigit( (unsigned char)*p ) ) { return -1; }
+	from = to = strtol( p, &end, 10 );
+	if ( *end == '-' ) {
+	    if ( !isdigit( (unsigned char)end[1] ) ) { return -1; }
+	    to = strtol( end+1, &end, 10 );
+	}
+	if ( to < from || to >= HASHCASH_MAX_CPU ) { return -1; }
+	for ( ; from <= to && n < max; from++ ) { cpus[n++] = from; }
+	if ( *end == ',' && end[1] ) { end++; }
+	else if ( *end != '\0' ) { return -1; }
+	p = end;
+    }
+    return n;
+}
+
+#if defined( CPU_PLACE )
+
+static int read_topology( int cpu, const char* what )
+{
+    char path[ 128 ];
+    FILE* f = NULL;
+    int value = -1;
+
+    sprintf( path, SYSFS_CPU, cpu, what );
+    f = fopen( path, "r" );
+    if ( f == NULL ) { return -1; }
+    if ( fscanf( f, "%d", &value ) != 1 ) { value = -1; }
+    fclose( f );
+    return value;
+}
+
+#endif
+
+/* the CPUs this process may run on in placement order, the first of
+ * each physical core; with smt their siblings follow.  Returns how
+ * many, 0 if not known.
+ */
+
+int hashcash_cpu_topology( int cpus[], int max, int smt )
+{
+#if defined( CPU_PLACE )
+    typedef struct { int cpu, package, core, rank; } cpu_info;
+    cpu_info info[ HASHCASH_MAX_CPU ], tmp;
+    cpu_set_t allowed;
+    int i = 0, j = 0, n = 0, out = 0;
+
+    if ( sched_getaffinity( 0, sizeof( allowed ), &allowed ) != 0 ) {
+	return 0;
+    }
+    for ( i = 0; i < HASHCASH_MAX_CPU && i < CPU_SETSIZE; i++ ) {
+	if ( !CPU_ISSET( i, &allowed ) ) { continue; }
+	info[n].cpu = i;
+	info[n].package = read_topology( i, "physical_package_id" );
+	info[n].core = read_topology( i, "core_id" );
+	if ( info[n].core < 0 ) { info[n].core = i; }
+	/* rank: which core of its package it is, -1 for a sibling */
+	info[n].rank = 0;
+	for ( j = 0; j < n; j++ ) {
+	    if ( info[j].package != info[n].package ) { continue; }
+	    if ( info[j].core == info[n].core ) { info[n].rank = -1; break; }
+	    if ( info[j].rank >= 0 ) { info[n].rank++; }
+	}
+	n++;
+    }
+
+    /* the cores by rank, so the sockets take turns */
+    for ( i = 0; i < n; i++ ) {
+	if ( info[i].rank < 0 ) { continue; }
+	tmp = info[i];
+	for ( j = i; j > out; j-- ) { info[j] = info[j-1]; } /* siblings */
+	for ( ; j > 0 && info[j-1].rank > tmp.rank; j-- ) {
+	    info[j] = info[j-1];
+	}
+	info[j] = tmp;
+	out++;
+    }
+    if ( smt ) { out = n; }
+    for ( i = 0; i < out && i < max; i++ ) { cpus[i] = info[i].cpu; }
+    return i;
+#else
+    cpus = cpus; max = max; smt = smt;
+    return 0;
+#endif
+}
+
+/* pin the calling thread to cpu, keeping where it could run before
+ * in saved for hashcash_unpin_thread; returns 0 if it can't be
+ */
+
+int hashcash_pin_thread( int cpu, void** saved )
+{
+#if defined( CPU_PLACE )
+    cpu_set_t set;
+
+    if ( saved ) {
+	*saved = malloc( sizeof( cpu_set_t ) );
+	if ( *saved && sched_getaffinity( 0, sizeof( cpu_set_t ),
+					  (cpu_set_t*)*saved ) != 0 ) {
+	    free( *saved );
+	    *saved = NULL;
+	}
+    }
+    CPU_ZERO( &set );
+    CPU_SET( cpu, &set );
+    return sched_setaffinity( 0, sizeof( set ), &set ) == 0;
+#else
+    cpu = cpu;
+    if ( saved ) { *saved = NULL; }
+    return 0;
+#endif
+}
+
+void hashcash_unpin_thread( void* saved )
+{
+#if defined( CPU_PLACE )
+    if ( saved == NULL ) { return; }
+    sched_setaffinity( 0, sizeof( cpu_set_t ), (cpu_set_t*)saved );
+    free( saved );
+#else
+    saved = saved;
+#endif
+}
+
+/* run the calling thread in the background for the rest of its life,
+ * it can't be undone without privilege; returns 0 if it can't be
+ */
+
+int hashcash_background_thread( void )
+{
+#if defined( CPU_PLACE ) && defined( SCHED_IDLE )
+    struct sched_param param;
+
+    param.sched_priority = 0;
+    /* on Linux these are just the calling thread */
+    return sched_setscheduler( 0, SCHED_IDLE, &param ) == 0 ||
+	setpriority( PRIO_PROCESS, 0, 19 ) == 0;
+#else
+    return 0;
+#endif
+}
@@ -6,7 +6,7 @@
 #include <sys/time.h>
 #include "random.h"
 
-int initialized = 0;
+static random_state global_state = RANDOM_STATE_INIT;
 
 /* on machines that have /dev/urandom -- use it */
 
@@ -14,25 +14,26 @@ int initialized = 0;
     defined( __OpenBSD__ ) || defined( DEV_URANDOM )
 
 #define URANDOM_FILE "/dev/urandom"
-FILE* urandom = NULL;
 
-int random_init( void )
+int random_state_init( random_state* rs )
 {
-    int res = (urandom = fopen( URANDOM_FILE, "r" )) != NULL;
-    if ( res ) { initialized = 1; }
+    int res = (rs->urandom = fopen( URANDOM_FILE, "r" )) != NULL;
+    if ( res ) { rs->initialized = 1; }
     return res;
 }
 
-int random_getbytes( void* data, size_t len )
+int random_state_getbytes( random_state* rs, void* data, size_t len )
 {
-    if ( !initialized && !random_init() ) { return 0; }
-    return fread( data, len, 1, urandom );
+    if ( !rs->initialized && !random_state_init( rs ) ) { return 0; }
+    return fread( data, len, 1, rs->urandom );
 }
 
-int random_final( void )
+int random_state_final( random_state* rs )
 {
     int res = 0;
-    if ( urandom ) { res = (fclose( urandom ) == 0); }
+    if ( rs->urandom ) { res = (fclose( rs->urandom ) == 0); }
+    rs->urandom = NULL;
+    rs->initialized = 0;
     return res;
 }
 
@@ -83,13 +84,12 @@ int random_final( void )
     CRYPTGENRANDOM gen = 0;
 #endif
 
-byte state[ SHA1_DIGEST_BYTES ];
-byte output[ SHA1_DIGEST_BYTES ];
-long counter = 0;
-
-/* output = SHA1( input || time || pid || counter++ ) */
+/* output = SHA1( input || time || pid || state address || counter++ ),
+ * the address so that states stirred at once in different threads
+ * differ */
 
-static void random_stir( const byte input[SHA1_DIGEST_BYTES],
+static void random_stir( random_state* rs, 
+			 const byte input[SHA1_DIGEST_BYTES],
 			 byte output[SHA1_DIGEST_BYTES] )
 {
     SHA1_ctx sha1;
@@ -128,13 +128,14 @@ static void random_stir( const byte input[SHA1_DIGEST_BYTES],
     SHA1_Update( &sha1, &t, sizeof( clock_t ) );
     SHA1_Update( &sha1, &t2, sizeof( time_t ) );
     SHA1_Update( &sha1, &pid, sizeof( pid ) );
-    SHA1_Update( &sha1, &counter, sizeof( long ) );
+    SHA1_Update( &sha1, &rs, sizeof( rs ) );
+    SHA1_Update( &sha1, &rs->counter, sizeof( long ) );
 
     SHA1_Final( &sha1, output );
-    counter++;
+    rs->counter++;
 }
 
-int random_init( void )
+int random_state_init( random_state* rs )
 {
 #if defined(WIN32)
     HMODULE advapi = 0;
@@ -158,35 +159,38 @@ int random_init( void )
     }
 #endif
     srand(clock());
-    random_stir( state, state );
+    random_stir( rs, rs->state, rs->state );
     
-    initialized = 1;
+    rs->initialized = 1;
 
     return 1;
 }
 
-int random_final( void )
+int random_state_final( random_state* rs )
 {
 #if defined(WIN32)
-    if ( hProvider && release ) { release(hProvider,0); }
+    if ( rs == &global_state && hProvider && release ) { 
+	release(hProvider,0); 
+    }
 #endif
+    rs->initialized = 0;
     return 1;
 }
 
 #define CHUNK_LEN (SHA1_DIGEST_BYTES)
 
-int random_getbytes( void* rnd, size_t len )
+int random_state_getbytes( random_state* rs, void* rnd, size_t len )
 {
     byte* rndp = (byte*)rnd;
     int use = 0;
 
-    if ( !initialized && !random_init() ) { return 0; }
+    if ( !rs->initialized && !random_state_init( rs ) ) { return 0; }
 
-    random_stir( state, state ); /* mix in the time, pid */
+    random_stir( rs, rs->state, rs->state ); /* mix in the time, pid */
     for ( ; len > 0; len -= use, rndp += CHUNK_LEN ) {
-	random_stir( state, output );
+	random_stir( rs, rs->state, rs->output );
 	use = len > CHUNK_LEN ? CHUNK_LEN : len;
-	memcpy( rndp, output, use );
+	memcpy( rndp, rs->output, use );
     }
     return 1;
 }
@@ -200,7 +204,7 @@ static int count_bits( long val )
     return count;
 }
 
-int random_rectangular( long top, long* resp )
+int random_state_rectangular( random_state* rs, long top, long* resp )
 {
     long mask = 0 ;
     int neg = 1;
@@ -209,9 +213,23 @@ int random_rectangular( long top, long* resp )
     if ( top < 0 ) { neg = -1; top = -top; }
     mask = ~( LONG_MAX << count_bits( top ) );
     do {
-	if ( !random_getbytes( &res, sizeof( long ) ) ) { return 0; }
+	if ( !random_state_getbytes( rs, &res, sizeof( long ) ) ) { return 0; }
 	res &= mask;
     } while ( res > top );
     *resp = res * neg;
     return 1;
 }
+
+int random_init( void ) { return random_state_init( &global_state ); }
+
+int random_getbytes( void* data, size_t len )
+{
+    return random_state_getbytes( &global_state, data, len );
+}
+
+int random_rectangular( long top, long* resp )
+{
+    return random_state_rectangular( &global_state, top, resp );
+}
+
+int random_final( void ) { return random_state_final( &global_state ); }
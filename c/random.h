@@ -11,6 +11,25 @@
 extern "C" {
 #endif
 
+#include <stdio.h>
+
+/* generator state: the functions without one share a global state */
+
+typedef struct {
+    int initialized;
+    FILE* urandom;		/* if there is /dev/urandom */
+    unsigned char state[ 20 ];	/* else a SHA1 stirred pool */
+    unsigned char output[ 20 ];
+    long counter;
+} random_state;
+
+#define RANDOM_STATE_INIT { 0, NULL, {0}, {0}, 0 }
+
+int random_state_init( random_state* );
+int random_state_getbytes( random_state*, void*, size_t );
+int random_state_rectangular( random_state*, long top, long* resp );
+int random_state_final( random_state* );
+
 int random_init( void );
 int random_addbytes( void*, size_t );
 int random_getbytes( void*, size_t );
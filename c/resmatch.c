@@ -0,0 +1,585 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* compiled set of resource patterns
+ *
+ * Checking a stamp against a long accept list one pattern at a time
+ * is slow, so patterns are sorted into:
+ *
+ *   exact    -- TYPE_STR, and TYPE_WILD user@domain with no '*': a
+ *               hash lookup of the resource (for TYPE_WILD of the
+ *               user@domain part, as email_match only looks that far)
+ *   domains  -- TYPE_WILD *@domain where each label of domain is
+ *               literal or "*": a trie of reversed domain labels
+ *   others   -- any other TYPE_WILD, compiled and tried one at a time
+ *   regexps  -- TYPE_REGEXP: with POSIX regexps one combined regexp
+ *               tells if any could match, and only then are they
+ *               tried one at a time
+ *
+ * Case insensitive patterns are lower cased and matched against the
+ * lower cased resource, so each kind is kept twice, once per case.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined( REGEXP_POSIX )
+    #include <sys/types.h>
+    #include <regex.h>
+#endif
+
+#define BUILD_DLL
+#include "hashcash.h"
+#include "libfastmint.h"
+#include "sstring.h"
+
+#define MATCH_EXACT 0
+#define MATCH_WEXACT 1		/* TYPE_WILD without '*' */
+#define MATCH_DOMAIN 2
+#define MATCH_OTHER 3
+#define MATCH_REGEXP 4
+
+typedef struct {
+    char* str;			/* pattern, lower cased if !case_flag */
+    int type;
+    int case_flag;
+    int kind;			/* MATCH_* */
+    void* compile;		/* regexp or wildcard compiled on first use */
+} match_ent;
+
+/* string -> entry multimap, chained through arrays */
+
+typedef struct {
+    char* key;
+    int parent;			/* for trie edges, else 0 */
+    int value;			/* entry, or for trie edges child node */
+    int next;
+} hm_item;
+
+typedef struct {
+    int* heads;
+    int nheads;
+    hm_item* items;
+    int num;
+    int max;
+} hmap;
+
+typedef struct {
+    int entry;
+    int next;
+} term_item;
+
+typedef struct {
+    hmap exact;			/* MATCH_EXACT */
+    hmap wexact;		/* MATCH_WEXACT keyed user@domain */
+    hmap edges;			/* domain trie (parent,label) -> child */
+    int* node_term;		/* per node first terminal, or -1 */
+    int nodes;
+    int max_nodes;
+    term_item* terms;
+    int num_terms;
+    int max_terms;
+    int* others;		/* MATCH_OTHER and MATCH_REGEXP entries */
+    int num_others;
+    int regexps;
+#if defined( REGEXP_POSIX )
+    char* combined;		/* all regexps as one alternation */
+    regex_t* prefilter;		/* compiled combined, NULL if none */
+    int prefilter_failed;
+#endif
+} match_bank;
+
+struct hashcash_matcher {
+    match_ent* ent;
+    int num;
+    int max;
+    match_bank bank[2];		/* [case_flag] */
+    int built;
+    char* re_err;		/* regexp error found building, or NULL */
+    char re_err_buf[ MAX_RE_ERR+1 ];
+};
+
+static unsigned long hm_hash( const char* key, int len, int parent )
+{
+    unsigned long h = 2166136261UL ^ (unsigned long)parent * 16777619UL;
+    int i = 0;
+
+    for ( i = 0; i < len; i++ ) {
+	h = ( h ^ (unsigned char)key[i] ) * 16777619UL;
+    }
+    return h;
+}
+
+static int hm_grow( hmap* m )
+{
+    int* heads = NULL;
+    int nheads = m->nheads ? m->nheads * 4 : 64;
+    int i = 0, slot = 0;
+
+    heads = malloc( sizeof( int ) * nheads );
+    if ( heads == NULL ) { return 0; }
+    for ( i = 0; i < nheads; i++ ) { heads[i] = -1; }
+    for ( i = 0; i < m->num; i++ ) {
+	slot = hm_hash( m->items[i].key, strlen( m->items[i].key ),
+			m->items[i].parent ) % nheads;
+	m->items[i].next = heads[slot];
+	heads[slot] = i;
+    }
+    free( m->heads );
+    m->heads = heads;
+    m->nheads = nheads;
+    return 1;
+}
+
+static int hm_put( hmap* m, const char* key, int len, int parent, int value )
+{
+    hm_item* items = NULL;
+    int slot = 0;
+
+    if ( m->num >= m->max ) {
+	m->max = m->max ? m->max * 2 : 64;
+	items = realloc( m->items, sizeof( hm_item ) * m->max );
+	if ( items == NULL ) { return 0; }
+	m->items = items;
+    }
+    if ( m->num >= m->nheads && !hm_grow( m ) ) { return 0; }
+    m->items[m->num].key = malloc( len + 1 );
+    if ( m->items[m->num].key == NULL ) { return 0; }
+    memcpy( m->items[m->num].key, key, len );
+    m->items[m->num].key[len] = '\0';
+    m->items[m->num].parent = parent;
+    m->items[m->num].value = value;
+    slot = hm_hash( key, len, parent ) % m->nheads;
+    m->items[m->num].next = m->heads[slot];
+    m->heads[slot] = m->num;
+    m->num++;
+    return 1;
+}
+
+/* first item for key, continue with hm_next */
+
+static int hm_next( const hmap* m, int i, const char* key, int len,
+		    int parent )
+{
+    for ( ; i >= 0; i = m->items[i].next ) {
+	if ( m->items[i].parent == parent &&
+	     strncmp( m->items[i].key, key, len ) == 0 &&
+	     m->items[i].key[len] == '\0' ) {
+	    return i;
+	}
+    }
+    return -1;
+}
+
+static int hm_first( const hmap* m, const char* key, int len, int parent )
+{
+    if ( m->nheads == 0 ) { return -1; }
+    return hm_next( m, m->heads[ hm_hash( key, len, parent ) % m->nheads ],
+		    key, len, parent );
+}
+
+static void hm_free( hmap* m )
+{
+    int i = 0;
+    for ( i = 0; i < m->num; i++ ) { free( m->items[i].key ); }
+    free( m->items );
+    free( m->heads );
+}
+
+/* resource split as email_match does: user up to the first '@',
+ * domain up to the next; returns 0 if there is no '@'
+ */
+
+static int split_email( const char* res, int* user_len, const char** dom,
+			int* dom_len )
+{
+    const char* at = strchr( res, '@' ), *end = NULL;
+
+    if ( at == NULL ) { return 0; }
+    *user_len = at - res;
+    *dom = at + 1;
+    end = strchr( *dom, '@' );
+    *dom_len = end ? end - *dom : (int)strlen( *dom );
+    return 1;
+}
+
+/* TYPE_WILD kind: which fast path if any, per the header comment */
+
+static int wild_kind( const char* pat )
+{
+    const char* dom = NULL, *label = NULL, *dot = NULL;
+    int user_len = 0, dom_len = 0, label_len = 0;
+
+    if ( !split_email( pat, &user_len, &dom, &dom_len ) ||
+	 dom[dom_len] != '\0' || user_len == 0 || dom_len == 0 ) {
+	return MATCH_OTHER;
+    }
+    if ( strchr( pat, '*' ) != NULL &&
+	 ( user_len != 1 || pat[0] != '*' ) ) {
+	return MATCH_OTHER;
+    }
+    for ( label = dom; ; label = dot + 1 ) {
+	dot = strchr( label, '.' );
+	label_len = dot ? dot - label : (int)strlen( label );
+	if ( label_len == 0 ) { return MATCH_OTHER; } /* "" matches any */
+	if ( memchr( label, '*', label_len ) &&
+	     ( label_len != 1 || label[0] != '*' ) ) {
+	    return MATCH_OTHER;	/* partial label wildcard */
+	}
+	if ( dot == NULL ) { break; }
+    }
+    return strchr( pat, '*' ) ? MATCH_DOMAIN : MATCH_WEXACT;
+}
+
+static int bank_node( match_bank* b )
+{
+    int* node_term = NULL;
+
+    if ( b->nodes >= b->max_nodes ) {
+	b->max_nodes = b->max_nodes ? b->max_nodes * 2 : 64;
+	node_term = realloc( b->node_term, sizeof( int ) * b->max_nodes );
+	if ( node_term == NULL ) { return -1; }
+	b->node_term = node_term;
+    }
+    b->node_term[b->nodes] = -1;
+    return b->nodes++;
+}
+
+static int bank_add_domain( match_bank* b, const char* dom, int entry )
+{
+    const char* end = dom + strlen( dom ), *label = NULL;
+    term_item* terms = NULL;
+    int node = 0, i = 0;
+
+    if ( b->nodes == 0 && bank_node( b ) < 0 ) { return 0; } /* root */
+
+    /* labels right to left */
+    while ( end >= dom ) {
+	for ( label = end; label > dom && label[-1] != '.'; label-- ) {}
+	i = hm_first( &b->edges, label, end - label, node );
+	if ( i >= 0 ) {
+	    node = b->edges.items[i].value;
+	} else {
+	    i = bank_node( b );
+	    if ( i < 0 ) { return 0; }
+	    if ( !hm_put( &b->edges, label, end - label, node, i ) ) {
+		return 0;
+	    }
+	    node = i;
+	}
+	end = label - 1;
+    }
+
+    if ( b->num_terms >= b->max_terms ) {
+	b->max_terms = b->max_terms ? b->max_terms * 2 : 64;
+	terms = realloc( b->terms, sizeof( term_item ) * b->max_terms );
+	if ( terms == NULL ) { return 0; }
+	b->terms = terms;
+    }
+    b->terms[b->num_terms].entry = entry;
+    b->terms[b->num_terms].next = b->node_term[node];
+    b->node_term[node] = b->num_terms++;
+    return 1;
+}
+
+static int bank_add_other( match_bank* b, int entry )
+{
+    int* others = realloc( b->others, sizeof( int ) * ( b->num_others+1 ) );
+    if ( others == NULL ) { return 0; }
+    b->others = others;
+    b->others[b->num_others++] = entry;
+    return 1;
+}
+
+#if defined( REGEXP_POSIX )
+
+/* append ^(pattern)$ alternative as regexp_match would anchor it */
+
+static int bank_add_regexp( match_bank* b, const char* re )
+{
+    int len = strlen( re ), old = b->combined ? strlen( b->combined ) : 0;
+    char* combined = NULL;
+    const char* p = NULL;
+
+    /* back references would be renumbered in the combined regexp */
+    for ( p = strchr( re, '\\' ); p; p = strchr( p + 2, '\\' ) ) {
+	if ( p[1] >= '1' && p[1] <= '9' ) { b->prefilter_failed = 1; }
+	if ( p[1] == '\0' ) { break; }
+    }
+    if ( b->prefilter_failed ) { return 1; }
+
+    combined = realloc( b->combined, old + len + 8 );
+    if ( combined == NULL ) { return 0; }
+    b->combined = combined;
+    sprintf( combined + old, "%s(%s%s%s)", old ? "|" : "",
+	     re[0] == '^' ? "" : "^", re,
+	     len && re[len-1] == '$' ? "" : "$" );
+    return 1;
+}
+
+static void bank_prefilter( match_bank* b )
+{
+    if ( b->combined == NULL || b->prefilter || b->prefilter_failed ) {
+	return;
+    }
+    b->prefilter = malloc( sizeof( regex_t ) );
+    if ( b->prefilter == NULL ||
+	 regcomp( b->prefilter, b->combined,
+		  REG_EXTENDED | REG_NOSUB ) != 0 ) {
+	free( b->prefilter );	/* let the regexps report their errors */
+	b->prefilter = NULL;
+	b->prefilter_failed = 1;
+    }
+}
+
+#endif
+
+hashcash_matcher* hashcash_matcher_new( void )
+{
+    return calloc( 1, sizeof( hashcash_matcher ) );
+}
+
+int hashcash_matcher_add( hashcash_matcher* m, int type, int case_flag,
+			  const char* pattern )
+{
+    match_ent* ent = NULL;
+
+    if ( m->built ) { return 0; }
+    if ( m->num >= m->max ) {
+	m->max = m->max ? m->max * 2 : 32;
+	ent = realloc( m->ent, sizeof( match_ent ) * m->max );
+	if ( ent == NULL ) { return 0; }
+	m->ent = ent;
+    }
+    ent = &m->ent[m->num];
+    ent->str = strdup( pattern );
+    if ( ent->str == NULL ) { return 0; }
+    if ( !case_flag ) { stolower( ent->str ); }
+    ent->type = type;
+    ent->case_flag = case_flag ? 1 : 0;
+    ent->compile = NULL;
+    m->num++;
+    return 1;
+}
+
+/* sort the patterns into banks and compile the rest, after which
+ * matching changes nothing and so can be shared between threads
+ */
+
+static int matcher_build( hashcash_matcher* m )
+{
+    match_ent* ent = NULL;
+    match_bank* b = NULL;
+    int i = 0, ok = 1, user_len = 0, dom_len = 0;
+    const char* dom = NULL;
+    char* re_err = NULL, re_buf[ MAX_RE_ERR+1 ];
+
+    for ( i = 0; ok && i < m->num; i++ ) {
+	ent = &m->ent[i];
+	b = &m->bank[ent->case_flag];
+	switch ( ent->type ) {
+	case TYPE_STR:
+	    ent->kind = MATCH_EXACT;
+	    ok = hm_put( &b->exact, ent->str, strlen( ent->str ), 0, i );
+	    break;
+	case TYPE_WILD:
+	    ent->kind = wild_kind( ent->str );
+	    if ( ent->kind == MATCH_WEXACT ) {
+		ok = hm_put( &b->wexact, ent->str, strlen( ent->str ), 0, i );
+	    } else if ( ent->kind == MATCH_DOMAIN ) {
+		split_email( ent->str, &user_len, &dom, &dom_len );
+		ok = bank_add_domain( b, dom, i );
+	    } else {
+		ok = bank_add_other( b, i );
+	    }
+	    break;
+	case TYPE_REGEXP:
+	    ent->kind = MATCH_REGEXP;
+	    ok = bank_add_other( b, i );
+	    b->regexps++;
+#if defined( REGEXP_POSIX )
+	    ok = ok && bank_add_regexp( b, ent->str );
+#endif
+	    break;
+	default:
+	    ent->kind = MATCH_OTHER;
+	    ok = bank_add_other( b, i );
+	}
+	if ( ok && ( ent->kind == MATCH_OTHER || 
+		    ent->kind == MATCH_REGEXP ) ) {
+	    hashcash_resource_match_buf( ent->type, "", ent->str, 
+					 &ent->compile, &re_err, re_buf );
+	    if ( re_err ) {
+		strncpy( m->re_err_buf, re_err, sizeof( m->re_err_buf ) - 1 );
+		m->re_err = m->re_err_buf;
+		free( ent->compile ); /* failed, nothing to regfree */
+		ent->compile = NULL;
+		break;
+	    }
+	}
+    }
+#if defined( REGEXP_POSIX )
+    bank_prefilter( &m->bank[0] );
+    bank_prefilter( &m->bank[1] );
+#endif
+    m->built = 1;
+    return ok;
+}
+
+static void hit( char* hits, int entry, int* found )
+{
+    if ( hits ) {
+	if ( !hits[entry] ) { (*found)++; }
+	hits[entry] = 1;
+    } else {
+	(*found)++;
+    }
+}
+
+/* walk the trie from node with labels[0..n) right to left; a label of
+ * "*" in the trie matches any label
+ */
+
+static void bank_domains( hashcash_matcher* m, match_bank* b, int node,
+			  const char** labels, int* lens, int n,
+			  char* hits, int* found )
+{
+    int i = 0, t = 0;
+
+    if ( !hits && *found ) { return; }
+    if ( n == 0 ) {
+	for ( t = b->node_term[node]; t >= 0; t = b->terms[t].next ) {
+	    hit( hits, b->terms[t].entry, found );
+	}
+	return;
+    }
+    i = hm_first( &b->edges, labels[n-1], lens[n-1], node );
+    if ( i >= 0 ) {
+	bank_domains( m, b, b->edges.items[i].value, labels, lens, n-1,
+		      hits, found );
+    }
+    if ( lens[n-1] == 1 && labels[n-1][0] == '*' ) { return; } /* same */
+    i = hm_first( &b->edges, "*", 1, node );
+    if ( i >= 0 ) {
+	bank_domains( m, b, b->edges.items[i].value, labels, lens, n-1,
+		      hits, found );
+    }
+}
+
+static int bank_match( hashcash_matcher* m, match_bank* b, const char* res,
+		       char* hits, char** re_err )
+{
+    const char* labels[ MAX_RES+1 ];
+    int lens[ MAX_RES+1 ];
+    const char* dom = NULL, *p = NULL;
+    int found = 0, i = 0, user_len = 0, dom_len = 0, n = 0, any = 1;
+    match_ent* ent = NULL;
+    char re_buf[ MAX_RE_ERR+1 ];	/* unused: all compiled when built */
+
+    for ( i = hm_first( &b->exact, res, strlen( res ), 0 ); i >= 0;
+	  i = hm_next( &b->exact, b->exact.items[i].next, res,
+		       strlen( res ), 0 ) ) {
+	hit( hits, b->exact.items[i].value, &found );
+	if ( !hits ) { return found; }
+    }
+
+    if ( split_email( res, &user_len, &dom, &dom_len ) ) {
+	n = user_len + 1 + dom_len;
+	for ( i = hm_first( &b->wexact, res, n, 0 ); i >= 0;
+	      i = hm_next( &b->wexact, b->wexact.items[i].next, res, n, 0 ) ) {
+	    hit( hits, b->wexact.items[i].value, &found );
+	    if ( !hits ) { return found; }
+	}
+
+	if ( b->nodes > 0 && dom_len > 0 ) {
+	    for ( n = 0, p = dom; n <= MAX_RES; p++ ) {
+		labels[n] = p;
+		p = memchr( p, '.', dom + dom_len - p );
+		if ( p == NULL ) { p = dom + dom_len; }
+		lens[n] = p - labels[n];
+		n++;
+		if ( p >= dom + dom_len ) { break; }
+	    }
+	    bank_domains( m, b, 0, labels, lens, n, hits, &found );
+	    if ( !hits && found ) { return found; }
+	}
+    }
+
+#if defined( REGEXP_POSIX )
+    /* no regexp can match if the combined one doesn't */
+    if ( b->prefilter && regexec( b->prefilter, res, 0, NULL, 0 ) != 0 ) {
+	any = 0;
+    }
+#endif
+    for ( i = 0; i < b->num_others; i++ ) {
+	ent = &m->ent[b->others[i]];
+	if ( ent->kind == MATCH_REGEXP && !any ) { continue; }
+	if ( hashcash_resource_match_buf( ent->type, res, ent->str,
+					  &ent->compile, re_err, re_buf ) ) {
+	    hit( hits, b->others[i], &found );
+	    if ( !hits ) { return found; }
+	} else if ( *re_err ) {
+	    return -1;
+	}
+    }
+    return found;
+}
+
+int hashcash_matcher_match( hashcash_matcher* m, const char* res,
+			    const char* lower_res, char* hits, char** re_err )
+{
+    int found = 0, more = 0;
+
+    *re_err = NULL;
+    if ( !m->built && !matcher_build( m ) ) {
+	m->re_err = "out of memory";
+    }
+    if ( m->re_err ) { *re_err = m->re_err; return -1; }
+    if ( hits ) { memset( hits, 0, m->num ); }
+    if ( m->num == 0 ) { return 0; }
+
+    found = bank_match( m, &m->bank[1], res, hits, re_err );
+    if ( found < 0 || ( found && !hits ) ) { return found; }
+    more = bank_match( m, &m->bank[0], lower_res, hits, re_err );
+    if ( more < 0 ) { return more; }
+    return found + more;
+}
+
+int hashcash_matcher_num( const hashcash_matcher* m )
+{
+    return m->num;
+}
+
+static void bank_free( match_bank* b )
+{
+    hm_free( &b->exact );
+    hm_free( &b->wexact );
+    hm_free( &b->edges );
+    free( b->node_term );
+    free( b->terms );
+    free( b->others );
+#if defined( REGEXP_POSIX )
+    if ( b->prefilter ) { regfree( b->prefilter ); free( b->prefilter ); }
+    free( b->combined );
+#endif
+}
+
+void hashcash_matcher_free( hashcash_matcher* m )
+{
+    int i = 0;
+
+    if ( m == NULL ) { return; }
+    for ( i = 0; i < m->num; i++ ) {
+#if defined( REGEXP_POSIX )
+	if ( m->ent[i].type == TYPE_REGEXP && m->ent[i].compile ) {
+	    regfree( (regex_t*)m->ent[i].compile );
+	}
+#endif
+	free( m->ent[i].compile );
+	free( m->ent[i].str );
+    }
+    free( m->ent );
+    bank_free( &m->bank[0] );
+    bank_free( &m->bank[1] );
+    free( m );
+}
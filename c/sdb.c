@@ -13,7 +13,18 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#if defined( WIN32 )
+    #include <windows.h>
+    #include <sys/utime.h>
+#else
+    #include <utime.h>
+    #include <sys/time.h>
+#endif
+#if defined( HAVE_PTHREADS )
+    #include <pthread.h>
+#endif
 #include "types.h"
+#include "sha1.h"
 #include "lock.h"
 #include "array.h"
 #include "hashcash.h"
@@ -30,6 +41,12 @@
 
 #if defined( WIN32 )
     #define ftruncate chsize
+    #define fsync _commit
+#endif
+
+#if defined( unix ) || defined( __unix__ ) || defined( __APPLE__ )
+    #include <sys/mman.h>
+    #define SDB_MMAP
 #endif
 
 #define MAX_UTC 13
@@ -37,6 +54,8 @@
 /* simple though inefficient implementation of a database function */
 
 static int sdb_insert( DB*, const char* key, const char* val, int* err );
+static void sdb_cursor_clear( DB* h );
+static int sdb_sync_due( DB* h );
 
 int sdb_open( DB* h, const char* filename, int* err ) 
 {
@@ -54,6 +73,12 @@ int sdb_open( DB* h, const char* filename, int* err )
     if ( !lock_write( h->file ) ) { goto fail; }
     strncpy( h->filename, filename, PATH_MAX ); h->filename[PATH_MAX] = '\0';
     h->write_pos = 0;
+    h->sync_mode = SDB_SYNC_NONE;
+    h->sync_interval = 0;
+    h->batch = 0;
+    h->unsynced = 0;
+    h->shards = 0;
+    h->shard = NULL;
     return 1;
  fail:
     *err = errno;
@@ -63,10 +88,86 @@ int sdb_open( DB* h, const char* filename, int* err )
 int sdb_close( DB* h, int* err )
 {
     if ( h == NULL || h->file == NULL ) { return 0; }
+    /* an unfinished batch, or an interval that has run out, is still
+     * owed its sync */
+    if ( h->unsynced && sdb_sync_due( h ) ) {
+	if ( !sdb_sync( h, err ) ) { return 0; }
+    }
     if ( fclose( h->file ) == EOF ) { *err = errno; return 0; }
     *err = 0; return 1;
 }
 
+/* name of a file kept alongside the db, eg <dbname>.sync */
+
+static int sdb_sidename( DB* h, const char* suffix, char* name )
+{
+    if ( strlen( h->filename ) + strlen( suffix ) > PATH_MAX ) { 
+	return 0; 
+    }
+    sprintf( name, "%s%s", h->filename, suffix );
+    return 1;
+}
+
+/* in interval mode the last sync time is the mtime of the .sync file,
+ * so that short lived processes checking one stamp each share it
+ */
+
+static int sdb_sync_due( DB* h )
+{
+    char name[PATH_MAX+1] = {0};
+    struct stat st;
+
+    switch ( h->sync_mode ) {
+    case SDB_SYNC_BATCH: return 1;
+    case SDB_SYNC_INTERVAL:
+	if ( !sdb_sidename( h, SYNC_SUFFIX, name ) ) { return 1; }
+	if ( stat( name, &st ) != 0 ) { return 1; }
+	return time( 0 ) - st.st_mtime >= h->sync_interval;
+    default: return 0;
+    }
+}
+
+int sdb_sync( DB* h, int* err )
+{
+    char name[PATH_MAX+1] = {0};
+    int fd = 0;
+
+    *err = 0;
+    if ( h == NULL || h->file == NULL ) { return 0; }
+    if ( fflush( h->file ) == EOF ) { goto fail; }
+    if ( fsync( fileno( h->file ) ) != 0 ) { goto fail; }
+    h->unsynced = 0;
+    if ( h->sync_mode == SDB_SYNC_INTERVAL && 
+	 sdb_sidename( h, SYNC_SUFFIX, name ) ) {
+	fd = open( name, O_WRONLY | O_CREAT, S_IREAD | S_IWRITE );
+	if ( fd == -1 ) { goto fail; }
+	close( fd );
+	if ( utime( name, NULL ) != 0 ) { goto fail; }
+    }
+    return 1;
+ fail:
+    *err = errno;
+    return 0;
+}
+
+int sdb_begin( DB* h, int* err )
+{
+    *err = 0;
+    if ( h == NULL || h->file == NULL ) { return 0; }
+    h->batch++;
+    return 1;
+}
+
+int sdb_commit( DB* h, int* err )
+{
+    *err = 0;
+    if ( h == NULL || h->file == NULL ) { return 0; }
+    if ( h->batch > 0 ) { h->batch--; }
+    if ( h->batch > 0 || !h->unsynced ) { return 1; }
+    if ( !sdb_sync_due( h ) ) { return 1; }
+    return sdb_sync( h, err );
+}
+
 int sdb_add( DB* h, const char* key, const char* val, int* err )
 {
     *err = 0;
@@ -76,6 +177,8 @@ int sdb_add( DB* h, const char* key, const char* val, int* err )
     if ( strlen( val ) > MAX_VAL ) { return 0; }
     if ( fseek( h->file, 0, SEEK_END ) == -1 ) { goto fail; }
     if ( fprintf( h->file, "%s %s\n", key, val ) == 0 ) { goto fail; }
+    h->unsynced++;
+    if ( h->batch == 0 ) { return sdb_commit( h, err ); }
     return 1;
  fail:
     *err = errno;
@@ -84,6 +187,15 @@ int sdb_add( DB* h, const char* key, const char* val, int* err )
 
 #define MAX_LINE (MAX_KEY+MAX_VAL) 
 
+/* bounded copy of a view to a NUL terminated buffer of max+1 */
+
+static void sdb_copy( char* dst, int max, const char* src, int len )
+{
+    if ( len > max ) { len = max; }
+    memcpy( dst, src, len );
+    dst[len] = '\0';
+}
+
 static void sdb_rewind( DB* h ) 
 {
     rewind( h->file );
@@ -106,38 +218,140 @@ int sdb_findnext( DB* h, char* key, int klen, char* val, int vlen,
 
     *err = 0;
     if ( h->file == NULL ) { return 0; }
-    if ( feof( h->file ) ) { return 0; }
-    if ( fgets( line, MAX_LINE, h->file ) == NULL ) { return 0; }
-    line_len = strlen( line );
-    if ( line_len == 0 ) { return 0; }
 
-    /* remove unix, DOS, and MAC linefeeds */
+    /* skip blank lines, an incremental purge leaves a run of spaces 
+     * where it has removed records */
 
-    if ( line[line_len-1] == '\n' ) { line[--line_len] = '\0'; }
-    if ( line[line_len-1] == '\r' ) { line[--line_len] = '\0'; }
-    if ( line[line_len-1] == '\n' ) { line[--line_len] = '\0'; }
+    do {
+	if ( feof( h->file ) ) { return 0; }
+	if ( fgets( line, MAX_LINE, h->file ) == NULL ) { return 0; }
+	line_len = strlen( line );
+	if ( line_len == 0 ) { return 0; }
+
+	/* remove unix, DOS, and MAC linefeeds */
+
+	if ( line[line_len-1] == '\n' ) { line[--line_len] = '\0'; }
+	if ( line_len && line[line_len-1] == '\r' ) { line[--line_len] = '\0'; }
+	if ( line_len && line[line_len-1] == '\n' ) { line[--line_len] = '\0'; }
+    } while ( line[0] == ' ' || line[0] == '\0' );
 
     fval = strchr( line, ' ' );
     if ( fval != NULL ) { *fval = '\0'; fval++; } 
     else { fval = ""; }		/* empty */
-    strncpy( key, fkey, klen ); key[klen] = '\0';
-    strncpy( val, fval, vlen ); val[vlen] = '\0';
+    sdb_copy( key, klen, fkey, strlen( fkey ) );
+    sdb_copy( val, vlen, fval, strlen( fval ) );
     return 1;
 }
 
-static int sdb_cb_notkeymatch( const char* key, const char* val, 
-			       void* arg, int* err ) 
+/* zero copy iteration: the file is mapped and each record handed to
+ * the callback as key and value views into the mapping, found with
+ * smemchr2 rather than fgets + strncpy.  Falls back to sdb_findnext
+ * where there's no mmap or the file can't be mapped.
+ */
+
+static int sdb_map( DB* h, int writable, char** map, long* len, int* err )
 {
-    *err = 0;
-    if ( strncmp( key, arg, MAX_KEY ) != 0 ) { return 1; }
+#if defined( SDB_MMAP )
+    struct stat st;
+
+    *map = NULL;
+    *len = 0;
+    if ( fflush( h->file ) == EOF ) { goto fail; }
+    if ( fstat( fileno( h->file ), &st ) != 0 ) { goto fail; }
+    *len = st.st_size;
+    if ( *len == 0 ) { return 1; }
+    *map = mmap( NULL, *len, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+		 MAP_SHARED, fileno( h->file ), 0 );
+    if ( *map == MAP_FAILED ) { *map = NULL; goto fail; }
+    return 1;
+ fail:
+    *err = errno;
+#endif
     return 0;
-} 
+}
+
+static void sdb_unmap( char* map, long len )
+{
+#if defined( SDB_MMAP )
+    if ( map ) { munmap( map, len ); }
+#endif
+}
+
+/* views of the next non blank record in [p,end), returns the start
+ * of the record after it or NULL if there isn't one
+ */
+
+static const char* sdb_view_next( const char* p, const char* end, 
+				  const char** rec, const char** key, 
+				  int* klen, const char** val, int* vlen )
+{
+    const char* eol = NULL, *sp = NULL, *next = NULL;
+
+    for ( ; p < end; p = next ) {
+	/* one pass: the key ends at the first space or newline, and
+	   only the value after a space is left to scan */
+	sp = smemchr2( p, end, ' ', '\n' );
+	eol = sp && *sp == ' ' ? smemchr( sp + 1, end, '\n' ) : sp;
+	if ( eol == NULL ) { eol = end; next = end; } else { next = eol+1; }
+	if ( eol > p && eol[-1] == '\r' ) { eol--; }
+	if ( eol == p || *p == ' ' ) { continue; } /* blank */
 
-static int sdb_cb_keymatch( const char* key, const char* val, 
-			    void* arg, int* err ) 
+	*rec = p;
+	*key = p;
+	if ( sp == NULL || *sp != ' ' ) {
+	    *klen = eol - p; *val = eol; *vlen = 0;
+	} else {
+	    *klen = sp - p; *val = sp + 1; *vlen = eol - ( sp + 1 );
+	}
+	return next;
+    }
+    return NULL;
+}
+
+int sdb_viewiterate( DB* h, sdb_vcallback cb, void* arg, int* err )
+{
+    char fkey[MAX_KEY+1] = {0};
+    char fval[MAX_VAL+1] = {0};
+    char* map = NULL;
+    const char* p = NULL, *next = NULL, *rec = NULL, *key = NULL, *val = NULL;
+    long len = 0, pos = 0;
+    int klen = 0, vlen = 0, found = 0;
+
+    *err = 0;
+    if ( h == NULL || h->file == NULL ) { return 0; }
+    pos = ftell( h->file );
+    if ( pos < 0 ) { *err = errno; return 0; }
+
+    if ( !sdb_map( h, 0, &map, &len, err ) ) {
+	*err = 0;		/* read it with stdio instead */
+	while ( sdb_findnext( h, fkey, MAX_KEY, fval, MAX_VAL, err ) ) {
+	    if ( cb( fkey, strlen( fkey ), fval, strlen( fval ), arg, err ) ) {
+		return 1;
+	    }
+	    if ( *err ) { return 0; }
+	}
+	return 0;
+    }
+
+    for ( p = map + ( pos < len ? pos : len ); 
+	  ( next = sdb_view_next( p, map + len, &rec, &key, &klen, 
+				  &val, &vlen ) ) != NULL; 
+	  p = next ) {
+	found = cb( key, klen, val, vlen, arg, err );
+	if ( found || *err ) { break; }
+    }
+    pos = found ? next - map : len;
+    sdb_unmap( map, len );
+    if ( *err ) { return 0; }
+    if ( fseek( h->file, pos, SEEK_SET ) == -1 ) { *err = errno; return 0; }
+    return found;
+}
+
+static int sdb_cb_notkeymatch( const char* key, const char* val, 
+			       void* arg, int* err ) 
 {
     *err = 0;
-    if ( strncmp( key, arg, MAX_KEY ) == 0 ) { return 1; }
+    if ( strncmp( key, arg, MAX_KEY ) != 0 ) { return 1; }
     return 0;
 } 
 
@@ -147,18 +361,67 @@ int sdb_del( DB* h, const char* key, int* err )
 				  (void*)key, err );
 }
 
+typedef struct {
+    const char* key;		/* key sought */
+    int len;
+    char* val;			/* where to put its value */
+    int vlen;
+} sdb_keyview;
+
+static int sdb_vcb_keymatch( const char* key, int klen, const char* val, 
+			     int vlen, void* arg, int* err )
+{
+    sdb_keyview* want = (sdb_keyview*)arg;
+
+    *err = 0;
+    if ( klen != want->len || memcmp( key, want->key, klen ) != 0 ) { 
+	return 0; 
+    }
+    sdb_copy( want->val, want->vlen, val, vlen );
+    return 1;
+}
+
 int sdb_lookup( DB* h, const char* key, char* val, int vlen, int* err )
 {
-    char fkey[MAX_KEY+1] = {0};
-    return sdb_callbacklookup( h, sdb_cb_keymatch, (void*)key, 
-				   fkey, MAX_KEY, val, vlen, err );
+    if ( h->file == NULL ) { *err = 0; return 0; }
+    rewind( h->file );
+    return sdb_lookupnext( h, key, val, vlen, err );
 }
 
 int sdb_lookupnext( DB* h, const char* key, char* val, int vlen, int* err )
 {
+    sdb_keyview want;
+
+    want.key = key;
+    want.len = strlen( key );
+    if ( want.len > MAX_KEY ) { want.len = MAX_KEY; }
+    want.val = val;
+    want.vlen = vlen;
+    return sdb_viewiterate( h, sdb_vcb_keymatch, (void*)&want, err );
+}
+
+/* adapt an sdb_rcallback to views, it wants NUL terminated copies */
+
+typedef struct {
+    sdb_rcallback cb;
+    void* arg;
+    char* key;
+    int klen;
+    char* val;
+    int vlen;
+} sdb_rview;
+
+static int sdb_vcb_rcallback( const char* key, int klen, const char* val, 
+			      int vlen, void* arg, int* err )
+{
+    sdb_rview* r = (sdb_rview*)arg;
     char fkey[MAX_KEY+1] = {0};
-    return sdb_callbacklookupnext( h, sdb_cb_keymatch, (void*)key,
-				       fkey, MAX_KEY, val, vlen, err );
+
+    sdb_copy( fkey, MAX_KEY, key, klen );
+    sdb_copy( r->val, r->vlen, val, vlen );
+    if ( !r->cb( fkey, r->val, r->arg, err ) ) { return 0; }
+    sdb_copy( r->key, r->klen, key, klen );
+    return 1;
 }
 
 int sdb_callbacklookup( DB* h, sdb_rcallback cb, void* arg, char* key, 
@@ -171,15 +434,12 @@ int sdb_callbacklookup( DB* h, sdb_rcallback cb, void* arg, char* key,
 int sdb_callbacklookupnext( DB* h, sdb_rcallback cb, void* arg, char* key, 
 			    int klen, char* val, int vlen, int* err ) 
 {
-    char fkey[MAX_KEY+1] = {0};
+    sdb_rview r;
 
-    while ( sdb_findnext( h, fkey, MAX_KEY, val, vlen, err ) ) {
-	if ( cb( fkey, val, arg, err ) ) {
-	    strncpy( key, fkey, klen ); key[klen] = '\0';
-	    return 1;
-	}
-    }
-    return 0;
+    r.cb = cb; r.arg = arg;
+    r.key = key; r.klen = klen;
+    r.val = val; r.vlen = vlen;
+    return sdb_viewiterate( h, sdb_vcb_rcallback, (void*)&r, err );
 }
 
 int sdb_insert( DB* db, const char* key, const char* val, int* err )
@@ -205,11 +465,67 @@ int sdb_insert( DB* db, const char* key, const char* val, int* err )
     return 0;
 }
 
+/* compact the mapping in place: kept records are moved down to
+ * write_pos, untouched where nothing before them has been dropped
+ */
+
+static int sdb_updatemapped( DB* h, sdb_wcallback cb, void* arg, 
+			     char* map, long len, int* err )
+{
+    char fkey[MAX_KEY+1] = {0};
+    char fval[MAX_VAL+1] = {0};
+    const char* p = map, *next = NULL, *rec = NULL, *key = NULL, *val = NULL;
+    long wpos = 0, use = 0;
+    int klen = 0, vlen = 0, flen = 0;
+
+    for ( ; ( next = sdb_view_next( p, map + len, &rec, &key, &klen, 
+				    &val, &vlen ) ) != NULL; p = next ) {
+	sdb_copy( fkey, MAX_KEY, key, klen );
+	sdb_copy( fval, MAX_VAL, val, vlen );
+	if ( !cb( fkey, fval, arg, err ) ) {
+	    if ( *err ) { return 0; }
+	    continue;		/* dropped */
+	}
+	if ( *err ) { return 0; }
+	flen = strlen( fval );
+	if ( rec == map + wpos && flen == vlen && 
+	     memcmp( fval, val, vlen ) == 0 ) {
+	    wpos = next - map;	/* in place already */
+	    continue;
+	}
+	use = klen + 1 + flen + 1;
+	if ( wpos + use > next - map ) { *err = EINPUT; return 0; }
+	memmove( map + wpos, key, klen );
+	map[wpos + klen] = ' ';
+	memcpy( map + wpos + klen + 1, fval, flen );
+	map[wpos + use - 1] = '\n';
+	wpos += use;
+    }
+    h->write_pos = wpos;
+    return 1;
+}
+
 int sdb_updateiterate( DB* h, sdb_wcallback cb, void* arg, int* err )
 {
     int found = 0, res = 0;
     char fkey[MAX_KEY+1] = {0};
     char fval[MAX_VAL+1] = {0};
+    char* map = NULL;
+    long len = 0;
+
+    *err = 0;
+    if ( h == NULL || h->file == NULL ) { return 0; }
+    if ( sdb_map( h, 1, &map, &len, err ) ) {
+	h->write_pos = 0;
+	found = sdb_updatemapped( h, cb, arg, map, len, err );
+	sdb_unmap( map, len );
+	if ( !found ) { goto fail; }
+	if ( fseek( h->file, h->write_pos, SEEK_SET ) == -1 ) { 
+	    *err = errno; goto fail; 
+	}
+	goto truncate;
+    }
+    *err = 0;			/* rewrite it with stdio instead */
 
     for ( found = sdb_findfirst( h, fkey, MAX_KEY, fval, MAX_VAL, err );
 	  found;
@@ -221,18 +537,163 @@ int sdb_updateiterate( DB* h, sdb_wcallback cb, void* arg, int* err )
 	else if ( *err ) { goto fail; }
     }
 
+ truncate:
     res = ftruncate( fileno( h->file ), h->write_pos );
+    sdb_cursor_clear( h );	/* any incremental pass is now complete */
     return 1;
  fail:
     return 0;
 }
 
-/* higher level functions */
+/* incremental update: an update pass is spread over many calls of
+ * sdb_updatestep.  The file is compacted in place as for
+ * sdb_updateiterate; between calls [write_pos,read_pos) is filled
+ * with spaces so it reads as a blank line, and the two positions are
+ * kept in <dbname>.purge, whose existence means a pass is under way.
+ */
 
-int hashcash_db_open( DB* db, const char* db_filename, int* err ) {
-    int my_err;
+static long sdb_millis( void )
+{
+#if defined( WIN32 )
+    return GetTickCount();
+#else
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
 
-    if ( !err ) { err = &my_err; }
+static int sdb_stepping( DB* h )
+{
+    char name[PATH_MAX+1] = {0};
+    struct stat st;
+
+    if ( !sdb_sidename( h, CURSOR_SUFFIX, name ) ) { return 0; }
+    return stat( name, &st ) == 0;
+}
+
+static void sdb_cursor_read( DB* h, long* rpos, long* wpos )
+{
+    char name[PATH_MAX+1] = {0};
+    struct stat st;
+    FILE* fp = NULL;
+    int ok = 0;
+
+    *rpos = 0; *wpos = 0;
+    if ( !sdb_sidename( h, CURSOR_SUFFIX, name ) ) { return; }
+    fp = fopen( name, "r" );
+    if ( fp == NULL ) { return; }
+    ok = fscanf( fp, "%ld %ld", rpos, wpos ) == 2;
+    fclose( fp );
+
+    /* if it doesn't make sense start the pass over, blanks are dropped */
+    if ( !ok || *wpos < 0 || *wpos > *rpos || 
+	 fstat( fileno( h->file ), &st ) != 0 || *rpos > st.st_size ) {
+	*rpos = 0; *wpos = 0;
+    }
+}
+
+static int sdb_cursor_write( DB* h, long rpos, long wpos, int* err )
+{
+    char name[PATH_MAX+1] = {0};
+    FILE* fp = NULL;
+
+    if ( !sdb_sidename( h, CURSOR_SUFFIX, name ) ) { 
+	*err = ENAMETOOLONG; return 0; 
+    }
+    fp = fopen( name, "w" );
+    if ( fp == NULL ) { goto fail; }
+    if ( fprintf( fp, "%ld %ld\n", rpos, wpos ) < 0 ) { goto fail; }
+    if ( fclose( fp ) == EOF ) { fp = NULL; goto fail; }
+    return 1;
+ fail:
+    *err = errno;
+    if ( fp ) { fclose( fp ); }
+    return 0;
+}
+
+static void sdb_cursor_clear( DB* h )
+{
+    char name[PATH_MAX+1] = {0};
+    if ( sdb_sidename( h, CURSOR_SUFFIX, name ) ) { unlink( name ); }
+}
+
+/* overwrite [from,to) with a blank line */
+
+static int sdb_blank( DB* h, long from, long to, int* err )
+{
+    static const char spaces[64] = "                                "
+	"                                ";
+    long use = 0;
+
+    if ( from >= to ) { return 1; }
+    if ( fseek( h->file, from, SEEK_SET ) == -1 ) { goto fail; }
+    for ( to--; from < to; from += use ) {
+	use = to - from > (long)sizeof( spaces ) ? 
+	    (long)sizeof( spaces ) : to - from;
+	if ( fwrite( spaces, 1, use, h->file ) != use ) { goto fail; }
+    }
+    if ( fputc( '\n', h->file ) == EOF ) { goto fail; }
+    return 1;
+ fail:
+    *err = errno;
+    return 0;
+}
+
+int sdb_updatestep( DB* h, sdb_wcallback cb, void* arg, long max_records,
+		    long max_millis, int* done, int* err )
+{
+    char fkey[MAX_KEY+1] = {0};
+    char fval[MAX_VAL+1] = {0};
+    long start = sdb_millis(), records = 0;
+    long rpos = 0, blanked = 0;
+
+    *err = 0;
+    *done = 0;
+    if ( h == NULL || h->file == NULL ) { return 0; }
+    if ( fflush( h->file ) == EOF ) { goto fail; }
+
+    sdb_cursor_read( h, &rpos, &(h->write_pos) );
+    blanked = rpos;		/* [write_pos,rpos) is already blank */
+    if ( fseek( h->file, rpos, SEEK_SET ) == -1 ) { goto fail; }
+
+    for ( ;; ) {
+	if ( max_records > 0 && records >= max_records ) { break; }
+	if ( max_millis > 0 && sdb_millis() - start >= max_millis ) { break; }
+	if ( !sdb_findnext( h, fkey, MAX_KEY, fval, MAX_VAL, err ) ) {
+	    if ( *err ) { return 0; }
+	    *done = 1;
+	    break;
+	}
+	records++;
+	if ( cb( fkey, fval, arg, err ) ) {
+	    if ( *err ) { return 0; }
+	    if ( !sdb_insert( h, fkey, fval, err ) ) { return 0; }
+	}
+	else if ( *err ) { return 0; }
+    }
+
+    if ( *done ) {
+	if ( fflush( h->file ) == EOF ) { goto fail; }
+	if ( ftruncate( fileno( h->file ), h->write_pos ) != 0 ) { goto fail; }
+	sdb_cursor_clear( h );
+	return 1;
+    }
+
+    rpos = ftell( h->file );
+    if ( rpos < 0 ) { goto fail; }
+    if ( blanked < h->write_pos ) { blanked = h->write_pos; }
+    if ( !sdb_blank( h, blanked, rpos, err ) ) { return 0; }
+    if ( fflush( h->file ) == EOF ) { goto fail; }
+    return sdb_cursor_write( h, rpos, h->write_pos, err );
+ fail:
+    *err = errno;
+    return 0;
+}
+
+/* higher level functions */
+
+static int db_open_file( DB* db, const char* db_filename, int* err ) {
     if ( !sdb_open( db, db_filename, err ) ) { return 0; }
     fgetc( db->file );		/* try read to trigger EOF */
     if ( feof( db->file ) ) {
@@ -244,6 +705,127 @@ int hashcash_db_open( DB* db, const char* db_filename, int* err ) {
     return 1;
 }
 
+/* number of shards recorded in the first line of db_filename, 0 if
+ * it is a one file db or doesn't exist; only takes a read lock
+ */
+
+static int db_shards_of( const char* db_filename ) {
+    char line[ 64 ] = {0};
+    FILE* fp = NULL;
+    int shards = 0;
+
+    fp = fopen( db_filename, "r" );
+    if ( fp == NULL ) { return 0; }
+    if ( lock_read( fp ) && fgets( line, sizeof( line ), fp ) &&
+	 strncmp( line, SHARDS_KEY " ", strlen( SHARDS_KEY " " ) ) == 0 ) {
+	shards = atoi( line + strlen( SHARDS_KEY " " ) );
+	if ( shards < 0 || shards > MAX_SHARDS ) { shards = 0; }
+    }
+    fclose( fp );
+    return shards;
+}
+
+static int db_shards_init( DB* db, const char* db_filename, int shards,
+			   int* err ) {
+    db->file = NULL;
+    strncpy( db->filename, db_filename, PATH_MAX ); 
+    db->filename[PATH_MAX] = '\0';
+    db->sync_mode = SDB_SYNC_NONE;
+    db->sync_interval = 0;
+    db->batch = 0;
+    db->unsynced = 0;
+    db->shards = shards;
+    db->shard = calloc( shards, sizeof( DB ) );
+    if ( db->shard == NULL ) { *err = ENOMEM; return 0; }
+    return 1;
+}
+
+static int db_shard_open( DB* db, int i, int* err ) {
+    char name[ PATH_MAX+1 ] = {0};
+    DB* shard = &db->shard[i];
+
+    if ( shard->file ) { return 1; }
+    if ( strlen( db->filename ) + 4 > PATH_MAX ) { 
+	*err = ENAMETOOLONG; return 0; 
+    }
+    sprintf( name, "%s.%d", db->filename, i );
+    if ( !db_open_file( shard, name, err ) ) { return 0; }
+    shard->sync_mode = db->sync_mode;
+    shard->sync_interval = db->sync_interval;
+    return 1;
+}
+
+/* the shard is chosen from the tail of the digest, the head is the
+ * zero bits the stamp was minted for
+ */
+
+static int db_shard_index( DB* db, const char* token ) {
+    SHA1_ctx ctx;
+    byte md[ SHA1_DIGEST_BYTES ];
+    unsigned long tail = 0;
+    int i = 0;
+
+    SHA1_Init( &ctx );
+    SHA1_Update( &ctx, token, strlen( token ) );
+    SHA1_Final( &ctx, md );
+    for ( i = SHA1_DIGEST_BYTES - 4; i < SHA1_DIGEST_BYTES; i++ ) {
+	tail = ( tail << 8 ) | md[i];
+    }
+    return (int)( tail % db->shards );
+}
+
+static DB* db_shard( DB* db, const char* token, int* err ) {
+    int i = db_shard_index( db, token );
+    return db_shard_open( db, i, err ) ? &db->shard[i] : NULL;
+}
+
+void hashcash_db_nowait( int nowait ) {
+    lock_nowait( nowait );
+}
+
+int hashcash_db_open( DB* db, const char* db_filename, int* err ) {
+    int shards = 0, my_err;
+
+    if ( !err ) { err = &my_err; }
+    *err = 0;
+    shards = db_shards_of( db_filename );
+    if ( shards > 0 ) { 
+	return db_shards_init( db, db_filename, shards, err ); 
+    }
+    return db_open_file( db, db_filename, err );
+}
+
+int hashcash_db_open_sharded( DB* db, const char* db_filename, int shards,
+			      int* err ) {
+    char val[ MAX_VAL+1 ] = {0};
+    char num[ 16 ] = {0};
+    int found = 0, empty = 0, my_err;
+
+    if ( !err ) { err = &my_err; }
+    *err = 0;
+    if ( shards <= 1 ) { return hashcash_db_open( db, db_filename, err ); }
+    if ( shards > MAX_SHARDS ) { *err = EINPUT; return 0; }
+
+    /* create or check the shard count under the root file's lock */
+    if ( !sdb_open( db, db_filename, err ) ) { return 0; }
+    fgetc( db->file );
+    empty = feof( db->file );
+    if ( empty ) {
+	sprintf( num, "%d", shards );
+	if ( !sdb_add( db, SHARDS_KEY, num, err ) ) { goto fail; }
+    } else {
+	found = sdb_lookup( db, SHARDS_KEY, val, MAX_VAL, err );
+	if ( *err ) { goto fail; }
+	if ( !found || atoi( val ) != shards ) { *err = EINPUT; goto fail; }
+    }
+    if ( !sdb_close( db, err ) ) { return 0; }
+    return db_shards_init( db, db_filename, shards, err );
+ fail:
+    fclose( db->file );
+    db->file = NULL;
+    return 0;
+}
+
 int hashcash_db_in( DB* db, char* token, char *period, int* err ) {
     int in_db = 0;
     int my_err;
@@ -251,18 +833,209 @@ int hashcash_db_in( DB* db, char* token, char *period, int* err ) {
     if ( !err ) { err = &my_err; }
     *err = 0;
 
+    if ( db->shards ) {
+	db = db_shard( db, token, err );
+	if ( db == NULL ) { return 0; }
+    }
     in_db = sdb_lookup( db, token, period, MAX_UTC, err ); 
     if ( *err ) { return 0; }
     return in_db;
 }
 
 int hashcash_db_add( DB* db, char* token, char *period, int* err ) {
+    int my_err;
+
+    if ( !err ) { err = &my_err; }
+    if ( db->shards ) {
+	db = db_shard( db, token, err );
+	if ( db == NULL ) { return 0; }
+    }
     if ( !sdb_add( db, token, period, err ) ) { 
 	return 0; 
     }
     return 1;
 }
 
+int hashcash_db_iterate( DB* db, sdb_vcallback cb, void* arg, int* err ) {
+    int i = 0, found = 0, my_err;
+
+    if ( !err ) { err = &my_err; }
+    *err = 0;
+    if ( db->shards ) {
+	for ( i = 0; i < db->shards && !found; i++ ) {
+	    if ( !db_shard_open( db, i, err ) ) { return 0; }
+	    found = hashcash_db_iterate( &db->shard[i], cb, arg, err );
+	    if ( *err ) { return 0; }
+	}
+	return found;
+    }
+    rewind( db->file );
+    return sdb_viewiterate( db, cb, arg, err );
+}
+
+int hashcash_db_durability( DB* db, int mode, long interval, int* err ) {
+    int i = 0, my_err;
+
+    if ( !err ) { err = &my_err; }
+    *err = 0;
+    if ( mode != SDB_SYNC_NONE && mode != SDB_SYNC_BATCH && 
+	 mode != SDB_SYNC_INTERVAL ) {
+	*err = EINPUT; return 0;
+    }
+    if ( interval < 0 ) { *err = EINPUT; return 0; }
+    db->sync_mode = mode;
+    db->sync_interval = interval;
+    for ( i = 0; i < db->shards; i++ ) {
+	db->shard[i].sync_mode = mode;
+	db->shard[i].sync_interval = interval;
+    }
+    return 1;
+}
+
+typedef struct {
+    const char* token;
+    int index;
+} batch_ent;
+
+static int batch_cmp( const void* ap, const void* bp ) {
+    const batch_ent* a = (const batch_ent*)ap;
+    const batch_ent* b = (const batch_ent*)bp;
+    int res = strcmp( a->token, b->token );
+    return res ? res : a->index - b->index;
+}
+
+typedef struct {
+    batch_ent* ents;
+    int num;
+    int* spent;
+} batch_arg;
+
+/* compare a key view with a NUL terminated token */
+
+static int batch_viewcmp( const char* key, int klen, const char* token ) {
+    int res = strncmp( key, token, klen );
+    if ( res ) { return res; }
+    return token[klen] == '\0' ? 0 : -1;
+}
+
+static int batch_vcb_mark( const char* key, int klen, const char* val, 
+			   int vlen, void* argp, int* err ) {
+    batch_arg* arg = (batch_arg*)argp;
+    int lo = 0, hi = arg->num, mid = 0, res = 0;
+
+    *err = 0;
+    while ( lo < hi ) {		/* first entry >= key */
+	mid = ( lo + hi ) / 2;
+	res = batch_viewcmp( key, klen, arg->ents[mid].token );
+	if ( res > 0 ) { lo = mid + 1; } else { hi = mid; }
+    }
+    for ( ; lo < arg->num && 
+	      batch_viewcmp( key, klen, arg->ents[lo].token ) == 0; lo++ ) {
+	arg->spent[arg->ents[lo].index] = 1;
+    }
+    return 0;			/* keep going */
+}
+
+/* mark spent[] for tokens already in the db using one scan, and for
+ * repeats within the batch itself
+ */
+
+static int db_batch_lookup( DB* db, char** tokens, int num, int* spent, 
+			    int* err ) {
+    batch_ent* ents = NULL;
+    batch_arg arg;
+    int i = 0;
+
+    ents = malloc( sizeof( batch_ent ) * num );
+    if ( ents == NULL ) { *err = ENOMEM; return 0; }
+    for ( i = 0; i < num; i++ ) {
+	ents[i].token = tokens[i];
+	ents[i].index = i;
+	spent[i] = 0;
+    }
+    qsort( ents, num, sizeof( batch_ent ), batch_cmp );
+
+    arg.ents = ents;
+    arg.num = num;
+    arg.spent = spent;
+    rewind( db->file );
+    sdb_viewiterate( db, batch_vcb_mark, (void*)&arg, err );
+    if ( *err ) { free( ents ); return 0; }
+
+    for ( i = 1; i < num; i++ ) {
+	if ( strcmp( ents[i].token, ents[i-1].token ) == 0 ) {
+	    spent[ents[i].index] = 1;
+	}
+    }
+    free( ents );
+    return 1;
+}
+
+/* split a batch by shard and add each part to its shard */
+
+static int db_add_batch_sharded( DB* db, char** tokens, char** periods, 
+				 int num, int* spent, int* err ) {
+    char** sub_tokens = NULL, **sub_periods = NULL;
+    int* sub_spent = NULL, *which = NULL, *index = NULL;
+    int i = 0, s = 0, n = 0, ok = 1;
+
+    sub_tokens = malloc( sizeof( char* ) * num );
+    sub_periods = malloc( sizeof( char* ) * num );
+    sub_spent = malloc( sizeof( int ) * num );
+    which = malloc( sizeof( int ) * num );
+    index = malloc( sizeof( int ) * num );
+    if ( !sub_tokens || !sub_periods || !sub_spent || !which || !index ) {
+	*err = ENOMEM; ok = 0; goto done;
+    }
+    for ( i = 0; i < num; i++ ) { which[i] = db_shard_index( db, tokens[i] ); }
+
+    for ( s = 0; ok && s < db->shards; s++ ) {
+	for ( n = 0, i = 0; i < num; i++ ) {
+	    if ( which[i] != s ) { continue; }
+	    sub_tokens[n] = tokens[i];
+	    sub_periods[n] = periods[i];
+	    index[n++] = i;
+	}
+	if ( n == 0 ) { continue; }
+	ok = db_shard_open( db, s, err ) &&
+	    hashcash_db_add_batch( &db->shard[s], sub_tokens, sub_periods, 
+				   n, spent ? sub_spent : NULL, err );
+	for ( i = 0; ok && spent && i < n; i++ ) { 
+	    spent[index[i]] = sub_spent[i]; 
+	}
+    }
+ done:
+    free( sub_tokens ); free( sub_periods ); free( sub_spent );
+    free( which ); free( index );
+    return ok;
+}
+
+int hashcash_db_add_batch( DB* db, char** tokens, char** periods, int num,
+			   int* spent, int* err ) {
+    int i = 0, my_err, commit_err = 0;
+
+    if ( !err ) { err = &my_err; }
+    *err = 0;
+    if ( num <= 0 ) { return 1; }
+    if ( db->shards ) {
+	return db_add_batch_sharded( db, tokens, periods, num, spent, err );
+    }
+    if ( spent && !db_batch_lookup( db, tokens, num, spent, err ) ) { 
+	return 0; 
+    }
+    if ( !sdb_begin( db, err ) ) { return 0; }
+    for ( i = 0; i < num; i++ ) {
+	if ( spent && spent[i] ) { continue; }
+	if ( !sdb_add( db, tokens[i], periods[i], err ) ) { 
+	    /* close the batch, syncing the adds made, but report the
+	       add's error */
+	    sdb_commit( db, &commit_err );
+	    return 0; 
+	}
+    }
+    return sdb_commit( db, err );
+}
+
 /* compile time assert */
 
 #if MAX_UTC > MAX_VAL
@@ -274,13 +1047,10 @@ static int sdb_cb_token_matcher( const char* key, char* val,
     db_arg* arg = (db_arg*)argp;
     char token_utime[ MAX_UTC+1 ] = {0};
     char token_res[ MAX_RES+1 ] = {0}, lower_token_res[ MAX_RES+1 ] = {0};
-    char *res = NULL;
     time_t expires = 0;
     time_t expiry_period = 0;
     time_t created = 0;
-    int vers = 0, i = 0, bits = 0, matched = 0, type = 0, case_flag = 0;
-    int lowered = 0 ;
-    void** compile = NULL;
+    int vers = 0, bits = 0, matched = 0;
     char* re_err = NULL;
 
     *err = 0;
@@ -298,26 +1068,15 @@ static int sdb_cb_token_matcher( const char* key, char* val,
 	*err = EINPUT; 		/* unsupported version number in DB */
 	return 0; 
     }
-    /* if purging only for given resource */
-    if ( array_num( arg->resource ) > 0 ) {
-	matched = 0;
-	for ( i = 0; !matched && i < array_num( arg->resource ); i++ ) {
-	    res = arg->resource->elt[i].str;
-	    type = arg->resource->elt[i].type;
-	    case_flag = arg->resource->elt[i].case_flag;
-	    compile = &(arg->resource->elt[i].regexp);
-	    if ( !case_flag && !lowered ) {
-		strncpy( lower_token_res, token_res, MAX_RES );
-		stolower( lower_token_res );
-		lowered = 1;
-	    }
-	    matched = hashcash_resource_match( type, case_flag ? 
-					       token_res : lower_token_res, 
-					       res, compile, &re_err );
-	    if ( re_err != NULL ) { 
-		fprintf( stderr, "regexp error: " ); 
-		die_msg( re_err ); 
-	    }
+    /* if purging only for given resources */
+    if ( arg->matcher ) {
+	sstrncpy( lower_token_res, token_res, MAX_RES );
+	stolower( lower_token_res );
+	matched = hashcash_matcher_match( arg->matcher, token_res, 
+					  lower_token_res, NULL, &re_err );
+	if ( matched < 0 ) { 
+	    fprintf( stderr, "regexp error: " ); 
+	    die_msg( re_err ); 
 	}
 	if ( !matched ) { return 1; } /* if it doesn't match, keep it */
     }
@@ -336,15 +1095,30 @@ static int sdb_cb_token_matcher( const char* key, char* val,
     return 1;			/* otherwise keep */
 }
 
-int db_purge( DB* db, ARRAY* purge_resource, int purge_all, 
-	       long purge_period, time_t now_time, long validity_period,
-	       long grace_period, int verbose_flag, int* err ) {
+static int db_purge_shards( DB* db, hashcash_matcher* matcher, 
+			    int purge_all, long purge_period, time_t now_time,
+			    long validity_period, long grace_period, 
+			    int verbose_flag, long max_records, 
+			    long max_millis, int incremental, int* err );
+
+static int db_purge_matched( DB* db, hashcash_matcher* matcher, 
+			     int purge_all, long purge_period, 
+			     time_t now_time, long validity_period, 
+			     long grace_period, int verbose_flag, 
+			     long max_records, long max_millis,
+			     int incremental, int* err ) {
     time_t last_time = 0 ;
     char purge_utime[ MAX_UTC+1 ] = {0}; /* time token created */
-    int ret = 0;
+    int ret = 0, done = 0;
     db_arg arg;
 
     if ( now_time < 0 ) { return HASHCASH_INVALID_TIME; }
+    if ( db->shards ) {
+	return db_purge_shards( db, matcher, purge_all, purge_period,
+				now_time, validity_period, grace_period, 
+				verbose_flag, max_records, max_millis, 
+				incremental, err );
+    }
 
     if ( !sdb_lookup( db, PURGED_KEY, purge_utime, MAX_UTC, err ) ) {
 	return 0;
@@ -360,12 +1134,19 @@ int db_purge( DB* db, ARRAY* purge_resource, int purge_all,
     }
 
     arg.expires_before = now_time;
-    arg.resource = purge_resource;
+    arg.matcher = matcher;
     arg.all = purge_all;
     arg.validity = validity_period;
     arg.grace = grace_period;
 
-    if ( purge_period == 0 || now_time >= last_time + purge_period ) {
+    if ( incremental && ( sdb_stepping( db ) || purge_period == 0 || 
+			  now_time >= last_time + purge_period ) ) {
+	VPRINTF( stderr, "purging database: step ..." );
+	ret = sdb_updatestep( db, sdb_cb_token_matcher, (void*)&arg, 
+			      max_records, max_millis, &done, err );
+	VPRINTF( stderr, ret ? ( done ? "done\n" : "continues\n" ) : 
+		 "failed\n" ); 
+    } else if ( purge_period == 0 || now_time >= last_time + purge_period ) {
 	VPRINTF( stderr, "purging database: ..." );
 	ret = sdb_updateiterate( db, sdb_cb_token_matcher, (void*)&arg, err );
 	VPRINTF( stderr, ret ? "done\n" : "failed\n" ); 
@@ -375,19 +1156,205 @@ int db_purge( DB* db, ARRAY* purge_resource, int purge_all,
     return ret;
 }
 
+/* purge each shard as a separate db, in parallel if we have threads */
+
+typedef struct {
+    DB* db;
+    hashcash_matcher* matcher;
+    int purge_all;
+    long purge_period;
+    time_t now_time;
+    long validity_period;
+    long grace_period;
+    int verbose_flag;
+    long max_records;
+    long max_millis;
+    int incremental;
+    int ret;
+    int err;
+} purge_job;
+
+static void* db_purge_job( void* argp ) {
+    purge_job* job = (purge_job*)argp;
+    job->ret = db_purge_matched( job->db, job->matcher, job->purge_all,
+				 job->purge_period, job->now_time, 
+				 job->validity_period, job->grace_period, 
+				 job->verbose_flag, job->max_records, 
+				 job->max_millis, job->incremental, 
+				 &job->err );
+    return NULL;
+}
+
+static int db_purge_shards( DB* db, hashcash_matcher* matcher, 
+			    int purge_all, long purge_period, time_t now_time,
+			    long validity_period, long grace_period, 
+			    int verbose_flag, long max_records, 
+			    long max_millis, int incremental, int* err ) {
+    purge_job* jobs = NULL;
+#if defined( HAVE_PTHREADS )
+    pthread_t* threads = NULL;
+    int* started = NULL;
+#endif
+    int i = 0, ret = 1;
+
+    jobs = calloc( db->shards, sizeof( purge_job ) );
+    if ( jobs == NULL ) { *err = ENOMEM; return 0; }
+    for ( i = 0; i < db->shards; i++ ) {
+	if ( !db_shard_open( db, i, err ) ) { free( jobs ); return 0; }
+	jobs[i].db = &db->shard[i];
+	jobs[i].matcher = matcher; /* built already, so read only */
+	jobs[i].purge_all = purge_all;
+	jobs[i].purge_period = purge_period;
+	jobs[i].now_time = now_time;
+	jobs[i].validity_period = validity_period;
+	jobs[i].grace_period = grace_period;
+	jobs[i].verbose_flag = 0; /* would interleave, report below */
+	jobs[i].max_records = max_records;
+	jobs[i].max_millis = max_millis;
+	jobs[i].incremental = incremental;
+    }
+
+    VPRINTF( stderr, "purging database: %d shards ...", db->shards );
+#if defined( HAVE_PTHREADS )
+    threads = calloc( db->shards, sizeof( pthread_t ) );
+    started = calloc( db->shards, sizeof( int ) );
+    for ( i = 0; threads && started && i < db->shards; i++ ) {
+	started[i] = pthread_create( &threads[i], NULL, 
+				     db_purge_job, &jobs[i] ) == 0;
+    }
+    for ( i = 0; i < db->shards; i++ ) {
+	if ( threads && started && started[i] ) { 
+	    pthread_join( threads[i], NULL ); 
+	} else { 
+	    db_purge_job( &jobs[i] ); /* couldn't start, do it here */
+	}
+    }
+    free( threads );
+    free( started );
+#else
+    for ( i = 0; i < db->shards; i++ ) { db_purge_job( &jobs[i] ); }
+#endif
+
+    for ( i = 0; i < db->shards; i++ ) {
+	if ( jobs[i].ret != 1 ) { 
+	    ret = jobs[i].ret; *err = jobs[i].err; 
+	    break; 
+	}
+    }
+    VPRINTF( stderr, ret == 1 ? "done\n" : "failed\n" );
+    free( jobs );
+    return ret;
+}
+
+/* one matcher for all the resources, built and its regexps compiled
+ * before any purging so a bad regexp is reported up front and shard
+ * threads can share it
+ */
+
+static int db_purge_run( DB* db, ARRAY* purge_resource, int purge_all, 
+			 long purge_period, time_t now_time, 
+			 long validity_period, long grace_period, 
+			 int verbose_flag, long max_records, long max_millis,
+			 int incremental, int* err ) {
+    hashcash_matcher* matcher = NULL;
+    ELEMENT* elt = NULL;
+    char* re_err = NULL;
+    int i = 0, ret = 0;
+
+    if ( array_num( purge_resource ) > 0 ) {
+	matcher = hashcash_matcher_new();
+	if ( matcher == NULL ) { *err = ENOMEM; return 0; }
+	for ( i = 0; i < array_num( purge_resource ); i++ ) {
+	    elt = &purge_resource->elt[i];
+	    if ( !hashcash_matcher_add( matcher, elt->type, elt->case_flag,
+					elt->str ) ) {
+		hashcash_matcher_free( matcher );
+		*err = ENOMEM; return 0;
+	    }
+	}
+	if ( hashcash_matcher_match( matcher, "", "", NULL, &re_err ) < 0 ) {
+	    fprintf( stderr, "regexp error: " ); 
+	    die_msg( re_err ); 
+	}
+    }
+    ret = db_purge_matched( db, matcher, purge_all, purge_period, now_time,
+			    validity_period, grace_period, verbose_flag, 
+			    max_records, max_millis, incremental, err );
+    hashcash_matcher_free( matcher );
+    return ret;
+}
+
+int db_purge( DB* db, ARRAY* purge_resource, int purge_all, 
+	       long purge_period, time_t now_time, long validity_period,
+	       long grace_period, int verbose_flag, int* err ) {
+    return db_purge_run( db, purge_resource, purge_all, purge_period, 
+			 now_time, validity_period, grace_period, 
+			 verbose_flag, 0, 0, 0, err );
+}
+
+/* as db_purge, but examine at most max_records records or spend at
+ * most max_millis milliseconds, continuing where the last call left
+ * off; a value of 0 means no limit of that kind
+ */
+
+int db_purge_step( DB* db, ARRAY* purge_resource, int purge_all, 
+		   long purge_period, time_t now_time, long validity_period,
+		   long grace_period, int verbose_flag, long max_records,
+		   long max_millis, int* err ) {
+    return db_purge_run( db, purge_resource, purge_all, purge_period, 
+			 now_time, validity_period, grace_period, 
+			 verbose_flag, max_records, max_millis, 1, err );
+}
+
 int hashcash_db_purge( DB* db, const char* purge_resource, int type,
 		       int case_flag, long validity_period, long grace_period,
 		       int purge_all, long purge_period, time_t now_time,
 		       int* err ) {
-    ARRAY* purge_resource_arr = NULL;
-    array_alloc( purge_resource_arr, 1 );
-    array_push( purge_resource_arr, purge_resource, type, case_flag,
-		validity_period, grace_period, 0, 0, 0, 0 );
-    return db_purge( db, purge_resource_arr, purge_all, purge_period, 
-		     now_time, validity_period, grace_period, 0, err );
+    return hashcash_db_purge_step( db, purge_resource, type, case_flag, 
+				   validity_period, grace_period, purge_all,
+				   purge_period, now_time, 0, 0, err );
+}
+
+int hashcash_db_purge_step( DB* db, const char* purge_resource, int type,
+			    int case_flag, long validity_period, 
+			    long grace_period, int purge_all, 
+			    long purge_period, time_t now_time, 
+			    long max_records, long max_millis, int* err ) {
+    ARRAY purge_resource_arr;
+    int ret = 0, my_err;
+
+    if ( !err ) { err = &my_err; }
+    array_alloc( &purge_resource_arr, 1 );
+    if ( purge_resource && purge_resource[0] ) {
+	array_push( &purge_resource_arr, purge_resource, type, case_flag,
+		    validity_period, grace_period, 0, 0, 0, 0 );
+    }
+    ret = db_purge_run( db, &purge_resource_arr, purge_all, purge_period, 
+			now_time, validity_period, grace_period, 0, 
+			max_records, max_millis, 
+			max_records > 0 || max_millis > 0, err );
+    if ( array_num( &purge_resource_arr ) > 0 ) {
+	free( purge_resource_arr.elt[0].str );
+    }
+    free( purge_resource_arr.elt );
+    return ret;
 }
 
 int hashcash_db_close( DB* db, int* err ) {
+    int i = 0, ok = 1, my_err;
+
+    if ( !err ) { err = &my_err; }
+    if ( db->shards ) {
+	for ( i = 0; i < db->shards; i++ ) {
+	    if ( db->shard[i].file && !sdb_close( &db->shard[i], err ) ) {
+		ok = 0; 
+	    }
+	}
+	free( db->shard );
+	db->shard = NULL;
+	db->shards = 0;
+	return ok;
+    }
     if ( !sdb_close( db, err ) ) { return 0; }
     return 1;
 }
@@ -23,11 +23,17 @@ extern "C" {
     #endif
 #endif
 
-typedef struct {
+typedef struct sdb {
     FILE* file;
     char filename[PATH_MAX+1];
     long read_pos;
     long write_pos;
+    int sync_mode;		/* one of the SDB_SYNC_* durability modes */
+    long sync_interval;		/* seconds between syncs for SDB_SYNC_INTERVAL */
+    int batch;			/* nesting depth of sdb_begin calls */
+    int unsynced;		/* records written but not yet fsync'd */
+    int shards;			/* 0 for one file, else number of shards */
+    struct sdb* shard;		/* shard handles, each opened when used */
 } DB;
 
 #define MAX_KEY 10240+1024+1
@@ -36,13 +42,56 @@ typedef struct {
 #define READ_MODE 0
 #define WRITE_MODE 1
 
+/* durability of inserted records:
+ *
+ * SDB_SYNC_NONE     -- leave flushing to stdio and the OS (default)
+ * SDB_SYNC_BATCH    -- fsync once per batch, a lone sdb_add is a batch of 1
+ * SDB_SYNC_INTERVAL -- fsync at most once per sync_interval seconds; the
+ *                      time of the last sync is shared between processes
+ *                      through the mtime of the file <dbname>.sync so
+ *                      forked checkers share one fsync per interval
+ */
+
+#define SDB_SYNC_NONE 0
+#define SDB_SYNC_BATCH 1
+#define SDB_SYNC_INTERVAL 2
+
+#define SYNC_SUFFIX ".sync"
+#define CURSOR_SUFFIX ".purge"
+
 /* higher level functions */
 
 #define PURGED_KEY "last_purged"
+#define SHARDS_KEY "shards"
+#define MAX_SHARDS 256
+
+/* a sharded db is a file <dbname> holding only the record "shards n"
+ * and n ordinary db files <dbname>.0 .. <dbname>.n-1, each with its
+ * own lock; a stamp lives in the shard selected by its SHA1 digest.
+ * hashcash_db_open recognises a sharded db, so the higher level
+ * functions below work on either kind.  The sdb_* functions work on
+ * a single file only.
+ */
 
 HCEXPORT
 int hashcash_db_open( DB* db, const char* db_filename, int* err );
 
+/* open or create a db split over shards files, shards <= 1 is the
+ * same as hashcash_db_open.  An existing db must have been created
+ * with the same number of shards; one file dbs are not converted.
+ */
+
+HCEXPORT
+int hashcash_db_open_sharded( DB* db, const char* db_filename, int shards,
+			      int* err );
+
+/* with nowait set, opening a db another process holds fails with
+ * EWOULDBLOCK instead of waiting for it, eg one a hashcashd owns
+ */
+
+HCEXPORT
+void hashcash_db_nowait( int nowait );
+
 HCEXPORT
 int hashcash_db_in( DB* db, char* token, char *period, int* err );
 
@@ -52,12 +101,43 @@ int hashcash_db_add( DB* db, char* token, char *period, int* err );
 HCEXPORT
 int hashcash_db_close( DB* db, int* err );
 
+/* set durability mode of subsequent adds, see SDB_SYNC_* above */
+
+HCEXPORT
+int hashcash_db_durability( DB* db, int mode, long interval, int* err );
+
+/* add num tokens with a single group commit
+ *
+ * if spent is non-NULL each token is first looked up (one scan of the
+ * database for the whole batch), spent[i] is set to 1 for tokens
+ * already in the database or earlier in the batch, which are not
+ * added again, and 0 for tokens added.  periods[i] is the expiry
+ * period stored with tokens[i].
+ */
+
+HCEXPORT
+int hashcash_db_add_batch( DB* db, char** tokens, char** periods, int num,
+			   int* spent, int* err );
+
 HCEXPORT
 int hashcash_db_purge( DB* db, const char* purge_resource, int type,
 		       int case_flag, long validity_period, long grace_period,
 		       int purge_all, long purge_period, time_t now_time,
 		       int* err );
 
+/* bounded purge: do at most max_records records or max_millis
+ * milliseconds of purging per call (0 = no limit), continuing from
+ * where the previous call stopped.  A pass in progress is continued
+ * on every call, regardless of purge_period, until it completes.
+ */
+
+HCEXPORT
+int hashcash_db_purge_step( DB* db, const char* purge_resource, int type,
+			    int case_flag, long validity_period, 
+			    long grace_period, int purge_all, 
+			    long purge_period, time_t now_time, 
+			    long max_records, long max_millis, int* err );
+
 
 /* low level functions */
 
@@ -70,6 +150,11 @@ typedef int (*sdb_wcallback)( const char* key, char* val,
 typedef int (*sdb_rcallback)( const char* key, const char* val, 
 			      void* arg, int* err );
 
+/* views into the db, key and val are not NUL terminated */
+
+typedef int (*sdb_vcallback)( const char* key, int klen, const char* val,
+			      int vlen, void* arg, int* err );
+
 /* NOTE: keys should not contain spaces */
 
 HCEXPORT
@@ -79,6 +164,9 @@ int sdb_add( DB*, const char* key, const char* val, int* err );
 HCEXPORT
 int sdb_updateiterate( DB*, sdb_wcallback cb, void* arg, int* err );
 HCEXPORT
+int sdb_updatestep( DB*, sdb_wcallback cb, void* arg, long max_records,
+		    long max_millis, int* done, int* err );
+HCEXPORT
 int sdb_del( DB*, const char* key, int* err );
 HCEXPORT
 int sdb_findfirst( DB*, char* key, int klen, char* val, int vlen, int* err );
@@ -86,11 +174,27 @@ HCEXPORT
 int sdb_findnext( DB*, char* key, int klen, char* val, int vlen, int* err );
 HCEXPORT
 int sdb_lookup( DB*, const char* key, char* val, int vlen, int* err );
+
+/* from the current position call cb with each record until it returns
+ * non-zero, then return 1 positioned after that record; 0 at the end
+ */
+
+HCEXPORT
+int sdb_viewiterate( DB*, sdb_vcallback cb, void* arg, int* err );
 HCEXPORT
 int sdb_lookupnext( DB*, const char* key, char* val, int vlen, int* err );
 HCEXPORT
 int sdb_close( DB*, int* err );
 
+/* group commit: adds between sdb_begin and sdb_commit share one sync */
+
+HCEXPORT
+int sdb_begin( DB*, int* err );
+HCEXPORT
+int sdb_commit( DB*, int* err );
+HCEXPORT
+int sdb_sync( DB*, int* err );
+
 HCEXPORT
 int sdb_callbacklookup( DB*, sdb_rcallback cb, void* arg, 
 			char* key, int klen, char* val, int vlen,
@@ -101,6 +205,13 @@ int sdb_callbacklookupnext( DB*, sdb_rcallback cb, void* arg,
 			    char* key, int klen, char* val, int vlen, 
 			    int* err );
 
+/* cb with each record of a db opened with hashcash_db_open, in turn
+ * each shard of a sharded db, until cb returns non-zero
+ */
+
+HCEXPORT
+int hashcash_db_iterate( DB* db, sdb_vcallback cb, void* arg, int* err );
+
 
 #if defined( __cplusplus )
 }
@@ -1,42 +1,212 @@
 /* -*- Mode: C; c-file-style: "stroustrup" -*- */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined( unix ) || defined( __unix__ ) || defined( __APPLE__ )
+    #include <unistd.h>
+#elif defined( WIN32 )
+    #include <io.h>
+#endif
+#if defined( HAVE_PTHREADS )
+    #include <pthread.h>
+#endif
 #include "sha1.h"
 
-#define BUFFER_SIZE 1024
+#if !defined( O_BINARY )
+    #define O_BINARY 0
+#endif
 
-int SHA1_file( char* filename, byte md[ SHA1_DIGEST_BYTES ] )
+/* Files are hashed by a pool of threads, each taking the next file
+ * given, and the digests printed in argument order as they come in.
+ * Large files are read in large blocks with sequential readahead
+ * advice -- not mapped, as a file truncated while being hashed would
+ * kill us with SIGBUS; files of up to SMALL_FILE bytes are read whole
+ * and hashed SMALL_BATCH at a time with the multi-buffer SHA1.
+ */
+
+#define BUFFER_SIZE ( 1024 * 1024 )
+#define SMALL_FILE ( 64 * 1024 )
+#define SMALL_BATCH 16
+#define MAX_THREADS 256
+
+typedef struct {
+    byte md[ SHA1_DIGEST_BYTES ];
+    int err;			/* errno if it couldn't be read */
+    int done;
+} SHA1_RESULT;
+
+static char** files = NULL;
+static SHA1_RESULT* results = NULL;
+static int num_files = 0;
+static int next_file = 0;	/* next to be taken by a thread */
+#if defined( HAVE_PTHREADS )
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+#endif
+
+static void sequential( int fd )
 {
-    FILE* file = NULL ;
-    byte buffer[ BUFFER_SIZE ] = {0};
-    size_t bytes_read = 0 ;
-    int opened = 0;
+#if defined( POSIX_FADV_SEQUENTIAL )
+    posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+}
+
+/* hash what is left to read of fd */
+
+static int SHA1_fd( int fd, byte md[ SHA1_DIGEST_BYTES ] )
+{
+    byte* buffer = NULL;
+    long bytes_read = 0 ;
     SHA1_ctx ctx;
-    
-    if ( strcmp( filename, "-" ) == 0 ) {
-	file = stdin;
-    } else {
-	file = fopen( filename, "rb" );
-	if ( file == 0 ) { return -1; }
-	opened = 1;
-    }
 
+    buffer = malloc( BUFFER_SIZE );
+    if ( buffer == NULL ) { errno = ENOMEM; return -1; }
+    sequential( fd );
     SHA1_Init( &ctx );
-    while ( !feof( file ) ) {
-	bytes_read = fread( buffer, 1, BUFFER_SIZE, file );
-	if ( bytes_read < BUFFER_SIZE && ferror( file ) ) {
+    while ( ( bytes_read = read( fd, buffer, BUFFER_SIZE ) ) != 0 ) {
+	if ( bytes_read < 0 ) {
+	    if ( errno == EINTR ) { continue; }
+	    free( buffer );
 	    return -1;
 	}
 	SHA1_Update( &ctx, buffer, bytes_read );
     }
     SHA1_Final( &ctx, md );
-    if ( opened ) {
-	fclose( file );
-    }
+    free( buffer );
     return 0;
 }
 
+int SHA1_file( char* filename, byte md[ SHA1_DIGEST_BYTES ] )
+{
+    int fd = 0, status = 0, err = 0;
+
+    if ( strcmp( filename, "-" ) == 0 ) { return SHA1_fd( 0, md ); }
+    fd = open( filename, O_RDONLY | O_BINARY );
+    if ( fd < 0 ) { return -1; }
+    status = SHA1_fd( fd, md );
+    err = errno;
+    close( fd );
+    errno = err;
+    return status;
+}
+
+/* read a regular file of up to SMALL_FILE bytes whole into buf, to
+ * EOF rather than to the size it had when opened, as it may be growing;
+ * returns its length, or -1 if it isn't one (or can't be read)
+ */
+
+static long read_small( const char* filename, byte* buf, int* err )
+{
+    struct stat st;
+    long got = 0, n = 0;
+    byte more = 0;
+    int fd = 0;
+
+    *err = 0;
+    if ( strcmp( filename, "-" ) == 0 ) { return -1; }
+    fd = open( filename, O_RDONLY | O_BINARY );
+    if ( fd < 0 ) { *err = errno; return -1; }
+    if ( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) ||
+	 st.st_size > SMALL_FILE ) {
+	close( fd );
+	return -1;
+    }
+    for ( got = 0; got < SMALL_FILE; got += n ) {
+	n = read( fd, buf + got, SMALL_FILE - got );
+	if ( n < 0 && errno == EINTR ) { n = 0; continue; }
+	if ( n <= 0 ) { break; }
+    }
+    /* a full buffer may not be all of it: one that has grown past
+       SMALL_FILE is left to SHA1_file to stream */
+    if ( got == SMALL_FILE ) {
+	do { n = read( fd, &more, 1 ); } while ( n < 0 && errno == EINTR );
+    }
+    close( fd );
+    return n != 0 ? -1 : got;
+}
+
+static void finish( int i, int err, const byte* md )
+{
+#if defined( HAVE_PTHREADS )
+    pthread_mutex_lock( &lock );
+#endif
+    if ( md ) { memcpy( results[i].md, md, SHA1_DIGEST_BYTES ); }
+    results[i].err = err;
+    results[i].done = 1;
+#if defined( HAVE_PTHREADS )
+    pthread_cond_signal( &ready );
+    pthread_mutex_unlock( &lock );
+#endif
+}
+
+static int take_file( void )
+{
+    int i = 0;
+
+#if defined( HAVE_PTHREADS )
+    pthread_mutex_lock( &lock );
+#endif
+    i = next_file < num_files ? next_file++ : -1;
+#if defined( HAVE_PTHREADS )
+    pthread_mutex_unlock( &lock );
+#endif
+    return i;
+}
+
+static void* hash_files( void* arg )
+{
+    byte* small[ SMALL_BATCH ];
+    const void* msgs[ SMALL_BATCH ];
+    size_t lens[ SMALL_BATCH ];
+    int which[ SMALL_BATCH ];
+    byte digests[ SMALL_BATCH ][ SHA1_DIGEST_BYTES ];
+    byte md[ SHA1_DIGEST_BYTES ];
+    long len = 0;
+    int i = 0, k = 0, j = 0, err = 0;
+
+    for ( k = 0; k < SMALL_BATCH; k++ ) {
+	small[k] = malloc( SMALL_FILE );
+	if ( small[k] == NULL ) { break; }
+    }
+    for ( j = k; j < SMALL_BATCH; j++ ) { small[j] = NULL; }
+    for ( k = 0; ; ) {
+	i = take_file();
+	err = 0;
+	if ( i >= 0 && small[k] &&
+	     ( len = read_small( files[i], small[k], &err ) ) >= 0 ) {
+	    msgs[k] = small[k];
+	    lens[k] = len;
+	    which[k++] = i;
+	} else if ( i >= 0 ) {
+	    if ( !err && SHA1_file( files[i], md ) < 0 ) { err = errno; }
+	    finish( i, err, err ? NULL : md );
+	}
+	if ( k > 0 && ( k == SMALL_BATCH || i < 0 || !small[k] ) ) {
+	    SHA1_Multi( k, msgs, lens, digests );
+	    for ( j = 0; j < k; j++ ) { finish( which[j], 0, digests[j] ); }
+	    k = 0;
+	}
+	if ( i < 0 ) { break; }
+    }
+    for ( k = 0; k < SMALL_BATCH; k++ ) { free( small[k] ); }
+    return arg;
+}
+
+static int online_cpus( void )
+{
+    long n = 1;
+
+#if defined( _SC_NPROCESSORS_ONLN )
+    n = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+    return n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : (int)n;
+}
+
 const char* hex_digest( byte md[ SHA1_DIGEST_BYTES ] )
 {
     int i = 0 ;
@@ -51,27 +221,70 @@ const char* hex_digest( byte md[ SHA1_DIGEST_BYTES ] )
 
 int main( int argc, char* argv[] )
 {
-    int i = 0 ;
-    byte digest[ SHA1_DIGEST_BYTES ] = {0};
-    int status = 0 ;
-    
-    if ( argc == 1 ) {
-	status = SHA1_file( "-", digest );
-	if ( status < 0 ) {
-	    perror( "(stdin)" );
-	} else {
-	    printf( "%s\n", hex_digest( digest ) );
+#if defined( HAVE_PTHREADS )
+    pthread_t thread[ MAX_THREADS ];
+#endif
+    char* stdin_file[ 1 ] = { "-" };
+    char* junk = NULL;
+    int i = 0, threads = 0, started = 0;
+
+    /* -j n: hash with n threads, default (or 0) one per CPU */
+    if ( argc > 1 && strncmp( argv[1], "-j", 2 ) == 0 ) {
+	if ( argv[1][2] ) {
+	    threads = strtol( argv[1] + 2, &junk, 10 );
+	    argv++; argc--;
+	} else if ( argc > 2 ) {
+	    threads = strtol( argv[2], &junk, 10 );
+	    argv += 2; argc -= 2;
+	}
+	if ( junk == NULL || *junk != '\0' || threads < 0 ||
+	     threads > MAX_THREADS ) {
+	    fprintf( stderr, "usage: sha1 [-j threads] [files]\n" );
+	    return 1;
 	}
+    }
+    if ( threads == 0 ) { threads = online_cpus(); }
+
+    if ( argc == 1 ) {
+	files = stdin_file;
+	num_files = 1;
     } else {
-	for ( i = 1; i < argc; i++ ) {
-	    status = SHA1_file( argv[ i ], digest );
-	    if ( status < 0 ) {
-		perror( argv[ i ] );
-		return 1;
-	    } else {
-		printf( "%s %s\n", hex_digest( digest ), argv[ i ] );
-	    }
+	files = argv + 1;
+	num_files = argc - 1;
+    }
+    if ( threads > num_files ) { threads = num_files; }
+    results = calloc( num_files, sizeof( SHA1_RESULT ) );
+    if ( results == NULL ) { perror( "sha1" ); return 1; }
+
+#if defined( HAVE_PTHREADS )
+    for ( started = 0; threads > 1 && started < threads; started++ ) {
+	if ( pthread_create( &thread[ started ], NULL, hash_files,
+			     NULL ) != 0 ) {
+	    break;
+	}
+    }
+#endif
+    if ( started == 0 ) { hash_files( NULL ); }
+
+    for ( i = 0; i < num_files; i++ ) {
+#if defined( HAVE_PTHREADS )
+	pthread_mutex_lock( &lock );
+	while ( !results[i].done ) { pthread_cond_wait( &ready, &lock ); }
+	pthread_mutex_unlock( &lock );
+#endif
+	if ( results[i].err ) {
+	    errno = results[i].err;
+	    perror( argc == 1 ? "(stdin)" : files[i] );
+	    return 1;
+	}
+	if ( argc == 1 ) {
+	    printf( "%s\n", hex_digest( results[i].md ) );
+	} else {
+	    printf( "%s %s\n", hex_digest( results[i].md ), files[i] );
 	}
     }
+#if defined( HAVE_PTHREADS )
+    for ( i = 0; i < started; i++ ) { pthread_join( thread[i], NULL ); }
+#endif
     return 0;
 }
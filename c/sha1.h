@@ -67,6 +67,28 @@ void SHA1_Init_With_IV( SHA1_ctx*, const byte[ SHA1_DIGEST_BYTES ] );
 void SHA1_Xform( word32[ SHA1_DIGEST_WORDS ], 
 		 const byte[ SHA1_INPUT_BYTES ] );
 
+/* multi-buffer: digests[i] = SHA1( msgs[i] ) for n whole messages,
+ * hashed up to SHA1_Multi_Lanes() at a time in SIMD lanes (libsha1mb.c)
+ */
+
+#define SHA1_MAX_LANES 16
+
+int SHA1_Multi_Lanes( void );
+void SHA1_Multi( int n, const void* const msgs[], const size_t lens[], 
+		 byte digests[][ SHA1_DIGEST_BYTES ] );
+
+/* finish n messages at once: digests[i] = SHA1_Final of ctx[i] after
+ * SHA1_Update( ctx[i], msgs[i], lens[i] ).  The contexts are not
+ * changed, so one midstate (a context that has hashed a common
+ * prefix) can finish many messages.  ctx, or any ctx[i], may be NULL
+ * for a message hashed from the start.  Bit for bit the same as the
+ * scalar SHA1.
+ */
+
+void SHA1_Multi_Final( const SHA1_ctx* const ctx[], const void* const msgs[],
+		       const size_t lens[], int n, 
+		       byte digests[][ SHA1_DIGEST_BYTES ] );
+
 #if defined( __cplusplus )
 }
 #endif
@@ -1,21 +1,170 @@
 /* -*- Mode: C; c-file-style: "stroustrup" -*- */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+    #include <x86intrin.h>
+    #define HAVE_RDTSC
+#endif
 #include "sha1.h"
 
 byte b = 0 ;
 
+static byte test4[ 1000000 + 1 ];
+
+#define MULTI_MAX 40
+
+static byte test5[ 4096 ];
+
 #define BUF_SIZE 1024
 
+/* benchmark, sha1test -b [seconds]: each backend on each message
+ * size, warmed up, then timed BENCH_REPS times for about seconds in
+ * all on a monotonic clock, reporting the best rate.  Cycles are the
+ * time stamp counter's (nominal clock) where there is one.  The scalar
+ * backend is libsha1 or, built with -DOPENSSL, OpenSSL's: compare the
+ * two builds' output (make sha1bench).
+ */
+
+#if defined( OPENSSL )
+#define BACKEND "openssl"
+#else
+#define BACKEND "libsha1"
+#endif
+
+#define BENCH_MAX ( 1024 * 1024 )
+#define BENCH_REPS 5
+
+static byte bench_buf[ BENCH_MAX ];
+
+static double bench_clock( void )
+{
+#if defined( CLOCK_MONOTONIC )
+    struct timespec ts;
+
+    if ( clock_gettime( CLOCK_MONOTONIC, &ts ) == 0 ) {
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+#endif
+    return clock() / (double)CLOCKS_PER_SEC;
+}
+
+static unsigned long long bench_cycles( void )
+{
+#if defined( HAVE_RDTSC )
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* count messages of size bytes, one at a time */
+
+static void bench_scalar( int lanes, size_t size, long count )
+{
+    SHA1_ctx ctx;
+    byte digest[ SHA1_DIGEST_BYTES ];
+
+    for ( ; count > 0; count-- ) {
+	SHA1_Init( &ctx );
+	SHA1_Update( &ctx, bench_buf, size );
+	SHA1_Final( &ctx, digest );
+	b ^= digest[ 0 ];
+    }
+}
+
+/* count messages of size bytes, lanes at a time */
+
+static void bench_multi( int lanes, size_t size, long count )
+{
+    const void* msgs[ SHA1_MAX_LANES ];
+    size_t lens[ SHA1_MAX_LANES ];
+    byte digests[ SHA1_MAX_LANES ][ SHA1_DIGEST_BYTES ];
+    int i = 0;
+
+    for ( i = 0; i < lanes; i++ ) { msgs[i] = bench_buf; lens[i] = size; }
+    for ( ; count > 0; count -= lanes ) {
+	SHA1_Multi( lanes, msgs, lens, digests );
+	b ^= digests[ 0 ][ 0 ];
+    }
+}
+
+static void bench_case( const char* name, 
+			void (*fn)( int, size_t, long ), int lanes,
+			size_t size, double seconds )
+{
+    double start = 0, elapsed = 0, best = 0;
+    unsigned long long cyc = 0, best_cyc = 0;
+    long count = lanes;
+    int rep = 0;
+
+    /* warm up, and find a count that takes a rep's share of the time */
+    do {
+	count *= 2;
+	start = bench_clock();
+	fn( lanes, size, count );
+	elapsed = bench_clock() - start;
+    } while ( elapsed < seconds / ( BENCH_REPS * 4 ) );
+    count = count * ( seconds / BENCH_REPS ) / elapsed;
+    count = ( count / lanes + 1 ) * lanes;
+
+    for ( rep = 0; rep < BENCH_REPS; rep++ ) {
+	cyc = bench_cycles();
+	start = bench_clock();
+	fn( lanes, size, count );
+	elapsed = bench_clock() - start;
+	cyc = bench_cycles() - cyc;
+	if ( rep == 0 || elapsed < best ) { best = elapsed; best_cyc = cyc; }
+    }
+    printf( "%-10s %8lu %10.1f", name, (unsigned long)size,
+	    (double)size * count / best / 1e6 );
+    if ( best_cyc ) {
+	printf( " %8.2f\n", (double)best_cyc / ( (double)size * count ) );
+    } else {
+	printf( " %8s\n", "-" );
+    }
+}
+
+static int benchmark( double seconds )
+{
+    char name[ 32 ];
+    size_t size = 0;
+    int lanes = 0;
+
+    memset( bench_buf, 'a', BENCH_MAX );
+    printf( "%-10s %8s %10s %8s\n", "backend", "bytes", "MB/s", 
+	    "cyc/byte" );
+    for ( size = 16; size <= BENCH_MAX; size *= 4 ) {
+	bench_case( BACKEND, bench_scalar, 1, size, seconds );
+	for ( lanes = 4; lanes <= SHA1_Multi_Lanes(); lanes *= 2 ) {
+	    sprintf( name, "multi-%d", lanes );
+	    bench_case( name, bench_multi, lanes, size, seconds );
+	}
+    }
+    return 0;
+}
+
 int main( int argc, char* argv[] )
 {
     SHA1_ctx ctx = {} ;
     int i = 0 , j = 0 ;
     byte digest[ SHA1_DIGEST_BYTES ] = {} ;
     clock_t start = 0 , end = 0 , tmp = 0 ;
-    double elapsed = 0 ;
+    byte digest2[ SHA1_DIGEST_BYTES ] = {} ;
+    double elapsed = 0 , bulk_elapsed = 0 ;
+    SHA1_ctx mid[ MULTI_MAX ];
+    const SHA1_ctx* pmid[ MULTI_MAX ];
+    const void* msgs[ MULTI_MAX ];
+    size_t lens[ MULTI_MAX ];
+    byte multi[ MULTI_MAX ][ SHA1_DIGEST_BYTES ];
+    unsigned long seed = 1;
+    int n = 0 , fails = 0 ;
+
+    if ( argc > 1 && strcmp( argv[ 1 ], "-b" ) == 0 ) {
+	return benchmark( argc > 2 ? atof( argv[ 2 ] ) : 0.5 );
+    }
 
 /* test 1 data */
     const char* test1 = "abc";
@@ -115,9 +264,98 @@ int main( int argc, char* argv[] )
     }
     printf( "\n" );
     
+/* test 4 */
+
+/* test 3 again as one unaligned update, hashed directly from the
+   input, and split so the first block is buffered; timed as the bulk
+   rate */
+
+    printf( "test 4\n\n" );
+    memset( test4, 'a', sizeof( test4 ) );
+
+    end = clock();
+    do { start = clock(); } while ( start == end );
+
+    for ( j = 0; j < 10; j++ ) {
+	SHA1_Init( &ctx );
+	SHA1_Update( &ctx, test4 + 1, 1000000 );
+	SHA1_Final( &ctx, digest );
+    }
+    end = clock();
+    if ( end < start ) { tmp = end; end = start; start = tmp; }
+    bulk_elapsed = ((end-start)/(double)CLOCKS_PER_SEC);
+
+    SHA1_Init( &ctx );
+    SHA1_Update( &ctx, test4 + 1, 3 );
+    SHA1_Update( &ctx, test4 + 4, 1000000 - 3 );
+    SHA1_Final( &ctx, digest2 );
+
+    printf( "SHA1(\"a\" x 1,000,000) = \n\t" );
+    
+    for ( i = 0; i < SHA1_DIGEST_BYTES ; i++ ) {
+	printf( "%02x", digest[ i ] );
+    }
+    
+    if ( memcmp( digest, result3, SHA1_DIGEST_BYTES ) == 0 &&
+	 memcmp( digest2, result3, SHA1_DIGEST_BYTES ) == 0 ) {
+	printf( " test ok\n" );
+    } else {
+	printf( " test failed\n" );
+    }
+    printf( "\n" );
+
+/* test 5 */
+
+/* multi-buffer against the scalar path: batches of 1 to 40 messages
+   of mixed lengths, from the start and from midstates */
+
+    printf( "test 5\n\n" );
+    printf( "SHA1_Multi_Final, %d lanes = \n\t", SHA1_Multi_Lanes() );
+    for ( i = 0; i < (int)sizeof( test5 ); i++ ) {
+	seed = seed * 1103515245 + 12345;
+	test5[ i ] = (byte)( seed >> 16 );
+    }
+    fails = 0;
+    for ( n = 1; n <= MULTI_MAX; n++ ) {
+	for ( j = 0; j < n; j++ ) {
+	    seed = seed * 1103515245 + 12345;
+	    lens[ j ] = ( seed >> 16 ) % 300;
+	    msgs[ j ] = test5 + j * 7;
+	    SHA1_Init( &mid[ j ] );
+	    SHA1_Update( &mid[ j ], test5 + 3000, ( seed >> 8 ) % 150 );
+	    pmid[ j ] = ( j % 3 ) ? &mid[ j ] : NULL;
+	}
+	SHA1_Multi_Final( NULL, msgs, lens, n, multi );
+	for ( j = 0; j < n; j++ ) {
+	    SHA1_Init( &ctx );
+	    SHA1_Update( &ctx, msgs[ j ], lens[ j ] );
+	    SHA1_Final( &ctx, digest );
+	    if ( memcmp( digest, multi[ j ], SHA1_DIGEST_BYTES ) != 0 ) {
+		fails++;
+	    }
+	}
+	SHA1_Multi_Final( pmid, msgs, lens, n, multi );
+	for ( j = 0; j < n; j++ ) {
+	    if ( pmid[ j ] ) { ctx = mid[ j ]; } else { SHA1_Init( &ctx ); }
+	    SHA1_Update( &ctx, msgs[ j ], lens[ j ] );
+	    SHA1_Final( &ctx, digest );
+	    if ( memcmp( digest, multi[ j ], SHA1_DIGEST_BYTES ) != 0 ) {
+		fails++;
+	    }
+	}
+    }
+    printf( "%d mismatches", fails );
+    if ( fails == 0 ) {
+	printf( " test ok\n" );
+    } else {
+	printf( " test failed\n" );
+    }
+    printf( "\n" );
+
 /* report timing information */
     
     printf( "speed: %.2f Mb/s\n", 10.0 / elapsed );
+    printf( "bulk speed: %.2f Mb/s\n", 10.0 / bulk_elapsed );
     
     return 0;
 }
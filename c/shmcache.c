@@ -0,0 +1,392 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+#if defined( __linux__ ) && !defined( _GNU_SOURCE )
+    #define _GNU_SOURCE		/* for statx */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "sdb.h"
+#include "sha1.h"
+#include "shmcache.h"
+
+#if defined( HAVE_POSIX_SHM )
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#define CACHE_MAGIC 0x68636331UL /* "hcc1" */
+#define CACHE_PROBE 16		/* slots examined per lookup / insert */
+#define CACHE_CLAIM_TIMEOUT 5	/* seconds before an abandoned claim is reused */
+#define CACHE_ATTACH_TRIES 50	/* ms to wait for a creator, if no locks */
+#define CACHE_FOREVER 0x7fffffffffffffffLL
+
+/* the header is changed only under an flock of the segment */
+
+typedef struct {
+    volatile unsigned long magic; /* set last by the creator */
+    long slots;
+    volatile long long dev;	/* identity of the db cached, 0 if none */
+    volatile long long ino;
+    volatile long long born;	/* its birth time (ns), 0 if not known */
+    volatile long gen;		/* bumped when the db is another */
+} cache_hdr;
+
+/* expires is 0 for an empty slot, the time the stamp may be purged,
+ * or minus the time a writer claimed the slot while it writes tag
+ */
+
+typedef struct {
+    volatile unsigned long long tag;
+    volatile long long expires;
+} cache_slot;
+
+#define CACHE_HDR_BYTES 64
+#define cache_hdr_of( c ) ((cache_hdr*)(c)->map)
+#define cache_slot_of( c ) \
+    ((cache_slot*)((char*)(c)->map + CACHE_HDR_BYTES))
+
+static size_t cache_bytes( long slots )
+{
+    return CACHE_HDR_BYTES + slots * sizeof( cache_slot );
+}
+
+static void cache_digest( const char* str, byte md[ SHA1_DIGEST_BYTES ] )
+{
+    SHA1_ctx ctx;
+    SHA1_Init( &ctx );
+    SHA1_Update( &ctx, str, strlen( str ) );
+    SHA1_Final( &ctx, md );
+}
+
+static unsigned long long cache_tag( const char* token )
+{
+    byte md[ SHA1_DIGEST_BYTES ];
+    unsigned long long tag = 0;
+    int i;
+
+    cache_digest( token, md );
+    for ( i = 0; i < 8; i++ ) { tag = ( tag << 8 ) | md[i]; }
+    return tag ? tag : 1;	/* 0 marks an empty slot */
+}
+
+/* segment name from the absolute path of the database */
+
+static int cache_name( const char* db_filename, char* name )
+{
+    char path[ PATH_MAX+1 ] = {0};
+    byte md[ SHA1_DIGEST_BYTES ];
+    int i;
+
+    if ( db_filename[0] == '/' ) {
+	if ( strlen( db_filename ) > PATH_MAX ) { return 0; }
+	strcpy( path, db_filename );
+    } else {
+	if ( getcwd( path, PATH_MAX ) == NULL ) { return 0; }
+	if ( strlen( path ) + 1 + strlen( db_filename ) > PATH_MAX ) {
+	    return 0;
+	}
+	strcat( path, "/" );
+	strcat( path, db_filename );
+    }
+    cache_digest( path, md );
+    strcpy( name, "/hashcash-" );
+    for ( i = 0; i < 8; i++ ) {
+	sprintf( name + strlen( name ), "%02x", md[i] );
+    }
+    return 1;
+}
+
+/* map the segment: 1 if done, 0 if it is not made yet, -1 on error
+ * (or if it isn't a cache)
+ */
+
+static int cache_attach( HCCACHE* cache, int fd )
+{
+    struct stat st;
+    cache_hdr* hdr = NULL;
+    void* map = NULL;
+    int ret = 0;
+
+    if ( fstat( fd, &st ) != 0 ) { return -1; }
+    if ( st.st_size < CACHE_HDR_BYTES ) { return 0; }
+    map = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if ( map == MAP_FAILED ) { return -1; }
+    hdr = (cache_hdr*)map;
+    if ( hdr->magic == CACHE_MAGIC && hdr->slots > 0 &&
+	 cache_bytes( hdr->slots ) <= (size_t)st.st_size ) {
+	cache->map = map;
+	cache->size = st.st_size;
+	cache->slots = hdr->slots;
+	return 1;
+    }
+    if ( hdr->magic != 0 ) { errno = EEXIST; ret = -1; }
+    munmap( map, st.st_size );
+    return ret;
+}
+
+/* make the segment; nobody has it mapped, it isn't made yet */
+
+static int cache_create( HCCACHE* cache, int fd, long slots )
+{
+    size_t size = cache_bytes( slots );
+    void* map = NULL;
+
+    if ( ftruncate( fd, size ) != 0 ) { return 0; }
+    map = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if ( map == MAP_FAILED ) { return 0; }
+    memset( map, 0, size );	/* a creator that died may have begun */
+    ((cache_hdr*)map)->slots = slots;
+    __sync_synchronize();
+    ((cache_hdr*)map)->magic = CACHE_MAGIC;
+    cache->map = map;
+    cache->size = size;
+    cache->slots = slots;
+    return 1;
+}
+
+/* the db's identity: device, inode and, where the filesystem keeps it,
+ * birth time, as the inode of a db removed is soon reused for a new
+ * one.  Not ctime, which every stamp added changes.  All 0 if there
+ * is no db.
+ */
+
+static void cache_db_id( const char* db_filename, long long id[3] )
+{
+    struct stat st;
+#if defined( STATX_BTIME )
+    struct statx stx;
+#endif
+
+    id[0] = id[1] = id[2] = 0;
+    if ( stat( db_filename, &st ) != 0 ) { return; }
+    id[0] = st.st_dev;
+    id[1] = st.st_ino;
+#if defined( STATX_BTIME )
+    if ( statx( AT_FDCWD, db_filename, 0, STATX_BTIME, &stx ) == 0 &&
+	 ( stx.stx_mask & STATX_BTIME ) ) {
+	id[2] = stx.stx_btime.tv_sec * 1000000000LL + stx.stx_btime.tv_nsec;
+    }
+#endif
+}
+
+/* forget the contents if the database was removed or replaced; the
+ * generation goes up first, so a process still adding stamps of the
+ * old one sees it and takes them back
+ */
+
+static void cache_bind( HCCACHE* cache, const char* db_filename )
+{
+    cache_hdr* hdr = cache_hdr_of( cache );
+    long long id[3];
+
+    cache_db_id( db_filename, id );
+    if ( hdr->dev != id[0] || hdr->ino != id[1] || hdr->born != id[2] ) {
+	if ( hdr->dev != 0 || hdr->ino != 0 ) {
+	    hdr->gen++;
+	    __sync_synchronize();
+	    hashcash_cache_clear( cache );
+	}
+	hdr->dev = id[0]; hdr->ino = id[1]; hdr->born = id[2];
+    }
+    cache->gen = hdr->gen;
+}
+
+/* The segment is made, and bound to the db, under an flock of it: who
+ * has the lock and finds it not made makes it, so one left half made
+ * by a process which died is made by the next, and none is removed
+ * while others may use it.  Where there are no locks only its creator
+ * makes it, and the others wait for it a while.
+ */
+
+int hashcash_cache_open( HCCACHE* cache, const char* db_filename,
+			 long slots, int* err )
+{
+    char name[ 32 ] = {0};
+    int fd = -1, tries = 0, ok = 0, created = 0, locked = 0, my_err;
+
+    if ( !err ) { err = &my_err; }
+    *err = 0;
+    cache->map = NULL;
+    if ( slots <= 0 ) { slots = HCCACHE_DEFAULT_SLOTS; }
+    if ( !cache_name( db_filename, name ) ) { *err = ENAMETOOLONG; return 0; }
+
+    fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+    created = fd >= 0;
+    if ( !created && errno == EEXIST ) { fd = shm_open( name, O_RDWR, 0600 ); }
+    if ( fd < 0 ) { *err = errno; return 0; }
+    while ( !( locked = flock( fd, LOCK_EX ) == 0 ) && errno == EINTR ) { }
+
+    for ( tries = 0; ; tries++ ) {
+	errno = 0;
+	ok = cache_attach( cache, fd );
+	if ( ok == 0 && ( locked || created ) ) {
+	    ok = cache_create( cache, fd, slots ) ? 1 : -1;
+	}
+	if ( ok != 0 || tries == CACHE_ATTACH_TRIES ) { break; }
+	usleep( 1000 );
+    }
+    if ( ok > 0 ) { cache_bind( cache, db_filename ); }
+    else { *err = ok < 0 && errno ? errno : EAGAIN; }
+    if ( locked ) { flock( fd, LOCK_UN ); }
+    close( fd );
+    return ok > 0;
+}
+
+int hashcash_cache_rebind( HCCACHE* cache, const char* db_filename )
+{
+    char name[ 32 ] = {0};
+    int fd = -1, locked = 0;
+
+    if ( cache == NULL || cache->map == NULL ) { return 0; }
+    if ( !cache_name( db_filename, name ) ) { return 0; }
+    fd = shm_open( name, O_RDWR, 0600 );
+    if ( fd < 0 ) { return 0; }
+    while ( !( locked = flock( fd, LOCK_EX ) == 0 ) && errno == EINTR ) { }
+    cache_bind( cache, db_filename );
+    if ( locked ) { flock( fd, LOCK_UN ); }
+    close( fd );
+    return cache_hdr_of( cache )->gen == cache->gen;
+}
+
+int hashcash_cache_in( HCCACHE* cache, const char* token, time_t now_time )
+{
+    cache_slot* slot = NULL;
+    unsigned long long tag = 0;
+    long long e = 0;
+    long start = 0;
+    int i = 0;
+
+    if ( cache == NULL || cache->map == NULL ) { return 0; }
+    if ( cache_hdr_of( cache )->gen != cache->gen ) { return 0; }
+    tag = cache_tag( token );
+    start = (long)( tag % cache->slots );
+    for ( i = 0; i < CACHE_PROBE; i++ ) {
+	slot = &cache_slot_of( cache )[ ( start + i ) % cache->slots ];
+	e = slot->expires;
+	if ( e <= (long long)now_time ) { continue; } /* empty or stale */
+	__sync_synchronize();
+	if ( slot->tag != tag ) { continue; }
+	__sync_synchronize();
+	if ( slot->expires == e ) { return 1; }	/* not rewritten meanwhile */
+    }
+    return 0;
+}
+
+int hashcash_cache_add( HCCACHE* cache, const char* token, time_t expires,
+			time_t now_time )
+{
+    cache_slot* slot = NULL, *victim = NULL;
+    unsigned long long tag = 0;
+    long long exp = 0, now = now_time, e = 0, raw = 0, victim_e = 0;
+    long long victim_raw = 0;
+    long start = 0;
+    int i = 0, tries = 0;
+
+    if ( cache == NULL || cache->map == NULL ) { return 0; }
+    if ( cache_hdr_of( cache )->gen != cache->gen ) { return 0; }
+    exp = ( expires == HCCACHE_FOREVER ) ? CACHE_FOREVER : expires;
+    if ( exp <= now ) { return 1; } /* nothing to remember */
+    tag = cache_tag( token );
+    start = (long)( tag % cache->slots );
+
+    for ( tries = 0; tries < CACHE_PROBE; tries++ ) {
+	victim = NULL;
+	for ( i = 0; i < CACHE_PROBE; i++ ) {
+	    slot = &cache_slot_of( cache )[ ( start + i ) % cache->slots ];
+	    raw = slot->expires;
+	    if ( raw > now && slot->tag == tag ) {
+		if ( raw < exp ) {
+		    __sync_bool_compare_and_swap( &slot->expires, raw, exp );
+		}
+		return 1;
+	    }
+	    e = raw;
+	    if ( e < 0 ) {
+		if ( -e > now - CACHE_CLAIM_TIMEOUT ) { continue; } /* busy */
+		e = 0;		/* writer died, as good as empty */
+	    }
+	    if ( e <= now ) { e = 0; }
+
+	    /* evict whichever expires soonest */
+	    if ( victim == NULL || e < victim_e ) {
+		victim = slot; victim_e = e; victim_raw = raw;
+	    }
+	}
+	if ( victim == NULL ) { return 0; }
+	if ( __sync_bool_compare_and_swap( &victim->expires, victim_raw,
+					   -now ) ) {
+	    victim->tag = tag;
+	    __sync_synchronize();
+	    victim->expires = exp;
+	    __sync_synchronize();
+	    if ( cache_hdr_of( cache )->gen != cache->gen ) {
+		victim->expires = 0; /* of a db since replaced */
+		return 0;
+	    }
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+int hashcash_cache_clear( HCCACHE* cache )
+{
+    cache_slot* slot = NULL;
+    long i = 0;
+
+    if ( cache == NULL || cache->map == NULL ) { return 0; }
+    slot = cache_slot_of( cache );
+    for ( i = 0; i < cache->slots; i++ ) {
+	slot[i].expires = 0;
+	slot[i].tag = 0;
+    }
+    __sync_synchronize();
+    return 1;
+}
+
+int hashcash_cache_close( HCCACHE* cache )
+{
+    int res = 1;
+    if ( cache == NULL || cache->map == NULL ) { return 1; }
+    res = munmap( cache->map, cache->size ) == 0;
+    cache->map = NULL;
+    return res;
+}
+
+#else
+
+/* no shared memory, callers fall back to the database */
+
+int hashcash_cache_open( HCCACHE* cache, const char* db_filename,
+			 long slots, int* err )
+{
+    cache->map = NULL;
+    if ( err ) { *err = ENOSYS; }
+    return 0;
+}
+
+int hashcash_cache_rebind( HCCACHE* cache, const char* db_filename )
+{
+    return 0;
+}
+
+int hashcash_cache_in( HCCACHE* cache, const char* token, time_t now_time )
+{
+    return 0;
+}
+
+int hashcash_cache_add( HCCACHE* cache, const char* token, time_t expires,
+			time_t now_time )
+{
+    return 0;
+}
+
+int hashcash_cache_clear( HCCACHE* cache ) { return 0; }
+int hashcash_cache_close( HCCACHE* cache ) { return 1; }
+
+#endif
@@ -0,0 +1,102 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+#if !defined( _shmcache_h )
+#define _shmcache_h
+
+#include <time.h>
+#include <stddef.h>
+
+#if defined( __cplusplus )
+extern "C" {
+#endif
+
+#if !defined(HCEXPORT)
+    #if !defined(WIN32) || defined(MONOLITHIC)
+        #define HCEXPORT
+    #elif defined(BUILD_DLL)
+        #define HCEXPORT __declspec(dllexport)
+    #else /* USE_DLL */
+        #define HCEXPORT extern __declspec(dllimport)
+    #endif
+#endif
+
+/* shared memory cache of recently spent stamps
+ *
+ * A fixed size open addressed hash table in a POSIX shared memory
+ * segment, named after the database it caches, so every hashcash
+ * process checking against that database on the host shares it.  It
+ * sits in front of the sdb file: a hit means the stamp is spent
+ * without opening the database, a miss means look in the database.
+ * Entries are a 64 bit tag (from SHA1 of the stamp) and the time the
+ * stamp may be purged; slots are claimed with compare and swap so
+ * there is no lock, and when the probe window is full the entry
+ * expiring soonest is evicted.
+ *
+ * The cache forgets itself if the database is removed or replaced,
+ * known by its device, inode and (where the filesystem keeps one)
+ * birth time; processes still attached for the old database stop
+ * using it.  A process dying part way through an insert leaves at
+ * worst one slot unusable for a few seconds; a segment left half
+ * initialised by a dying creator is made by the next process.
+ *
+ * The segment outlives the processes using it.  On Linux it is
+ * /dev/shm/hashcash-<hex>, the hex being the first 16 digits of the
+ * SHA1 of the absolute path of the database, and may be removed when
+ * the database is.
+ */
+
+typedef struct {
+    void* map;			/* mapped segment, NULL if not open */
+    size_t size;		/* bytes mapped */
+    long slots;			/* number of entries */
+    long gen;			/* of the db bound to, see cache_bind */
+} HCCACHE;
+
+#define HCCACHE_DEFAULT_SLOTS 65536
+#define HCCACHE_FOREVER ((time_t)-1) /* stamp never expires */
+
+/* attach to (or create, with room for slots entries) the cache for
+ * db_filename; slots of 0 means HCCACHE_DEFAULT_SLOTS.  An existing
+ * cache keeps the size it was created with.  Fails with *err set if
+ * shared memory is not available, callers then use the db directly.
+ */
+
+HCEXPORT
+int hashcash_cache_open( HCCACHE* cache, const char* db_filename,
+			 long slots, int* err );
+
+/* bind the cache to db_filename as it is now, eg once it has been
+ * made by this process: a cache opened when there was no database
+ * otherwise stays bound to none.  0 if the cache is now of another
+ * database than the one this process opened it for.
+ */
+
+HCEXPORT
+int hashcash_cache_rebind( HCCACHE* cache, const char* db_filename );
+
+/* 1 if token is recorded as spent and not yet expired at now_time */
+
+HCEXPORT
+int hashcash_cache_in( HCCACHE* cache, const char* token, time_t now_time );
+
+/* record token as spent until expires (or HCCACHE_FOREVER) */
+
+HCEXPORT
+int hashcash_cache_add( HCCACHE* cache, const char* token, time_t expires,
+			time_t now_time );
+
+/* forget all entries, eg after purging the database with -k or -j */
+
+HCEXPORT
+int hashcash_cache_clear( HCCACHE* cache );
+
+/* detach, the segment persists for other processes */
+
+HCEXPORT
+int hashcash_cache_close( HCCACHE* cache );
+
+#if defined( __cplusplus )
+}
+#endif
+
+#endif
@@ -7,3 +7,8 @@ char* sstrtok( const char* str, const char* delim, char** tok, int tok_max,
 
 void stolower( char* str );
 
+/* first of c1 or c2 in [s,end), or NULL; SSE2 where available */
+
+const char* smemchr2( const char* s, const char* end, int c1, int c2 );
+
+#define smemchr(s,end,c) smemchr2(s,end,c,c)
@@ -460,3 +460,624 @@ $hashcash -clq -b5 < stamps > res.$test
 diff -q res.$test out.$test 1> /dev/null 2>&1 && echo ok || echo fail
 test=`expr $test + 1`
 
+######################################################################
+# -D
+######################################################################
+
+echo -n "test $test (-cdyD batch spent twice) "
+rm -f db.$test
+$hashcash -cdyqb10 -D batch -f db.$test -r '*@foo.com' < stamps && \
+$hashcash -cdyqb10 -D batch -f db.$test -r '*@foo.com' < stamps
+[ $? -eq 1 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cdyD period shares sync file) "
+rm -f db.$test db.$test.sync
+$hashcash -cdyqb10 -D 1h -f db.$test -r '*@foo.com' < stamps
+[ $? -eq 0 -a -f db.$test.sync ] && echo ok || echo fail
+test=`expr $test + 1`
+
+
+
+######################################################################
+# -I
+######################################################################
+
+echo -n "test $test (-p now -I 1 step leaves cursor) "
+cat > db.$test <<EOF
+last_purged 700101000000
+0:040301:adam+bar@foo.com:0ace5ad5254b4e401036b5f0 60
+0:040402:jack+bar@foo.com:be45eb4e586a3e08cf7c95c4 0
+0:040401:fred+xyz@foo.com:20056ff4e877027ef8ba55eb 60
+EOF
+rm -f db.$test.purge
+$hashcash -q -p now -I 1 -f db.$test
+[ $? -eq 0 -a -f db.$test.purge ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-p now -I 1 completes over several runs) "
+cp db.`expr $test - 1` db.$test
+cp db.`expr $test - 1`.purge db.$test.purge
+cat > out.$test <<EOF
+0:040402:jack+bar@foo.com:be45eb4e586a3e08cf7c95c4 0
+EOF
+for i in 1 2 3 4; do $hashcash -q -p now -I 1 -f db.$test; done
+grep -v last_purged db.$test > res.$test
+diff -q res.$test out.$test 1> /dev/null 2>&1 && [ ! -f db.$test.purge ] \
+    && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+# -H
+######################################################################
+
+echo -n "test $test (-cdyH spent twice) "
+rm -f db.$test
+$hashcash -cdyqb10 -H 0 -f db.$test -r '*@foo.com' < stamps && \
+$hashcash -cdyqb10 -H 0 -f db.$test -r '*@foo.com' < stamps
+[ $? -eq 1 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cdyH spent found in cache not db) "
+rm -f db.$test
+$hashcash -cdyqb10 -H 0 -f db.$test -r '*@foo.com' < stamps
+head -1 db.$test > res.$test
+cat res.$test > db.$test
+$hashcash -cdyqb10 -H 0 -f db.$test -r '*@foo.com' < stamps
+[ $? -eq 1 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cdyH cache forgotten with the db recreated) "
+rm -f db.$test
+$hashcash -cdyqb10 -H 0 -f db.$test -r '*@foo.com' < stamps
+rm -f db.$test
+$hashcash -mqb10 other@foo.com | $hashcash -cdyqb10 -f db.$test -r '*@foo.com'
+$hashcash -cdyqb10 -H 0 -f db.$test -r '*@foo.com' < stamps
+[ $? -eq 0 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+# the segments cached for the dbs above, see shmcache.h
+dir=`pwd -P`
+for i in `expr $test - 3` `expr $test - 2` `expr $test - 1`
+do
+    shm=`echo -n "$dir/db.$i" | $sha1 | cut -c1-16`
+    rm -f /dev/shm/hashcash-$shm
+done
+
+######################################################################
+# -N
+######################################################################
+
+echo -n "test $test (-cdyN 4 spent twice, second without -N) "
+rm -f db.$test db.$test.*
+$hashcash -cdyqb10 -N 4 -f db.$test -r '*@foo.com' < stamps && \
+$hashcash -cdyqb10 -f db.$test -r '*@foo.com' < stamps
+[ $? -eq 1 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-p now -k -N purges all shards) "
+rm -f db.$test db.$test.*
+$hashcash -cdyqb10 -N 4 -f db.$test -r '*@foo.com' < stamps
+$hashcash -q -p now -k -f db.$test
+cat db.$test.* | grep -v last_purged > res.$test
+[ ! -s res.$test ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+# -p
+######################################################################
+
+echo -n "test $test (-p now keeps CRLF records, drops blanks) "
+printf 'last_purged 700101000000\r\n0:040402:jack+bar@foo.com:be45eb4e586a3e08cf7c95c4 0\r\n    \n0:040301:adam+bar@foo.com:0ace5ad5254b4e401036b5f0 60\n0:040402:fred+xyz@foo.com:20056ff4e877027ef8ba55eb 0\n' > db.$test
+cat > out.$test <<EOF
+0:040402:jack+bar@foo.com:be45eb4e586a3e08cf7c95c4 0
+0:040402:fred+xyz@foo.com:20056ff4e877027ef8ba55eb 0
+EOF
+$hashcash -q -p now -f db.$test
+grep -v last_purged db.$test | tr -d '\r' > res.$test
+diff -q res.$test out.$test 1> /dev/null 2>&1 && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+# -r many
+######################################################################
+
+echo -n "test $test (-cy many -r, last matches) "
+$hashcash -cyqb10 -r a@bar.com -r b@bar.com -r 'c*@bar.com' \
+    -r '*@foo.com' < stamps
+[ $? -eq 0 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cy many -r, none match) "
+$hashcash -cyqb10 -r a@bar.com -r b@bar.com -r 'c*@bar.com' < stamps
+[ $? -eq 1 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cy many -r, domain label wildcard) "
+$hashcash -cyqb10 -r a@bar.com -r 'x@foo.com' -r '*@*.org' \
+    -r '*@*.com' < stamps
+[ $? -eq 0 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cy many -r, case folded and regexp) "
+$hashcash -cyqb10 -r a@bar.com -r '*@FOO.NET' -E -r '^[a-z]+@bar\.com$' \
+    -M -r 'JACK+BAR@FOO.COM' < stamps
+[ $? -eq 0 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-p now -k many -j) "
+cat > db.$test <<EOF
+last_purged 700101000000
+0:040402:jack+bar@foo.com:be45eb4e586a3e08cf7c95c4 0
+0:040402:adam+bar@foo.com:0ace5ad5254b4e401036b5f0 0
+0:040404:fred+xyz@foo.com:20056ff4e877027ef8ba55eb 0
+EOF
+cat > out.$test <<EOF
+0:040402:adam+bar@foo.com:0ace5ad5254b4e401036b5f0 0
+EOF
+$hashcash -q -p now -k -j 'jack*@foo.com' -j 'x@bar.com' \
+    -j 'fred+xyz@foo.com' -f db.$test
+grep -v last_purged db.$test > res.$test
+diff -q res.$test out.$test 1> /dev/null 2>&1 && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+# -r wildcards
+######################################################################
+
+echo -n "test $test (-cy -r wildcard without @ matches whole resource) "
+$hashcash -cyqb10 -r 'jack*.com' < stamps
+[ $? -eq 0 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cy -r wildcard many stars) "
+$hashcash -cyqb10 -r '*a*k*+*@*o*.*' < stamps
+[ $? -eq 0 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+# batch
+######################################################################
+
+echo -n "test $test (-w many stamps on stdin) "
+rm -f res.$test out.$test stamps.$test
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15; do
+    cat stamps >> stamps.$test
+    printf '5\n5\n5\n12\n6\n' >> out.$test
+done
+$hashcash -wq < stamps.$test > res.$test
+diff -q res.$test out.$test 1> /dev/null 2>&1 && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cd many stamps on stdin, each spent once) "
+rm -f db.$test
+$hashcash -cdqb10 -f db.$test -r '*@foo.com' < stamps.`expr $test - 1`
+grep -c jack db.$test > res.$test
+echo 1 | diff -q res.$test - 1> /dev/null 2>&1 && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+# parse
+######################################################################
+
+echo -n "test $test (-cy stamp longer than a block) "
+res=a-resource-name-long-enough-that-the-stamp-is-over-one-sha1-block@foo.com
+$hashcash -mqb8 $res > stamp.$test
+$hashcash -cyqb8 -r $res `cat stamp.$test`
+[ $? -eq 0 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cy invalid character in counter) "
+sed 's/.$/!/' stamp.`expr $test - 1` > stamp.$test
+$hashcash -cyqb8 -r $res `cat stamp.$test`
+[ $? -eq 1 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+# time
+######################################################################
+
+echo -n "test $test (-cy -e 2d stamp from leap day, last second) "
+../hashcash -u -t 040229 -mqb8 foo > stamp.$test
+../hashcash -u -t 040301235959 -cyqb8 -e 2d -g 0 -r foo `cat stamp.$test`
+[ $? -eq 0 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cy -e 2d stamp from leap day, expired) "
+../hashcash -u -t 040229 -mqb8 foo > stamp.$test
+../hashcash -u -t 040302000000 -cyqb8 -e 2d -g 0 -r foo `cat stamp.$test`
+[ $? -eq 1 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+# headers
+######################################################################
+
+echo -n "test $test (-cX folded header, CRLF) "
+$hashcash -mqb10 foo@bar.com > stamp.$test
+stamp=`cat stamp.$test`
+printf 'From: a\r\nX-Hashcash: %s\r\n\t%s\r\n\r\nbody\r\n' \
+    `echo $stamp | cut -c1-20` `echo $stamp | cut -c21-` > msg.$test
+cat msg.$test | $hashcash -cyqXb10 -r foo@bar.com
+[ $? -eq 0 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cX stamp in body not checked) "
+printf 'From: a\n\nX-Hashcash: %s\n' $stamp > msg.$test
+$hashcash -cyqXb10 -r foo@bar.com < msg.$test
+[ $? -eq 1 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cXi stamp in body) "
+$hashcash -cyqXib10 -r foo@bar.com < msg.`expr $test - 1`
+[ $? -eq 0 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+# threaded checking
+######################################################################
+
+echo -n "test $test (-cw -T 4 same as without) "
+rm -f stamps.$test
+for r in foo@bar.com bar@foo.com foo@foo.com
+do
+    $hashcash -mqb8 $r >> stamps.$test
+    $hashcash -mqb8 $r >> stamps.$test
+done
+$hashcash -cwb8 -r foo@bar.com -r 'foo*' < stamps.$test > out.$test 2>&1
+$hashcash -cwb8 -r foo@bar.com -r 'foo*' -T 4 < stamps.$test > res.$test 2>&1
+cmp -s out.$test res.$test && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cd -T 2 stamp spent once) "
+rm -f db.$test.sdb
+sed -n 1p stamps.`expr $test - 1` > dup.$test
+sed -n 1p stamps.`expr $test - 1` >> dup.$test
+$hashcash -cdqb8 -f db.$test.sdb -r foo@bar.com -T 2 < dup.$test
+$hashcash -cdqb8 -f db.$test.sdb -r foo@bar.com -T 2 < dup.$test
+[ $? -eq 1 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cdw -T 4 on a long stream same as without) "
+# 320 stamps a blank line every 10; stamp 69 is spent already, and it
+# and stamp 5 come again batches later (batches are 64 stamps)
+rm -f minted.$test db.$test.sdb
+args=""
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16
+do
+    args="$args foo@bar.com bar@foo.com"
+done
+for i in 1 2 3 4 5 6 7 8 9 10
+do
+    $hashcash -mqb8 $args >> minted.$test
+done
+awk '{ print } NR % 10 == 0 { print "" } NR == 5 || NR == 69 { dup[NR] = $0 }
+     NR == 200 { print dup[5] } NR == 300 { print dup[69] }' \
+    minted.$test > stamps.$test
+$hashcash -cdqb8 -f db.$test.sdb -r foo@bar.com `sed -n 69p minted.$test`
+$hashcash -cdwb8 -f db.$test.sdb -r foo@bar.com < stamps.$test \
+    > out.$test 2>&1
+$hashcash -cdwb8 -f db.$test.sdb -r foo@bar.com -T 4 < stamps.$test \
+    > res.$test 2>&1
+cmp -s out.$test res.$test && [ `grep -c '^8$' res.$test` -eq 160 ] && 
+    [ `grep -c 'skipped: spent stamp' res.$test` -eq 2 ] && 
+    echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-cd -T 4 takes the first unspent batches in) "
+# the first 140 stamps are spent, so the check goes through two
+# batches of spent stamps and spends stamp 141 in the third
+minted=minted.`expr $test - 1`
+awk 'NR <= 140 { print $0, 2419200 }' $minted > db.$test.sdb
+cp db.$test.sdb db.$test.T.sdb
+sed -n 1,200p $minted > stamps.$test
+$hashcash -cdb8 -f db.$test.sdb -r foo@bar.com < stamps.$test \
+    > out.$test 2>&1
+ok=$?
+$hashcash -cdb8 -f db.$test.T.sdb -r foo@bar.com -T 4 < stamps.$test \
+    > res.$test 2>&1
+[ $ok -eq 0 -a $? -eq 0 ] && cmp -s out.$test res.$test &&
+    cmp -s db.$test.sdb db.$test.T.sdb &&
+    grep -q "^`sed -n 141p $minted` " db.$test.T.sdb &&
+    [ `wc -l < db.$test.T.sdb` -eq 141 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+# resident daemon
+######################################################################
+
+rm -f hcd.sock hcm.sock hcd.sdb
+../hashcashd -q -s hcd.sock -f hcd.sdb -m hcm.sock -b 10 &
+hcd_pid=$!
+for i in 1 2 3 4 5 6 7 8 9 10
+do
+    [ -S hcd.sock ] && break
+    sleep 1
+done
+hcd="env HASHCASH_SOCKET=hcd.sock ../hashcash"
+
+echo -n "test $test (hashcashd mint and check) "
+stamp=`$hcd -mqb10 foo@bar.com`
+$hcd -cdqb10 -f hcd.sdb -r foo@bar.com $stamp
+[ $? -eq 0 ] && grep -q "^$stamp " hcd.sdb && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (hashcashd db: a check it can't answer fails, not waits) "
+unspent=`$hcd -mqb10 foo@bar.com`
+$hcd -cdb10 -f hcd.sdb -r foo@bar.com $unspent > hcd.out 2>&1
+[ $? -eq 3 ] && grep -q "database owned by hashcashd" hcd.out && 
+    ! grep -q "^$unspent " hcd.sdb && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (hashcashd check without -r) "
+$hcd -cqb8 $stamp
+[ $? -eq 2 ] && kill -0 $hcd_pid 2>/dev/null && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (hashcashd checks during a long mint) "
+$hcd -mqb40 foo@bar.com > /dev/null &
+mint_pid=$!
+sleep 1
+stamp2=`$hcd -mqb10 foo@bar.com`
+$hcd -cdqb10 -f hcd.sdb -r foo@bar.com $stamp2
+[ $? -eq 0 ] && kill -0 $mint_pid 2>/dev/null && echo ok || echo fail
+kill $mint_pid
+wait $mint_pid 2>/dev/null
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (hashcashd double spend) "
+$hcd -cdqb10 -f hcd.sdb -r foo@bar.com $stamp
+[ $? -eq 1 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (hashcashd -X several resources) "
+printf 'X-Hashcash: %s\n\nbody\n' `$hcd -mqb10 bar@foo.com` | \
+    $hcd -cdqXb10 -f hcd.sdb -r foo@bar.com -r '*@foo.com'
+[ $? -eq 0 ] && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (hashcashd milter pays recipient) "
+stamp=`$hcd -mqb10 rcpt@foo.com`
+printf 'From: a@b.com\nX-Hashcash: %s\n\nbody\n' $stamp | \
+    ../miltertest hcm.sock rcpt@foo.com > milter.out
+grep -q "^header: X-Hashcash-Check: pass 1/1" milter.out && \
+    grep -q "^continue" milter.out && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (hashcashd milter double spend) "
+printf 'X-Hashcash: %s\n\n' $stamp | \
+    ../miltertest hcm.sock rcpt@foo.com other@foo.com > milter.out
+grep -q "^header: X-Hashcash-Check: fail 0/2" milter.out && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (hashcashd milter adds no header unless let) "
+printf 'X-Hashcash: %s\n\n' `$hcd -mqb10 rcpt@foo.com` | \
+    ../miltertest -n hcm.sock rcpt@foo.com > milter.out
+! grep -q "^header:" milter.out && grep -q "^continue" milter.out && 
+    echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (hashcashd milter spends a stamp a list recipient) "
+stamp1=`$hcd -mqb10 rcpt@foo.com`
+stamp2=`$hcd -mqb10 other@foo.com`
+printf 'X-Hashcash: %s\nX-Hashcash: %s\n\n' $stamp1 $stamp2 | \
+    ../miltertest hcm.sock rcpt@foo.com other@foo.com > milter.out
+grep -q "^header: X-Hashcash-Check: pass 2/2" milter.out && 
+    grep -q "^$stamp1 " hcd.sdb && grep -q "^$stamp2 " hcd.sdb && 
+    echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (hashcashd milter -R keeps stamps of rejected mail) "
+rm -f hcr.sock hcr.sdb
+../hashcashd -q -m hcr.sock -f hcr.sdb -b 10 -R &
+hcr_pid=$!
+for i in 1 2 3 4 5 6 7 8 9 10
+do
+    [ -S hcr.sock ] && break
+    sleep 1
+done
+stamp=`$hcd -mqb10 rcpt@foo.com`
+printf 'X-Hashcash: %s\n\n' $stamp | \
+    ../miltertest hcr.sock rcpt@foo.com other@foo.com > milter.out
+grep -q "^reject 550" milter.out && 
+    printf 'X-Hashcash: %s\n\n' $stamp | \
+    ../miltertest hcr.sock rcpt@foo.com > milter.out &&
+    grep -q "^header: X-Hashcash-Check: pass 1/1" milter.out && 
+    echo ok || echo fail
+kill $hcr_pid
+wait $hcr_pid 2>/dev/null
+test=`expr $test + 1`
+
+######################################################################
+
+kill $hcd_pid
+wait $hcd_pid 2>/dev/null
+
+######################################################################
+
+# sha1 tool, files hashed in parallel
+
+echo -n "test $test (sha1 many files in argument order) "
+files=""
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+do
+    echo "file $i" > sha1in.$i
+    files="$files sha1in.$i"
+done
+cat $files $files $files $files > sha1in.big
+for f in $files sha1in.big
+do
+    echo `cat $f | $sha1` $f
+done > sha1.one
+$sha1 -j 4 $files sha1in.big > sha1.many
+cmp -s sha1.one sha1.many && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (mint with -F processes) "
+$hashcash -mq -F 3 -b12 foo@bar.com > stamp.$test
+echo -n `cat stamp.$test` | $sha1 | sed 's/^\(...\).*/\1/' > res.$test
+echo 000 > out.$test
+diff -q res.$test out.$test 1> /dev/null 2>&1 && 
+    grep -q "^1:12:040404:foo@bar.com::" stamp.$test && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (mint with -G coordinator and -J workers) "
+# a 22 bit stamp is 16 units or so; the workers start together once
+# the coordinator listens, so both get work, and both must finish well
+port=`expr 30000 + $$ % 20000`
+hexport=`printf %04X $port`
+$hashcash -mq -b22 -G $port foo@bar.com > stamp.$test &
+coord_pid=$!
+for i in 1 2 3 4 5 6 7 8 9 10
+do
+    cat /proc/net/tcp /proc/net/tcp6 2> /dev/null | 
+	grep -q "^ *[0-9]*: [0-9A-F]*:$hexport [0-9A-F]*:0000 0A" && break
+    [ -r /proc/net/tcp ] || break
+    sleep 1
+done
+[ -r /proc/net/tcp ] || sleep 1
+../hashcash -J 127.0.0.1:$port &
+worker1_pid=$!
+../hashcash -J 127.0.0.1:$port &
+worker2_pid=$!
+wait $coord_pid; coord_ok=$?
+wait $worker1_pid; worker1_ok=$?
+wait $worker2_pid; worker2_ok=$?
+echo -n `cat stamp.$test` | $sha1 | sed 's/^\(.....\).*/\1/' > res.$test
+echo 00000 > out.$test
+[ $coord_ok -eq 0 -a $worker1_ok -eq 0 -a $worker2_ok -eq 0 ] &&
+    diff -q res.$test out.$test 1> /dev/null 2>&1 && 
+    grep -q "^1:22:040404:foo@bar.com::" stamp.$test && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (-G gives the unit of a worker killed to another) "
+# the first worker mints at 1% so it is still in its first unit when
+# killed; the coordinator must hand that unit to the second
+port=`expr 30000 + \( $$ + 1 \) % 20000`
+hexport=`printf %04X $port`
+$hashcash -mq -b24 -G $port foo@bar.com > stamp.$test &
+coord_pid=$!
+for i in 1 2 3 4 5 6 7 8 9 10
+do
+    cat /proc/net/tcp /proc/net/tcp6 2> /dev/null | 
+	grep -q "^ *[0-9]*: [0-9A-F]*:$hexport [0-9A-F]*:0000 0A" && break
+    [ -r /proc/net/tcp ] || break
+    sleep 1
+done
+[ -r /proc/net/tcp ] || sleep 1
+../hashcash -L 1 -J 127.0.0.1:$port &
+worker1_pid=$!
+sleep 2
+kill -9 $worker1_pid
+wait $worker1_pid 2> /dev/null
+worker2_ok=0
+# unless the first worker was lucky, its unit is lost and still wanted
+if kill -0 $coord_pid 2> /dev/null; then
+    ../hashcash -J 127.0.0.1:$port
+    worker2_ok=$?
+fi
+wait $coord_pid; coord_ok=$?
+echo -n `cat stamp.$test` | $sha1 | sed 's/^\(......\).*/\1/' > res.$test
+echo 000000 > out.$test
+[ $coord_ok -eq 0 -a $worker2_ok -eq 0 ] &&
+    diff -q res.$test out.$test 1> /dev/null 2>&1 && 
+    grep -q "^1:24:040404:foo@bar.com::" stamp.$test && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (mint with -A threads) "
+$hashcash -mq -A 3 -b14 foo@bar.com > stamp.$test
+echo -n `cat stamp.$test` | $sha1 | sed 's/^\(...\).*/\1/' > res.$test
+echo 000 > out.$test
+diff -q res.$test out.$test 1> /dev/null 2>&1 && 
+    grep -q "^1:14:040404:foo@bar.com::" stamp.$test && echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (mint with threads placed with -B) "
+$hashcash -mq -A 2 -B 0 -b14 foo@bar.com > stamp.$test
+echo -n `cat stamp.$test` | $sha1 | sed 's/^\(...\).*/\1/' > res.$test
+echo 000 > out.$test
+diff -q res.$test out.$test 1> /dev/null 2>&1 && 
+    grep -q "^1:14:040404:foo@bar.com::" stamp.$test &&
+    ../hashcash -s -B 0 2>&1 | grep -q "^placement 0: 1 threads" &&
+    echo ok || echo fail
+test=`expr $test + 1`
+
+######################################################################
+
+echo -n "test $test (mint in the background with -L) "
+$hashcash -mv -L 25 -b22 foo@bar.com > stamp.$test 2> err.$test
+echo -n `cat stamp.$test` | $sha1 | sed 's/^\(...\).*/\1/' > res.$test
+echo 000 > out.$test
+# the speed measured minting, last, against one thread flat out
+speed=`sed -n 's/^speed: \([0-9]*\).*/\1/p' err.$test`
+eff=`sed -n 's/^effective speed: \([0-9]*\).*/\1/p' err.$test | tail -1`
+diff -q res.$test out.$test 1> /dev/null 2>&1 && 
+    grep -q "^1:22:040404:foo@bar.com::" stamp.$test &&
+    [ `expr $eff \* 2` -lt $speed ] && echo ok || echo fail
+test=`expr $test + 1`
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <limits.h>
 #include "sstring.h"
 
 #define BUILD_DLL
@@ -17,18 +18,66 @@
 
 static int char_pair_atoi( const char* pair )
 {
-    char str[3] = {0};
-    str[0] = pair[0]; str[1] = pair[1]; str[2] = '\0';
-    if ( !isdigit( str[0] ) || !isdigit( str[1] ) ) { return -1; }
-    return atoi( str );
+    if ( pair[0] < '0' || pair[0] > '9' || pair[1] < '0' || pair[1] > '9' ) {
+	return -1;
+    }
+    return ( pair[0] - '0' ) * 10 + ( pair[1] - '0' );
+}
+
+/* floor of a / b for b > 0, C division truncates towards 0 */
+
+static long floor_div( long long a, long b )
+{
+    return (long)( a >= 0 ? a / b : -( ( -a + b - 1 ) / b ) );
+}
+
+/* days since 1970-01-01 of year y, month m (1-12), day d in the
+ * proleptic Gregorian calendar.  Counts in 400 year eras of years
+ * starting in March, so the leap day is the last day of its year.
+ * d may be out of range, day 0 is the last day of the month before.
+ */
+
+static long days_from_civil( long y, int m, int d )
+{
+    long era = 0, yoe = 0, doy = 0, doe = 0;
+
+    y -= m <= 2;
+    era = ( y >= 0 ? y : y - 399 ) / 400;
+    yoe = y - era * 400;				/* [0, 399] */
+    doy = ( 153 * ( m > 2 ? m - 3 : m + 9 ) + 2 ) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;	/* [0, 146096] */
+    return era * 146097 + doe - 719468;
+}
+
+/* inverse of days_from_civil */
+
+static void civil_from_days( long z, long* y, int* m, int* d )
+{
+    long era = 0, doe = 0, yoe = 0, doy = 0, mp = 0;
+
+    z += 719468;
+    era = ( z >= 0 ? z : z - 146096 ) / 146097;
+    doe = z - era * 146097;
+    yoe = ( doe - doe / 1460 + doe / 36524 - doe / 146096 ) / 365;
+    doy = doe - ( 365 * yoe + yoe / 4 - yoe / 100 );
+    mp = ( 5 * doy + 2 ) / 153;			/* March is 0 */
+    *d = (int)( doy - ( 153 * mp + 2 ) / 5 + 1 );
+    *m = (int)( mp < 10 ? mp + 3 : mp - 9 );
+    *y = era * 400 + yoe + ( *m <= 2 );
+}
+
+static long this_year( void )
+{
+    long year = 0;
+    int m = 0, d = 0;
+
+    civil_from_days( floor_div( time( 0 ), 86400 ), &year, &m, &d );
+    return year;
 }
 
 /* deal with 2 char year issue */
-static int century_offset_to_year( int century_offset )
+static int century_offset_to_year( int century_offset, long current_year )
 {
-    time_t time_now = time( 0 ); /* local time */
-    struct tm* now = gmtime( &time_now ); /* gmt broken down time */
-    int current_year = now->tm_year + 1900;
     int current_century_offset = current_year % 100;
     int current_century = (current_year - current_century_offset) / 100;
     int year = current_century * 100 + century_offset;
@@ -40,6 +89,64 @@ static int century_offset_to_year( int century_offset )
     return year;
 }
 
+/* days since the epoch of a UTC YYMMDD.  The stamps checked or purged
+ * together carry only a few distinct dates, so the answers are kept in
+ * a small direct mapped cache.  An entry is one 64 bit word: the date
+ * and the current year it was resolved in (the century depends on it)
+ * above, the days below.  Threads share it without a lock, so an entry
+ * must be loaded and stored whole: with atomic builtins where 64 bit
+ * ones are lock free, plainly where long is 64 bits, and otherwise
+ * (32 bit targets without them) there is no cache.
+ */
+
+#define DATE_CACHE 16
+#define DATE_VALID 0x80000000UL
+#define DATE_BIAS 0x40000000L	/* days stored + bias, keeps them +ve */
+
+#if defined( __GCC_ATOMIC_LLONG_LOCK_FREE ) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+    #define DATE_CACHED
+    #define date_load(e) __atomic_load_n( (e), __ATOMIC_RELAXED )
+    #define date_store(e,v) __atomic_store_n( (e), (v), __ATOMIC_RELAXED )
+#elif ULONG_MAX > 0xffffffffUL
+    #define DATE_CACHED
+    #define date_load(e) ( *(e) )
+    #define date_store(e,v) ( *(e) = (v) )
+#endif
+
+#if defined( DATE_CACHED )
+static volatile unsigned long long date_cache[ DATE_CACHE ];
+#endif
+
+static long date_days( int century_offset, int mon, int mday )
+{
+#if defined( DATE_CACHED )
+    unsigned long date = ( century_offset * 100 + mon ) * 100 + mday;
+    unsigned long key = 0;
+    unsigned long long entry = 0;
+#endif
+    long current_year = 0, year = 0, days = 0;
+
+    current_year = this_year();
+#if defined( DATE_CACHED )
+    key = DATE_VALID | ( ( current_year & 0x7ff ) << 20 ) | date;
+    entry = date_load( &date_cache[ date % DATE_CACHE ] );
+    if ( (unsigned long)( entry >> 32 ) == key ) { 
+	return (long)( entry & 0xffffffffUL ) - DATE_BIAS;
+    }
+#endif
+
+    /* months past 12 run on into the next years, as mktime does */
+    year = century_offset_to_year( century_offset, current_year );
+    year += ( mon - 1 ) / 12;
+    days = days_from_civil( year, ( mon - 1 ) % 12 + 1, mday );
+#if defined( DATE_CACHED )
+    entry = ( (unsigned long long)key << 32 ) | 
+	(unsigned long)( days + DATE_BIAS );
+    date_store( &date_cache[ date % DATE_CACHE ], entry );
+#endif
+    return days;
+}
+
 #define MAX_DATE 50		/* Sun Mar 10 19:25:06 2002 (EST) */
 
 /* more logical time_t to string conversion */
@@ -65,22 +172,17 @@ const char* strtime( time_t* timep, int utc )
     return str;
 }
 
-/* alternate form of mktime, this tm struct is in UTC time */
+/* alternate form of mktime, this tm struct is in UTC time; fields out
+ * of range carry into the next as with mktime, but tms is not changed
+ */
 
 time_t mk_utctime( struct tm* tms ) {
-    char* tz = getenv( "TZ" );
-    time_t res = 0 ;
-    char *set_tz = NULL ;
-
-    putenv( "TZ=UTC+0" );
-    res = mktime( tms );
-    if ( tz ) { 
-        set_tz = malloc( strlen( tz ) + 3 + 1 );
-        sprintf( set_tz, "TZ=%s", tz );
-	putenv( set_tz );
-	free( set_tz );
-    } else { putenv("TZ="); putenv( "TZ" ); }
-    return res;
+    long year = tms->tm_year + 1900L + tms->tm_mon / 12;
+    int mon = tms->tm_mon % 12;
+
+    if ( mon < 0 ) { mon += 12; year--; }
+    return (time_t)days_from_civil( year, mon + 1, tms->tm_mday ) * 86400 +
+	tms->tm_hour * 3600L + tms->tm_min * 60L + tms->tm_sec;
 }
 
 time_t hashcash_from_utctimestr( const char utct[MAX_UTC+1], int utc )
@@ -92,45 +194,40 @@ time_t hashcash_from_utctimestr( const char utct[MAX_UTC+1], int utc )
     struct tm* dst = NULL;
     int utct_len = strlen( utct );
     int century_offset = 0;
+    int mon = 1, mday = 1, hour = 0, min = 0, sec = 0;
 
     if ( utct_len > MAX_UTC || utct_len < 2 || ( utct_len % 2 == 1 ) ) {
 	return failed;
     }
 
-/* defaults */
-    tms.tm_mon = 0; tms.tm_mday = 1;
-    tms.tm_hour = 0; tms.tm_min = 0; tms.tm_sec = 0;
-    tms.tm_isdst = 0;	/* daylight saving on */
-    tms_hour = tms.tm_hour;
-
 /* year */
     century_offset = char_pair_atoi( utct );
     if ( century_offset < 0 ) { return failed; }
-    tms.tm_year = century_offset_to_year( century_offset ) - 1900;
 /* month -- optional */
     if ( utct_len <= 2 ) { goto convert; }
-    tms.tm_mon = char_pair_atoi( utct+2 ) - 1;
-    if ( tms.tm_mon < 0 ) { return failed; }
+    mon = char_pair_atoi( utct+2 );
+    if ( mon < 1 ) { return failed; }
 /* day */
     if ( utct_len <= 4 ) { goto convert; }
-    tms.tm_mday = char_pair_atoi( utct+4 );
-    if ( tms.tm_mday < 0 ) { return failed; }
+    mday = char_pair_atoi( utct+4 );
+    if ( mday < 0 ) { return failed; }
 /* hour -- optional */
     if ( utct_len <= 6 ) { goto convert; }
-    tms.tm_hour = char_pair_atoi( utct+6 );
-    if ( tms.tm_hour < 0 ) { return failed; }
+    hour = char_pair_atoi( utct+6 );
+    if ( hour < 0 ) { return failed; }
 /* minute -- optional */
     if ( utct_len <= 8 ) { goto convert; }
-    tms.tm_min = char_pair_atoi( utct+8 );
-    if ( tms.tm_min < 0 ) { return failed; }
+    min = char_pair_atoi( utct+8 );
+    if ( min < 0 ) { return failed; }
     if ( utct_len <= 10 ) { goto convert; }
 /* second -- optional */
-    tms.tm_sec = char_pair_atoi( utct+10 );
-    if ( tms.tm_sec < 0 ) { return failed; }
+    sec = char_pair_atoi( utct+10 );
+    if ( sec < 0 ) { return failed; }
 
  convert:
     if ( utc ) {
-        return mk_utctime( &tms );
+	return (time_t)date_days( century_offset, mon, mday ) * 86400 +
+	    hour * 3600L + min * 60L + sec;
     } else {
     /* note when switching from daylight to standard the last daylight
        hour(s) are ambiguous with the first hour(s) of standard time.  The
@@ -142,6 +239,11 @@ time_t hashcash_from_utctimestr( const char utct[MAX_UTC+1], int utc )
        expressed in localtime) are illegal values and have undefined
        conversions, this code will do whatever the system calls do */
 
+	tms.tm_year = century_offset_to_year( century_offset, 
+					      this_year() ) - 1900;
+	tms.tm_mon = mon - 1; tms.tm_mday = mday;
+	tms.tm_hour = hour; tms.tm_min = min; tms.tm_sec = sec;
+	tms.tm_isdst = 0;	/* daylight saving on */
         tms_hour = tms.tm_hour;
         res = mktime( &tms );	/* get time without DST adjust */
  	dst = localtime( &res ); /* convert back to get DST adjusted  */
@@ -153,21 +255,25 @@ time_t hashcash_from_utctimestr( const char utct[MAX_UTC+1], int utc )
 
 int hashcash_to_utctimestr( char utct[MAX_UTC+1], int len, time_t t  )
 {
-    struct tm* tms = gmtime( &t );
-
-    if ( tms == NULL || len > MAX_UTC || len < 2 ) { return 0; }
-    sprintf( utct, "%02d", tms->tm_year % 100 );
-    if ( len == 2 ) { goto leave; }
-    sprintf( utct+2, "%02d", tms->tm_mon+1 );
-    if ( len == 4 ) { goto leave; }
-    sprintf( utct+4, "%02d", tms->tm_mday );
-    if ( len == 6 ) { goto leave; }
-    sprintf( utct+6, "%02d", tms->tm_hour );
-    if ( len == 8 ) { goto leave; }
-    sprintf( utct+8, "%02d", tms->tm_min ); 
-    if ( len == 10 ) { goto leave; }
-    sprintf( utct+10, "%02d", tms->tm_sec );
-
- leave:
+    long days = floor_div( t, 86400 );
+    long secs = (long)( t - (time_t)days * 86400 );
+    long year = 0;
+    int field[ 6 ];
+    int i = 0, pairs = 0;
+
+    if ( len > MAX_UTC || len < 2 ) { return 0; }
+    civil_from_days( days, &year, &field[1], &field[2] );
+    field[0] = (int)( ( year % 100 + 100 ) % 100 );
+    field[3] = (int)( secs / 3600 );
+    field[4] = (int)( secs / 60 % 60 );
+    field[5] = (int)( secs % 60 );
+
+    /* YY[MM[DD[hh[mm[ss]]]]], odd lengths get the lot */
+    pairs = ( len % 2 == 0 ) ? len / 2 : 6;
+    for ( i = 0; i < pairs; i++ ) {
+	utct[ 2*i ] = '0' + field[i] / 10;
+	utct[ 2*i+1 ] = '0' + field[i] % 10;
+    }
+    utct[ 2*i ] = '\0';
     return 1;
 }